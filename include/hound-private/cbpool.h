@@ -0,0 +1,36 @@
+/**
+ * @file      cbpool.h
+ * @brief     Parallel callback dispatch header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_CBPOOL_H_
+#define HOUND_PRIVATE_CBPOOL_H_
+
+#include <hound/hound.h>
+#include <stddef.h>
+
+struct cbpool;
+struct record_info;
+
+hound_err cbpool_alloc(size_t partitions, struct cbpool **pool);
+void cbpool_destroy(struct cbpool *pool);
+size_t cbpool_partitions(const struct cbpool *pool);
+
+/*
+ * Runs cb on every record in buf, with buf[i] getting seqno + i. Records are
+ * split into partitions by data ID; each partition runs on its own thread, in
+ * order, and the calling thread runs one of them. Returns once every callback
+ * has returned.
+ */
+void cbpool_run(
+    struct cbpool *pool,
+    hound_cb cb,
+    void *cb_ctx,
+    struct record_info **buf,
+    hound_seqno seqno,
+    size_t n);
+
+#endif /* HOUND_PRIVATE_CBPOOL_H_ */
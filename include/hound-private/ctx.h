@@ -28,17 +28,56 @@ hound_err ctx_stop(struct hound_ctx *ctx);
 
 hound_err ctx_next(struct hound_ctx *ctx, size_t n);
 
-hound_err ctx_read_bytes(struct hound_ctx *ctx, size_t bytes);
+hound_err ctx_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    size_t *records_read,
+    size_t *bytes_read);
 hound_err ctx_read_bytes_nowait(
     struct hound_ctx *ctx,
     size_t bytes,
     size_t *records_read,
     size_t *bytes_read);
 hound_err ctx_read(struct hound_ctx *ctx, size_t records, size_t *read);
+hound_err ctx_read_timeout(
+    struct hound_ctx *ctx,
+    size_t records,
+    hound_data_period timeout_ns,
+    size_t *read);
 hound_err ctx_read_nowait(struct hound_ctx *ctx, size_t records, size_t *read);
 hound_err ctx_read_all_nowait(struct hound_ctx *ctx, size_t *read);
+hound_err ctx_read_batch(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read);
+hound_err ctx_read_batch_nowait(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read);
+hound_err ctx_release_batch(const struct hound_record **recs, size_t count);
+hound_err ctx_read_columns(
+    struct hound_ctx *ctx,
+    hound_data_id data_id,
+    size_t records,
+    int64_t *timestamps,
+    void *const *columns,
+    size_t *read);
+
+hound_err ctx_start_record_log(struct hound_ctx *ctx, const char *path);
+hound_err ctx_stop_record_log(struct hound_ctx *ctx);
+
+hound_err ctx_get_fd(struct hound_ctx *ctx, int *fd);
+hound_err ctx_set_fd_watermark(struct hound_ctx *ctx, size_t records);
+hound_err ctx_set_callback_threads(struct hound_ctx *ctx, size_t threads);
 
 hound_err ctx_queue_length(struct hound_ctx *ctx, size_t *count);
 hound_err ctx_max_queue_length(struct hound_ctx *ctx, size_t *count);
+hound_err ctx_queue_dropped(struct hound_ctx *ctx, uint64_t *count);
+hound_err ctx_queue_high_water(struct hound_ctx *ctx, size_t *count);
+hound_err ctx_get_stats(struct hound_ctx *ctx, struct hound_ctx_stats *stats);
 
 #endif /* HOUND_PRIVATE_CTX_H_ */
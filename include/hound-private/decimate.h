@@ -0,0 +1,46 @@
+/**
+ * @file      decimate.h
+ * @brief     Record decimation and filtering header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_DECIMATE_H_
+#define HOUND_PRIVATE_DECIMATE_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct decimator;
+struct record_info;
+struct record_pool;
+
+hound_err decimator_alloc(
+    const struct hound_datadesc *desc,
+    hound_aggregate aggregate,
+    const struct hound_data_filter *filter,
+    struct decimator **dec);
+void decimator_ref(struct decimator *dec);
+void decimator_unref(struct decimator *dec);
+
+/* Returns whether a decimator was made with the given aggregate and filter. */
+bool decimator_matches(
+    const struct decimator *dec,
+    hound_aggregate aggregate,
+    const struct hound_data_filter *filter);
+
+/*
+ * Feeds a record through a decimator that passes on one record out of every
+ * stride and then applies its filter. Returns the record to deliver, if any:
+ * either info itself, which the caller needs to take a reference on, or a new
+ * aggregate record from pool, which already holds one reference.
+ */
+struct record_info *decimator_push(
+    struct decimator *dec,
+    size_t stride,
+    struct record_info *info,
+    struct record_pool *pool);
+
+#endif /* HOUND_PRIVATE_DECIMATE_H_ */
@@ -11,7 +11,12 @@
 #define HOUND_PRIVATE_DRIVER_OPS_H_
 
 #include <hound-private/driver.h>
+#include <hound-private/parse/schema.h>
+#include <hound-private/pool.h>
+#include <hound-private/stats.h>
+#include <hound-private/trace.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <xlib/xvec.h>
 
 /**
@@ -40,6 +45,9 @@ struct data {
 
 XVEC_DEFINE(active_data_vec, struct data);
 
+/* The I/O subsystem's per-fd state, defined in io.c. */
+struct fdctx;
+
 struct driver {
     pthread_mutex_t state_lock;
     pthread_mutex_t op_lock;
@@ -49,12 +57,34 @@ struct driver {
     char device_name[HOUND_DEVICE_NAME_MAX];
     size_t desc_count;
     struct hound_datadesc *descs;
+    /* The cache the descriptor names and formats live in, if any. */
+    struct schema_cache schema_cache;
 
     active_data_vec active_data;
 
+    /*
+     * On-demand requests waiting for the poll thread, counted per descriptor;
+     * see io_next.
+     */
+    atomic_size_t *next_counts;
+    atomic_bool next_pending;
+    /* Scratch space for the poll thread to build next_batch ID lists in. */
+    hound_data_id *next_ids;
+
     int fd;
+    _Atomic(struct fdctx *) fdctx;
+    /* The I/O shard to poll in, or -1 to pick one from the device ID. */
+    int io_shard;
+    /* How the default poll functions read the fd; see drv_set_read_budget. */
+    size_t read_budget;
+    size_t read_msg_size;
+    bool read_msg_stamps;
     struct driver_ops ops;
     void *ctx;
+
+    struct record_pool *pool;
+
+    struct driver_stats stats;
 };
 
 #define TOKENIZE(...) __VA_ARGS__
@@ -66,10 +96,13 @@ struct driver {
         hound_err err; \
         \
         set_active_drv(drv); \
+        TRACE2(op_lock_wait, drv->id, (const char *) #name); \
         lock_mutex(&drv->op_lock); \
+        TRACE2(op_lock_acquired, drv->id, (const char *) #name); \
         XASSERT_NOT_NULL(drv->ops.name); \
         err = drv->ops.name(args); \
         unlock_mutex(&drv->op_lock); \
+        TRACE3(op_done, drv->id, (const char *) #name, err); \
         clear_active_drv(); \
         return err; \
     }
@@ -115,6 +148,10 @@ DEFINE_DRV_OP(
     TOKENIZE(buf, bytes))
 DEFINE_DRV_OP(start, int *fd, fd)
 DEFINE_DRV_OP(next, hound_data_id id, id)
+DEFINE_DRV_OP(
+    next_batch,
+    TOKENIZE(const hound_data_id *ids, size_t count, size_t n),
+    TOKENIZE(ids, count, n))
 DEFINE_DRV_OP_VOID(stop)
 
 #endif /* HOUND_PRIVATE_DRIVER_OPS_H_ */
@@ -12,6 +12,9 @@
 #include <hound-private/io.h>
 #include <hound-private/queue.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 #define HOUND_DRIVER_REGISTER_PRIO 102
 #define HOUND_DRIVER_REGISTER_FUNC __attribute__((constructor(HOUND_DRIVER_REGISTER_PRIO)))
@@ -33,6 +36,12 @@ struct drv_datadesc {
     /** For enabled data, the available data periods for this descriptor. */
     hound_data_period *avail_periods;
 
+    /**
+     * For enabled data, the most samples a request may pack into one record.
+     * This starts at 1, which a driver that doesn't pack should leave alone.
+     */
+    size_t max_pack;
+
     /* The schema for this descriptor. */
     const struct schema_desc *schema_desc;
 };
@@ -141,6 +150,20 @@ struct driver_ops {
      */
     hound_err (*next)(hound_data_id id);
 
+    /**
+     * Ask the driver to generate n values of each of the given IDs. This is
+     * optional; if it is implemented, the core calls it instead of next, once
+     * for all the IDs it wants from the driver at a time, so that a driver can
+     * combine requests (for instance, into a single message on the wire).
+     *
+     * @param ids a list of data IDs
+     * @param count the length of the ID list
+     * @param n the number of values to generate for each ID
+     *
+     * @return an error code
+     */
+    hound_err (*next_batch)(const hound_data_id *ids, size_t count, size_t n);
+
     /**
      * Stop the driver from producing data and frees resources associated with
      * the driver's open fd.
@@ -153,7 +176,8 @@ struct driver_ops {
 size_t get_type_size(hound_type type);
 
 /**
- * A function that drivers should use for any allocations they need to do.
+ * A function that drivers should use for any allocations they need to do,
+ * other than record data (see drv_record_alloc).
  *
  * @param bytes the number of bytes to allocate to the pointer
  *
@@ -187,6 +211,41 @@ char *drv_strdup(const char *s);
  */
 void drv_free(void *p);
 
+/**
+ * Allocate the payload for a record. All record data passed to
+ * drv_push_records must be allocated with this function rather than
+ * drv_alloc, as the payload lives in the same block as the core's bookkeeping
+ * for the record. Ownership of the data passes to the core when the record is
+ * pushed.
+ *
+ * This should be called only from a driver's callback.
+ *
+ * @param bytes the number of bytes to allocate
+ *
+ * @return a pointer to the record data, or NULL if the allocation failed.
+ */
+void *drv_record_alloc(size_t bytes);
+
+/**
+ * Resize record data allocated by drv_record_alloc, preserving its contents.
+ *
+ * This should be called only from a driver's callback.
+ *
+ * @param data a pointer returned by drv_record_alloc or drv_record_realloc
+ * @param bytes the new size of the record data
+ *
+ * @return a pointer to the resized record data, or NULL if the allocation
+ * failed. On failure, the original data is left untouched.
+ */
+void *drv_record_realloc(void *data, size_t bytes);
+
+/**
+ * Free record data that was allocated by drv_record_alloc but never pushed.
+ *
+ * @param data a pointer returned by drv_record_alloc or drv_record_realloc
+ */
+void drv_record_free(void *data);
+
 /**
  * Gets the currently set driver context.
  *
@@ -209,6 +268,67 @@ void drv_set_ctx(void *ctx);
  */
 int drv_fd(void);
 
+/** The default read budget; see drv_set_read_budget. */
+#define DRV_READ_BUDGET_DEFAULT 16
+
+/**
+ * Set how many reads drv_default_push and drv_default_pull may do each time
+ * the driver's fd is ready. They keep reading until the fd runs dry or the
+ * budget runs out, calling parse after each read, so a higher budget takes
+ * more data per wakeup at the cost of making the rest of the shard wait.
+ *
+ * This should be called only from a driver's callback.
+ *
+ * @param reads the read budget, which must be at least 1
+ */
+void drv_set_read_budget(size_t reads);
+
+/**
+ * Ask drv_default_push and drv_default_pull to read the driver's fd with
+ * recvmmsg, taking many messages per syscall. The messages are packed back to
+ * back in the buffer handed to parse, so this suits sockets whose messages
+ * parse can split up by itself, such as SocketCAN frames. Each recvmmsg counts
+ * as one read against the read budget.
+ *
+ * This should be called only from a driver's callback, and the driver's fd
+ * must be a socket.
+ *
+ * @param msg_size the largest message the socket will return, or 0 to go back
+ * to one read per syscall
+ */
+void drv_set_read_msgs(size_t msg_size);
+
+/**
+ * The header that precedes each message handed to parse when the driver has
+ * asked for message timestamps. The message follows the header, and the next
+ * header starts at the following multiple of DRV_MSG_ALIGN.
+ */
+struct drv_msg_header {
+    /** The kernel's receive timestamp, or zero if the socket gave none. */
+    struct timespec timestamp;
+    /** The size of the message that follows. */
+    size_t size;
+};
+
+#define DRV_MSG_ALIGN (_Alignof(struct drv_msg_header))
+
+/** The space a message of the given size takes up, including its header. */
+#define DRV_MSG_SPACE(size) \
+    (sizeof(struct drv_msg_header) + \
+     ((size) + DRV_MSG_ALIGN - 1) / DRV_MSG_ALIGN * DRV_MSG_ALIGN)
+
+/**
+ * Ask for each message read by drv_set_read_msgs to be preceded by a struct
+ * drv_msg_header carrying its kernel receive timestamp, so parse can stamp
+ * records with when each message actually arrived. The socket must already
+ * have SO_TIMESTAMPNS set.
+ *
+ * This should be called only from a driver's callback.
+ *
+ * @param enable whether to add the headers
+ */
+void drv_set_read_msg_stamps(bool enable);
+
 void driver_init_statics(void);
 void driver_destroy_statics(void);
 
@@ -221,6 +341,10 @@ bool driver_is_push_mode(const struct driver *drv);
 
 hound_err driver_get_datadescs(struct hound_datadesc **descs, size_t *len);
 void driver_free_datadescs(struct hound_datadesc *descs);
+hound_err driver_acquire_datadescs(
+    const struct hound_datadesc_snapshot **snapshot);
+void driver_release_datadescs(const struct hound_datadesc_snapshot *snapshot);
+uint64_t driver_datadesc_generation(void);
 
 void driver_register(const char *name, struct driver_ops *ops);
 
@@ -229,13 +353,35 @@ hound_err driver_init(
     const char *path,
     const char *schema_base,
     const char *schema,
+    bool use_schema_cache,
     size_t arg_count,
     const struct hound_init_arg *args);
 
+hound_err driver_set_io_shard(const char *path, int shard, int cpu);
+hound_err driver_set_io_sched(
+    const char *path,
+    hound_sched_policy policy,
+    int priority);
+hound_err driver_set_io_cpus(
+    const char *path,
+    const int *cpus,
+    size_t cpu_count);
+hound_err driver_set_io_busy_poll(const char *path, uint64_t busy_ns);
+hound_err driver_get_io_latency(
+    const char *path,
+    struct hound_io_latency *stats);
+hound_err driver_get_io_stats(const char *path, struct hound_io_stats *stats);
+hound_err driver_get_stats(const char *path, struct hound_driver_stats *stats);
+hound_err driver_lock_memory(const char *path, size_t records);
+
 hound_err driver_destroy(const char *path);
 hound_err driver_destroy_all(void);
 
-hound_err driver_next(struct driver *drv, hound_data_id id, size_t n);
+hound_err driver_next(
+    struct driver *drv,
+    const hound_data_id *ids,
+    size_t count,
+    size_t n);
 
 /*
  * Take a reference on this driver, causing the driver to start if it's the
@@ -277,6 +423,36 @@ bool driver_period_supported(
     hound_data_id id,
     hound_data_period period);
 
+bool driver_pack_supported(struct driver *drv, hound_data_id id, size_t pack);
+
+bool driver_aggregate_supported(
+    struct driver *drv,
+    const struct hound_data_rq *rq);
+
+bool driver_filter_supported(
+    struct driver *drv,
+    const struct hound_data_rq *rq);
+
+/*
+ * Whether a request can be folded into a faster request for the same data ID.
+ * The driver then runs only at the fastest foldable period of each data ID,
+ * and the I/O layer decimates the stream for each slower request whose period
+ * is a whole multiple of it. The driver and the I/O layer must agree on this,
+ * so both use this check.
+ */
+static inline
+bool driver_rq_foldable(const struct hound_data_rq *rq)
+{
+    return rq->period_ns > 0 && rq->pack <= 1;
+}
+
+/*
+ * A good number of records for drivers to accumulate before calling
+ * drv_push_records. Pushing records in batches rather than one at a time lets
+ * the I/O core lock and wake up each user queue once per batch.
+ */
+#define DRV_PUSH_BATCH_SIZE 64
+
 /* #defines so drivers don't have to peek into the I/O subsystem. */
 #define drv_push_records io_push_records
 #define drv_default_pull io_default_pull
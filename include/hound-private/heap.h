@@ -0,0 +1,49 @@
+/**
+ * @file      heap.h
+ * @brief     Timer min-heap header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_HEAP_H_
+#define HOUND_PRIVATE_HEAP_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xlib/xvec.h>
+
+/** The index of a timer that isn't in a heap. */
+#define TIMER_IDLE SIZE_MAX
+
+/**
+ * A timer, meant to be embedded in whatever struct owns it. The heap holds
+ * pointers to its timers, so a timer must not move while it's in a heap.
+ */
+struct heap_timer {
+    hound_data_period deadline;
+    size_t index;
+};
+
+/** A min-heap of timers, ordered by deadline. */
+struct timer_heap {
+    xvec_t(struct heap_timer *) timers;
+};
+
+void timer_init(struct heap_timer *timer);
+bool timer_pending(const struct heap_timer *timer);
+
+void timer_heap_init(struct timer_heap *heap);
+void timer_heap_destroy(struct timer_heap *heap);
+void timer_heap_reset(struct timer_heap *heap);
+
+hound_err timer_heap_set(
+    struct timer_heap *heap,
+    struct heap_timer *timer,
+    hound_data_period deadline);
+void timer_heap_remove(struct timer_heap *heap, struct heap_timer *timer);
+struct heap_timer *timer_heap_peek(const struct timer_heap *heap);
+
+#endif /* HOUND_PRIVATE_HEAP_H_ */
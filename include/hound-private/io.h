@@ -29,6 +29,23 @@ hound_err io_add_fd(
 
 void io_remove_fd(int fd);
 
+bool io_next(
+    struct driver *drv,
+    const hound_data_id *ids,
+    size_t count,
+    size_t n);
+
+size_t io_driver_shard(const struct driver *drv);
+size_t io_shard_count(void);
+hound_err io_set_shard_cpus(size_t shard, const int *cpus, size_t cpu_count);
+hound_err io_set_shard_sched(
+    size_t shard,
+    hound_sched_policy policy,
+    int priority);
+hound_err io_set_shard_busy_poll(size_t shard, uint64_t busy_ns);
+void io_get_shard_latency(size_t shard, struct hound_io_latency *stats);
+void io_get_shard_stats(size_t shard, struct hound_io_stats *stats);
+
 PUBLIC_API
 hound_err io_default_push(
     short events,
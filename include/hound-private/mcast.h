@@ -0,0 +1,115 @@
+/**
+ * @file      mcast.h
+ * @brief     Per-driver multicast record log header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_MCAST_H_
+#define HOUND_PRIVATE_MCAST_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* The most cursors a single log can have, one per bit of a slot mask. */
+#define MCAST_MAX_CURSORS 64
+
+struct mcast_log;
+struct mcast_cursor;
+struct record_info;
+
+hound_err mcast_log_alloc(struct mcast_log **log);
+void mcast_log_destroy(struct mcast_log *log);
+
+hound_err mcast_attach(struct mcast_log *log, struct mcast_cursor *cursor);
+void mcast_detach(struct mcast_log *log, struct mcast_cursor *cursor);
+
+/*
+ * Writes go through mcast_write_begin and mcast_write_end, which hold the log
+ * lock. mcast_append hands one reference on rec to the log and delivers it to
+ * every cursor whose bit (see mcast_cursor_bit) is set in mask. The cursors see
+ * the records only once mcast_write_end publishes them.
+ */
+void mcast_write_begin(struct mcast_log *log);
+void mcast_append(
+    struct mcast_log *log,
+    struct record_info *rec,
+    uint64_t mask);
+void mcast_write_end(struct mcast_log *log);
+uint64_t mcast_cursor_bit(const struct mcast_cursor *cursor);
+
+hound_err mcast_cursor_alloc(struct mcast_cursor **cursor, size_t max_len);
+hound_err mcast_cursor_resize(
+    struct mcast_cursor *cursor,
+    size_t max_len,
+    bool flush);
+void mcast_cursor_destroy(struct mcast_cursor *cursor);
+
+void mcast_interrupt(struct mcast_cursor *cursor);
+
+hound_err mcast_get_event_fd(struct mcast_cursor *cursor, int *fd);
+void mcast_set_event_len(struct mcast_cursor *cursor, size_t len);
+
+void mcast_set_overflow(
+    struct mcast_cursor *cursor,
+    hound_overflow_policy policy,
+    size_t grow_len);
+
+/*
+ * Popped records may still belong to the log, so they must be handed back with
+ * mcast_release, or kept past that with mcast_keep, which takes a reference on
+ * each of them.
+ */
+size_t mcast_pop_records_timeout(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    const struct timespec *deadline,
+    bool *interrupt);
+
+size_t mcast_pop_bytes(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    size_t wait_records,
+    hound_seqno *first_seqno,
+    size_t *records,
+    bool *interrupt);
+
+size_t mcast_pop_bytes_nowait(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    hound_seqno *first_seqno,
+    size_t *records);
+
+size_t mcast_pop_records_nowait(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    hound_seqno *first_seqno,
+    size_t records);
+
+void mcast_release(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t count);
+void mcast_keep(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t count);
+
+void mcast_drain(struct mcast_cursor *cursor);
+
+size_t mcast_len(struct mcast_cursor *cursor);
+size_t mcast_max_len(struct mcast_cursor *cursor);
+uint64_t mcast_dropped(struct mcast_cursor *cursor);
+size_t mcast_high_water(struct mcast_cursor *cursor);
+
+#endif /* HOUND_PRIVATE_MCAST_H_ */
@@ -10,7 +10,11 @@
 #define HOUND_PRIVATE_PARSE_CONFIG_H_
 
 #include <hound/hound.h>
+#include <stddef.h>
 
-hound_err parse_config(const char *config_path, const char *schema_base);
+hound_err parse_config(
+    const char *config_path,
+    const char *schema_base,
+    size_t thread_count);
 
 #endif /* HOUND_PRIVATE_PARSE_CONFIG_H_ */
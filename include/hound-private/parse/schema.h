@@ -10,6 +10,19 @@
 #define HOUND_PRIVATE_PARSE_SCHEMA_H_
 
 #include <hound/hound.h>
+#include <hound-private/driver.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A schema mapped from a binary cache. Descriptors loaded from a cache point
+ * into the mapping, so it must outlive them. map is NULL if the descriptors
+ * were parsed from YAML instead.
+ */
+struct schema_cache {
+    void *map;
+    size_t size;
+};
 
 void schema_init(void);
 void schema_destroy(void);
@@ -20,10 +33,17 @@ hound_err copy_schema_desc(
 
 void destroy_desc_fmts(size_t count, struct hound_data_fmt *fmts);
 void destroy_schema_desc(struct schema_desc *desc);
+void destroy_schema_descs(
+    const struct schema_cache *cache,
+    size_t count,
+    struct schema_desc *descs);
+void schema_cache_unmap(struct schema_cache *cache);
 
 hound_err schema_parse(
     const char *schema_base,
     const char *schema,
+    bool use_cache,
+    struct schema_cache *cache,
     size_t *out_desc_count,
     struct schema_desc **out_descs);
 
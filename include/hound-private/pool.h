@@ -0,0 +1,36 @@
+/**
+ * @file      pool.h
+ * @brief     Pooled record allocator header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_POOL_H_
+#define HOUND_PRIVATE_POOL_H_
+
+#include <hound/hound.h>
+#include <stddef.h>
+
+struct record_pool;
+struct record_info;
+
+hound_err pool_alloc(
+    struct record_pool **pool,
+    size_t desc_count,
+    const struct hound_datadesc *descs);
+void pool_destroy(struct record_pool *pool);
+
+hound_err pool_prefault(
+    struct record_pool *pool,
+    size_t desc_count,
+    const struct hound_datadesc *descs,
+    size_t records);
+
+struct record_info *pool_get(struct record_pool *pool, size_t bytes);
+struct record_info *pool_resize(struct record_info *info, size_t bytes);
+void pool_put(struct record_info *info);
+
+struct record_info *pool_info_from_data(void *data);
+
+#endif /* HOUND_PRIVATE_POOL_H_ */
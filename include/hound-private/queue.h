@@ -18,27 +18,69 @@ struct queue;
 #include <hound/hound.h>
 #include <hound-private/driver.h>
 #include <hound-private/refcount.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
 
+/*
+ * Record infos are allocated from a per-driver pool (see pool.c). The record
+ * payload is stored inline, at the end of the record info, and record.data
+ * points to it. Every block has room for at least
+ * CONFIG_HOUND_INLINE_RECORD_SIZE bytes of payload, so small records share a
+ * single size class.
+ */
 struct record_info {
+    /* Pool bookkeeping, touched only on allocation and free. */
+    struct record_pool *pool;
+    struct record_info *next_free;
+    size_t size_class;
+    size_t capacity;
+
     atomic_refcount_val refcount;
+    /* When the record was pushed, for the callback latency stats. */
+    uint_least64_t push_ns;
     struct hound_record record;
+    alignas(max_align_t) unsigned char data[];
 };
 
 void record_ref_dec(struct record_info *info);
 
 hound_err queue_alloc(
     struct queue **queue,
-    size_t max_len);
+    size_t max_len,
+    hound_queue_type type);
 hound_err queue_resize(struct queue *queue, size_t max_len, bool flush);
 
 void queue_destroy(struct queue *queue);
 
 void queue_interrupt(struct queue *queue);
 
+hound_err queue_get_event_fd(struct queue *queue, int *fd);
+void queue_set_event_len(struct queue *queue, size_t len);
+
+void queue_set_overflow(
+    struct queue *queue,
+    hound_overflow_policy policy,
+    size_t grow_len);
+
+struct record_log;
+struct record_log *queue_swap_record_log(
+    struct queue *queue,
+    struct record_log *log);
+void queue_log_records(
+    struct queue *queue,
+    struct record_info *const *recs,
+    size_t count);
+
 void queue_push(
     struct queue *queue,
     struct record_info *rec);
 
+void queue_push_many(
+    struct queue *queue,
+    struct record_info **recs,
+    size_t count);
+
 size_t queue_pop_records(
     struct queue *queue,
     struct record_info **buf,
@@ -46,9 +88,28 @@ size_t queue_pop_records(
     hound_seqno *first_seqno,
     bool *interrupt);
 
+size_t queue_pop_records_timeout(
+    struct queue *queue,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    const struct timespec *deadline,
+    bool *interrupt);
+
+size_t queue_pop_bytes(
+    struct queue *queue,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    size_t wait_records,
+    hound_seqno *first_seqno,
+    size_t *records,
+    bool *interrupt);
+
 size_t queue_pop_bytes_nowait(
     struct queue *queue,
     struct record_info **buf,
+    size_t max_records,
     size_t bytes,
     hound_seqno *first_seqno,
     size_t *records);
@@ -65,9 +126,27 @@ size_t queue_pop_nolock(
     hound_seqno *first_seqno,
     size_t n);
 
+/*
+ * Every batch of popped records must be handed back with queue_release once the
+ * caller is done with it. A caller that wants to hold onto the records instead
+ * calls queue_keep, after which it owns a reference to each record.
+ */
+void queue_release(struct queue *queue, struct record_info **buf, size_t count);
+void queue_keep(struct queue *queue, struct record_info **buf, size_t count);
+
 void queue_drain(struct queue *queue);
 
 size_t queue_len(struct queue *queue);
 size_t queue_max_len(struct queue *queue);
+uint64_t queue_dropped(struct queue *queue);
+size_t queue_high_water(struct queue *queue);
+hound_queue_type queue_type(struct queue *queue);
+
+/*
+ * Returns the queue's multicast cursor, or NULL if it isn't a multicast
+ * queue.
+ */
+struct mcast_cursor;
+struct mcast_cursor *queue_cursor(struct queue *queue);
 
 #endif /* HOUND_PRIVATE_QUEUE_H_ */
@@ -0,0 +1,119 @@
+/**
+ * @file      record-log.h
+ * @brief     Binary record log header. The log format is shared by the core,
+ *            which writes logs, and the replay driver, which reads them.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_RECORD_LOG_H_
+#define HOUND_PRIVATE_RECORD_LOG_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A log starts with a header, followed by chunks. Each chunk starts at a
+ * page-aligned offset so that the writer can map it on its own, and holds
+ * entries back to back, each one padded to RECORD_LOG_ALIGN bytes. An entry
+ * never spans chunks; a record too big for a normal chunk gets a bigger one.
+ *
+ * Each chunk header is kept up to date as entries are appended, so a log from
+ * a writer that never closed it is still readable up to the last entry. A
+ * cleanly closed log also ends with an index of its chunks followed by a
+ * trailer pointing at the index. All fields are in host byte order.
+ */
+#define RECORD_LOG_MAGIC UINT64_C(0x474f4c444e554f48) /* "HOUNDLOG" */
+#define RECORD_LOG_VERSION 1
+#define RECORD_LOG_CHUNK_MAGIC UINT32_C(0x4b4e4843) /* "CHNK" */
+#define RECORD_LOG_INDEX_MAGIC UINT32_C(0x58444e49) /* "INDX" */
+#define RECORD_LOG_ALIGN 8
+#define RECORD_LOG_CHUNK_SIZE (1024*1024)
+
+struct record_log_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    /* The offset of the first chunk. */
+    uint64_t first_chunk;
+};
+
+struct record_log_chunk {
+    uint32_t magic;
+    /* The number of entries in the chunk. */
+    uint32_t count;
+    /* The bytes from the start of this chunk to the start of the next. */
+    uint64_t size;
+    /* The bytes in use, including this header. */
+    uint64_t used;
+    /* The timestamps of the first and last entries, in nanoseconds. */
+    int64_t first_ns;
+    int64_t last_ns;
+};
+
+struct record_log_entry {
+    int64_t timestamp_ns;
+    uint32_t data_id;
+    uint32_t size;
+    /* Followed by size bytes of record data. */
+};
+
+struct record_log_index {
+    uint64_t offset;
+    uint32_t count;
+    uint32_t reserved;
+    int64_t first_ns;
+    int64_t last_ns;
+};
+
+struct record_log_trailer {
+    uint32_t magic;
+    uint32_t chunk_count;
+    uint64_t index_offset;
+};
+
+struct record_log;
+struct record_info;
+
+hound_err record_log_open(const char *path, struct record_log **log);
+void record_log_append(
+    struct record_log *log,
+    struct record_info *const *recs,
+    size_t count);
+hound_err record_log_close(struct record_log *log);
+
+/*
+ * A read-only view of a whole log. Entries are read straight out of the
+ * mapping, so entry pointers stay valid until the reader is closed.
+ */
+struct record_log_reader {
+    const unsigned char *map;
+    size_t size;
+    /* The chunk index, or NULL if the log wasn't closed cleanly. */
+    const struct record_log_index *index;
+    size_t chunk_count;
+
+    size_t chunk;
+    uint64_t chunk_offset;
+    uint64_t pos;
+};
+
+hound_err record_log_reader_open(
+    const char *path,
+    struct record_log_reader *reader);
+void record_log_reader_close(struct record_log_reader *reader);
+void record_log_reader_rewind(struct record_log_reader *reader);
+const struct record_log_entry *record_log_reader_next(
+    struct record_log_reader *reader);
+
+static inline
+const unsigned char *record_log_entry_data(
+    const struct record_log_entry *entry)
+{
+    return (const unsigned char *) (entry + 1);
+}
+
+#endif /* HOUND_PRIVATE_RECORD_LOG_H_ */
@@ -0,0 +1,89 @@
+/**
+ * @file      ring.h
+ * @brief     Lock-free record ring buffer header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_RING_H_
+#define HOUND_PRIVATE_RING_H_
+
+#include <hound/hound.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+struct ring;
+struct record_info;
+
+hound_err ring_alloc(struct ring **ring, size_t max_len);
+hound_err ring_resize(struct ring *ring, size_t max_len, bool flush);
+
+void ring_destroy(struct ring *ring);
+
+void ring_interrupt(struct ring *ring);
+
+hound_err ring_get_event_fd(struct ring *ring, int *fd);
+void ring_set_event_len(struct ring *ring, size_t len);
+
+void ring_set_overflow(
+    struct ring *ring,
+    hound_overflow_policy policy,
+    size_t grow_len);
+
+void ring_push(struct ring *ring, struct record_info *rec);
+void ring_push_many(
+    struct ring *ring,
+    struct record_info **recs,
+    size_t count);
+
+size_t ring_pop_records(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    bool *interrupt);
+
+size_t ring_pop_records_timeout(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    const struct timespec *deadline,
+    bool *interrupt);
+
+size_t ring_pop_bytes(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    size_t wait_records,
+    hound_seqno *first_seqno,
+    size_t *records,
+    bool *interrupt);
+
+size_t ring_pop_bytes_nowait(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    hound_seqno *first_seqno,
+    size_t *records);
+
+size_t ring_pop_records_nowait(
+    struct ring *ring,
+    struct record_info **buf,
+    hound_seqno *first_seqno,
+    size_t records);
+
+void ring_drain(struct ring *ring);
+
+size_t ring_len(struct ring *ring);
+size_t ring_bytes(struct ring *ring);
+size_t ring_max_len(struct ring *ring);
+uint64_t ring_dropped(struct ring *ring);
+size_t ring_high_water(struct ring *ring);
+
+#endif /* HOUND_PRIVATE_RING_H_ */
@@ -0,0 +1,38 @@
+/**
+ * @file      shm.h
+ * @brief     Shared-memory record distribution header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_SHM_H_
+#define HOUND_PRIVATE_SHM_H_
+
+#include <hound/hound.h>
+#include <stddef.h>
+#include <stdint.h>
+
+hound_err shm_serve(
+    const char *socket_path,
+    const struct hound_rq *rq,
+    size_t slot_count,
+    size_t max_record_size,
+    struct hound_shm_server **server);
+hound_err shm_stop(struct hound_shm_server *server);
+
+hound_err shm_attach(
+    const char *socket_path,
+    hound_data_id id,
+    struct hound_shm_client **client);
+void shm_detach(struct hound_shm_client *client);
+hound_err shm_read(
+    struct hound_shm_client *client,
+    size_t records,
+    hound_data_period timeout_ns,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read);
+hound_err shm_dropped(struct hound_shm_client *client, uint64_t *count);
+
+#endif /* HOUND_PRIVATE_SHM_H_ */
@@ -0,0 +1,54 @@
+/**
+ * @file      stats.h
+ * @brief     Runtime statistics header.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef HOUND_PRIVATE_STATS_H_
+#define HOUND_PRIVATE_STATS_H_
+
+#include <hound/hound.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Statistics are relaxed atomics, so the hot paths can update them with no
+ * locks and no ordering cost, and readers get each counter whole, though not a
+ * consistent snapshot across counters.
+ */
+struct stats_histogram {
+    atomic_uint_least64_t count;
+    atomic_uint_least64_t total;
+    atomic_uint_least64_t max;
+    atomic_uint_least64_t buckets[HOUND_HISTOGRAM_BUCKETS];
+};
+
+struct driver_stats {
+    atomic_uint_least64_t records;
+    atomic_uint_least64_t bytes;
+    atomic_uint_least64_t reads;
+    struct stats_histogram parse_ns;
+    struct stats_histogram poll_ns;
+    struct stats_histogram pull_late_ns;
+};
+
+uint_least64_t stats_now_ns(void);
+void stats_add(atomic_uint_least64_t *counter, uint_least64_t val);
+
+void stats_histogram_init(struct stats_histogram *hist);
+void stats_histogram_add(struct stats_histogram *hist, uint_least64_t val);
+void stats_histogram_read(
+    const struct stats_histogram *hist,
+    struct hound_histogram *out);
+void stats_histogram_merge(
+    struct hound_histogram *into,
+    const struct hound_histogram *from);
+
+void driver_stats_init(struct driver_stats *stats);
+void driver_stats_read(
+    const struct driver_stats *stats,
+    struct hound_driver_stats *out);
+
+#endif /* HOUND_PRIVATE_STATS_H_ */
@@ -0,0 +1,55 @@
+/**
+ * @file      trace.h
+ * @brief     Static tracepoints on the record path. With the tracepoints
+ *            meson option, each TRACE macro becomes a USDT probe in the
+ *            "hound" provider, which tools such as bpftrace, perf and
+ *            SystemTap can attach to. A probe that nothing is attached to
+ *            is a single nop. Without the option, the macros expand to
+ *            nothing and their arguments are never evaluated.
+ *
+ *            A record can be followed through the probes by the address of
+ *            its record info, which stays the same from push to callback.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#ifndef HOUND_PRIVATE_TRACE_H_
+#define HOUND_PRIVATE_TRACE_H_
+
+#include <hound-private/util.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#ifdef CONFIG_HOUND_TRACEPOINTS
+
+#include <sys/sdt.h>
+
+#define TRACE1(name, a) DTRACE_PROBE1(hound, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(hound, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(hound, name, a, b, c)
+#define TRACE4(name, a, b, c, d) DTRACE_PROBE4(hound, name, a, b, c, d)
+#define TRACE5(name, a, b, c, d, e) DTRACE_PROBE5(hound, name, a, b, c, d, e)
+
+#else
+
+/*
+ * sizeof doesn't evaluate its operand, but it still counts as a use, so values
+ * computed only for a probe don't set off unused variable warnings.
+ */
+#define TRACE1(name, a) do { (void) sizeof(a); } while (0)
+#define TRACE2(name, a, b) do { TRACE1(name, a); (void) sizeof(b); } while (0)
+#define TRACE3(name, a, b, c) \
+    do { TRACE2(name, a, b); (void) sizeof(c); } while (0)
+#define TRACE4(name, a, b, c, d) \
+    do { TRACE3(name, a, b, c); (void) sizeof(d); } while (0)
+#define TRACE5(name, a, b, c, d, e) \
+    do { TRACE4(name, a, b, c, d); (void) sizeof(e); } while (0)
+
+#endif /* CONFIG_HOUND_TRACEPOINTS */
+
+/* Converts a timestamp to ns, so a probe can carry it in one argument. */
+#define TRACE_TIMESPEC_NS(ts) \
+    ((uint64_t) (ts).tv_sec * NSEC_PER_SEC + (uint64_t) (ts).tv_nsec)
+
+#endif /* HOUND_PRIVATE_TRACE_H_ */
@@ -9,8 +9,10 @@
 #define HOUND_PRIVATE_UTIL_H_
 
 #include <hound/hound.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <pthread.h>
+#include <time.h>
 #include <xlib/xassert.h>
 
 #define ARRAYLEN(a) (sizeof(a) / sizeof(a[0]))
@@ -49,6 +51,13 @@ void init_cond(pthread_cond_t *cond);
 void destroy_cond(pthread_cond_t *cond);
 
 void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+bool cond_timedwait(
+    pthread_cond_t *cond,
+    pthread_mutex_t *mutex,
+    const struct timespec *deadline);
+void cond_broadcast(pthread_cond_t *cond);
 void cond_signal(pthread_cond_t *cond);
 
+void deadline_after(hound_data_period timeout_ns, struct timespec *deadline);
+
 #endif /* HOUND_PRIVATE_UTIL_H_ */
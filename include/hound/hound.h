@@ -49,7 +49,14 @@ typedef enum {
     HOUND_DRIVER_ALREADY_PRESENT = -25,
     HOUND_CTX_STOPPED = -26,
     HOUND_NO_DESCS_ENABLED = -27,
-    HOUND_PATH_TOO_LONG = -28
+    HOUND_PATH_TOO_LONG = -28,
+    HOUND_INVALID_QUEUE_TYPE = -29,
+    HOUND_INVALID_OVERFLOW_POLICY = -30,
+    HOUND_PACK_UNSUPPORTED = -31,
+    HOUND_RECORD_LOG_ACTIVE = -32,
+    HOUND_AGGREGATE_UNSUPPORTED = -33,
+    HOUND_INVALID_FILTER = -34,
+    HOUND_MULTICAST_UNSUPPORTED = -35
 } hound_err;
 
 /**
@@ -197,6 +204,12 @@ struct hound_datadesc {
     /** an array of periods available for this data */
     hound_data_period *avail_periods;
 
+    /**
+     * the most samples a request may pack into each record (see
+     * hound_data_rq), or 1 if the driver does not pack this data
+     */
+    size_t max_pack;
+
     /** the number of data formats inside a given record */
     size_t fmt_count;
 
@@ -204,12 +217,107 @@ struct hound_datadesc {
     struct hound_data_fmt *fmts;
 };
 
+/**
+ * How a context receives data at a slower period than the one its driver runs
+ * at. When several contexts request the same data ID at periods that are
+ * whole multiples of the fastest one, the driver runs only at the fastest
+ * period and the core reduces the stream for the slower contexts.
+ */
+typedef enum {
+    /** deliver every Nth record unchanged */
+    HOUND_AGGREGATE_NONE,
+    /** deliver the per-field mean of each N records */
+    HOUND_AGGREGATE_MEAN,
+    /** deliver the per-field minimum of each N records */
+    HOUND_AGGREGATE_MIN,
+    /** deliver the per-field maximum of each N records */
+    HOUND_AGGREGATE_MAX
+} hound_aggregate;
+
+/** The rules a hound_data_filter applies, as bit flags. */
+typedef enum {
+    /** deliver only records from one device */
+    HOUND_FILTER_DEV_ID = 1 << 0,
+    /** deliver only records in which a field moved by more than a deadband */
+    HOUND_FILTER_DEADBAND = 1 << 1,
+    /** deliver records no more often than a minimum interval */
+    HOUND_FILTER_MIN_INTERVAL = 1 << 2
+} hound_filter_flag;
+
+/**
+ * Rules the core applies to a context's data before queueing it, so that
+ * records the context doesn't want never take up queue space or wake it up.
+ * A record is delivered only if it passes every rule in flags. The deadband
+ * and interval are measured against the last record delivered, and the first
+ * record always passes them.
+ */
+struct hound_data_filter {
+    /** a mask of hound_filter_flag values; 0 delivers every record */
+    uint32_t flags;
+
+    /** for HOUND_FILTER_DEV_ID, the device to take records from */
+    hound_dev_id dev_id;
+
+    /**
+     * for HOUND_FILTER_DEADBAND, the index into the descriptor's fmts of the
+     * field to watch, which must be numeric
+     */
+    size_t fmt_index;
+
+    /**
+     * for HOUND_FILTER_DEADBAND, how far the field must move before a record
+     * is delivered; 0 delivers a record whenever the field changes at all
+     */
+    double deadband;
+
+    /**
+     * for HOUND_FILTER_MIN_INTERVAL, the least time (in nanoseconds) between
+     * the timestamps of delivered records
+     */
+    hound_data_period min_interval_ns;
+};
+
 struct hound_data_rq {
     /** a data ID to be requested */
     hound_data_id id;
 
     /** the period (in nanoseconds) to generate this data */
     hound_data_period period_ns;
+
+    /**
+     * the number of consecutive samples to pack into each record, up to the
+     * descriptor's max_pack; 0 or 1 means one sample per record. A packed
+     * record's timestamp is that of its first sample. Its data starts with one
+     * uint64_t per sample, giving the sample's offset in nanoseconds from the
+     * record's timestamp, followed by the samples back to back, each laid out
+     * as the descriptor's formats describe.
+     */
+    size_t pack;
+
+    /**
+     * how long (in nanoseconds) a sample may wait before it is delivered.
+     * Drivers that batch samples in hardware, such as IIO, use this to decide
+     * how many samples to collect before waking up; 0 means deliver each
+     * sample as soon as possible.
+     */
+    hound_data_period latency_ns;
+
+    /**
+     * how to reduce the records when the core delivers this data at a slower
+     * period than the driver runs at. Aggregation works only on unpacked data
+     * with fixed-size records; other requests for it fail with
+     * HOUND_AGGREGATE_UNSUPPORTED. Numeric fields are reduced element by
+     * element, and other fields come from the last record. An aggregated
+     * record's timestamp is that of its first record.
+     */
+    hound_aggregate aggregate;
+
+    /**
+     * which records to deliver. Filters run after any aggregation. Deadbands
+     * can't be used on packed data. If a context requests a data ID more than
+     * once, the first request's filter applies.
+     */
+    struct hound_data_filter filter;
 };
 
 struct hound_data_rq_list {
@@ -220,6 +328,57 @@ struct hound_data_rq_list {
     struct hound_data_rq *data;
 };
 
+/**
+ * The kind of queue backing a context. Every type handles a full queue as the
+ * request's overflow_policy says, and wakes a blocked reader only once the
+ * queue holds as many records (or bytes) as the reader is waiting for, rather
+ * than on every push.
+ */
+typedef enum {
+    /**
+     * A mutex-protected queue. Pushes and pops always take the queue lock.
+     */
+    HOUND_QUEUE_LOCKED,
+
+    /**
+     * A ring buffer with lock-free reads. Pops never take a lock, and blocked
+     * readers sleep on a futex only while the ring holds fewer records than
+     * they need. Pushes take a lock of their own, which is uncontended unless
+     * drivers in different I/O threads feed the same context, so readers never
+     * wait behind a push. Resizing the ring, including growing it under
+     * HOUND_OVERFLOW_GROW, briefly stops both pushes and pops. This is a better
+     * fit for high-rate data.
+     */
+    HOUND_QUEUE_RING,
+
+    /**
+     * A read cursor into a record log shared by every multicast context on the
+     * same driver. Each record is written into the log once, however many
+     * contexts want it, and is freed once the slowest cursor has passed it,
+     * which makes this a better fit when many contexts read the same data.
+     * Each cursor has a lock that pops take, but writing to the log takes it
+     * only to deal with a cursor that has fallen behind or to wake a blocked
+     * reader. All of the context's data must come from a single driver, and a
+     * driver can have at most 64 multicast contexts running at once.
+     */
+    HOUND_QUEUE_MULTICAST
+} hound_queue_type;
+
+/** What a context's queue does with a new record when the queue is full. */
+typedef enum {
+    /** Overwrite the oldest record in the queue. This is the default. */
+    HOUND_OVERFLOW_OVERWRITE,
+
+    /** Drop the new record, leaving the queue as it is. */
+    HOUND_OVERFLOW_DROP_NEWEST,
+
+    /**
+     * Grow the queue, doubling its length each time, up to queue_max_len. Once
+     * the queue can't grow any more, overwrite the oldest record.
+     */
+    HOUND_OVERFLOW_GROW
+} hound_overflow_policy;
+
 struct hound_rq {
     /**
      * The number of records in the circular buffer hound uses to queue up data
@@ -227,6 +386,25 @@ struct hound_rq {
      */
     size_t queue_len;
 
+    /**
+     * The kind of queue to use for this context. This cannot be changed by
+     * hound_modify_ctx.
+     */
+    hound_queue_type queue_type;
+
+    /**
+     * What to do with new records when the queue is full. Records lost this way
+     * are counted by hound_queue_dropped.
+     */
+    hound_overflow_policy overflow_policy;
+
+    /**
+     * For HOUND_OVERFLOW_GROW, the length the queue may grow to, which must be
+     * at least queue_len. hound_modify_ctx sets the queue back to queue_len.
+     * Ignored for other overflow policies.
+     */
+    size_t queue_max_len;
+
     /**
      * A callback function, which will be called by hound_read and friends for
      * each record to be read from the context's queue.
@@ -282,6 +460,49 @@ hound_err hound_get_datadescs(struct hound_datadesc **descs, size_t *len);
  */
 void hound_free_datadescs(struct hound_datadesc *descs);
 
+/** An immutable snapshot of the descriptors for every registered driver. */
+struct hound_datadesc_snapshot {
+    /** the driver generation this snapshot describes */
+    uint64_t generation;
+
+    /** the number of descriptors */
+    size_t len;
+
+    /** an array of descriptors */
+    const struct hound_datadesc *descs;
+};
+
+/**
+ * Acquires a snapshot of the descriptors for every registered driver. Unlike
+ * hound_get_datadescs, this doesn't copy anything unless a driver has been
+ * added or removed since the last snapshot was taken, so it's cheap to call
+ * often. The snapshot stays valid until it is released, even if drivers go
+ * away in the meantime.
+ *
+ * @param[out] snapshot filled in with a snapshot, which must be released with
+ *             hound_release_datadescs
+ *
+ * @return an error code
+ */
+hound_err hound_acquire_datadescs(
+    const struct hound_datadesc_snapshot **snapshot);
+
+/**
+ * Releases a snapshot acquired by hound_acquire_datadescs.
+ *
+ * @param[in] snapshot a snapshot, or NULL to do nothing
+ */
+void hound_release_datadescs(const struct hound_datadesc_snapshot *snapshot);
+
+/**
+ * Gets the current driver generation, which changes whenever a driver is added
+ * or removed. If this matches the generation of a snapshot, the snapshot is
+ * still current.
+ *
+ * @return the driver generation
+ */
+uint64_t hound_datadesc_generation(void);
+
 /* Devices. */
 
 /** Opaque pointer to an I/O context. */
@@ -314,7 +535,9 @@ hound_err hound_alloc_ctx(const struct hound_rq *rq, struct hound_ctx **ctx);
  * Modifies an existing context to produce a different set of data.
  *
  * @param[in] ctx an already-allocated context
- * @param[in] rq a request containing the data the context should now generate
+ * @param[in] rq a request containing the data the context should now generate.
+ *               Its queue type must match the one the context was allocated
+ *               with.
  * @param[in] flush if true, empty the queue of any pending records. if false,
  *                  the callback specified in the new request must be able to
  *                  handle data that was part of the previous request in the
@@ -357,6 +580,10 @@ hound_err hound_stop(struct hound_ctx *ctx);
  * only for on-demand (period == 0) data, and it does nothing for periodic
  * drivers.
  *
+ * For a started context, this queues the requests for each driver's I/O
+ * thread and returns without waiting for the drivers, so errors from the
+ * drivers are logged rather than returned.
+ *
  * @param[in] ctx a context
  * @param[in] n the number of records to produce.
  *
@@ -383,6 +610,28 @@ hound_err hound_next(struct hound_ctx *ctx, size_t n);
  */
 hound_err hound_read(struct hound_ctx *ctx, size_t records, size_t *read);
 
+/**
+ * Like hound_read(), but gives up waiting once a timeout expires, and then
+ * processes callbacks for whatever is available. This allows batching up
+ * records with a bound on latency. Callbacks for all records read are
+ * guaranteed to have completed upon return.
+ *
+ * @param[in]  ctx a context
+ * @param[in]  records the number of records to read
+ * @param[in]  timeout_ns the maximum time to wait, in nanoseconds
+ * @param[out] read if not NULL, filled in with the number of records that were
+ *                  read. This is less than the requested number of records if
+ *                  the timeout expired or HOUND_CTX_STOPPED is returned.
+ *
+ * @return HOUND_OK, or HOUND_CTX_STOPPED if the context is stopped during the
+ *         read. A timeout is not an error.
+ */
+hound_err hound_read_timeout(
+    struct hound_ctx *ctx,
+    size_t records,
+    hound_data_period timeout_ns,
+    size_t *read);
+
 /**
  * Triggers callback invocations to process queued data. If fewer than n records
  * are available, processes callbacks on what is available instead of blocking
@@ -399,6 +648,35 @@ hound_err hound_read(struct hound_ctx *ctx, size_t records, size_t *read);
  */
 hound_err hound_read_nowait(struct hound_ctx *ctx, size_t records, size_t *read);
 
+/**
+ * Triggers callback invocations on up to the specified number of bytes of
+ * records, blocking until that many bytes are available. The callback takes
+ * the same form as usual, triggering on a per-record basis, and the sum of the
+ * record sizes triggered will not exceed the specified number of bytes. Since
+ * records vary in size, the read stops early if the next record would not fit
+ * in the bytes that remain.
+ *
+ * For on-demand data, this function calls hound_next() on your behalf, asking
+ * for as many records as the bytes requested appear to hold based on the sizes
+ * of records read so far. If those records come up short, it asks for more.
+ *
+ * @param[in] ctx a context
+ * @param[in] bytes trigger callbacks for up to the specified bytes of records
+ * @param[out] records_read filled in to indicate how many records were
+ *                          actually read
+ * @param[out] bytes_read filled in to indicate how many bytes were actually
+ *                        read
+ *
+ * @return HOUND_OK, or HOUND_CTX_STOPPED if the context is stopped during the
+ *         read. If HOUND_CTX_STOPPED is returned, then the number of bytes read
+ *         may be less than the number requested.
+ */
+hound_err hound_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    size_t *records_read,
+    size_t *bytes_read);
+
 /**
  * Triggers callback invocations to process queued data. If fewer than n records
  * are available, processes callbacks on what is available instead of blocking
@@ -437,6 +715,178 @@ hound_err hound_read_bytes_nowait(
  */
 hound_err hound_read_all_nowait(struct hound_ctx *ctx, size_t *read);
 
+/**
+ * Reads queued records without invoking callbacks, blocking until the requested
+ * number of records is available. Instead of triggering callbacks, fills in an
+ * array with pointers to the records themselves, which stay valid until they
+ * are released with hound_release_batch(). The records are not copied.
+ *
+ * The records in a batch are in increasing sequence number order, starting at
+ * first_seqno. A read that has to wait may take records from the queue more
+ * than once, so if records were overwritten or taken by another reader in the
+ * meantime, the sequence numbers skip over them.
+ *
+ * @param[in]  ctx a context
+ * @param[in]  records the number of records to read
+ * @param[out] recs an array of at least records entries, filled in with
+ *                  pointers to the records that were read
+ * @param[out] first_seqno filled in with the sequence number of recs[0]
+ * @param[out] read filled in with the number of records that were read. This
+ *                  will be the requested number of records unless
+ *                  HOUND_CTX_STOPPED is returned.
+ *
+ * @return HOUND_OK, or HOUND_CTX_STOPPED if the context is stopped during the
+ *         read. Any records read must be released in either case.
+ */
+hound_err hound_read_batch(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read);
+
+/**
+ * Like hound_read_batch(), but reads only what is available instead of
+ * blocking.
+ *
+ * @param[in]  ctx a context
+ * @param[in]  records the maximum number of records to read
+ * @param[out] recs an array of at least records entries, filled in with
+ *                  pointers to the records that were read
+ * @param[out] first_seqno filled in with the sequence number of recs[0]
+ * @param[out] read filled in with the number of records that were read
+ *
+ * @return an error code
+ */
+hound_err hound_read_batch_nowait(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read);
+
+/**
+ * Releases records obtained from hound_read_batch() or
+ * hound_read_batch_nowait(). The record pointers must not be used afterwards.
+ *
+ * @param[in] recs an array of records from a batch read
+ * @param[in] count the number of records in the array
+ *
+ * @return an error code
+ */
+hound_err hound_release_batch(const struct hound_record **recs, size_t count);
+
+/**
+ * Reads the available records for one data ID into columns, one array per
+ * data format, instead of handing out records. Each requested format of the
+ * i-th record read is copied to element i of its column, so consumers get
+ * contiguous per-field arrays with no transpose of their own. Like
+ * hound_read_nowait(), this reads only what is available instead of blocking.
+ *
+ * Records for other data IDs, and records too short to hold every requested
+ * format, are passed to the context callback as usual.
+ *
+ * @param[in]  ctx a context
+ * @param[in]  data_id the data ID to read, which must be requested by ctx
+ *                     without packing
+ * @param[in]  records the maximum number of records to read
+ * @param[out] timestamps an array of at least records entries, filled in with
+ *                        each record's timestamp in nanoseconds, or NULL
+ * @param[in]  columns an array with one entry per format in the data ID's
+ *                     descriptor, in descriptor order. Each entry is either
+ *                     NULL, to skip that format, or an array of at least
+ *                     records * fmt.size bytes. Formats with a size of 0
+ *                     must be skipped.
+ * @param[out] read filled in with the number of records that were read
+ *
+ * @return an error code
+ */
+hound_err hound_read_columns(
+    struct hound_ctx *ctx,
+    hound_data_id data_id,
+    size_t records,
+    int64_t *timestamps,
+    void *const *columns,
+    size_t *read);
+
+/**
+ * Starts logging every record that goes into a context's queue to a binary
+ * log file, which the replay driver can play back later. Records are logged as
+ * they arrive, whether or not they are read, and records dropped by the
+ * queue's overflow policy are still logged. The log is written through a
+ * memory mapping, so logging costs a copy per record rather than a syscall.
+ *
+ * @param[in] ctx a context
+ * @param[in] path the log file to create. An existing file is overwritten.
+ *
+ * @return an error code, or HOUND_RECORD_LOG_ACTIVE if the context is already
+ *         logging
+ */
+hound_err hound_start_record_log(struct hound_ctx *ctx, const char *path);
+
+/**
+ * Stops logging a context's records and finishes the log file. This is done
+ * automatically when a context is freed, but then there's no way to see
+ * whether writing the log failed.
+ *
+ * @param[in] ctx a context
+ *
+ * @return an error code, including any error hit while writing the log. If the
+ *         context isn't logging, HOUND_OK.
+ */
+hound_err hound_stop_record_log(struct hound_ctx *ctx);
+
+/**
+ * Gets a file descriptor that becomes readable when the context has data
+ * available, for use with poll(), epoll and other event loops. By default, the
+ * fd is readable whenever at least one record is queued; use
+ * hound_ctx_set_fd_watermark() to require more. The fd stays readable until
+ * enough records are read that the queue drops below the watermark, so the
+ * caller should read records (typically with one of the nowait functions)
+ * rather than reading from the fd itself.
+ *
+ * The fd is owned by the context and is closed when the context is freed, so
+ * the caller must not close it.
+ *
+ * @param[in]  ctx a context
+ * @param[out] fd filled in with the readiness fd
+ *
+ * @return an error code
+ */
+hound_err hound_ctx_get_fd(struct hound_ctx *ctx, int *fd);
+
+/**
+ * Sets how many records must be queued before the fd returned by
+ * hound_ctx_get_fd() becomes readable.
+ *
+ * @param[in] ctx a context
+ * @param[in] records the number of records, which must be at least 1 and no
+ *                    more than the queue length
+ *
+ * @return an error code
+ */
+hound_err hound_ctx_set_fd_watermark(struct hound_ctx *ctx, size_t records);
+
+/**
+ * Sets how many threads run the context's callbacks. By default, every
+ * callback runs on the thread that reads, one after another. With more than
+ * one thread, a slow callback for one data ID doesn't hold up the others:
+ * records are split among the threads by data ID, so the records for a given
+ * data ID all run on the same thread in seqno order, while records for
+ * different data IDs may run at the same time. The reading thread is one of
+ * the threads, and a read still returns only once all of its callbacks have.
+ *
+ * With more than one thread, the callback must be thread-safe and must not
+ * read from its own context. This can't be called while the context is being
+ * read.
+ *
+ * @param[in] ctx a context
+ * @param[in] threads the number of threads, from 1 (the default) to 64
+ *
+ * @return an error code
+ */
+hound_err hound_ctx_set_callback_threads(struct hound_ctx *ctx, size_t threads);
+
 /**
  * Returns how many records are currently available in the queue.
  *
@@ -457,15 +907,66 @@ hound_err hound_queue_length(struct hound_ctx *ctx, size_t *count);
  */
 hound_err hound_max_queue_length(struct hound_ctx *ctx, size_t *count);
 
+/**
+ * Returns how many records the queue has dropped because it was full, either by
+ * overwriting old records or by dropping new ones, depending on the overflow
+ * policy. Records dropped by shrinking or flushing the queue in
+ * hound_modify_ctx are not counted.
+ *
+ * @param[in] ctx a context
+ * @param[out] count filled in with the number of dropped records
+ *
+ * @return an error code
+ */
+hound_err hound_queue_dropped(struct hound_ctx *ctx, uint64_t *count);
+
+/**
+ * Returns the most records the queue has held at once. Together with
+ * hound_queue_dropped, this can be used to pick a queue length.
+ *
+ * @param[in] ctx a context
+ * @param[out] count filled in with the queue's high-water mark
+ *
+ * @return an error code
+ */
+hound_err hound_queue_high_water(struct hound_ctx *ctx, size_t *count);
+
 /**
  * Initializes drivers specified in the given config file.
  *
+ * A driver with schema_cache set in the config compiles its schema into a
+ * binary cache file next to the schema, and later loads the cache instead of
+ * parsing the schema, as long as the schema hasn't changed. If the cache can't
+ * be written, the schema is simply parsed every time.
+ *
  * @param[in] config the path to a driver config file
  *
  * @return an error code
  */
 hound_err hound_init_config(const char *config, const char *schema_base);
 
+/**
+ * Initializes drivers specified in the given config file, like
+ * hound_init_config, but initializes the drivers in parallel on a pool of
+ * threads. Since initializing a driver may walk sysfs or connect to a server,
+ * this brings start-up time down to roughly that of the slowest driver.
+ *
+ * Failures are logged for each driver. If any driver fails, the ones that
+ * succeeded are destroyed, and the first failure in config order is returned.
+ *
+ * @param[in] config the path to a driver config file
+ * @param[in] schema_base the base path for schema files, or NULL for the
+ *            default
+ * @param[in] thread_count the most threads to use, counting the calling
+ *            thread, or 0 for one thread per driver
+ *
+ * @return an error code
+ */
+hound_err hound_init_config_parallel(
+    const char *config,
+    const char *schema_base,
+    size_t thread_count);
+
 /**
  * Initializes a driver with a concrete device.
  *
@@ -507,6 +1008,344 @@ hound_err hound_destroy_driver(const char *path);
  */
 hound_err hound_destroy_all_drivers(void);
 
+/* I/O threads. */
+
+/** Scheduling policies for the threads that poll driver data. */
+typedef enum {
+    /** The normal time-sharing policy. This is the default. */
+    HOUND_SCHED_OTHER,
+
+    /** Real-time first-in, first-out scheduling. */
+    HOUND_SCHED_FIFO,
+
+    /** Real-time round-robin scheduling. */
+    HOUND_SCHED_RR
+} hound_sched_policy;
+
+/**
+ * Sets the scheduling policy and priority of the I/O thread that polls a
+ * driver. A thread polls every driver in its I/O shard, so this affects all of
+ * them. Real-time policies usually require CAP_SYS_NICE or an RLIMIT_RTPRIO
+ * allowance.
+ *
+ * @param[in] path the path to a device file, or NULL for all I/O threads
+ * @param[in] policy a scheduling policy
+ * @param[in] priority the thread priority, which must be 0 for
+ *                     HOUND_SCHED_OTHER and within the system's range for the
+ *                     real-time policies
+ *
+ * @return an error code
+ */
+hound_err hound_set_io_sched(
+    const char *path,
+    hound_sched_policy policy,
+    int priority);
+
+/**
+ * Restricts the I/O thread that polls a driver to a set of CPUs. As with
+ * hound_set_io_sched, this affects every driver in the same shard.
+ *
+ * @param[in] path the path to a device file, or NULL for all I/O threads
+ * @param[in] cpus an array of CPU numbers
+ * @param[in] cpu_count the number of entries in cpus
+ *
+ * @return an error code
+ */
+hound_err hound_set_io_cpus(
+    const char *path,
+    const int *cpus,
+    size_t cpu_count);
+
+/**
+ * Has the I/O thread that polls a driver busy poll: instead of going straight
+ * to sleep when it runs out of work, the thread spins checking its fds and
+ * timers for up to busy_ns, which trades a CPU for lower and steadier latency.
+ * The thread also asks the kernel to busy poll the device queues of its
+ * drivers' sockets (SO_BUSY_POLL), which needs CAP_NET_ADMIN to go past the
+ * system default. As with hound_set_io_sched, this affects every driver in
+ * the same shard, and it works best with the thread pinned to its own CPU.
+ *
+ * @param[in] path the path to a device file, or NULL for all I/O threads
+ * @param[in] busy_ns how long to spin before sleeping, in nanoseconds, or 0 to
+ *                    turn busy polling off (the default)
+ *
+ * @return an error code
+ */
+hound_err hound_set_io_busy_poll(const char *path, uint64_t busy_ns);
+
+/** Wakeup and timer latency statistics for I/O threads. */
+struct hound_io_latency {
+    /** how many times a thread slept and was woken up with work to do */
+    uint64_t blocking_wakeups;
+
+    /** how many times a thread found work while busy polling */
+    uint64_t busy_wakeups;
+
+    /** how many pull-mode timers fired */
+    uint64_t timer_fires;
+
+    /** the total time, over all timer_fires, that timers fired late, in ns */
+    uint64_t timer_late_total_ns;
+
+    /** the latest that any timer fired, in ns */
+    uint64_t timer_late_max_ns;
+};
+
+/**
+ * Gets the latency statistics for the I/O thread that polls a driver, counted
+ * since hound started, for tuning hound_set_io_busy_poll.
+ *
+ * @param[in]  path the path to a device file, or NULL to sum over all I/O
+ *                  threads (taking the largest timer_late_max_ns)
+ * @param[out] stats filled in with the statistics
+ *
+ * @return an error code
+ */
+hound_err hound_get_io_latency(
+    const char *path,
+    struct hound_io_latency *stats);
+
+/* Statistics. */
+
+/** The number of buckets in a hound_histogram. */
+#define HOUND_HISTOGRAM_BUCKETS 32
+
+/**
+ * A histogram with power-of-2 buckets: bucket 0 counts values of 0 and 1, and
+ * bucket i counts values in [2^i, 2^(i+1)), except that the last bucket also
+ * counts every larger value.
+ */
+struct hound_histogram {
+    /** how many values there were */
+    uint64_t count;
+
+    /** the sum of all the values */
+    uint64_t total;
+
+    /** the largest value */
+    uint64_t max;
+
+    /** the count for each bucket */
+    uint64_t buckets[HOUND_HISTOGRAM_BUCKETS];
+};
+
+/** Statistics for a driver, counted since it was initialized. */
+struct hound_driver_stats {
+    /** how many records the driver produced */
+    uint64_t records;
+
+    /** the total size of the records the driver produced, in bytes */
+    uint64_t bytes;
+
+    /** how many read system calls were made on the driver's fd */
+    uint64_t reads;
+
+    /** how long each call to the driver's parse function took, in ns */
+    struct hound_histogram parse_ns;
+
+    /** how long each call to the driver's poll function took, in ns */
+    struct hound_histogram poll_ns;
+
+    /** how late each pull-mode request was made, in ns */
+    struct hound_histogram pull_late_ns;
+};
+
+/** Statistics for a context, counted since it was allocated. */
+struct hound_ctx_stats {
+    /** how many records are in the queue */
+    size_t queue_len;
+
+    /** the most records there have been in the queue at once */
+    size_t high_water;
+
+    /** how many records were overwritten or dropped when the queue was full */
+    uint64_t dropped;
+
+    /** how many records each read returned, counting only non-empty reads */
+    struct hound_histogram read_batch;
+
+    /**
+     * how long records waited between being pushed into the queue and their
+     * callbacks being run, in ns
+     */
+    struct hound_histogram callback_latency_ns;
+};
+
+/** Statistics for I/O threads, counted since hound started. */
+struct hound_io_stats {
+    /** how many times the poll loop ran */
+    uint64_t iterations;
+
+    /**
+     * how long each request change spent waiting for the poll loop to let go
+     * of the old requests, in ns
+     */
+    struct hound_histogram sync_stall_ns;
+
+    /** how late each timer fired, in ns */
+    struct hound_histogram wakeup_jitter_ns;
+};
+
+/**
+ * Gets the statistics for a driver.
+ *
+ * @param[in]  path the path to a device file
+ * @param[out] stats filled in with the statistics
+ *
+ * @return an error code
+ */
+hound_err hound_get_driver_stats(
+    const char *path,
+    struct hound_driver_stats *stats);
+
+/**
+ * Gets the statistics for a context.
+ *
+ * @param[in]  ctx a context
+ * @param[out] stats filled in with the statistics
+ *
+ * @return an error code
+ */
+hound_err hound_get_ctx_stats(
+    struct hound_ctx *ctx,
+    struct hound_ctx_stats *stats);
+
+/**
+ * Gets the statistics for the I/O thread that polls a driver.
+ *
+ * @param[in]  path the path to a device file, or NULL to combine every I/O
+ *                  thread
+ * @param[out] stats filled in with the statistics
+ *
+ * @return an error code
+ */
+hound_err hound_get_io_stats(const char *path, struct hound_io_stats *stats);
+
+/**
+ * Locks the process's memory into RAM with mlockall, including memory mapped
+ * in the future, and pre-faults records for a driver so that the records it
+ * produces in steady state need no allocation or page faults. Note that this
+ * locks all of the process's memory, not just hound's.
+ *
+ * @param[in] path the path to a device file, or NULL for all registered drivers
+ * @param[in] records the number of records to pre-fault for each of the
+ *                    driver's data types
+ *
+ * @return an error code
+ */
+hound_err hound_lock_memory(const char *path, size_t records);
+
+/** A server publishing records to other processes; see hound_shm_serve(). */
+struct hound_shm_server;
+
+/** A client reading one data ID from a server; see hound_shm_attach(). */
+struct hound_shm_client;
+
+/**
+ * Starts publishing data to other processes through shared memory, so that
+ * several processes can share one set of devices without each doing its own
+ * device I/O and parsing. The server allocates and starts a context for rq,
+ * and a thread of its own copies each of the context's records into a
+ * shared-memory ring for the record's data ID. It listens for clients on a
+ * UNIX socket, which attach to one ring each with hound_shm_attach().
+ *
+ * There is one writer per ring, and clients only read, so a slow client never
+ * holds up the server or any other client; it just loses the records that get
+ * overwritten before it reads them.
+ *
+ * @param[in]  socket_path the path to listen on, which must not exist
+ * @param[in]  rq the data to publish, as for hound_alloc_ctx(). The callback
+ *                and its context are ignored, but must still be set.
+ * @param[in]  slot_count the number of records each ring holds, which is
+ *                        rounded up to a power of 2
+ * @param[in]  max_record_size the largest record to publish for data that
+ *                             doesn't have a fixed size, or that is packed.
+ *                             Larger records are dropped.
+ * @param[out] server filled in with the new server
+ *
+ * @return an error code
+ */
+hound_err hound_shm_serve(
+    const char *socket_path,
+    const struct hound_rq *rq,
+    size_t slot_count,
+    size_t max_record_size,
+    struct hound_shm_server **server);
+
+/**
+ * Stops a server and frees it, removing its socket. Clients that are still
+ * attached can read what is already in their rings, but won't get any more.
+ *
+ * @param[in] server a server
+ *
+ * @return an error code
+ */
+hound_err hound_shm_stop(struct hound_shm_server *server);
+
+/**
+ * Attaches to the ring for one data ID on a server, which may be in another
+ * process. Reading starts with the next record the server publishes.
+ *
+ * @param[in]  socket_path the path the server listens on
+ * @param[in]  id the data ID to read
+ * @param[out] client filled in with the new client
+ *
+ * @return an error code, or HOUND_DATA_ID_DOES_NOT_EXIST if the server does
+ *         not publish the data ID
+ */
+hound_err hound_shm_attach(
+    const char *socket_path,
+    hound_data_id id,
+    struct hound_shm_client **client);
+
+/**
+ * Detaches from a server and frees the client.
+ *
+ * @param[in] client a client
+ */
+void hound_shm_detach(struct hound_shm_client *client);
+
+/**
+ * Reads records from a client's ring, waiting up to a timeout for the first
+ * one. Each record is copied out of the shared ring into a buffer of the
+ * client's, and the callback runs only once the copy is known to be whole, so
+ * it never sees a record half-written. The record is valid only during the
+ * callback. Records the server overwrote before they could be copied are
+ * skipped and counted by hound_shm_dropped().
+ *
+ * Sequence numbers count the records the server has published to the ring,
+ * so a gap means records were lost.
+ *
+ * @param[in]  client a client
+ * @param[in]  records the maximum number of records to read
+ * @param[in]  timeout_ns how long to wait for a record, or 0 not to wait at
+ *                        all
+ * @param[in]  cb a callback to call on each record
+ * @param[in]  cb_ctx a context to pass to the callback
+ * @param[out] read filled in with the number of records that were read
+ *
+ * @return an error code
+ */
+hound_err hound_shm_read(
+    struct hound_shm_client *client,
+    size_t records,
+    hound_data_period timeout_ns,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read);
+
+/**
+ * Gets the number of records a client has lost, either because the server
+ * overwrote them before the client read them or because they were overwritten
+ * during the client's callback.
+ *
+ * @param[in]  client a client
+ * @param[out] count filled in with the number of records lost
+ *
+ * @return an error code
+ */
+hound_err hound_shm_dropped(struct hound_shm_client *client, uint64_t *count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,273 @@
+/**
+ * @file      cbpool.c
+ * @brief     Parallel callback dispatch. A context can own a small pool of
+ *            worker threads, so that a slow callback for one data ID doesn't
+ *            hold up the others. Each batch of records is split into
+ *            partitions by data ID, so every data ID stays on one thread and
+ *            its callbacks run in seqno order, while different partitions run
+ *            at the same time. The reading thread runs partition 0 itself and
+ *            then waits for the workers, so a read still returns only once
+ *            every callback for it has returned.
+ *
+ *            A pool runs one batch at a time; concurrent readers of the same
+ *            context take turns.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound-private/cbpool.h>
+#include <hound-private/error.h>
+#include <hound-private/queue.h>
+#include <hound-private/trace.h>
+#include <hound-private/util.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct cbpool_worker {
+    struct cbpool *pool;
+    size_t partition;
+    pthread_t thread;
+};
+
+struct cbpool {
+    pthread_mutex_t lock;
+    /* Workers wait here for a new batch. */
+    pthread_cond_t work_cond;
+    /* Readers wait here for a batch to finish. */
+    pthread_cond_t done_cond;
+
+    size_t partitions;
+    struct cbpool_worker *workers;
+    size_t worker_count;
+
+    /* Everything below is protected by lock. */
+    bool stop;
+    bool running;
+    uint64_t gen;
+    size_t remaining;
+
+    hound_cb cb;
+    void *cb_ctx;
+    struct record_info **buf;
+    hound_seqno seqno;
+    size_t n;
+};
+
+static
+size_t get_partition(const struct record_info *rec, size_t partitions)
+{
+    return rec->record.data_id % partitions;
+}
+
+static
+void run_partition(
+    hound_cb cb,
+    void *cb_ctx,
+    struct record_info **buf,
+    hound_seqno seqno,
+    size_t n,
+    size_t partition,
+    size_t partitions)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        if (get_partition(buf[i], partitions) == partition) {
+            TRACE4(
+                callback,
+                buf[i],
+                buf[i]->record.data_id,
+                buf[i]->record.dev_id,
+                seqno + i);
+            cb(&buf[i]->record, seqno + i, cb_ctx);
+        }
+    }
+}
+
+static
+void *run_worker(void *data)
+{
+    struct record_info **buf;
+    hound_cb cb;
+    void *cb_ctx;
+    uint64_t gen;
+    size_t n;
+    struct cbpool *pool;
+    hound_seqno seqno;
+    struct cbpool_worker *worker;
+
+    worker = data;
+    pool = worker->pool;
+
+    /* No batch can run before cbpool_alloc returns, so we start at gen 0. */
+    gen = 0;
+    lock_mutex(&pool->lock);
+    while (true) {
+        while (pool->gen == gen && !pool->stop) {
+            cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        gen = pool->gen;
+        cb = pool->cb;
+        cb_ctx = pool->cb_ctx;
+        buf = pool->buf;
+        seqno = pool->seqno;
+        n = pool->n;
+        unlock_mutex(&pool->lock);
+
+        run_partition(
+            cb,
+            cb_ctx,
+            buf,
+            seqno,
+            n,
+            worker->partition,
+            pool->partitions);
+
+        lock_mutex(&pool->lock);
+        --pool->remaining;
+        if (pool->remaining == 0) {
+            cond_broadcast(&pool->done_cond);
+        }
+    }
+    unlock_mutex(&pool->lock);
+
+    return NULL;
+}
+
+static
+void stop_workers(struct cbpool *pool, size_t count)
+{
+    hound_err err;
+    size_t i;
+
+    lock_mutex(&pool->lock);
+    pool->stop = true;
+    cond_broadcast(&pool->work_cond);
+    unlock_mutex(&pool->lock);
+
+    for (i = 0; i < count; ++i) {
+        err = pthread_join(pool->workers[i].thread, NULL);
+        XASSERT_EQ(err, 0);
+    }
+}
+
+hound_err cbpool_alloc(size_t partitions, struct cbpool **out_pool)
+{
+    hound_err err;
+    size_t i;
+    struct cbpool *pool;
+    struct cbpool_worker *worker;
+
+    XASSERT_GTE(partitions, 2);
+    XASSERT_NOT_NULL(out_pool);
+
+    pool = malloc(sizeof(*pool));
+    if (pool == NULL) {
+        return HOUND_OOM;
+    }
+
+    pool->worker_count = partitions - 1;
+    pool->workers = malloc(pool->worker_count * sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        err = HOUND_OOM;
+        goto error_workers;
+    }
+
+    init_mutex(&pool->lock);
+    init_cond(&pool->work_cond);
+    init_cond(&pool->done_cond);
+    pool->partitions = partitions;
+    pool->stop = false;
+    pool->running = false;
+    pool->gen = 0;
+    pool->remaining = 0;
+
+    /* The calling thread runs partition 0, so the workers take the rest. */
+    for (i = 0; i < pool->worker_count; ++i) {
+        worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->partition = i + 1;
+        err = pthread_create(&worker->thread, NULL, run_worker, worker);
+        if (err != 0) {
+            goto error_thread;
+        }
+    }
+
+    *out_pool = pool;
+
+    return HOUND_OK;
+
+error_thread:
+    stop_workers(pool, i);
+    destroy_cond(&pool->done_cond);
+    destroy_cond(&pool->work_cond);
+    destroy_mutex(&pool->lock);
+    free(pool->workers);
+error_workers:
+    free(pool);
+    return err;
+}
+
+void cbpool_destroy(struct cbpool *pool)
+{
+    XASSERT_NOT_NULL(pool);
+    XASSERT(!pool->running);
+
+    stop_workers(pool, pool->worker_count);
+    destroy_cond(&pool->done_cond);
+    destroy_cond(&pool->work_cond);
+    destroy_mutex(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+size_t cbpool_partitions(const struct cbpool *pool)
+{
+    XASSERT_NOT_NULL(pool);
+
+    return pool->partitions;
+}
+
+void cbpool_run(
+    struct cbpool *pool,
+    hound_cb cb,
+    void *cb_ctx,
+    struct record_info **buf,
+    hound_seqno seqno,
+    size_t n)
+{
+    XASSERT_NOT_NULL(pool);
+    XASSERT_NOT_NULL(cb);
+    XASSERT_NOT_NULL(buf);
+
+    lock_mutex(&pool->lock);
+    while (pool->running) {
+        cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pool->running = true;
+    pool->cb = cb;
+    pool->cb_ctx = cb_ctx;
+    pool->buf = buf;
+    pool->seqno = seqno;
+    pool->n = n;
+    pool->remaining = pool->worker_count;
+    ++pool->gen;
+    cond_broadcast(&pool->work_cond);
+    unlock_mutex(&pool->lock);
+
+    run_partition(cb, cb_ctx, buf, seqno, n, 0, pool->partitions);
+
+    lock_mutex(&pool->lock);
+    while (pool->remaining > 0) {
+        cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pool->running = false;
+    /* Let in the next reader, if any. */
+    cond_broadcast(&pool->done_cond);
+    unlock_mutex(&pool->lock);
+}
@@ -7,12 +7,22 @@
 
 #define _GNU_SOURCE
 #include <hound/hound.h>
+#include <hound-private/cbpool.h>
+#include <hound-private/ctx.h>
 #include <hound-private/driver.h>
 #include <hound-private/error.h>
 #include <hound-private/log.h>
+#include <hound-private/queue.h>
+#include <hound-private/record-log.h>
+#include <hound-private/stats.h>
+#include <hound-private/trace.h>
 #include <hound-private/util.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <xlib/xhash.h>
 #include <xlib/xvec.h>
 
@@ -22,6 +32,9 @@
  */
 #define DEQUEUE_BUF_SIZE (4096 / sizeof(struct hound_record_info *))
 
+/* The most threads a context may run its callbacks on. */
+#define MAX_CALLBACK_THREADS 64
+
 XVEC_DEFINE(data_rq_vec, struct hound_data_rq);
 XVEC_DEFINE(id_vec, hound_data_id);
 
@@ -45,6 +58,25 @@ struct hound_ctx {
     struct queue *queue;
     xhash_t(DRIVER_DATA_MAP) *drv_data_map;
     xhash_t(ON_DEMAND_MAP) *on_demand_data_map;
+
+    /*
+     * Running estimate of how many bytes a record takes, or 0 if we haven't
+     * read any records yet. It's used only to size the on-demand requests made
+     * by ctx_read_bytes.
+     */
+    _Atomic size_t bytes_per_record;
+
+    /* The log that records are being written to, or NULL. */
+    struct record_log *log;
+
+    /*
+     * The threads callbacks run on, or NULL to run them all on the reading
+     * thread. It changes only while there are no readers.
+     */
+    struct cbpool *cbpool;
+
+    struct stats_histogram read_batch;
+    struct stats_histogram callback_latency_ns;
 };
 
 static
@@ -76,6 +108,7 @@ hound_err validate_rq(const struct hound_rq *rq)
     struct hound_data_rq *data_rq;
     struct driver *drv;
     hound_err err;
+    struct driver *first_drv;
     size_t i;
     size_t j;
     const struct hound_data_rq_list *list;
@@ -85,6 +118,25 @@ hound_err validate_rq(const struct hound_rq *rq)
         return HOUND_EMPTY_QUEUE;
     }
 
+    if (rq->queue_type != HOUND_QUEUE_LOCKED &&
+        rq->queue_type != HOUND_QUEUE_RING &&
+        rq->queue_type != HOUND_QUEUE_MULTICAST) {
+        return HOUND_INVALID_QUEUE_TYPE;
+    }
+
+    switch (rq->overflow_policy) {
+        case HOUND_OVERFLOW_OVERWRITE:
+        case HOUND_OVERFLOW_DROP_NEWEST:
+            break;
+        case HOUND_OVERFLOW_GROW:
+            if (rq->queue_max_len < rq->queue_len) {
+                return HOUND_INVALID_OVERFLOW_POLICY;
+            }
+            break;
+        default:
+            return HOUND_INVALID_OVERFLOW_POLICY;
+    }
+
     list = &rq->rq_list;
     if (list->len == 0) {
         return HOUND_NO_DATA_REQUESTED;
@@ -101,6 +153,7 @@ hound_err validate_rq(const struct hound_rq *rq)
     }
 
     /* Are the data IDs all valid? */
+    first_drv = NULL;
     for (i = 0; i < list->len; ++i) {
         data_rq = &list->data[i];
 
@@ -109,10 +162,34 @@ hound_err validate_rq(const struct hound_rq *rq)
             return err;
         }
 
+        /* A multicast queue is a cursor into a single driver's log. */
+        if (i == 0) {
+            first_drv = drv;
+        }
+        else if (rq->queue_type == HOUND_QUEUE_MULTICAST && drv != first_drv) {
+            return HOUND_MULTICAST_UNSUPPORTED;
+        }
+
         if (!driver_period_supported(drv, data_rq->id, data_rq->period_ns)) {
             return HOUND_PERIOD_UNSUPPORTED;
         }
 
+        /*
+         * Check aggregation first, so that asking to aggregate packed data
+         * says what's wrong with the request even if the driver can't pack.
+         */
+        if (!driver_aggregate_supported(drv, data_rq)) {
+            return HOUND_AGGREGATE_UNSUPPORTED;
+        }
+
+        if (!driver_pack_supported(drv, data_rq->id, data_rq->pack)) {
+            return HOUND_PACK_UNSUPPORTED;
+        }
+
+        if (!driver_filter_supported(drv, data_rq)) {
+            return HOUND_INVALID_FILTER;
+        }
+
         for (j = 0; j < i; ++j) {
             if (data_rq->id == list->data[j].id) {
                 if (data_rq->period_ns == list->data[j].period_ns ||
@@ -192,6 +269,10 @@ hound_err make_driver_data_maps(
             goto error_loop;
         }
         *new_rq = *data_rq;
+        /* Drivers see a single-sample record as a pack of 1. */
+        if (new_rq->pack == 0) {
+            new_rq->pack = 1;
+        }
 
         if (data_rq->period_ns == 0) {
             /* On-demand data. */
@@ -265,13 +346,19 @@ hound_err ctx_alloc(const struct hound_rq *rq, struct hound_ctx **ctx_out)
 
     ctx->active = false;
     ctx->readers = 0;
+    atomic_init(&ctx->bytes_per_record, 0);
+    ctx->log = NULL;
+    ctx->cbpool = NULL;
+    stats_histogram_init(&ctx->read_batch);
+    stats_histogram_init(&ctx->callback_latency_ns);
     ctx->cb = rq->cb;
     ctx->cb_ctx = rq->cb_ctx;
 
-    err = queue_alloc(&ctx->queue, rq->queue_len);
+    err = queue_alloc(&ctx->queue, rq->queue_len, rq->queue_type);
     if (err != HOUND_OK) {
         goto error_queue_alloc;
     }
+    queue_set_overflow(ctx->queue, rq->overflow_policy, rq->queue_max_len);
 
     /* Populate our context. */
     err = make_driver_data_maps(
@@ -588,6 +675,7 @@ hound_err ctx_modify(
     const struct hound_rq *rq,
     bool flush)
 {
+    struct driver *drv;
     xhash_t(DRIVER_DATA_MAP) *drv_data_map;
     hound_err err;
     xhash_t(ON_DEMAND_MAP) *on_demand_map;
@@ -605,11 +693,31 @@ hound_err ctx_modify(
     /* The request is OK, so let's proceed. */
     pthread_rwlock_wrlock(&ctx->rwlock);
 
+    /* Readers hold onto the queue pointer, so we can't swap out the queue. */
+    if (rq->queue_type != queue_type(ctx->queue)) {
+        err = HOUND_INVALID_QUEUE_TYPE;
+        goto out;
+    }
+
+    /* Nor can a multicast cursor move to another driver's log. */
+    if (rq->queue_type == HOUND_QUEUE_MULTICAST) {
+        err = driver_get(rq->rq_list.data[0].id, &drv);
+        if (err != HOUND_OK) {
+            goto out;
+        }
+        if (xh_get(DRIVER_DATA_MAP, ctx->drv_data_map, drv) ==
+            xh_end(ctx->drv_data_map)) {
+            err = HOUND_MULTICAST_UNSUPPORTED;
+            goto out;
+        }
+    }
+
     orig_max_len = queue_max_len(ctx->queue);
     err = queue_resize(ctx->queue, rq->queue_len, flush);
     if (err != HOUND_OK) {
         goto error_resize;
     }
+    queue_set_overflow(ctx->queue, rq->overflow_policy, rq->queue_max_len);
 
     err = make_driver_data_maps(&rq->rq_list, &drv_data_map, &on_demand_map);
     if (err != HOUND_OK) {
@@ -667,9 +775,20 @@ hound_err ctx_free(struct hound_ctx *ctx)
         return HOUND_CTX_ACTIVE;
     }
 
+    err = ctx_stop_record_log(ctx);
+    if (err != HOUND_OK) {
+        hound_log_err(
+            err,
+            "ctx %p: failed to close record log while freeing",
+            (void *) ctx);
+    }
+
     err = pthread_rwlock_destroy(&ctx->rwlock);
     XASSERT_EQ(err, 0);
 
+    if (ctx->cbpool != NULL) {
+        cbpool_destroy(ctx->cbpool);
+    }
     destroy_drv_data_map(ctx->drv_data_map);
     destroy_on_demand_map(ctx->on_demand_data_map);
     queue_destroy(ctx->queue);
@@ -687,35 +806,56 @@ void process_callbacks(
 {
     hound_cb cb;
     void *cb_ctx;
+    struct cbpool *cbpool;
     size_t i;
+    uint_least64_t now;
     struct record_info *rec_info;
 
     if (n == 0) {
         return;
     }
 
+    stats_histogram_add(&ctx->read_batch, n);
+    now = stats_now_ns();
+    for (i = 0; i < n; ++i) {
+        stats_histogram_add(&ctx->callback_latency_ns, now - buf[i]->push_ns);
+    }
+
     /*
      * Grab the callback and its context, since they can be changed via
-     * ctx_modify.
+     * ctx_modify. The pool can't change while we're reading.
      */
     pthread_rwlock_rdlock(&ctx->rwlock);
     cb = ctx->cb;
     cb_ctx = ctx->cb_ctx;
+    cbpool = ctx->cbpool;
     pthread_rwlock_unlock(&ctx->rwlock);
 
-    for (i = 0; i < n; ++i) {
-        rec_info = buf[i];
-        cb(&rec_info->record, seqno, cb_ctx);
-        record_ref_dec(rec_info);
-        ++seqno;
+    TRACE3(callbacks_start, ctx, seqno, n);
+    if (cbpool != NULL) {
+        cbpool_run(cbpool, cb, cb_ctx, buf, seqno, n);
     }
+    else {
+        for (i = 0; i < n; ++i) {
+            rec_info = buf[i];
+            TRACE4(
+                callback,
+                rec_info,
+                rec_info->record.data_id,
+                rec_info->record.dev_id,
+                seqno);
+            cb(&rec_info->record, seqno, cb_ctx);
+            ++seqno;
+        }
+    }
+    TRACE2(callbacks_done, ctx, n);
+    queue_release(ctx->queue, buf, n);
 }
 
 hound_err ctx_next(struct hound_ctx *ctx, size_t n)
 {
     struct driver *drv;
     hound_err err;
-    size_t i;
     id_vec *ids;
     xhiter_t iter;
 
@@ -728,15 +868,13 @@ hound_err ctx_next(struct hound_ctx *ctx, size_t n)
         drv = xh_key(ctx->on_demand_data_map, iter);
         ids = &xh_val(ctx->on_demand_data_map, iter);
 
-        for (i = 0; i < xv_size(*ids); ++i) {
-            err = driver_next(drv, xv_A(*ids, i), n);
-            if (err != HOUND_OK) {
-                hound_log_err(
-                    err,
-                    "ctx %p: driver %p failed next() call",
-                    (void *) ctx,
-                    (void *) drv);
-            }
+        err = driver_next(drv, xv_data(*ids), xv_size(*ids), n);
+        if (err != HOUND_OK) {
+            hound_log_err(
+                err,
+                "ctx %p: driver %p failed next() call",
+                (void *) ctx,
+                (void *) drv);
         }
     );
     pthread_rwlock_unlock(&ctx->rwlock);
@@ -768,7 +906,12 @@ void stop_read(struct hound_ctx *ctx)
     pthread_rwlock_unlock(&ctx->rwlock);
 }
 
-hound_err ctx_read(struct hound_ctx *ctx, size_t records, size_t *read)
+static
+hound_err read_helper(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct timespec *deadline,
+    size_t *read)
 {
     struct record_info *buf[DEQUEUE_BUF_SIZE];
     hound_err err;
@@ -788,19 +931,23 @@ hound_err ctx_read(struct hound_ctx *ctx, size_t records, size_t *read)
         goto out;
     }
 
-    /* Dequeue and process callbacks. */
+    /*
+     * Dequeue and process callbacks. A short pop means we hit the deadline, so
+     * stop there.
+     */
     total = 0;
     do {
         target = min(records - total, ARRAYLEN(buf));
-        pop_count = queue_pop_records(
+        pop_count = queue_pop_records_timeout(
             queue,
             buf,
             target,
             &first_seqno,
+            deadline,
             &interrupt);
         process_callbacks(ctx, buf, first_seqno, pop_count);
         total += pop_count;
-    } while (total < records && !interrupt);
+    } while (total < records && pop_count == target && !interrupt);
 
     if (interrupt) {
         err = HOUND_CTX_STOPPED;
@@ -818,35 +965,176 @@ out:
     return err;
 }
 
+hound_err ctx_read(struct hound_ctx *ctx, size_t records, size_t *read)
+{
+    return read_helper(ctx, records, NULL, read);
+}
+
+hound_err ctx_read_timeout(
+    struct hound_ctx *ctx,
+    size_t records,
+    hound_data_period timeout_ns,
+    size_t *read)
+{
+    struct timespec deadline;
+
+    deadline_after(timeout_ns, &deadline);
+
+    return read_helper(ctx, records, &deadline, read);
+}
+
+/*
+ * Returns the number of on-demand data IDs in the context.
+ */
+static
+size_t on_demand_count(struct hound_ctx *ctx)
+{
+    size_t count;
+    xhiter_t iter;
+
+    count = 0;
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    xh_iter(ctx->on_demand_data_map, iter,
+        count += xv_size(xh_val(ctx->on_demand_data_map, iter));
+    );
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return count;
+}
+
 /*
- * NB: There is no ctx_read_bytes function; this is deliberate. The
- * problem with such a function is that records are not guaranteed to be a fixed
- * size, and until a record is delivered, the driver does not necessarily know
- * how large the record for a given data ID will be. Thus there is no good way
- * to call driver_next for a given number of bytes.
+ * Records are not guaranteed to be a fixed size, and until a record is
+ * delivered, the driver does not necessarily know how large it will be, so
+ * there's no way to ask a driver for a given number of bytes. Instead, we keep
+ * a running estimate of the bytes per record and ask for as many records as we
+ * think will fit.
  *
- * That said, it would be possible to implement a blocking queue_pop_bytes
- * function.  You could do something like this:
- *  - add a new property to each context indicating a guess of how many bytes
- *    per sample. initially set this property to something reasonably small but
- *    arbitrary. call this property "guess".
- *  - when doing ctx_read_bytes:
- *      - read target bytes / "guess" number of samples.
- *      - block waiting for that read to finish
- *      - check how many bytes you got. adjust "guess" according to this, erring
- *        on the low side because you don't want to read more bytes than
- *        requested. you would want to figure out a heuristic for how to adjust
- *        "guess" (always take the most recent guess, average the new guess and
- *        the old one, or something else?)
- *      - keep reading until you're done, continually adjusting "guess" based on
- *        how many bytes are in the samples you're getting.
-
- * Considering that the heuristic requered is non-obvious, this is clearly
- * complex, and you risk reading more samples than requested, let's not
- * implement ctx_read_bytes until there is a clear need for it. At that point,
- * perhaps concrete requirements will make it more obvious how it should be
- * implemented.
-*/
+ * The estimate errs on the high side so that we ask for too few records rather
+ * than too many: asking for too few costs another trip around the read loop,
+ * while asking for too many leaves unrequested records sitting in the queue.
+ * So a larger record raises the estimate right away, while smaller records
+ * pull it down gradually.
+ */
+static
+void update_estimate(struct hound_ctx *ctx, size_t bytes, size_t records)
+{
+    size_t estimate;
+    size_t observed;
+
+    if (records == 0) {
+        return;
+    }
+
+    observed = bytes / records;
+    estimate = atomic_load(&ctx->bytes_per_record);
+    if (observed > estimate || estimate == 0) {
+        estimate = observed;
+    }
+    else {
+        estimate = (estimate + observed) / 2;
+    }
+    atomic_store(&ctx->bytes_per_record, max(estimate, 1));
+}
+
+static
+size_t estimate_records(struct hound_ctx *ctx, size_t bytes, size_t ids)
+{
+    size_t estimate;
+
+    /* With no estimate yet, take a single record from each data ID. */
+    estimate = atomic_load(&ctx->bytes_per_record);
+    if (estimate == 0) {
+        return 1;
+    }
+
+    return max(bytes / (estimate * ids), 1);
+}
+
+hound_err ctx_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    size_t *records_read,
+    size_t *bytes_read)
+{
+    struct record_info *buf[DEQUEUE_BUF_SIZE];
+    size_t count;
+    hound_err err;
+    hound_seqno first_seqno;
+    size_t ids;
+    bool interrupt;
+    size_t n;
+    struct queue *queue;
+    size_t records;
+    size_t remaining;
+    size_t total_bytes;
+    size_t total_records;
+    size_t wait_records;
+
+    NULL_CHECK(ctx);
+
+    start_read(ctx, &queue);
+
+    /*
+     * Each pop waits until the queue holds enough bytes. For on-demand data,
+     * we first ask the drivers for the records we think we need and also stop
+     * waiting once they all arrive, since they may add up to fewer bytes than
+     * we guessed and nothing else is coming.
+     */
+    ids = on_demand_count(ctx);
+    interrupt = false;
+    total_bytes = 0;
+    total_records = 0;
+    while (total_bytes < bytes) {
+        remaining = bytes - total_bytes;
+        wait_records = SIZE_MAX;
+        if (ids > 0) {
+            n = estimate_records(ctx, remaining, ids);
+            err = ctx_next(ctx, n);
+            if (err != HOUND_OK) {
+                goto out;
+            }
+            wait_records = n * ids;
+        }
+
+        count = queue_pop_bytes(
+            queue,
+            buf,
+            ARRAYLEN(buf),
+            remaining,
+            wait_records,
+            &first_seqno,
+            &records,
+            &interrupt);
+        process_callbacks(ctx, buf, first_seqno, records);
+        update_estimate(ctx, count, records);
+
+        total_records += records;
+        total_bytes += count;
+
+        /*
+         * We only wake up once the queue is non-empty, so popping nothing means
+         * the next record doesn't fit in the bytes we have left.
+         */
+        if (interrupt || records == 0) {
+            break;
+        }
+    }
+
+    if (interrupt) {
+        err = HOUND_CTX_STOPPED;
+    }
+    else {
+        err = HOUND_OK;
+    }
+
+out:
+    *bytes_read = total_bytes;
+    *records_read = total_records;
+
+    stop_read(ctx);
+
+    return err;
+}
 
 hound_err ctx_read_nowait(struct hound_ctx *ctx, size_t records, size_t *read)
 {
@@ -888,7 +1176,6 @@ hound_err ctx_read_bytes_nowait(
     size_t records;
     size_t total_bytes;
     size_t total_records;
-    size_t target;
 
     NULL_CHECK(ctx);
 
@@ -897,19 +1184,21 @@ hound_err ctx_read_bytes_nowait(
     total_bytes = 0;
     total_records = 0;
     do {
-        target = min(bytes - total_bytes, sizeof(buf));
-
         count = queue_pop_bytes_nowait(
             queue,
             buf,
-            target,
+            ARRAYLEN(buf),
+            bytes - total_bytes,
             &first_seqno,
             &records);
         process_callbacks(ctx, buf, first_seqno, records);
+        update_estimate(ctx, count, records);
 
         total_records += records;
         total_bytes += count;
-    } while (count == target && total_bytes < bytes);
+
+        /* A full buffer means there may be more records that fit. */
+    } while (records == ARRAYLEN(buf) && total_bytes < bytes);
 
     *bytes_read = total_bytes;
     *records_read = total_records;
@@ -924,6 +1213,472 @@ hound_err ctx_read_all_nowait(struct hound_ctx *ctx, size_t *read)
     return ctx_read_nowait(ctx, SIZE_MAX, read);
 }
 
+/*
+ * Batch reads pop record infos straight into the caller's array and then
+ * convert each entry, in place, into a pointer to its record. That way a batch
+ * needs no copies and no intermediate buffer.
+ */
+static
+void infos_to_records(const struct hound_record **recs, size_t n)
+{
+    struct record_info **infos;
+    size_t i;
+
+    infos = (struct record_info **) recs;
+    for (i = 0; i < n; ++i) {
+        recs[i] = &infos[i]->record;
+    }
+}
+
+hound_err ctx_read_batch(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read)
+{
+    hound_err err;
+    bool interrupt;
+    size_t pop_count;
+    struct queue *queue;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(recs);
+    NULL_CHECK(first_seqno);
+    NULL_CHECK(read);
+
+    start_read(ctx, &queue);
+
+    if (records > queue_max_len(queue)) {
+        err = HOUND_QUEUE_TOO_SMALL;
+        goto out;
+    }
+
+    pop_count = queue_pop_records(
+        queue,
+        (struct record_info **) recs,
+        records,
+        first_seqno,
+        &interrupt);
+    queue_keep(queue, (struct record_info **) recs, pop_count);
+    infos_to_records(recs, pop_count);
+    if (pop_count > 0) {
+        stats_histogram_add(&ctx->read_batch, pop_count);
+    }
+    *read = pop_count;
+
+    if (interrupt) {
+        err = HOUND_CTX_STOPPED;
+    }
+    else {
+        err = HOUND_OK;
+    }
+
+out:
+    stop_read(ctx);
+    return err;
+}
+
+hound_err ctx_read_batch_nowait(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read)
+{
+    struct queue *queue;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(recs);
+    NULL_CHECK(first_seqno);
+    NULL_CHECK(read);
+
+    start_read(ctx, &queue);
+
+    *read = queue_pop_records_nowait(
+        queue,
+        (struct record_info **) recs,
+        first_seqno,
+        records);
+    queue_keep(queue, (struct record_info **) recs, *read);
+    infos_to_records(recs, *read);
+    if (*read > 0) {
+        stats_histogram_add(&ctx->read_batch, *read);
+    }
+
+    stop_read(ctx);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_release_batch(const struct hound_record **recs, size_t count)
+{
+    size_t i;
+    struct record_info *rec_info;
+
+    if (count == 0) {
+        return HOUND_OK;
+    }
+    NULL_CHECK(recs);
+
+    for (i = 0; i < count; ++i) {
+        XASSERT_NOT_NULL(recs[i]);
+        rec_info = (struct record_info *)
+            ((unsigned char *) recs[i] - offsetof(struct record_info, record));
+        record_ref_dec(rec_info);
+    }
+
+    return HOUND_OK;
+}
+
+/*
+ * Returns the pack size the context requested for a data ID, or 0 if the
+ * context didn't request it.
+ */
+static
+size_t get_rq_pack(struct hound_ctx *ctx, hound_data_id data_id)
+{
+    size_t i;
+    xhiter_t iter;
+    size_t pack;
+    const data_rq_vec *rqs;
+
+    pack = 0;
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    xh_iter(ctx->drv_data_map, iter,
+        rqs = &xh_val(ctx->drv_data_map, iter);
+        for (i = 0; i < xv_size(*rqs); ++i) {
+            if (xv_A(*rqs, i).id == data_id) {
+                pack = xv_A(*rqs, i).pack;
+                break;
+            }
+        }
+    );
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return pack;
+}
+
+/*
+ * Copies one field out of n records into a column. The common sizes get their
+ * own loops so that each copy is a single fixed-width load and store, which the
+ * compiler can unroll and vectorize.
+ */
+#define SCATTER_LOOP(size) \
+    for (i = 0; i < n; ++i) { \
+        memcpy(col + (i * (size)), recs[i]->record.data + offset, (size)); \
+    }
+
+static
+void scatter_field(
+    struct record_info **recs,
+    size_t n,
+    size_t offset,
+    size_t size,
+    unsigned char *col)
+{
+    size_t i;
+
+    switch (size) {
+        case 1:
+            SCATTER_LOOP(1);
+            break;
+        case 2:
+            SCATTER_LOOP(2);
+            break;
+        case 4:
+            SCATTER_LOOP(4);
+            break;
+        case 8:
+            SCATTER_LOOP(8);
+            break;
+        default:
+            SCATTER_LOOP(size);
+            break;
+    }
+}
+
+static
+void scatter_records(
+    const struct hound_datadesc *desc,
+    struct record_info **recs,
+    size_t n,
+    size_t base,
+    int64_t *timestamps,
+    void *const *columns)
+{
+    unsigned char *col;
+    const struct hound_data_fmt *fmt;
+    size_t i;
+    const struct timespec *ts;
+
+    for (i = 0; i < desc->fmt_count; ++i) {
+        if (columns[i] == NULL) {
+            continue;
+        }
+        fmt = &desc->fmts[i];
+        col = (unsigned char *) columns[i] + base*fmt->size;
+        scatter_field(recs, n, fmt->offset, fmt->size, col);
+    }
+
+    if (timestamps != NULL) {
+        for (i = 0; i < n; ++i) {
+            ts = &recs[i]->record.timestamp;
+            timestamps[base + i] = NSEC_PER_SEC*ts->tv_sec + ts->tv_nsec;
+        }
+    }
+}
+
+hound_err ctx_read_columns(
+    struct hound_ctx *ctx,
+    hound_data_id data_id,
+    size_t records,
+    int64_t *timestamps,
+    void *const *columns,
+    size_t *read)
+{
+    struct record_info *buf[DEQUEUE_BUF_SIZE];
+    hound_cb cb;
+    void *cb_ctx;
+    size_t count;
+    const struct hound_datadesc *desc;
+    hound_err err;
+    hound_seqno first_seqno;
+    const struct hound_data_fmt *fmt;
+    size_t i;
+    size_t matched;
+    struct record_info *matches[DEQUEUE_BUF_SIZE];
+    size_t min_size;
+    size_t pack;
+    struct queue *queue;
+    struct record_info *rec_info;
+    const struct hound_datadesc_snapshot *snapshot;
+    size_t target;
+    size_t total;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(columns);
+    NULL_CHECK(read);
+
+    pack = get_rq_pack(ctx, data_id);
+    if (pack == 0) {
+        return HOUND_DATA_ID_DOES_NOT_EXIST;
+    }
+    if (pack > 1) {
+        /* Packed records hold many rows each; read them with a batch read. */
+        return HOUND_PACK_UNSUPPORTED;
+    }
+
+    err = driver_acquire_datadescs(&snapshot);
+    if (err != HOUND_OK) {
+        return err;
+    }
+
+    desc = NULL;
+    for (i = 0; i < snapshot->len; ++i) {
+        if (snapshot->descs[i].data_id == data_id) {
+            desc = &snapshot->descs[i];
+            break;
+        }
+    }
+    if (desc == NULL) {
+        err = HOUND_DATA_ID_DOES_NOT_EXIST;
+        goto out_snapshot;
+    }
+
+    /*
+     * Variable-length fields don't fit in a column. Records too short to hold
+     * every requested field can't be scattered either, so find the smallest
+     * record we can take.
+     */
+    min_size = 0;
+    for (i = 0; i < desc->fmt_count; ++i) {
+        if (columns[i] == NULL) {
+            continue;
+        }
+        fmt = &desc->fmts[i];
+        if (fmt->size == 0) {
+            err = HOUND_INVALID_VAL;
+            goto out_snapshot;
+        }
+        min_size = max(min_size, fmt->offset + fmt->size);
+    }
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    cb = ctx->cb;
+    cb_ctx = ctx->cb_ctx;
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    start_read(ctx, &queue);
+
+    /*
+     * Records for other data IDs share the queue, so they go to the callback as
+     * usual. The matching records are gathered up and scattered a field at a
+     * time.
+     */
+    total = 0;
+    do {
+        target = min(records - total, ARRAYLEN(buf));
+        count = queue_pop_records_nowait(queue, buf, &first_seqno, target);
+
+        matched = 0;
+        for (i = 0; i < count; ++i) {
+            rec_info = buf[i];
+            if (rec_info->record.data_id == data_id &&
+                rec_info->record.size >= min_size) {
+                matches[matched] = rec_info;
+                ++matched;
+            }
+            else {
+                cb(&rec_info->record, first_seqno + i, cb_ctx);
+            }
+        }
+
+        scatter_records(desc, matches, matched, total, timestamps, columns);
+        queue_release(queue, buf, count);
+        total += matched;
+    } while (count == target && total < records);
+    *read = total;
+    if (total > 0) {
+        stats_histogram_add(&ctx->read_batch, total);
+    }
+
+    stop_read(ctx);
+
+out_snapshot:
+    driver_release_datadescs(snapshot);
+    return err;
+}
+
+hound_err ctx_start_record_log(struct hound_ctx *ctx, const char *path)
+{
+    hound_err err;
+    struct record_log *log;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(path);
+
+    /*
+     * Hold the lock across the open so that a second caller can't truncate
+     * the path before finding out a log is already running.
+     */
+    pthread_rwlock_wrlock(&ctx->rwlock);
+    if (ctx->log != NULL) {
+        err = HOUND_RECORD_LOG_ACTIVE;
+        goto out;
+    }
+
+    err = record_log_open(path, &log);
+    if (err != HOUND_OK) {
+        goto out;
+    }
+    ctx->log = log;
+    queue_swap_record_log(ctx->queue, log);
+
+out:
+    pthread_rwlock_unlock(&ctx->rwlock);
+    return err;
+}
+
+hound_err ctx_stop_record_log(struct hound_ctx *ctx)
+{
+    struct record_log *log;
+
+    NULL_CHECK(ctx);
+
+    pthread_rwlock_wrlock(&ctx->rwlock);
+    log = ctx->log;
+    ctx->log = NULL;
+    if (log != NULL) {
+        /* This waits out any pushes still appending to the log. */
+        queue_swap_record_log(ctx->queue, NULL);
+    }
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    if (log == NULL) {
+        return HOUND_OK;
+    }
+
+    return record_log_close(log);
+}
+
+hound_err ctx_get_fd(struct hound_ctx *ctx, int *fd)
+{
+    hound_err err;
+
+    NULL_CHECK(ctx);
+    NULL_CHECK(fd);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    err = queue_get_event_fd(ctx->queue, fd);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return err;
+}
+
+hound_err ctx_set_fd_watermark(struct hound_ctx *ctx, size_t records)
+{
+    hound_err err;
+
+    NULL_CHECK(ctx);
+
+    if (records == 0) {
+        return HOUND_INVALID_VAL;
+    }
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    if (records > queue_max_len(ctx->queue)) {
+        err = HOUND_QUEUE_TOO_SMALL;
+        goto out;
+    }
+    queue_set_event_len(ctx->queue, records);
+    err = HOUND_OK;
+
+out:
+    pthread_rwlock_unlock(&ctx->rwlock);
+    return err;
+}
+
+hound_err ctx_set_callback_threads(struct hound_ctx *ctx, size_t threads)
+{
+    struct cbpool *cbpool;
+    hound_err err;
+
+    NULL_CHECK(ctx);
+
+    if (threads == 0 || threads > MAX_CALLBACK_THREADS) {
+        return HOUND_INVALID_VAL;
+    }
+
+    pthread_rwlock_wrlock(&ctx->rwlock);
+    if (ctx->readers > 0) {
+        err = HOUND_CTX_ACTIVE;
+        goto out;
+    }
+
+    if (ctx->cbpool != NULL && cbpool_partitions(ctx->cbpool) == threads) {
+        err = HOUND_OK;
+        goto out;
+    }
+
+    cbpool = NULL;
+    if (threads > 1) {
+        err = cbpool_alloc(threads, &cbpool);
+        if (err != HOUND_OK) {
+            goto out;
+        }
+    }
+    if (ctx->cbpool != NULL) {
+        cbpool_destroy(ctx->cbpool);
+    }
+    ctx->cbpool = cbpool;
+    err = HOUND_OK;
+
+out:
+    pthread_rwlock_unlock(&ctx->rwlock);
+    return err;
+}
+
 hound_err ctx_queue_length(struct hound_ctx *ctx, size_t *count)
 {
     NULL_CHECK(ctx);
@@ -945,3 +1700,46 @@ hound_err ctx_max_queue_length(struct hound_ctx *ctx, size_t *count)
 
     return HOUND_OK;
 }
+
+hound_err ctx_queue_dropped(struct hound_ctx *ctx, uint64_t *count)
+{
+    NULL_CHECK(ctx);
+    NULL_CHECK(count);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    *count = queue_dropped(ctx->queue);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_queue_high_water(struct hound_ctx *ctx, size_t *count)
+{
+    NULL_CHECK(ctx);
+    NULL_CHECK(count);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    *count = queue_high_water(ctx->queue);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    return HOUND_OK;
+}
+
+hound_err ctx_get_stats(struct hound_ctx *ctx, struct hound_ctx_stats *stats)
+{
+    NULL_CHECK(ctx);
+    NULL_CHECK(stats);
+
+    pthread_rwlock_rdlock(&ctx->rwlock);
+    stats->queue_len = queue_len(ctx->queue);
+    stats->high_water = queue_high_water(ctx->queue);
+    stats->dropped = queue_dropped(ctx->queue);
+    pthread_rwlock_unlock(&ctx->rwlock);
+
+    stats_histogram_read(&ctx->read_batch, &stats->read_batch);
+    stats_histogram_read(
+        &ctx->callback_latency_ns,
+        &stats->callback_latency_ns);
+
+    return HOUND_OK;
+}
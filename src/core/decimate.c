@@ -0,0 +1,530 @@
+/**
+ * @file      decimate.c
+ * @brief     Record decimation and filtering. When a driver runs at a faster
+ *            period than a context asked for, or the context filters its
+ *            data, the I/O layer hands each of the context's records to a
+ *            decimator. It passes on one record out of every stride, or else
+ *            reduces each window of stride records to their mean, minimum or
+ *            maximum, and then drops whatever the context's filter rejects.
+ *
+ *            A decimator is shared by every snapshot of its fd's requests, so
+ *            its window carries across request changes, and it is refcounted
+ *            so the last snapshot to go frees it. Only the thread pushing the
+ *            fd's records touches the window.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound-private/decimate.h>
+#include <hound-private/error.h>
+#include <hound-private/log.h>
+#include <hound-private/pool.h>
+#include <hound-private/queue.h>
+#include <hound-private/refcount.h>
+#include <hound-private/util.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct decimator {
+    atomic_refcount_val refcount;
+    hound_aggregate aggregate;
+    const struct hound_datadesc *desc;
+    /* The size of a record, per the descriptor's formats. */
+    size_t size;
+
+    /* The records seen in the current window and the stride it started at. */
+    size_t count;
+    size_t window;
+    /* The window's first timestamp and its running result. */
+    struct timespec timestamp;
+    unsigned char *acc;
+    /* For a mean, the running sum of each format. */
+    double *sums;
+
+    /* The filter, and the value and time of the last record it passed. */
+    struct hound_data_filter filter;
+    bool have_last;
+    double last_value;
+    int64_t last_ns;
+};
+
+hound_err decimator_alloc(
+    const struct hound_datadesc *desc,
+    hound_aggregate aggregate,
+    const struct hound_data_filter *filter,
+    struct decimator **out_dec)
+{
+    struct decimator *dec;
+    const struct hound_data_fmt *fmt;
+    size_t i;
+    size_t size;
+
+    XASSERT_NOT_NULL(desc);
+    XASSERT_NOT_NULL(filter);
+    XASSERT_NOT_NULL(out_dec);
+
+    size = 0;
+    for (i = 0; i < desc->fmt_count; ++i) {
+        fmt = &desc->fmts[i];
+        size = max(size, fmt->offset + fmt->size);
+    }
+
+    dec = malloc(sizeof(*dec));
+    if (dec == NULL) {
+        return HOUND_OOM;
+    }
+    atomic_ref_init(&dec->refcount, 1);
+    dec->aggregate = aggregate;
+    dec->desc = desc;
+    dec->size = size;
+    dec->count = 0;
+    dec->window = 0;
+    dec->acc = NULL;
+    dec->sums = NULL;
+    dec->filter = *filter;
+    dec->have_last = false;
+    dec->last_value = 0;
+    dec->last_ns = 0;
+
+    if (aggregate == HOUND_AGGREGATE_NONE) {
+        *out_dec = dec;
+        return HOUND_OK;
+    }
+
+    dec->acc = malloc(size);
+    if (dec->acc == NULL) {
+        goto error;
+    }
+    if (aggregate == HOUND_AGGREGATE_MEAN) {
+        dec->sums = malloc(desc->fmt_count * sizeof(*dec->sums));
+        if (dec->sums == NULL) {
+            goto error;
+        }
+    }
+
+    *out_dec = dec;
+
+    return HOUND_OK;
+
+error:
+    free(dec->acc);
+    free(dec);
+    return HOUND_OOM;
+}
+
+bool decimator_matches(
+    const struct decimator *dec,
+    hound_aggregate aggregate,
+    const struct hound_data_filter *filter)
+{
+    const struct hound_data_filter *own;
+
+    XASSERT_NOT_NULL(dec);
+    XASSERT_NOT_NULL(filter);
+
+    own = &dec->filter;
+
+    return dec->aggregate == aggregate &&
+           own->flags == filter->flags &&
+           own->dev_id == filter->dev_id &&
+           own->fmt_index == filter->fmt_index &&
+           own->deadband == filter->deadband &&
+           own->min_interval_ns == filter->min_interval_ns;
+}
+
+void decimator_ref(struct decimator *dec)
+{
+    atomic_ref_inc(&dec->refcount);
+}
+
+void decimator_unref(struct decimator *dec)
+{
+    refcount_val count;
+
+    count = atomic_ref_dec(&dec->refcount);
+    if (count == 1) {
+        free(dec->acc);
+        free(dec->sums);
+        free(dec);
+    }
+}
+
+#define LOAD_AS_DOUBLE(type) \
+    do { \
+        type v; \
+        memcpy(&v, p, sizeof(v)); \
+        return (double) v; \
+    } while (0)
+
+static
+double load_double(hound_type type, const unsigned char *p)
+{
+    switch (type) {
+        case HOUND_TYPE_DOUBLE:
+            LOAD_AS_DOUBLE(double);
+        case HOUND_TYPE_FLOAT:
+            LOAD_AS_DOUBLE(float);
+        case HOUND_TYPE_INT8:
+            LOAD_AS_DOUBLE(int8_t);
+        case HOUND_TYPE_INT16:
+            LOAD_AS_DOUBLE(int16_t);
+        case HOUND_TYPE_INT32:
+            LOAD_AS_DOUBLE(int32_t);
+        case HOUND_TYPE_INT64:
+            LOAD_AS_DOUBLE(int64_t);
+        case HOUND_TYPE_UINT8:
+            LOAD_AS_DOUBLE(uint8_t);
+        case HOUND_TYPE_UINT16:
+            LOAD_AS_DOUBLE(uint16_t);
+        case HOUND_TYPE_UINT32:
+            LOAD_AS_DOUBLE(uint32_t);
+        case HOUND_TYPE_UINT64:
+            LOAD_AS_DOUBLE(uint64_t);
+        case HOUND_TYPE_BOOL:
+        case HOUND_TYPE_BYTES:
+            break;
+    }
+
+    XASSERT_ERROR;
+}
+
+/*
+ * Integer means round to the nearest value. The mean of some values can't be
+ * outside their range, so only rounding error can push a 64-bit mean past the
+ * type's limits, which the clamps catch.
+ */
+#define STORE_FLOAT(type) \
+    do { \
+        type v; \
+        v = (type) mean; \
+        memcpy(p, &v, sizeof(v)); \
+        return; \
+    } while (0)
+
+#define STORE_INT(type, lo, hi) \
+    do { \
+        type v; \
+        mean += (mean < 0) ? -0.5 : 0.5; \
+        if (mean <= (double) (lo)) { \
+            v = (lo); \
+        } \
+        else if (mean >= (double) (hi)) { \
+            v = (hi); \
+        } \
+        else { \
+            v = (type) mean; \
+        } \
+        memcpy(p, &v, sizeof(v)); \
+        return; \
+    } while (0)
+
+static
+void store_mean(hound_type type, double mean, unsigned char *p)
+{
+    switch (type) {
+        case HOUND_TYPE_DOUBLE:
+            STORE_FLOAT(double);
+        case HOUND_TYPE_FLOAT:
+            STORE_FLOAT(float);
+        case HOUND_TYPE_INT8:
+            STORE_INT(int8_t, INT8_MIN, INT8_MAX);
+        case HOUND_TYPE_INT16:
+            STORE_INT(int16_t, INT16_MIN, INT16_MAX);
+        case HOUND_TYPE_INT32:
+            STORE_INT(int32_t, INT32_MIN, INT32_MAX);
+        case HOUND_TYPE_INT64:
+            STORE_INT(int64_t, INT64_MIN, INT64_MAX);
+        case HOUND_TYPE_UINT8:
+            STORE_INT(uint8_t, 0, UINT8_MAX);
+        case HOUND_TYPE_UINT16:
+            STORE_INT(uint16_t, 0, UINT16_MAX);
+        case HOUND_TYPE_UINT32:
+            STORE_INT(uint32_t, 0, UINT32_MAX);
+        case HOUND_TYPE_UINT64:
+            STORE_INT(uint64_t, 0, UINT64_MAX);
+        case HOUND_TYPE_BOOL:
+        case HOUND_TYPE_BYTES:
+            break;
+    }
+
+    XASSERT_ERROR;
+}
+
+/* Keeps the smaller or larger of acc and p in acc, compared as the type. */
+#define KEEP_EXTREME(type) \
+    do { \
+        type a; \
+        type b; \
+        memcpy(&a, acc, sizeof(a)); \
+        memcpy(&b, p, sizeof(b)); \
+        if (keep_max ? b > a : b < a) { \
+            memcpy(acc, &b, sizeof(b)); \
+        } \
+        return; \
+    } while (0)
+
+static
+void keep_extreme(
+    hound_type type,
+    bool keep_max,
+    const unsigned char *p,
+    unsigned char *acc)
+{
+    switch (type) {
+        case HOUND_TYPE_DOUBLE:
+            KEEP_EXTREME(double);
+        case HOUND_TYPE_FLOAT:
+            KEEP_EXTREME(float);
+        case HOUND_TYPE_INT8:
+            KEEP_EXTREME(int8_t);
+        case HOUND_TYPE_INT16:
+            KEEP_EXTREME(int16_t);
+        case HOUND_TYPE_INT32:
+            KEEP_EXTREME(int32_t);
+        case HOUND_TYPE_INT64:
+            KEEP_EXTREME(int64_t);
+        case HOUND_TYPE_UINT8:
+            KEEP_EXTREME(uint8_t);
+        case HOUND_TYPE_UINT16:
+            KEEP_EXTREME(uint16_t);
+        case HOUND_TYPE_UINT32:
+            KEEP_EXTREME(uint32_t);
+        case HOUND_TYPE_UINT64:
+            KEEP_EXTREME(uint64_t);
+        case HOUND_TYPE_BOOL:
+        case HOUND_TYPE_BYTES:
+            break;
+    }
+
+    XASSERT_ERROR;
+}
+
+static
+bool is_numeric(hound_type type)
+{
+    return type != HOUND_TYPE_BOOL && type != HOUND_TYPE_BYTES;
+}
+
+/* Adds a record to the window. Fields that aren't numbers take its value. */
+static
+void accumulate(struct decimator *dec, const unsigned char *data)
+{
+    const struct hound_data_fmt *fmt;
+    size_t i;
+
+    for (i = 0; i < dec->desc->fmt_count; ++i) {
+        fmt = &dec->desc->fmts[i];
+        if (!is_numeric(fmt->type)) {
+            memcpy(dec->acc + fmt->offset, data + fmt->offset, fmt->size);
+            continue;
+        }
+
+        switch (dec->aggregate) {
+            case HOUND_AGGREGATE_MEAN:
+                dec->sums[i] += load_double(fmt->type, data + fmt->offset);
+                break;
+            case HOUND_AGGREGATE_MIN:
+            case HOUND_AGGREGATE_MAX:
+                keep_extreme(
+                    fmt->type,
+                    dec->aggregate == HOUND_AGGREGATE_MAX,
+                    data + fmt->offset,
+                    dec->acc + fmt->offset);
+                break;
+            case HOUND_AGGREGATE_NONE:
+                XASSERT_ERROR;
+        }
+    }
+}
+
+static
+void start_window(
+    struct decimator *dec,
+    size_t stride,
+    const struct hound_record *rec)
+{
+    size_t i;
+
+    dec->window = stride;
+    dec->timestamp = rec->timestamp;
+    memcpy(dec->acc, rec->data, dec->size);
+    if (dec->aggregate == HOUND_AGGREGATE_MEAN) {
+        for (i = 0; i < dec->desc->fmt_count; ++i) {
+            dec->sums[i] = 0;
+        }
+        accumulate(dec, rec->data);
+    }
+}
+
+static
+struct record_info *finish_window(
+    struct decimator *dec,
+    const struct hound_record *rec,
+    struct record_pool *pool)
+{
+    unsigned char *data;
+    const struct hound_data_fmt *fmt;
+    size_t i;
+    struct record_info *out;
+
+    if (dec->aggregate == HOUND_AGGREGATE_MEAN) {
+        for (i = 0; i < dec->desc->fmt_count; ++i) {
+            fmt = &dec->desc->fmts[i];
+            if (is_numeric(fmt->type)) {
+                store_mean(
+                    fmt->type,
+                    dec->sums[i] / dec->window,
+                    dec->acc + fmt->offset);
+            }
+        }
+    }
+
+    out = pool_get(pool, dec->size);
+    if (out == NULL) {
+        hound_log_err(
+            HOUND_OOM,
+            "Failed to aggregate record for data ID 0x%x",
+            rec->data_id);
+        return NULL;
+    }
+
+    data = out->record.data;
+    memcpy(data, dec->acc, dec->size);
+    out->record = *rec;
+    out->record.data = data;
+    out->record.timestamp = dec->timestamp;
+    atomic_ref_init(&out->refcount, 1);
+
+    return out;
+}
+
+static
+struct record_info *decimate(
+    struct decimator *dec,
+    size_t stride,
+    struct record_info *info,
+    struct record_pool *pool)
+{
+    struct record_info *pick;
+    const struct hound_record *rec;
+
+    /* A window that began at another stride starts over. */
+    if (dec->count > 0 && dec->window != stride) {
+        dec->count = 0;
+    }
+
+    if (stride == 1) {
+        return info;
+    }
+
+    rec = &info->record;
+    if (dec->aggregate == HOUND_AGGREGATE_NONE) {
+        dec->window = stride;
+        pick = (dec->count == 0) ? info : NULL;
+        ++dec->count;
+        if (dec->count == stride) {
+            dec->count = 0;
+        }
+        return pick;
+    }
+
+    if (rec->size != dec->size) {
+        /* The fields can't be found in this record, so leave it alone. */
+        return info;
+    }
+
+    if (dec->count == 0) {
+        start_window(dec, stride, rec);
+    }
+    else {
+        accumulate(dec, rec->data);
+    }
+    ++dec->count;
+    if (dec->count < dec->window) {
+        return NULL;
+    }
+    dec->count = 0;
+
+    return finish_window(dec, rec, pool);
+}
+
+/* Checks a record against the filter, and remembers it if it passes. */
+static
+bool filter_passes(struct decimator *dec, const struct hound_record *rec)
+{
+    double diff;
+    const struct hound_data_filter *filter;
+    const struct hound_data_fmt *fmt;
+    int64_t ns;
+    double value;
+
+    filter = &dec->filter;
+    if (filter->flags == 0) {
+        return true;
+    }
+
+    if ((filter->flags & HOUND_FILTER_DEV_ID) &&
+        rec->dev_id != filter->dev_id) {
+        return false;
+    }
+
+    ns = NSEC_PER_SEC*rec->timestamp.tv_sec + rec->timestamp.tv_nsec;
+    if ((filter->flags & HOUND_FILTER_MIN_INTERVAL) &&
+        dec->have_last &&
+        ns - dec->last_ns < (int64_t) filter->min_interval_ns) {
+        return false;
+    }
+
+    value = 0;
+    if (filter->flags & HOUND_FILTER_DEADBAND) {
+        fmt = &dec->desc->fmts[filter->fmt_index];
+        if (rec->size < fmt->offset + fmt->size) {
+            /* A record too short to hold the field can't have moved it. */
+            return false;
+        }
+        value = load_double(fmt->type, rec->data + fmt->offset);
+        if (dec->have_last) {
+            diff = value - dec->last_value;
+            if (diff < 0) {
+                diff = -diff;
+            }
+            if (filter->deadband == 0 ?
+                value == dec->last_value :
+                diff <= filter->deadband) {
+                return false;
+            }
+        }
+    }
+
+    dec->have_last = true;
+    dec->last_value = value;
+    dec->last_ns = ns;
+
+    return true;
+}
+
+struct record_info *decimator_push(
+    struct decimator *dec,
+    size_t stride,
+    struct record_info *info,
+    struct record_pool *pool)
+{
+    struct record_info *pick;
+
+    XASSERT_NOT_NULL(dec);
+    XASSERT_GT(stride, 0);
+    XASSERT_NOT_NULL(info);
+
+    pick = decimate(dec, stride, info, pool);
+    if (pick != NULL && !filter_passes(dec, &pick->record)) {
+        if (pick != info) {
+            /* Nobody else has seen the aggregate, so it goes straight back. */
+            record_ref_dec(pick);
+        }
+        pick = NULL;
+    }
+
+    return pick;
+}
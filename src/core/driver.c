@@ -6,6 +6,7 @@
  */
 
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
 #include <hound/hound.h>
 #include <hound-private/driver.h>
 #include <hound-private/driver-ops.h>
@@ -13,11 +14,16 @@
 #include <hound-private/io.h>
 #include <hound-private/log.h>
 #include <hound-private/parse/schema.h>
+#include <hound-private/pool.h>
+#include <hound-private/refcount.h>
 #include <hound-private/util.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <xlib/xhash.h>
 #include <xlib/xvec.h>
 
@@ -39,11 +45,36 @@ static xhash_t(DATA_MAP) *s_data_map;
 
 XVEC_DEFINE(data_rq_vec, struct hound_data_rq);
 
-/* Forward declaration. */
+/* Forward declarations. */
 hound_err driver_destroy_nolock(const char *path);
+static void driver_destroy_obj(struct driver *drv);
 
 static pthread_rwlock_t s_driver_rwlock = PTHREAD_RWLOCK_INITIALIZER;
 
+/*
+ * An immutable copy of every driver's descriptors. The copy owns all its
+ * memory, so it stays valid after the drivers it describes go away.
+ */
+struct datadesc_snapshot {
+    atomic_refcount_val refcount;
+    struct hound_datadesc_snapshot snapshot;
+};
+
+/*
+ * Bumped whenever a driver is added or removed, with the driver lock held for
+ * writing.
+ */
+static _Atomic uint64_t s_desc_generation = 0;
+
+/*
+ * The snapshot for the current generation, or NULL if nobody has asked for it
+ * yet. This holds a reference of its own.
+ */
+static pthread_mutex_t s_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct datadesc_snapshot *s_snapshot = NULL;
+
+static void release_snapshot(struct datadesc_snapshot *snapshot);
+
 void driver_init_statics(void)
 {
     s_data_map = xh_init(DATA_MAP);
@@ -64,6 +95,11 @@ void driver_destroy_statics(void)
     );
     xh_destroy(DEVICE_MAP, s_device_map);
     xh_destroy(DATA_MAP, s_data_map);
+
+    if (s_snapshot != NULL) {
+        release_snapshot(s_snapshot);
+        s_snapshot = NULL;
+    }
 }
 
 PUBLIC_API
@@ -183,16 +219,192 @@ void driver_free_datadescs(struct hound_datadesc *descs)
     free(descs);
 }
 
-static hound_dev_id s_next_dev_id = 0;
 static
-hound_dev_id next_dev_id(void)
+void release_snapshot(struct datadesc_snapshot *snapshot)
+{
+    if (atomic_ref_dec(&snapshot->refcount) == 1) {
+        free(snapshot);
+    }
+}
+
+/*
+ * Drop the current snapshot, as the set of drivers changed. The caller must
+ * hold the driver lock for writing.
+ */
+static
+void invalidate_snapshot(void)
+{
+    struct datadesc_snapshot *snapshot;
+
+    ++s_desc_generation;
+
+    lock_mutex(&s_snapshot_lock);
+    snapshot = s_snapshot;
+    s_snapshot = NULL;
+    unlock_mutex(&s_snapshot_lock);
+
+    if (snapshot != NULL) {
+        release_snapshot(snapshot);
+    }
+}
+
+static
+void *bump_alloc(unsigned char **pos, size_t size)
+{
+    void *p;
+
+    p = *pos;
+    *pos += size;
+    return p;
+}
+
+static
+const char *copy_str(unsigned char **pos, const char *s)
 {
-    hound_dev_id id;
+    size_t len;
 
-    /* Must be called with the driver lock held. */
-    id = s_next_dev_id;
-    ++s_next_dev_id;
-    return id;
+    len = strlen(s) + 1;
+    return memcpy(bump_alloc(pos, len), s, len);
+}
+
+/*
+ * Deep-copy every driver's descriptors into a single allocation. The caller
+ * must hold the driver lock.
+ */
+static
+hound_err build_snapshot(struct datadesc_snapshot **out)
+{
+    size_t desc_count;
+    struct hound_datadesc *desc;
+    struct hound_datadesc *descs;
+    struct driver *drv;
+    size_t fmt_count;
+    size_t i;
+    size_t j;
+    size_t period_count;
+    unsigned char *pos;
+    const struct hound_datadesc *src;
+    struct datadesc_snapshot *snapshot;
+    size_t str_size;
+
+    desc_count = 0;
+    fmt_count = 0;
+    period_count = 0;
+    str_size = 0;
+    xh_foreach_value(s_device_map, drv,
+        desc_count += drv->desc_count;
+        for (i = 0; i < drv->desc_count; ++i) {
+            src = &drv->descs[i];
+            fmt_count += src->fmt_count;
+            period_count += src->period_count;
+            str_size += strlen(src->name) + 1;
+            for (j = 0; j < src->fmt_count; ++j) {
+                str_size += strlen(src->fmts[j].name) + 1;
+            }
+        }
+    );
+
+    /*
+     * Lay out the arrays in order of decreasing alignment, so each one starts
+     * suitably aligned without any padding.
+     */
+    snapshot = malloc(
+        sizeof(*snapshot) +
+        desc_count*sizeof(*descs) +
+        fmt_count*sizeof(*desc->fmts) +
+        period_count*sizeof(*desc->avail_periods) +
+        str_size);
+    if (snapshot == NULL) {
+        return HOUND_OOM;
+    }
+
+    pos = (unsigned char *) (snapshot + 1);
+    descs = bump_alloc(&pos, desc_count*sizeof(*descs));
+    desc = descs;
+    xh_foreach_value(s_device_map, drv,
+        for (i = 0; i < drv->desc_count; ++i, ++desc) {
+            src = &drv->descs[i];
+            *desc = *src;
+            desc->fmts = bump_alloc(&pos, src->fmt_count*sizeof(*desc->fmts));
+            memcpy(desc->fmts, src->fmts, src->fmt_count*sizeof(*desc->fmts));
+            desc->avail_periods = bump_alloc(
+                &pos,
+                src->period_count*sizeof(*desc->avail_periods));
+            /* Drivers that accept any period have no period list. */
+            if (src->period_count > 0) {
+                memcpy(
+                    desc->avail_periods,
+                    src->avail_periods,
+                    src->period_count*sizeof(*desc->avail_periods));
+            }
+        }
+    );
+
+    /* Strings go last, as they need no alignment. */
+    for (i = 0; i < desc_count; ++i) {
+        desc = &descs[i];
+        desc->name = copy_str(&pos, desc->name);
+        for (j = 0; j < desc->fmt_count; ++j) {
+            desc->fmts[j].name = copy_str(&pos, desc->fmts[j].name);
+        }
+    }
+
+    atomic_ref_init(&snapshot->refcount, 1);
+    snapshot->snapshot.generation = s_desc_generation;
+    snapshot->snapshot.len = desc_count;
+    snapshot->snapshot.descs = descs;
+    *out = snapshot;
+
+    return HOUND_OK;
+}
+
+hound_err driver_acquire_datadescs(
+    const struct hound_datadesc_snapshot **out_snapshot)
+{
+    hound_err err;
+
+    NULL_CHECK(out_snapshot);
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+    lock_mutex(&s_snapshot_lock);
+
+    err = HOUND_OK;
+    if (s_snapshot == NULL) {
+        err = build_snapshot(&s_snapshot);
+    }
+    if (err == HOUND_OK) {
+        atomic_ref_inc(&s_snapshot->refcount);
+        *out_snapshot = &s_snapshot->snapshot;
+    }
+
+    unlock_mutex(&s_snapshot_lock);
+    pthread_rwlock_unlock(&s_driver_rwlock);
+
+    return err;
+}
+
+void driver_release_datadescs(const struct hound_datadesc_snapshot *snapshot)
+{
+    if (snapshot == NULL) {
+        return;
+    }
+
+    release_snapshot((struct datadesc_snapshot *) (
+        (const unsigned char *) snapshot -
+        offsetof(struct datadesc_snapshot, snapshot)));
+}
+
+uint64_t driver_datadesc_generation(void)
+{
+    return s_desc_generation;
+}
+
+static atomic_uint_least8_t s_next_dev_id = 0;
+static
+hound_dev_id next_dev_id(void)
+{
+    /* Drivers initialize without the driver lock, so this must be atomic. */
+    return atomic_fetch_add(&s_next_dev_id, 1);
 }
 
 size_t get_type_size(hound_type type)
@@ -249,6 +461,7 @@ void copy_desc(
      */
     datadesc->period_count = drv_desc->period_count;
     datadesc->avail_periods = drv_desc->avail_periods;
+    datadesc->max_pack = drv_desc->max_pack;
     datadesc->fmt_count = schema_desc->fmt_count;
     datadesc->fmts = schema_desc->fmts;
     drv_desc->avail_periods = NULL;
@@ -263,6 +476,76 @@ void destroy_drv_desc(struct drv_datadesc *desc)
     free(desc->avail_periods);
 }
 
+/*
+ * Add a fully initialized driver to the driver maps, making it visible to
+ * everyone else. The caller must hold the driver lock for writing.
+ */
+static
+hound_err commit_driver(struct driver *drv, const char *path)
+{
+    char *drv_path;
+    hound_err err;
+    size_t i;
+    xhiter_t iter;
+    int ret;
+
+    /*
+     * The driver initialized without the lock, so someone else may have taken
+     * the same path or data in the meantime.
+     */
+    iter = xh_get(DEVICE_MAP, s_device_map, path);
+    if (iter != xh_end(s_device_map)) {
+        return HOUND_DRIVER_ALREADY_PRESENT;
+    }
+
+    /* Verify that multiple drivers don't claim the same data ID. */
+    for (i = 0; i < drv->desc_count; ++i) {
+        iter = xh_get(DATA_MAP, s_data_map, drv->descs[i].data_id);
+        if (iter != xh_end(s_data_map)) {
+            return HOUND_CONFLICTING_DRIVERS;
+        }
+    }
+
+    drv_path = strdup(path);
+    if (drv_path == NULL) {
+        return HOUND_OOM;
+    }
+
+    iter = xh_put(DEVICE_MAP, s_device_map, drv_path, &ret);
+    if (ret == -1) {
+        err = HOUND_OOM;
+        goto error_device_map_put;
+    }
+    xh_val(s_device_map, iter) = drv;
+
+    for (i = 0; i < drv->desc_count; ++i) {
+        iter = xh_put(DATA_MAP, s_data_map, drv->descs[i].data_id, &ret);
+        if (ret == -1) {
+            err = HOUND_OOM;
+            goto error_data_map_put;
+        }
+        xh_val(s_data_map, iter) = drv;
+    }
+
+    invalidate_snapshot();
+
+    return HOUND_OK;
+
+error_data_map_put:
+    for (--i; i < drv->desc_count; --i) {
+        iter = xh_get(DATA_MAP, s_data_map, drv->descs[i].data_id);
+        if (iter != xh_end(s_data_map)) {
+            xh_del(DATA_MAP, s_data_map, iter);
+        }
+    }
+    iter = xh_get(DEVICE_MAP, s_device_map, path);
+    XASSERT_NEQ(iter, xh_end(s_device_map));
+    xh_del(DEVICE_MAP, s_device_map, iter);
+error_device_map_put:
+    free(drv_path);
+    return err;
+}
+
 bool driver_is_pull_mode(const struct driver *drv)
 {
     return drv->ops.poll == drv_default_pull;
@@ -279,6 +562,7 @@ hound_err driver_init(
     const char *path,
     const char *schema_base,
     const char *schema,
+    bool use_schema_cache,
     size_t arg_count,
     const struct hound_init_arg *args)
 {
@@ -286,9 +570,9 @@ hound_err driver_init(
     struct driver *drv;
     struct drv_datadesc *drv_desc;
     struct drv_datadesc *drv_descs;
-    char *drv_path;
     size_t enabled_count;
     hound_err err;
+    hound_err err2;
     struct hound_data_fmt *fmt;
     size_t i;
     size_t j;
@@ -296,7 +580,7 @@ hound_err driver_init(
     size_t next_index;
     size_t offset;
     const struct driver_ops *ops;
-    int ret;
+    bool present;
     struct schema_desc *schema_desc;
     struct schema_desc *schema_descs;
     size_t size;
@@ -321,19 +605,24 @@ hound_err driver_init(
         return HOUND_INVALID_STRING;
     }
 
-    pthread_rwlock_wrlock(&s_driver_rwlock);
-
+    /* Fail early rather than initializing a driver we can't register. */
+    pthread_rwlock_rdlock(&s_driver_rwlock);
     iter = xh_get(DEVICE_MAP, s_device_map, path);
-    if (iter != xh_end(s_device_map)) {
-        err = HOUND_DRIVER_ALREADY_PRESENT;
-        goto out;
+    present = (iter != xh_end(s_device_map));
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    if (present) {
+        return HOUND_DRIVER_ALREADY_PRESENT;
     }
 
-    /* Allocate. */
+    /*
+     * Initializing a driver can be slow, as it may walk sysfs or talk to a
+     * server, so we build the driver without the driver lock and take the lock
+     * only to register it at the end. This lets drivers initialize in
+     * parallel.
+     */
     drv = malloc(sizeof(*drv));
     if (drv == NULL) {
-        err = HOUND_OOM;
-        goto out;
+        return HOUND_OOM;
     }
 
     /* Initialize driver fields. */
@@ -341,10 +630,22 @@ hound_err driver_init(
     init_mutex(&drv->op_lock);
     drv->refcount = 0;
     drv->fd = FD_INVALID;
+    drv->fdctx = NULL;
+    drv->io_shard = -1;
+    drv->read_budget = DRV_READ_BUDGET_DEFAULT;
+    drv->read_msg_size = 0;
+    drv->read_msg_stamps = false;
+    driver_stats_init(&drv->stats);
     xv_init(drv->active_data);
     drv->ops = *ops;
     drv->id = next_dev_id();
     drv->ctx = NULL;
+    drv->pool = NULL;
+    drv->schema_cache.map = NULL;
+    drv->schema_cache.size = 0;
+    drv->next_counts = NULL;
+    drv->next_ids = NULL;
+    atomic_init(&drv->next_pending, false);
 
     /* Init. */
     err = drv_op_init(drv, path, arg_count, args);
@@ -364,7 +665,13 @@ hound_err driver_init(
         goto error_device_name;
     }
 
-    err = schema_parse(schema_base, schema, &desc_count, &schema_descs);
+    err = schema_parse(
+        schema_base,
+        schema,
+        use_schema_cache,
+        &drv->schema_cache,
+        &desc_count,
+        &schema_descs);
     if (err != HOUND_OK) {
         goto error_schema_parse;
     }
@@ -386,6 +693,7 @@ hound_err driver_init(
                  * or else the caller won't be able to parse its records.
                  */
                 XASSERT_FALSE(fmt->size == 0 && j != schema_desc->fmt_count-1);
+                offset += fmt->size;
             }
             else {
                 /*
@@ -416,6 +724,7 @@ hound_err driver_init(
         drv_desc->enabled = false;
         drv_desc->period_count = 0;
         drv_desc->avail_periods = NULL;
+        drv_desc->max_pack = 1;
         drv_desc->schema_desc = &schema_descs[i];
     }
 
@@ -427,24 +736,13 @@ hound_err driver_init(
 
     /*
      * Count the number of enabled descriptors so we can allocate a data
-     * descriptor array. While we're looping through the descriptors, validate
-     * that the driver gave us sane data.
+     * descriptor array.
      */
     enabled_count = 0;
     for (i = 0; i < desc_count; ++i) {
-        drv_desc = &drv_descs[i];
-        if (!drv_desc->enabled) {
-            continue;
-        }
-        ++enabled_count;
-
-        /* Verify that multiple drivers don't claim the same data ID. */
-        iter = xh_get(DATA_MAP, s_data_map, drv_desc->schema_desc->data_id);
-        if (iter != xh_end(s_data_map)) {
-            err = HOUND_CONFLICTING_DRIVERS;
-            goto error_drv_datadesc;
+        if (drv_descs[i].enabled) {
+            ++enabled_count;
         }
-
     }
     if (enabled_count == 0) {
         err = HOUND_NO_DESCS_ENABLED;
@@ -468,48 +766,48 @@ hound_err driver_init(
         ++next_index;
     }
 
-    for (i = 0; i < desc_count; ++i) {
-        destroy_drv_desc(&drv_descs[i]);
-        destroy_schema_desc(&schema_descs[i]);
+    /* Make a record pool sized for the data this driver produces. */
+    err = pool_alloc(&drv->pool, drv->desc_count, drv->descs);
+    if (err != HOUND_OK) {
+        goto error_pool_alloc;
     }
-    free(drv_descs);
-    free(schema_descs);
 
-    /*
-     * Finally, commit the driver into all the maps.
-     */
-    drv_path = strdup(path);
-    if (drv_path == NULL) {
+    drv->next_counts = malloc(drv->desc_count * sizeof(*drv->next_counts));
+    if (drv->next_counts == NULL) {
         err = HOUND_OOM;
-        goto error_alloc_drv_path;
+        goto error_alloc_next_counts;
+    }
+    for (i = 0; i < drv->desc_count; ++i) {
+        atomic_init(&drv->next_counts[i], 0);
     }
 
-    iter = xh_put(DEVICE_MAP, s_device_map, drv_path, &ret);
-    if (ret == -1) {
+    drv->next_ids = malloc(drv->desc_count * sizeof(*drv->next_ids));
+    if (drv->next_ids == NULL) {
         err = HOUND_OOM;
-        goto error_device_map_put;
+        goto error_alloc_next_ids;
     }
-    xh_val(s_device_map, iter) = drv;
 
-    for (i = 0; i < drv->desc_count; ++i ) {
-        iter = xh_put(DATA_MAP, s_data_map, drv->descs[i].data_id, &ret);
-        if (ret == -1) {
-            err = HOUND_OOM;
-            goto error_data_map_put;
-        }
-        xh_val(s_data_map, iter) = drv;
+    for (i = 0; i < desc_count; ++i) {
+        destroy_drv_desc(&drv_descs[i]);
     }
+    free(drv_descs);
+    destroy_schema_descs(&drv->schema_cache, desc_count, schema_descs);
 
-    err = HOUND_OK;
-    goto out;
+    /* Finally, commit the driver into all the maps. */
+    pthread_rwlock_wrlock(&s_driver_rwlock);
+    err = commit_driver(drv, path);
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    if (err != HOUND_OK) {
+        driver_destroy_obj(drv);
+    }
 
-error_data_map_put:
-    iter = xh_get(DEVICE_MAP, s_device_map, path);
-    XASSERT_NEQ(iter, xh_end(s_device_map));
-    xh_del(DEVICE_MAP, s_device_map, iter);
-error_device_map_put:
-    free(drv_path);
-error_alloc_drv_path:
+    return err;
+
+error_alloc_next_ids:
+    free(drv->next_counts);
+error_alloc_next_counts:
+    pool_destroy(drv->pool);
+error_pool_alloc:
     free(drv->descs);
 error_drv_datadesc:
     for (i = 0; i < desc_count; ++i) {
@@ -517,29 +815,31 @@ error_drv_datadesc:
     }
     free(drv_descs);
 error_alloc_drv_descs:
-    for (i = 0; i < desc_count; ++i) {
-        destroy_schema_desc(&schema_descs[i]);
-    }
-    free(schema_descs);
+    destroy_schema_descs(&drv->schema_cache, desc_count, schema_descs);
+    schema_cache_unmap(&drv->schema_cache);
 error_schema_parse:
 error_device_name:
-    err = drv_op_destroy(drv);
-    if (err != HOUND_OK) {
-        hound_log_err(err, "driver %p failed to destroy", (void *) drv);
+    err2 = drv_op_destroy(drv);
+    if (err2 != HOUND_OK) {
+        hound_log_err(err2, "driver %p failed to destroy", (void *) drv);
     }
 error_init:
+    destroy_mutex(&drv->state_lock);
+    destroy_mutex(&drv->op_lock);
     free(drv);
-out:
-    pthread_rwlock_unlock(&s_driver_rwlock);
     return err;
 }
 
 static
-void drv_destroy_desc(struct hound_datadesc *desc)
+void drv_destroy_desc(const struct driver *drv, struct hound_datadesc *desc)
 {
-    drv_free((void *) desc->name);
     drv_free((void *) desc->avail_periods);
-    destroy_desc_fmts(desc->fmt_count, desc->fmts);
+
+    /* Names and formats from a schema cache live in its mapping. */
+    if (drv->schema_cache.map == NULL) {
+        drv_free((void *) desc->name);
+        destroy_desc_fmts(desc->fmt_count, desc->fmts);
+    }
 }
 
 static
@@ -580,6 +880,7 @@ hound_err driver_remove_from_maps(const char *path, struct driver **out_drv)
     );
 
     free((char *) drv_path);
+    invalidate_snapshot();
 
     *out_drv = drv;
 
@@ -600,9 +901,15 @@ void driver_destroy_obj(struct driver *drv)
 
     /* Free the driver-allocated data descriptor. */
     for (i = 0; i < drv->desc_count; ++i) {
-        drv_destroy_desc(&drv->descs[i]);
+        drv_destroy_desc(drv, &drv->descs[i]);
     }
     free(drv->descs);
+    schema_cache_unmap(&drv->schema_cache);
+
+    /* Records still sitting in user queues keep the pool alive. */
+    pool_destroy(drv->pool);
+    free(drv->next_counts);
+    free(drv->next_ids);
 
     destroy_mutex(&drv->state_lock);
     destroy_mutex(&drv->op_lock);
@@ -624,6 +931,278 @@ hound_err driver_destroy_nolock(const char *path)
     return HOUND_OK;
 }
 
+hound_err driver_set_io_shard(const char *path, int shard, int cpu)
+{
+    struct driver *drv;
+    hound_err err;
+    xhiter_t iter;
+
+    if (shard >= (int) io_shard_count()) {
+        return HOUND_INVALID_VAL;
+    }
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    iter = xh_get(DEVICE_MAP, s_device_map, path);
+    if (iter == xh_end(s_device_map)) {
+        err = HOUND_DRIVER_NOT_REGISTERED;
+        goto out;
+    }
+    drv = xh_val(s_device_map, iter);
+
+    /* The shard is picked when the driver's fd is added to the poll loop. */
+    lock_mutex(&drv->state_lock);
+    if (drv->fdctx != NULL) {
+        err = HOUND_DRIVER_IN_USE;
+    }
+    else {
+        if (shard >= 0) {
+            drv->io_shard = shard;
+        }
+        err = HOUND_OK;
+    }
+    unlock_mutex(&drv->state_lock);
+    if (err != HOUND_OK || cpu < 0) {
+        goto out;
+    }
+
+    err = io_set_shard_cpus(io_driver_shard(drv), &cpu, 1);
+
+out:
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+/*
+ * Find the range of I/O shards that a setting for the given driver applies to:
+ * just the driver's shard, or every shard if path is NULL. The caller must hold
+ * s_driver_rwlock.
+ */
+static
+hound_err get_io_shards(const char *path, size_t *begin, size_t *end)
+{
+    xhiter_t iter;
+
+    if (path == NULL) {
+        *begin = 0;
+        *end = io_shard_count();
+        return HOUND_OK;
+    }
+
+    iter = xh_get(DEVICE_MAP, s_device_map, path);
+    if (iter == xh_end(s_device_map)) {
+        return HOUND_DRIVER_NOT_REGISTERED;
+    }
+    *begin = io_driver_shard(xh_val(s_device_map, iter));
+    *end = *begin + 1;
+
+    return HOUND_OK;
+}
+
+hound_err driver_set_io_sched(
+    const char *path,
+    hound_sched_policy policy,
+    int priority)
+{
+    size_t begin;
+    size_t end;
+    hound_err err;
+    size_t shard;
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    err = get_io_shards(path, &begin, &end);
+    for (shard = begin; err == HOUND_OK && shard < end; ++shard) {
+        err = io_set_shard_sched(shard, policy, priority);
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+hound_err driver_set_io_cpus(
+    const char *path,
+    const int *cpus,
+    size_t cpu_count)
+{
+    size_t begin;
+    size_t end;
+    hound_err err;
+    size_t shard;
+
+    NULL_CHECK(cpus);
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    err = get_io_shards(path, &begin, &end);
+    for (shard = begin; err == HOUND_OK && shard < end; ++shard) {
+        err = io_set_shard_cpus(shard, cpus, cpu_count);
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+hound_err driver_set_io_busy_poll(const char *path, uint64_t busy_ns)
+{
+    size_t begin;
+    size_t end;
+    hound_err err;
+    size_t shard;
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    err = get_io_shards(path, &begin, &end);
+    for (shard = begin; err == HOUND_OK && shard < end; ++shard) {
+        err = io_set_shard_busy_poll(shard, busy_ns);
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+hound_err driver_get_io_latency(
+    const char *path,
+    struct hound_io_latency *stats)
+{
+    size_t begin;
+    size_t end;
+    hound_err err;
+    size_t shard;
+    struct hound_io_latency shard_stats;
+
+    NULL_CHECK(stats);
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    memset(stats, 0, sizeof(*stats));
+    err = get_io_shards(path, &begin, &end);
+    for (shard = begin; err == HOUND_OK && shard < end; ++shard) {
+        io_get_shard_latency(shard, &shard_stats);
+        stats->blocking_wakeups += shard_stats.blocking_wakeups;
+        stats->busy_wakeups += shard_stats.busy_wakeups;
+        stats->timer_fires += shard_stats.timer_fires;
+        stats->timer_late_total_ns += shard_stats.timer_late_total_ns;
+        stats->timer_late_max_ns = max(
+            stats->timer_late_max_ns,
+            shard_stats.timer_late_max_ns);
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+hound_err driver_get_io_stats(const char *path, struct hound_io_stats *stats)
+{
+    size_t begin;
+    size_t end;
+    hound_err err;
+    size_t shard;
+    struct hound_io_stats shard_stats;
+
+    NULL_CHECK(stats);
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    memset(stats, 0, sizeof(*stats));
+    err = get_io_shards(path, &begin, &end);
+    for (shard = begin; err == HOUND_OK && shard < end; ++shard) {
+        io_get_shard_stats(shard, &shard_stats);
+        stats->iterations += shard_stats.iterations;
+        stats_histogram_merge(
+            &stats->sync_stall_ns,
+            &shard_stats.sync_stall_ns);
+        stats_histogram_merge(
+            &stats->wakeup_jitter_ns,
+            &shard_stats.wakeup_jitter_ns);
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+hound_err driver_get_stats(const char *path, struct hound_driver_stats *stats)
+{
+    struct driver *drv;
+    hound_err err;
+    xhiter_t iter;
+
+    NULL_CHECK(path);
+    NULL_CHECK(stats);
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    iter = xh_get(DEVICE_MAP, s_device_map, path);
+    if (iter == xh_end(s_device_map)) {
+        err = HOUND_DRIVER_NOT_REGISTERED;
+        goto out;
+    }
+    drv = xh_val(s_device_map, iter);
+    driver_stats_read(&drv->stats, stats);
+    err = HOUND_OK;
+
+out:
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
+static
+hound_err prefault_driver(struct driver *drv, size_t records)
+{
+    hound_err err;
+
+    /* Pools are filled only from driver callbacks, under the op lock. */
+    lock_mutex(&drv->op_lock);
+    err = pool_prefault(drv->pool, drv->desc_count, drv->descs, records);
+    unlock_mutex(&drv->op_lock);
+
+    return err;
+}
+
+hound_err driver_lock_memory(const char *path, size_t records)
+{
+    struct driver *drv;
+    hound_err err;
+    xhiter_t iter;
+    int ret;
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    drv = NULL;
+    if (path != NULL) {
+        iter = xh_get(DEVICE_MAP, s_device_map, path);
+        if (iter == xh_end(s_device_map)) {
+            err = HOUND_DRIVER_NOT_REGISTERED;
+            goto out;
+        }
+        drv = xh_val(s_device_map, iter);
+    }
+
+    /* Lock first, so the records we're about to allocate are locked too. */
+    ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (ret != 0) {
+        err = errno;
+        goto out;
+    }
+
+    if (drv != NULL) {
+        err = prefault_driver(drv, records);
+    }
+    else {
+        err = HOUND_OK;
+        xh_foreach_value(s_device_map, drv,
+            err = prefault_driver(drv, records);
+            if (err != HOUND_OK) {
+                break;
+            }
+        );
+    }
+
+out:
+    pthread_rwlock_unlock(&s_driver_rwlock);
+    return err;
+}
+
 hound_err driver_destroy(const char *path)
 {
     struct driver *drv;
@@ -676,7 +1255,9 @@ size_t get_active_data_index(
     for (i = 0; i < xv_size(drv->active_data); ++i) {
         data = &xv_A(drv->active_data, i);
         if (data->rq.id == drv_data->id &&
-            data->rq.period_ns == drv_data->period_ns) {
+            data->rq.period_ns == drv_data->period_ns &&
+            data->rq.pack == drv_data->pack &&
+            data->rq.latency_ns == drv_data->latency_ns) {
             *found = true;
             return i;
         }
@@ -727,24 +1308,47 @@ hound_err push_drv_data(struct driver *drv, const struct hound_data_rq *rq)
 }
 
 
-hound_err driver_next(struct driver *drv, hound_data_id id, size_t n)
+hound_err driver_next(
+    struct driver *drv,
+    const hound_data_id *ids,
+    size_t count,
+    size_t n)
 {
     hound_err err;
     size_t i;
+    size_t j;
 
     XASSERT_NOT_NULL(drv);
 
+    if (count == 0 || n == 0) {
+        return HOUND_OK;
+    }
+
+    /*
+     * A running driver takes its requests from its poll thread, so we don't
+     * have to wait behind whatever callback it's in.
+     */
+    if (io_next(drv, ids, count, n)) {
+        return HOUND_OK;
+    }
+
     lock_mutex(&drv->state_lock);
-    for (i = 0; i < n; ++i) {
-        err = drv_op_next(drv, id);
-        if (err != HOUND_OK) {
-            goto out;
+    if (drv->ops.next_batch != NULL) {
+        err = drv_op_next_batch(drv, ids, count, n);
+        goto out;
+    }
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < n; ++j) {
+            err = drv_op_next(drv, ids[i]);
+            if (err != HOUND_OK) {
+                goto out;
+            }
         }
     }
-    unlock_mutex(&drv->state_lock);
     err = HOUND_OK;
 
 out:
+    unlock_mutex(&drv->state_lock);
     return err;
 }
 
@@ -818,12 +1422,45 @@ bool unref_data_list(
     return changed;
 }
 
+/* Returns the fastest foldable period requested for a data ID, or 0. */
+static
+hound_data_period get_base_period(
+    const active_data_vec *active_data,
+    hound_data_id id)
+{
+    hound_data_period base;
+    size_t i;
+    const struct hound_data_rq *rq;
+
+    base = 0;
+    for (i = 0; i < xv_size(*active_data); ++i) {
+        rq = &xv_A(*active_data, i).rq;
+        if (rq->id == id &&
+            driver_rq_foldable(rq) &&
+            (base == 0 || rq->period_ns < base)) {
+            base = rq->period_ns;
+        }
+    }
+
+    return base;
+}
+
+/*
+ * Makes the request list to give the driver. Foldable requests for a data ID
+ * whose periods are whole multiples of the fastest one become a single request
+ * at the fastest period, with the lowest latency any of them asked for; the
+ * I/O layer decimates that stream for the slower ones. That way, a slow
+ * context never makes the driver produce the same data at a second rate.
+ */
 static
 hound_err make_active_data_vec(
     const active_data_vec *active_data,
     data_rq_vec *rq_vec)
 {
+    const struct hound_data_rq *active;
+    hound_data_period base;
     size_t i;
+    size_t j;
     struct hound_data_rq *rq;
 
     /* Preallocate space for the request vector. */
@@ -833,6 +1470,27 @@ hound_err make_active_data_vec(
     }
 
     for (i = 0; i < xv_size(*active_data); ++i) {
+        active = &xv_A(*active_data, i).rq;
+
+        if (driver_rq_foldable(active)) {
+            base = get_base_period(active_data, active->id);
+            if (active->period_ns % base == 0) {
+                /* Fold into the request we already made for the base period. */
+                for (j = 0; j < xv_size(*rq_vec); ++j) {
+                    rq = &xv_A(*rq_vec, j);
+                    if (rq->id == active->id &&
+                        driver_rq_foldable(rq) &&
+                        rq->period_ns == base) {
+                        break;
+                    }
+                }
+                if (j < xv_size(*rq_vec)) {
+                    rq->latency_ns = min(rq->latency_ns, active->latency_ns);
+                    continue;
+                }
+            }
+        }
+
         rq = xv_pushp(struct hound_data_rq, *rq_vec);
         /*
          * This shouldn't fail because we already preallocated space for the
@@ -840,7 +1498,13 @@ hound_err make_active_data_vec(
          */
         XASSERT_NOT_NULL(rq);
 
-        *rq = xv_A(*active_data, i).rq;
+        *rq = *active;
+        if (driver_rq_foldable(active)) {
+            base = get_base_period(active_data, active->id);
+            if (active->period_ns % base == 0) {
+                rq->period_ns = base;
+            }
+        }
     }
 
     return HOUND_OK;
@@ -1066,21 +1730,26 @@ hound_err driver_modify(
         goto error_unref;
     }
 
-    if (changed) {
-        if (drv->refcount > 0) {
-            /* Tell the I/O layer to expect different data. */
-            err = io_modify_queue(
-                drv->fd,
-                old_rqs,
-                old_rqs_len,
-                new_rqs,
-                new_rqs_len,
-                queue);
-            if (err != HOUND_OK) {
-                goto error_modify_queue;
-            }
+    /*
+     * The driver's active data doesn't track filters or aggregation, since
+     * they don't change what the driver makes, so a change to only those
+     * leaves changed false. The queue's entries still have to be rebuilt for
+     * them, so always tell the I/O layer.
+     */
+    if (drv->refcount > 0) {
+        err = io_modify_queue(
+            drv->fd,
+            old_rqs,
+            old_rqs_len,
+            new_rqs,
+            new_rqs_len,
+            queue);
+        if (err != HOUND_OK) {
+            goto error_modify_queue;
         }
+    }
 
+    if (changed) {
         /* Tell the driver to generate different data. */
         err = set_driver_data(drv);
         if (err != HOUND_OK) {
@@ -1092,18 +1761,20 @@ hound_err driver_modify(
     goto out;
 
 error_setdata:
-    tmp = io_modify_queue(
-        drv->fd,
-        new_rqs,
-        new_rqs_len,
-        old_rqs,
-        old_rqs_len,
-        queue);
-    if (tmp != HOUND_OK) {
-        hound_log_err(
-            tmp,
-            "failed to restore queue for driver %p during cleanup",
-            (void *) drv);
+    if (drv->refcount > 0) {
+        tmp = io_modify_queue(
+            drv->fd,
+            new_rqs,
+            new_rqs_len,
+            old_rqs,
+            old_rqs_len,
+            queue);
+        if (tmp != HOUND_OK) {
+            hound_log_err(
+                tmp,
+                "failed to restore queue for driver %p during cleanup",
+                (void *) drv);
+        }
     }
 error_modify_queue:
     tmp = ref_data_list(drv, old_rqs, old_rqs_len, NULL);
@@ -1163,3 +1834,131 @@ out:
     pthread_rwlock_unlock(&s_driver_rwlock);
     return found;
 }
+
+bool driver_pack_supported(struct driver *drv, hound_data_id id, size_t pack)
+{
+    const struct hound_datadesc *desc;
+    bool supported;
+    size_t i;
+
+    XASSERT_NOT_NULL(drv);
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    supported = false;
+    for (i = 0; i < drv->desc_count; ++i) {
+        desc = &drv->descs[i];
+        if (desc->data_id == id) {
+            supported = (pack <= desc->max_pack);
+            break;
+        }
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+
+    return supported;
+}
+
+bool driver_aggregate_supported(
+    struct driver *drv,
+    const struct hound_data_rq *rq)
+{
+    const struct hound_datadesc *desc;
+    size_t i;
+    size_t j;
+    bool supported;
+
+    XASSERT_NOT_NULL(drv);
+    XASSERT_NOT_NULL(rq);
+
+    switch (rq->aggregate) {
+        case HOUND_AGGREGATE_NONE:
+            return true;
+        case HOUND_AGGREGATE_MEAN:
+        case HOUND_AGGREGATE_MIN:
+        case HOUND_AGGREGATE_MAX:
+            break;
+        default:
+            return false;
+    }
+
+    /* As with deadbands, a packed record's fields aren't where we'd look. */
+    if (rq->pack > 1) {
+        return false;
+    }
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    /* Only fixed-size records can be aggregated field by field. */
+    supported = false;
+    for (i = 0; i < drv->desc_count; ++i) {
+        desc = &drv->descs[i];
+        if (desc->data_id != rq->id) {
+            continue;
+        }
+        supported = true;
+        for (j = 0; j < desc->fmt_count; ++j) {
+            if (desc->fmts[j].size == 0) {
+                supported = false;
+                break;
+            }
+        }
+        break;
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+
+    return supported;
+}
+
+bool driver_filter_supported(
+    struct driver *drv,
+    const struct hound_data_rq *rq)
+{
+    const struct hound_datadesc *desc;
+    const struct hound_data_filter *filter;
+    const struct hound_data_fmt *fmt;
+    size_t i;
+    bool supported;
+
+    XASSERT_NOT_NULL(drv);
+    XASSERT_NOT_NULL(rq);
+
+    filter = &rq->filter;
+    if ((filter->flags & ~(uint32_t) (
+            HOUND_FILTER_DEV_ID |
+            HOUND_FILTER_DEADBAND |
+            HOUND_FILTER_MIN_INTERVAL)) != 0) {
+        return false;
+    }
+    if (!(filter->flags & HOUND_FILTER_DEADBAND)) {
+        return true;
+    }
+
+    /* A packed record's fields aren't at the descriptor's offsets. */
+    if (rq->pack > 1 || !(filter->deadband >= 0)) {
+        return false;
+    }
+
+    pthread_rwlock_rdlock(&s_driver_rwlock);
+
+    supported = false;
+    for (i = 0; i < drv->desc_count; ++i) {
+        desc = &drv->descs[i];
+        if (desc->data_id != rq->id) {
+            continue;
+        }
+        if (filter->fmt_index < desc->fmt_count) {
+            fmt = &desc->fmts[filter->fmt_index];
+            supported =
+                fmt->size > 0 &&
+                fmt->type != HOUND_TYPE_BOOL &&
+                fmt->type != HOUND_TYPE_BYTES;
+        }
+        break;
+    }
+
+    pthread_rwlock_unlock(&s_driver_rwlock);
+
+    return supported;
+}
@@ -78,6 +78,23 @@ const char *error_strerror(hound_err err)
             return "driver didn't enabled any data descriptors";
         case HOUND_PATH_TOO_LONG:
             return "path is longer than PATH_MAX";
+        case HOUND_INVALID_QUEUE_TYPE:
+            return "queue type is invalid or differs from the context's queue "
+                   "type";
+        case HOUND_INVALID_OVERFLOW_POLICY:
+            return "overflow policy is invalid, or queue_max_len is less than "
+                   "queue_len";
+        case HOUND_PACK_UNSUPPORTED:
+            return "the driver can't pack that many samples into a record";
+        case HOUND_RECORD_LOG_ACTIVE:
+            return "context is already logging its records";
+        case HOUND_AGGREGATE_UNSUPPORTED:
+            return "the data can't be aggregated that way";
+        case HOUND_INVALID_FILTER:
+            return "filter flags or field are invalid for this data";
+        case HOUND_MULTICAST_UNSUPPORTED:
+            return "multicast data must come from one driver, with at most 64 "
+                   "contexts per driver";
     }
 
     /*
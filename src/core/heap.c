@@ -0,0 +1,174 @@
+/**
+ * @file      heap.c
+ * @brief     Timer min-heap, keyed by absolute deadline. Each timer remembers
+ *            its position in the heap, so a timer can be moved or removed in
+ *            O(log n) without searching for it. The heap only stores pointers,
+ *            and it allocates only when it grows, so rescheduling a timer that
+ *            is already in the heap can't fail.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound-private/error.h>
+#include <hound-private/heap.h>
+#include <hound-private/util.h>
+
+#define PARENT(i) (((i) - 1) / 2)
+#define LEFT(i) (2*(i) + 1)
+
+static
+void place(struct timer_heap *heap, struct heap_timer *timer, size_t index)
+{
+    xv_A(heap->timers, index) = timer;
+    timer->index = index;
+}
+
+static
+void sift_up(struct timer_heap *heap, struct heap_timer *timer)
+{
+    size_t index;
+    struct heap_timer *parent;
+
+    index = timer->index;
+    while (index > 0) {
+        parent = xv_A(heap->timers, PARENT(index));
+        if (parent->deadline <= timer->deadline) {
+            break;
+        }
+        place(heap, parent, index);
+        index = PARENT(index);
+    }
+    place(heap, timer, index);
+}
+
+static
+void sift_down(struct timer_heap *heap, struct heap_timer *timer)
+{
+    struct heap_timer *child;
+    size_t index;
+    size_t left;
+    size_t size;
+
+    index = timer->index;
+    size = xv_size(heap->timers);
+    while (true) {
+        left = LEFT(index);
+        if (left >= size) {
+            break;
+        }
+
+        /* Pick the earlier of the two children. */
+        child = xv_A(heap->timers, left);
+        if (left + 1 < size &&
+            xv_A(heap->timers, left + 1)->deadline < child->deadline) {
+            child = xv_A(heap->timers, left + 1);
+        }
+        if (timer->deadline <= child->deadline) {
+            break;
+        }
+
+        index = child->index;
+        place(heap, child, PARENT(index));
+    }
+    place(heap, timer, index);
+}
+
+void timer_init(struct heap_timer *timer)
+{
+    timer->deadline = 0;
+    timer->index = TIMER_IDLE;
+}
+
+bool timer_pending(const struct heap_timer *timer)
+{
+    return timer->index != TIMER_IDLE;
+}
+
+void timer_heap_init(struct timer_heap *heap)
+{
+    xv_init(heap->timers);
+}
+
+void timer_heap_destroy(struct timer_heap *heap)
+{
+    xv_destroy(heap->timers);
+}
+
+/**
+ * Empty the heap without touching any of its timers, which may no longer
+ * exist. The caller must timer_init any timer it wants to add back.
+ */
+void timer_heap_reset(struct timer_heap *heap)
+{
+    xv_size(heap->timers) = 0;
+}
+
+/**
+ * Set a timer's deadline, adding it to the heap if it isn't already there.
+ * This fails only when adding a timer requires the heap to grow.
+ */
+hound_err timer_heap_set(
+    struct timer_heap *heap,
+    struct heap_timer *timer,
+    hound_data_period deadline)
+{
+    struct heap_timer **slot;
+
+    if (!timer_pending(timer)) {
+        slot = xv_pushp(struct heap_timer *, heap->timers);
+        if (slot == NULL) {
+            return HOUND_OOM;
+        }
+        timer->deadline = deadline;
+        timer->index = xv_size(heap->timers) - 1;
+        sift_up(heap, timer);
+        return HOUND_OK;
+    }
+
+    if (deadline < timer->deadline) {
+        timer->deadline = deadline;
+        sift_up(heap, timer);
+    }
+    else {
+        timer->deadline = deadline;
+        sift_down(heap, timer);
+    }
+
+    return HOUND_OK;
+}
+
+void timer_heap_remove(struct timer_heap *heap, struct heap_timer *timer)
+{
+    size_t index;
+    struct heap_timer *last;
+
+    XASSERT(timer_pending(timer));
+    index = timer->index;
+    XASSERT_EQ(xv_A(heap->timers, index), timer);
+    timer->index = TIMER_IDLE;
+
+    last = xv_pop(heap->timers);
+    if (last == timer) {
+        return;
+    }
+
+    /* Fill the hole with the last timer, which may need to go either way. */
+    last->index = index;
+    xv_A(heap->timers, index) = last;
+    if (index > 0 &&
+        xv_A(heap->timers, PARENT(index))->deadline > last->deadline) {
+        sift_up(heap, last);
+    }
+    else {
+        sift_down(heap, last);
+    }
+}
+
+struct heap_timer *timer_heap_peek(const struct timer_heap *heap)
+{
+    if (xv_size(heap->timers) == 0) {
+        return NULL;
+    }
+
+    return xv_A(heap->timers, 0);
+}
@@ -12,6 +12,7 @@
 #include <hound-private/log.h>
 #include <hound-private/parse/config.h>
 #include <hound-private/parse/schema.h>
+#include <hound-private/shm.h>
 #include <hound-private/util.h>
 
 PUBLIC_API
@@ -32,6 +33,25 @@ void hound_free_datadescs(struct hound_datadesc *descs)
     driver_free_datadescs(descs);
 }
 
+PUBLIC_API
+hound_err hound_acquire_datadescs(
+    const struct hound_datadesc_snapshot **snapshot)
+{
+    return driver_acquire_datadescs(snapshot);
+}
+
+PUBLIC_API
+void hound_release_datadescs(const struct hound_datadesc_snapshot *snapshot)
+{
+    driver_release_datadescs(snapshot);
+}
+
+PUBLIC_API
+uint64_t hound_datadesc_generation(void)
+{
+    return driver_datadesc_generation();
+}
+
 PUBLIC_API
 hound_err hound_alloc_ctx(const struct hound_rq *rq, struct hound_ctx **ctx)
 {
@@ -77,6 +97,16 @@ hound_err hound_read(struct hound_ctx *ctx, size_t records, size_t *read)
     return ctx_read(ctx, records, read);
 }
 
+PUBLIC_API
+hound_err hound_read_timeout(
+    struct hound_ctx *ctx,
+    size_t records,
+    hound_data_period timeout_ns,
+    size_t *read)
+{
+    return ctx_read_timeout(ctx, records, timeout_ns, read);
+}
+
 PUBLIC_API
 hound_err hound_read_nowait(
     struct hound_ctx *ctx,
@@ -86,6 +116,16 @@ hound_err hound_read_nowait(
     return ctx_read_nowait(ctx, records, read);
 }
 
+PUBLIC_API
+hound_err hound_read_bytes(
+    struct hound_ctx *ctx,
+    size_t bytes,
+    size_t *records_read,
+    size_t *bytes_read)
+{
+    return ctx_read_bytes(ctx, bytes, records_read, bytes_read);
+}
+
 PUBLIC_API
 hound_err hound_read_bytes_nowait(
     struct hound_ctx *ctx,
@@ -102,6 +142,76 @@ hound_err hound_read_all_nowait(struct hound_ctx *ctx, size_t *read)
     return ctx_read_all_nowait(ctx, read);
 }
 
+PUBLIC_API
+hound_err hound_read_batch(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read)
+{
+    return ctx_read_batch(ctx, records, recs, first_seqno, read);
+}
+
+PUBLIC_API
+hound_err hound_read_batch_nowait(
+    struct hound_ctx *ctx,
+    size_t records,
+    const struct hound_record **recs,
+    hound_seqno *first_seqno,
+    size_t *read)
+{
+    return ctx_read_batch_nowait(ctx, records, recs, first_seqno, read);
+}
+
+PUBLIC_API
+hound_err hound_release_batch(const struct hound_record **recs, size_t count)
+{
+    return ctx_release_batch(recs, count);
+}
+
+PUBLIC_API
+hound_err hound_read_columns(
+    struct hound_ctx *ctx,
+    hound_data_id data_id,
+    size_t records,
+    int64_t *timestamps,
+    void *const *columns,
+    size_t *read)
+{
+    return ctx_read_columns(ctx, data_id, records, timestamps, columns, read);
+}
+
+PUBLIC_API
+hound_err hound_start_record_log(struct hound_ctx *ctx, const char *path)
+{
+    return ctx_start_record_log(ctx, path);
+}
+
+PUBLIC_API
+hound_err hound_stop_record_log(struct hound_ctx *ctx)
+{
+    return ctx_stop_record_log(ctx);
+}
+
+PUBLIC_API
+hound_err hound_ctx_get_fd(struct hound_ctx *ctx, int *fd)
+{
+    return ctx_get_fd(ctx, fd);
+}
+
+PUBLIC_API
+hound_err hound_ctx_set_fd_watermark(struct hound_ctx *ctx, size_t records)
+{
+    return ctx_set_fd_watermark(ctx, records);
+}
+
+PUBLIC_API
+hound_err hound_ctx_set_callback_threads(struct hound_ctx *ctx, size_t threads)
+{
+    return ctx_set_callback_threads(ctx, threads);
+}
+
 PUBLIC_API
 hound_err hound_queue_length(struct hound_ctx *ctx, size_t *count)
 {
@@ -114,10 +224,31 @@ hound_err hound_max_queue_length(struct hound_ctx *ctx, size_t *count)
     return ctx_max_queue_length(ctx, count);
 }
 
+PUBLIC_API
+hound_err hound_queue_dropped(struct hound_ctx *ctx, uint64_t *count)
+{
+    return ctx_queue_dropped(ctx, count);
+}
+
+PUBLIC_API
+hound_err hound_queue_high_water(struct hound_ctx *ctx, size_t *count)
+{
+    return ctx_queue_high_water(ctx, count);
+}
+
 PUBLIC_API
 hound_err hound_init_config(const char *config, const char *schema_base)
 {
-    return parse_config(config, schema_base);
+    return parse_config(config, schema_base, 1);
+}
+
+PUBLIC_API
+hound_err hound_init_config_parallel(
+    const char *config,
+    const char *schema_base,
+    size_t thread_count)
+{
+    return parse_config(config, schema_base, thread_count);
 }
 
 PUBLIC_API
@@ -129,7 +260,14 @@ hound_err hound_init_driver(
     size_t arg_count,
     const struct hound_init_arg *args)
 {
-    return driver_init(name, path, schema_base, schema, arg_count, args);
+    return driver_init(
+        name,
+        path,
+        schema_base,
+        schema,
+        false,
+        arg_count,
+        args);
 }
 
 PUBLIC_API
@@ -144,6 +282,116 @@ hound_err hound_destroy_all_drivers(void)
     return driver_destroy_all();
 }
 
+PUBLIC_API
+hound_err hound_set_io_sched(
+    const char *path,
+    hound_sched_policy policy,
+    int priority)
+{
+    return driver_set_io_sched(path, policy, priority);
+}
+
+PUBLIC_API
+hound_err hound_set_io_cpus(
+    const char *path,
+    const int *cpus,
+    size_t cpu_count)
+{
+    return driver_set_io_cpus(path, cpus, cpu_count);
+}
+
+PUBLIC_API
+hound_err hound_set_io_busy_poll(const char *path, uint64_t busy_ns)
+{
+    return driver_set_io_busy_poll(path, busy_ns);
+}
+
+PUBLIC_API
+hound_err hound_get_io_latency(
+    const char *path,
+    struct hound_io_latency *stats)
+{
+    return driver_get_io_latency(path, stats);
+}
+
+PUBLIC_API
+hound_err hound_get_driver_stats(
+    const char *path,
+    struct hound_driver_stats *stats)
+{
+    return driver_get_stats(path, stats);
+}
+
+PUBLIC_API
+hound_err hound_get_ctx_stats(
+    struct hound_ctx *ctx,
+    struct hound_ctx_stats *stats)
+{
+    return ctx_get_stats(ctx, stats);
+}
+
+PUBLIC_API
+hound_err hound_get_io_stats(const char *path, struct hound_io_stats *stats)
+{
+    return driver_get_io_stats(path, stats);
+}
+
+PUBLIC_API
+hound_err hound_lock_memory(const char *path, size_t records)
+{
+    return driver_lock_memory(path, records);
+}
+
+PUBLIC_API
+hound_err hound_shm_serve(
+    const char *socket_path,
+    const struct hound_rq *rq,
+    size_t slot_count,
+    size_t max_record_size,
+    struct hound_shm_server **server)
+{
+    return shm_serve(socket_path, rq, slot_count, max_record_size, server);
+}
+
+PUBLIC_API
+hound_err hound_shm_stop(struct hound_shm_server *server)
+{
+    return shm_stop(server);
+}
+
+PUBLIC_API
+hound_err hound_shm_attach(
+    const char *socket_path,
+    hound_data_id id,
+    struct hound_shm_client **client)
+{
+    return shm_attach(socket_path, id, client);
+}
+
+PUBLIC_API
+void hound_shm_detach(struct hound_shm_client *client)
+{
+    shm_detach(client);
+}
+
+PUBLIC_API
+hound_err hound_shm_read(
+    struct hound_shm_client *client,
+    size_t records,
+    hound_data_period timeout_ns,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read)
+{
+    return shm_read(client, records, timeout_ns, cb, cb_ctx, read);
+}
+
+PUBLIC_API
+hound_err hound_shm_dropped(struct hound_shm_client *client, uint64_t *count)
+{
+    return shm_dropped(client, count);
+}
+
 PUBLIC_API
 const char *hound_strerror(hound_err err)
 {
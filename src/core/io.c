@@ -7,647 +7,2675 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <hound-private/decimate.h>
 #include <hound-private/driver.h>
 #include <hound-private/driver-ops.h>
 #include <hound-private/error.h>
+#include <hound-private/heap.h>
 #include <hound-private/log.h>
+#include <hound-private/mcast.h>
+#include <hound-private/pool.h>
 #include <hound-private/queue.h>
 #include <hound-private/refcount.h>
+#include <hound-private/stats.h>
+#include <hound-private/trace.h>
 #include <hound-private/util.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <xlib/xhash.h>
 #include <xlib/xvec.h>
 
-#define PAUSE_FD_INDEX 0
-#define DATA_FD_START 1
+#include "config.h"
+
+#ifdef CONFIG_HOUND_IO_URING
+#include <liburing.h>
+#endif
 
 #define READ_END 0
 #define WRITE_END 1
 
 #define POLL_BUF_SIZE (100*1024)
+
+/*
+ * The number of records io_push_records handles at a time. This bounds the
+ * stack space used for record pointers.
+ */
+#define PUSH_BATCH_SIZE 256
 #define POLL_DEFAULT_EVENTS (POLLIN|POLLOUT|POLLPRI|POLLERR|POLLHUP)
 
-struct pull_timeout_info {
+/* The number of events we take from each epoll_wait call. */
+#define EPOLL_EVENTS 64
+
+/* The most messages we take from each recvmmsg call. */
+#define READ_MSGS_MAX 64
+
+/*
+ * How long to wait before retrying a timer rebuild that failed for lack of
+ * memory.
+ */
+#define REBUILD_RETRY_NS (NSEC_PER_SEC / 100)
+
+/*
+ * The most on-demand requests the poll thread makes of one driver per pass.
+ * Requests often make a driver write to the fd it reads from, so the poll
+ * thread has to get back to reading before the driver's writes can block.
+ */
+#define NEXT_BUDGET 8
+
+#ifdef CONFIG_HOUND_IO_URING
+/* The submission queue size for each shard's ring. */
+#define URING_ENTRIES 64
+
+/*
+ * The buffers each shard provides for multishot reads. The count must be a
+ * power of 2.
+ */
+#define URING_BUF_COUNT 32
+#define URING_BUF_SIZE (16*1024)
+#define URING_BUF_GROUP 0
+
+/**
+ * A multishot read posted for an fd. The poll thread owns it, and frees it
+ * only once the kernel posts its final completion, so the completion's user
+ * data can never dangle. Once the fd is removed, ctx is set to NULL.
+ */
+struct uring_read {
+    struct fdctx *ctx;
+};
+#endif
+
+struct pull_period {
     hound_data_id id;
-    hound_data_period current_timeout;
-    hound_data_period max_timeout;
+    hound_data_period period_ns;
+    bool foldable;
+    /* Whether a faster period for the same ID covers this one. */
+    bool folded;
 };
 
-struct pull_info {
-    hound_data_period last_pull;
-    xvec_t(struct pull_timeout_info) timeout_info;
+XVEC_DEFINE(pull_period_vec, struct pull_period);
+
+/**
+ * A timer in a shard's timer heap. Each pull-mode period on an fd gets one,
+ * and each fd gets one more for the timeout its poll op asks for, which has a
+ * period of 0.
+ */
+struct io_timer {
+    /* This must be first, so a heap_timer can be cast to its io_timer. */
+    struct heap_timer timer;
+    struct fdctx *ctx;
+    hound_data_id id;
+    hound_data_period period_ns;
 };
 
-/** Map from fd to pull-mode timeout information for the fd. */
-XHASH_MAP_INIT_INT(PULL_MAP, struct pull_info)
-xhash_t(PULL_MAP) *s_pull_map = NULL;
+struct pull_info {
+    uint_least64_t gen;
+    struct io_timer *timers;
+    size_t timer_count;
+    /* The data IDs whose timers fired since the driver last pulled. */
+    xvec_t(hound_data_id) due;
+};
 
+/**
+ * A queue that wants a data ID. fold_period is the fastest foldable period the
+ * queue asked for (see driver_rq_foldable), or 0 if none. If every request the
+ * queue made for the ID is foldable and the driver runs at a faster period,
+ * the queue gets one record in stride through its decimator. A queue with a
+ * filter gets a decimator too, even at a stride of 1. For a multicast queue,
+ * cursor is its cursor into the fd's record log, and records go to the log
+ * instead of the queue.
+ */
 struct queue_entry {
     hound_data_id id;
     struct queue *queue;
+    struct mcast_cursor *cursor;
+    hound_data_period fold_period;
+    bool decimate;
+    hound_aggregate aggregate;
+    struct hound_data_filter filter;
+    size_t stride;
+    struct decimator *dec;
+};
+
+/** The queue entries for one data ID, as a run of dispatch targets. */
+struct dispatch_span {
+    hound_data_id id;
+    size_t start;
+    size_t len;
+};
+
+/**
+ * The queues and pull periods an fd feeds, published as an immutable snapshot.
+ * A change builds a new snapshot and swaps it in, so the poll loop never has
+ * to stop for one; it sees the new generation on its next pass. periods holds
+ * one entry per pull-mode request.
+ *
+ * So that pushing a record doesn't mean scanning every queue entry, index_rqs
+ * builds a dispatch table once the entries are final: spans, sorted by data
+ * ID, each point at the run of targets that want the ID, in entry order.
+ * pushes lists each queue that isn't multicast once, in entry order, which is
+ * the order push_batch fills them in.
+ */
+struct fd_rqs {
+    uint_least64_t gen;
+    xvec_t(struct queue_entry) queues;
+    pull_period_vec periods;
+    struct dispatch_span *spans;
+    size_t span_count;
+    const struct queue_entry **targets;
+    struct queue **pushes;
+    size_t push_count;
+};
+
+/**
+ * An immutable snapshot of the fds a shard polls. Removing an fd just clears
+ * its slot, so removal can't fail; the next insert compacts the table.
+ */
+struct fd_table {
+    size_t len;
+    _Atomic(struct fdctx *) ctx[];
+};
+
+/**
+ * An I/O shard is a poll thread along with the fds it polls. Each shard has
+ * its own epoll set, wake pipe and read buffer, so a slow driver holds up only
+ * the drivers in its own shard. A driver goes to the shard given in its
+ * config, or else to a shard picked by its device ID.
+ *
+ * The fd table and the per-fd requests are read without locks, RCU-style.
+ * Readers bump the reader count for the current epoch and may use any
+ * snapshot they load until they drop it. Writers serialize on update_lock,
+ * swap in a new snapshot, then flip the epoch and wait for the old epoch's
+ * readers to leave before freeing what they replaced. The poll thread stays a
+ * reader across epoll_wait, so writers kick it through the wake pipe to keep
+ * the wait short.
+ *
+ * Every timer for the shard's fds lives in one heap, keyed by absolute
+ * deadline, so finding the next timeout and the timers that fired is
+ * O(log n). The heap belongs to the poll thread. Since it points into the
+ * fdctxs, writers bump gen whenever they change the table or an fd's
+ * requests, and the poll thread rebuilds the heap before it looks at it again.
+ *
+ * On-demand requests reach a shard without any locks. io_next adds them to a
+ * per-driver count and sets next_pending, and the poll thread makes them
+ * between passes.
+ *
+ * With busy polling on, the poll thread spins on zero-timeout epoll_waits for
+ * up to busy_poll_ns before it blocks, watching the next timer deadline
+ * itself instead of waiting for the timerfd. The latency counters are written
+ * only by the poll thread, and read by anyone.
+ */
+struct io_shard {
+    pthread_mutex_t update_lock;
+    _Atomic(struct fd_table *) table;
+    atomic_uint epoch;
+    atomic_uint readers[2];
+    atomic_uint_least64_t gen;
+    atomic_bool next_pending;
+    atomic_uint_least64_t busy_poll_ns;
+
+    atomic_uint_least64_t iterations;
+    atomic_uint_least64_t blocking_wakeups;
+    atomic_uint_least64_t busy_wakeups;
+    struct stats_histogram sync_stall_ns;
+    struct stats_histogram wakeup_jitter_ns;
+
+    pthread_t thread;
+    atomic_bool stop;
+    int epoll_fd;
+    int timer_fd;
+    bool timer_armed;
+    int wake_pipe[2];
+
+    uint_least64_t timers_gen;
+    struct timer_heap timers;
+    /* The fds to service on this pass of the poll loop. */
+    xvec_t(struct fdctx *) ready;
+
+#ifdef CONFIG_HOUND_IO_URING
+    /*
+     * The shard's io_uring, if the kernel gave us one. It's used only by the
+     * poll thread, and its fd sits in the epoll set like any other.
+     */
+    bool uring_ok;
+    struct io_uring uring;
+    struct io_uring_buf_ring *buf_ring;
+    unsigned char *uring_bufs;
+    xvec_t(struct uring_read *) reads;
+#endif
+
+    unsigned char read_buf[POLL_BUF_SIZE];
 };
 
 /**
  * Provides the relevant information that the I/O system need to know about a
- * given fd (besides the fd value itself). This is stored separately from the
- * struct pollfd structures because poll requires that the array of struct
- * pollfd's passed in be contiguous in memory.
+ * given fd. Each fdctx is allocated separately so that its address is stable;
+ * epoll hands the pointer back to us with each event, and the driver keeps a
+ * pointer to it so io_push_records doesn't have to look it up.
  */
 struct fdctx {
+    int fd;
     struct driver *drv;
+    struct io_shard *shard;
+    _Atomic(struct fd_rqs *) rqs;
+
+    /*
+     * The record log for the fd's multicast queues, created along with the
+     * first cursor. It's set before any snapshot that needs it is published.
+     */
+    struct mcast_log *mcast;
+
+    /* Everything below is owned by the poll thread. */
+    short events;
+    short revents;
+    bool ready;
     bool timeout_enabled;
-    hound_data_period timeout_ns;
-    xvec_t(struct queue_entry) queues;
+    struct io_timer timeout;
+
+    /* Pull-mode timers, used only for pull-mode drivers. */
+    struct pull_info pull;
+
+#ifdef CONFIG_HOUND_IO_URING
+    /*
+     * Whether the fd is read through io_uring rather than epoll, and the read
+     * posted for it, if any.
+     */
+    bool use_uring;
+    struct uring_read *uring;
+#endif
 };
 
+/** Map from fd to its fdctx, for the fd-based entry points. */
+XHASH_MAP_INIT_INT(FD_MAP, struct fdctx *)
+
+/* The fd map has its own lock, which is never held along with update_lock. */
 static struct {
-    pthread_rwlock_t lock;
-    xvec_t(struct fdctx) ctx;
-    xvec_t(struct pollfd) fds;
+    pthread_mutex_t lock;
+    xhash_t(FD_MAP) *fd_map;
+    struct io_shard shards[CONFIG_HOUND_IO_SHARDS];
 } s_ios;
 
-/* Polling. */
-static pthread_t s_poll_thread;
-static int s_self_pipe[2];
-static pthread_mutex_t s_poll_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t s_poll_cond = PTHREAD_COND_INITIALIZER;
-static bool s_poll_active_target = false;
-static bool s_poll_active_current = false;
-
-static unsigned char s_read_buf[POLL_BUF_SIZE];
+/*
+ * The epoll data for the wake pipe and the timer point at these fds rather
+ * than at an fdctx, so the poll loop can tell them apart.
+ */
+#define WAKE_TAG(shard) ((void *) &(shard)->wake_pipe[READ_END])
+#define TIMER_TAG(shard) ((void *) &(shard)->timer_fd)
+#ifdef CONFIG_HOUND_IO_URING
+#define URING_TAG(shard) ((void *) &(shard)->uring)
+#endif
 
 static
-size_t get_fd_index(int fd)
+struct fdctx *get_fdctx(int fd)
 {
-    size_t index;
-    const struct pollfd *pfd;
+    struct fdctx *ctx;
+    xhiter_t iter;
 
-    for (index = DATA_FD_START; index < xv_size(s_ios.fds); ++index) {
-        pfd = &xv_A(s_ios.fds, index);
-        if (pfd->fd == fd) {
-            break;
-        }
+    lock_mutex(&s_ios.lock);
+    iter = xh_get(FD_MAP, s_ios.fd_map, fd);
+    XASSERT_NEQ(iter, xh_end(s_ios.fd_map));
+    ctx = xh_val(s_ios.fd_map, iter);
+    unlock_mutex(&s_ios.lock);
+
+    return ctx;
+}
+
+size_t io_driver_shard(const struct driver *drv)
+{
+    if (drv->io_shard >= 0) {
+        return (size_t) drv->io_shard % CONFIG_HOUND_IO_SHARDS;
     }
-    XASSERT_NEQ(index, xv_size(s_ios.fds));
 
-    return index;
+    /* Device IDs are handed out sequentially, so this spreads them evenly. */
+    return drv->id % CONFIG_HOUND_IO_SHARDS;
+}
+
+size_t io_shard_count(void)
+{
+    return CONFIG_HOUND_IO_SHARDS;
 }
 
 static
-size_t get_fdctx_index(size_t fd_index)
+unsigned read_lock(struct io_shard *shard)
 {
+    unsigned epoch;
+
     /*
-     * We have to subtract one to get the ctx corresponding to an fd index
-     * because the first index is taken up by the special self-pipe that we use
-     * to stop the poll loop.
+     * If a writer flips the epoch between our load and our increment, it may
+     * already have seen no readers in our epoch, so back out and retry in the
+     * new one.
      */
-    XASSERT_GT(fd_index, 0);
-    return fd_index - 1;
+    while (true) {
+        epoch = atomic_load(&shard->epoch);
+        atomic_fetch_add(&shard->readers[epoch & 1], 1);
+        if (atomic_load(&shard->epoch) == epoch) {
+            return epoch;
+        }
+        atomic_fetch_sub(&shard->readers[epoch & 1], 1);
+    }
 }
 
 static
-struct fdctx *get_fdctx(int fd)
+void read_unlock(struct io_shard *shard, unsigned epoch)
+{
+    atomic_fetch_sub_explicit(
+        &shard->readers[epoch & 1],
+        1,
+        memory_order_release);
+}
+
+static
+void wake_poll(struct io_shard *shard)
+{
+    ssize_t bytes;
+    static const char payload = 1;
+
+    bytes = write(shard->wake_pipe[WRITE_END], &payload, sizeof(payload));
+    /* A full pipe means a wakeup is already pending, which is just as good. */
+    XASSERT(bytes == sizeof(payload) || errno == EAGAIN);
+}
+
+/**
+ * Wait until no reader can still see a snapshot that was swapped out before
+ * this call. The caller must hold update_lock.
+ */
+static
+void synchronize(struct io_shard *shard)
+{
+    unsigned epoch;
+    uint_least64_t stall_ns;
+    uint_least64_t start;
+
+    TRACE1(sync_start, shard - s_ios.shards);
+    start = stats_now_ns();
+    epoch = atomic_fetch_add(&shard->epoch, 1);
+    wake_poll(shard);
+    while (atomic_load_explicit(
+            &shard->readers[epoch & 1],
+            memory_order_acquire) > 0) {
+        sched_yield();
+    }
+    stall_ns = stats_now_ns() - start;
+    stats_histogram_add(&shard->sync_stall_ns, stall_ns);
+    TRACE2(sync_done, shard - s_ios.shards, stall_ns);
+}
+
+static
+const struct dispatch_span *find_span(
+    const struct fd_rqs *rqs,
+    hound_data_id id)
+{
+    size_t high;
+    size_t low;
+    size_t mid;
+
+    low = 0;
+    high = rqs->span_count;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (rqs->spans[mid].id < id) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    if (low < rqs->span_count && rqs->spans[low].id == id) {
+        return &rqs->spans[low];
+    }
+    return NULL;
+}
+
+/*
+ * Finds the span for each record in a batch. Drivers tend to push runs of the
+ * same ID, so check the previous record's span before searching.
+ */
+static
+void find_spans(
+    const struct fd_rqs *rqs,
+    const struct hound_record *records,
+    const struct dispatch_span **spans,
+    size_t count)
+{
+    size_t i;
+    const struct dispatch_span *prev;
+
+    prev = NULL;
+    for (i = 0; i < count; ++i) {
+        if (prev == NULL || prev->id != records[i].data_id) {
+            prev = find_span(rqs, records[i].data_id);
+        }
+        spans[i] = prev;
+    }
+}
+
+/*
+ * Writes a batch of records into the fd's multicast log. Each record goes in
+ * once, tagged with every cursor that takes it; aggregate records made by a
+ * decimator go in separately, for their cursor alone. logged says whether the
+ * refcount already counts the log's reference to a record.
+ */
+static
+void log_batch(
+    struct mcast_log *log,
+    const struct driver *drv,
+    const struct fd_rqs *rqs,
+    const struct dispatch_span **spans,
+    struct record_info **infos,
+    const bool *logged,
+    size_t count)
 {
-    size_t fdctx_index;
+    uint64_t bit;
+    const struct queue_entry *entry;
+    size_t i;
+    size_t j;
+    uint64_t mask;
+    struct record_info *pick;
+
+    mcast_write_begin(log);
+    for (i = 0; i < count; ++i) {
+        if (infos[i] == NULL) {
+            continue;
+        }
+
+        mask = 0;
+        for (j = 0; j < spans[i]->len; ++j) {
+            entry = rqs->targets[spans[i]->start + j];
+            if (entry->cursor == NULL) {
+                continue;
+            }
+
+            if (entry->dec == NULL) {
+                pick = infos[i];
+            }
+            else {
+                pick = decimator_push(
+                    entry->dec,
+                    entry->stride,
+                    infos[i],
+                    drv->pool);
+                if (pick == NULL) {
+                    continue;
+                }
+                pick->push_ns = infos[i]->push_ns;
+            }
+            queue_log_records(entry->queue, &pick, 1);
 
-    fdctx_index = get_fdctx_index(get_fd_index(fd));
+            bit = mcast_cursor_bit(entry->cursor);
+            if (pick == infos[i]) {
+                mask |= bit;
+            }
+            else {
+                mcast_append(log, pick, bit);
+            }
+        }
 
-    return &xv_A(s_ios.ctx, fdctx_index);
+        if (mask != 0) {
+            if (!logged[i]) {
+                atomic_ref_inc(&infos[i]->refcount);
+            }
+            mcast_append(log, infos[i], mask);
+        }
+        else {
+            XASSERT(!logged[i]);
+        }
+    }
+    mcast_write_end(log);
 }
 
 static
-struct fdctx *get_fdctx_from_fd_index(size_t fd_index)
+void push_batch(
+    const struct driver *drv,
+    struct mcast_log *log,
+    const struct fd_rqs *rqs,
+    struct hound_record *records,
+    size_t count)
 {
-    size_t fdctx_index;
+    struct record_info *batch[PUSH_BATCH_SIZE];
+    const struct queue_entry *entry;
+    bool held[PUSH_BATCH_SIZE];
+    size_t i;
+    struct record_info *infos[PUSH_BATCH_SIZE];
+    size_t j;
+    size_t k;
+    bool logged[PUSH_BATCH_SIZE];
+    bool multicast;
+    size_t n;
+    struct record_info *pick;
+    struct queue *queue;
+    uint_least64_t push_ns;
+    struct hound_record *record;
+    refcount_val refs;
+    const struct dispatch_span *span;
+    const struct dispatch_span *spans[PUSH_BATCH_SIZE];
+
+    XASSERT_LTE(count, PUSH_BATCH_SIZE);
+
+    find_spans(rqs, records, spans, count);
+    /* One clock read covers the whole batch. */
+    push_ns = stats_now_ns();
+
+    /*
+     * Fill in the record info for each record, with its refcount set to the
+     * number of queues it will go into. The refcount must be final before the
+     * first push, or a fast reader could drop it to 0 while we're still pushing
+     * it into other queues. A decimating queue may or may not take a record,
+     * so for those we hold a reference of our own until they have all had
+     * their pick, and they take their own references as they go. The
+     * multicast log needs just one reference, however many of its cursors
+     * take the record.
+     */
+    multicast = false;
+    for (i = 0; i < count; ++i) {
+        record = &records[i];
+        infos[i] = NULL;
+        held[i] = false;
+        logged[i] = false;
+
+        refs = 0;
+        span = spans[i];
+        for (j = 0; span != NULL && j < span->len; ++j) {
+            entry = rqs->targets[span->start + j];
+            if (entry->cursor != NULL) {
+                multicast = true;
+            }
+            if (entry->dec != NULL) {
+                held[i] = true;
+            }
+            else if (entry->cursor != NULL) {
+                logged[i] = true;
+            }
+            else {
+                ++refs;
+            }
+        }
+        if (held[i]) {
+            ++refs;
+        }
+        if (logged[i]) {
+            ++refs;
+        }
+        if (refs == 0) {
+            /*
+             * This is unlikely, but if there's no queue associated with this
+             * data, make sure we don't leak the record. This should happen only
+             * if a driver pushes data from outside the poll loop and its
+             * context is being modified at the same time.
+             */
+            drv_record_free(record->data);
+            continue;
+        }
 
-    fdctx_index = get_fdctx_index(fd_index);
+        /* The record info lives in the same pool block as the record data. */
+        infos[i] = pool_info_from_data(record->data);
+        record->dev_id = drv->id;
+        infos[i]->record = *record;
+        infos[i]->push_ns = push_ns;
+        atomic_ref_init(&infos[i]->refcount, refs);
+        TRACE5(
+            push,
+            infos[i],
+            record->dev_id,
+            record->data_id,
+            TRACE_TIMESPEC_NS(record->timestamp),
+            push_ns);
+    }
+
+    /*
+     * Push to each queue exactly once, so each queue takes its lock and wakes
+     * its readers once per batch instead of once per record. A queue has at
+     * most one entry per data ID, so it shows up at most once in a span.
+     */
+    for (j = 0; j < rqs->push_count; ++j) {
+        queue = rqs->pushes[j];
+        n = 0;
+        for (i = 0; i < count; ++i) {
+            if (infos[i] == NULL) {
+                continue;
+            }
+            entry = NULL;
+            for (k = 0; k < spans[i]->len; ++k) {
+                if (rqs->targets[spans[i]->start + k]->queue == queue) {
+                    entry = rqs->targets[spans[i]->start + k];
+                    break;
+                }
+            }
+            if (entry == NULL) {
+                continue;
+            }
+
+            if (entry->dec == NULL) {
+                pick = infos[i];
+            }
+            else {
+                pick = decimator_push(
+                    entry->dec,
+                    entry->stride,
+                    infos[i],
+                    drv->pool);
+                if (pick == infos[i]) {
+                    atomic_ref_inc(&pick->refcount);
+                }
+                else if (pick != NULL) {
+                    pick->push_ns = push_ns;
+                }
+            }
+            if (pick != NULL) {
+                batch[n] = pick;
+                ++n;
+            }
+        }
+        queue_push_many(queue, batch, n);
+    }
+
+    if (multicast) {
+        log_batch(log, drv, rqs, spans, infos, logged, count);
+    }
 
-    return &xv_A(s_ios.ctx, fdctx_index);
+    for (i = 0; i < count; ++i) {
+        if (held[i]) {
+            record_ref_dec(infos[i]);
+        }
+    }
 }
 
 void io_push_records(struct hound_record *records, size_t count)
 {
-    const struct hound_record *end;
+    uint_least64_t bytes;
     struct driver *drv;
-    struct queue_entry *entry;
+    unsigned epoch;
     struct fdctx *fdctx;
     size_t i;
-    struct hound_record *record;
-    struct record_info *rec_info;
-    bool pushed;
-
-    pthread_rwlock_rdlock(&s_ios.lock);
+    const struct fd_rqs *rqs;
+    struct io_shard *shard;
 
     drv = get_active_drv();
     XASSERT_NOT_NULL(drv);
+    shard = &s_ios.shards[io_driver_shard(drv)];
+
+    bytes = 0;
+    for (i = 0; i < count; ++i) {
+        bytes += records[i].size;
+    }
+    stats_add(&drv->stats.records, count);
+    stats_add(&drv->stats.bytes, bytes);
+
+    epoch = read_lock(shard);
 
-    fdctx = get_fdctx(drv->fd);
-    XASSERT_NOT_NULL(fdctx);
+    /*
+     * If the fd is being removed, no queue wants these records anymore. The
+     * read lock keeps a removed fdctx alive, but not the driver's pointer to
+     * it, so load that just once.
+     */
+    fdctx = drv->fdctx;
+    if (fdctx == NULL) {
+        for (i = 0; i < count; ++i) {
+            drv_record_free(records[i].data);
+        }
+        goto out;
+    }
+    rqs = atomic_load_explicit(&fdctx->rqs, memory_order_acquire);
 
     /* Add to all user queues. */
-    end = records + count;
-    for (record = records; record < end; ++record) {
-        rec_info = drv_alloc(sizeof(*rec_info));
-        if (rec_info == NULL) {
-            hound_log_err_nofmt(
-                    HOUND_OOM,
-                    "Failed to allocate a rec_info; can't add record to user queue");
-            continue;
+    for (i = 0; i < count; i += PUSH_BATCH_SIZE) {
+        push_batch(
+            drv,
+            fdctx->mcast,
+            rqs,
+            records + i,
+            min(count - i, PUSH_BATCH_SIZE));
+    }
+
+out:
+    read_unlock(shard, epoch);
+}
+
+static
+hound_data_period get_time_ns(void)
+{
+    struct timespec ts;
+
+    /*
+     * Use CLOCK_MONOTONIC_RAW, as it's not subject to time discontinuities due
+     * to NTP, leap seconds, etc.
+     */
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return NSEC_PER_SEC*ts.tv_sec + ts.tv_nsec;
+}
+
+/* Find the SO_TIMESTAMPNS timestamp in a received message, if it has one. */
+static
+void get_msg_stamp(struct msghdr *hdr, struct timespec *ts)
+{
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr);
+         cmsg != NULL;
+         cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(*ts));
+            return;
         }
-        record->dev_id = drv->id;
-        rec_info->record = *record;
-        atomic_ref_init(&rec_info->refcount, 0);
+    }
+
+    ts->tv_sec = 0;
+    ts->tv_nsec = 0;
+}
 
-        pushed = false;
-        for (i = 0; i < xv_size(fdctx->queues); ++i) {
-            entry = &xv_A(fdctx->queues, i);
-            if (record->data_id == entry->id) {
-                atomic_ref_inc(&rec_info->refcount);
-//                fprintf(stderr, "pushing %p into %lu\n", (void *) rec_info, i);
-                queue_push(entry->queue, rec_info);
-                pushed = true;
+/*
+ * Read as many messages as fit in buf with a single recvmmsg, packing them back
+ * to back, each behind a struct drv_msg_header if the driver wants timestamps.
+ * Sets drained if the socket ran out of messages before buf filled up, which
+ * saves the caller a read that would only return EAGAIN.
+ */
+static
+ssize_t read_msgs(
+    int fd,
+    const struct driver *drv,
+    unsigned char *buf,
+    size_t size,
+    bool *drained)
+{
+    alignas(struct cmsghdr) unsigned char
+        controls[READ_MSGS_MAX][CMSG_SPACE(sizeof(struct timespec))];
+    size_t count;
+    struct drv_msg_header *header;
+    size_t i;
+    struct iovec iovs[READ_MSGS_MAX];
+    size_t len;
+    struct mmsghdr msgs[READ_MSGS_MAX];
+    size_t msg_size;
+    unsigned char *pos;
+    int ret;
+    size_t slot;
+    bool stamps;
+
+    msg_size = drv->read_msg_size;
+    stamps = drv->read_msg_stamps;
+    slot = stamps ? DRV_MSG_SPACE(msg_size) : msg_size;
+    count = min(size / slot, ARRAYLEN(msgs));
+    XASSERT_GT(count, 0);
+    for (i = 0; i < count; ++i) {
+        iovs[i].iov_base = buf + i*slot;
+        iovs[i].iov_len = msg_size;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (stamps) {
+            iovs[i].iov_base = (unsigned char *) iovs[i].iov_base +
+                sizeof(*header);
+            msgs[i].msg_hdr.msg_control = controls[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+    }
+
+    ret = recvmmsg(fd, msgs, count, MSG_DONTWAIT, NULL);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    /*
+     * Close any gaps left by short messages. Everything moves toward the start
+     * of buf, so writing a header never clobbers a message we have yet to move.
+     */
+    pos = buf;
+    for (i = 0; i < (size_t) ret; ++i) {
+        len = msgs[i].msg_len;
+        if (stamps) {
+            header = (struct drv_msg_header *) pos;
+            pos += sizeof(*header);
+            if (pos != iovs[i].iov_base) {
+                memmove(pos, iovs[i].iov_base, len);
             }
+            get_msg_stamp(&msgs[i].msg_hdr, &header->timestamp);
+            header->size = len;
+            pos += DRV_MSG_SPACE(len) - sizeof(*header);
         }
-        if (!pushed) {
-            /*
-             * This is unlikely, but if there's no queue associated with this
-             * data, make sure we don't leak the record info. This should happen
-             * only if a driver pushes data from outside the poll loop and its
-             * context is being modified at the same time.
+        else {
+            if (pos != iovs[i].iov_base) {
+                memmove(pos, iovs[i].iov_base, len);
+            }
+            pos += len;
+        }
+    }
+    *drained = (size_t) ret < count;
+
+    return pos - buf;
+}
+
+/* Account for one read of a driver's fd, whichever way it was done. */
+static
+void count_read(struct driver *drv, int fd, ssize_t bytes)
+{
+    stats_add(&drv->stats.reads, 1);
+    TRACE3(read, drv->id, fd, bytes);
+}
+
+/*
+ * Hand a buffer read from a driver's fd to its parse op, timing the parse.
+ * Callers already inside a driver op set in_op, since they hold the driver ops
+ * mutex and taking it again through drv_op_parse would deadlock.
+ */
+static
+hound_err parse_read(
+    struct driver *drv,
+    int fd,
+    unsigned char *buf,
+    size_t bytes,
+    bool in_op)
+{
+    hound_err err;
+    uint_least64_t start;
+
+    TRACE2(parse_start, drv->id, bytes);
+    start = stats_now_ns();
+    if (in_op) {
+        err = drv->ops.parse(buf, bytes);
+    }
+    else {
+        err = drv_op_parse(drv, buf, bytes);
+    }
+    stats_histogram_add(&drv->stats.parse_ns, stats_now_ns() - start);
+    TRACE2(parse_done, drv->id, err);
+    if (err != HOUND_OK) {
+        hound_log_err(
+                err,
+                "Driver failed to parse records (size = %zu, fd = %d)",
+                bytes, fd);
+    }
+
+    return err;
+}
+
+/*
+ * Read and parse until the fd runs dry or the driver's read budget runs out.
+ * The budget keeps a busy driver from starving the rest of its shard; epoll is
+ * level-triggered, so anything we leave behind is reported again next time.
+ */
+static
+hound_err make_records(struct driver *drv, unsigned char *buf, size_t size)
+{
+    size_t budget;
+    ssize_t bytes_read;
+    bool drained;
+    hound_err err;
+    int fd;
+
+    fd = drv_fd();
+    drained = false;
+    for (budget = drv->read_budget; budget > 0 && !drained; --budget) {
+        if (drv->read_msg_size > 0) {
+            bytes_read = read_msgs(fd, drv, buf, size, &drained);
+        }
+        else {
+            bytes_read = read(fd, buf, size);
+        }
+        count_read(drv, fd, bytes_read);
+        if (bytes_read <= 0) {
+            if (bytes_read == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* No more data to read, so we're done. */
+                return HOUND_OK;
+            }
+
+            /* A signal interrupted us; we can finish reading later. */
+            if (errno == EINTR) {
+                return HOUND_INTR;
+            }
+            else if (errno == EIO) {
+                hound_log_err(errno, "read returned EIO on fd %d", fd);
+                return HOUND_IO_ERROR;
+            }
+            else {
+                /* Other error codes are likely program bugs. */
+                XASSERT_ERROR;
+            }
+        }
+
+        /* We're inside the driver's poll op, so we hold its ops mutex. */
+        err = parse_read(drv, fd, buf, bytes_read, true);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    return HOUND_OK;
+}
+
+hound_err io_default_pull(
+    short events,
+    short *next_events,
+    UNUSED hound_data_period poll_time,
+    bool *timeout_enabled,
+    UNUSED hound_data_period *timeout)
+{
+    struct driver *drv;
+    hound_err err;
+    struct fdctx *fdctx;
+    size_t i;
+    struct pull_info *info;
+
+    /* Our pull timers are in the timer heap, so we need no fd timeout. */
+    *next_events = POLLIN;
+    *timeout_enabled = false;
+
+    /* The fd may be removed while we run, so load its fdctx just once. */
+    drv = get_active_drv();
+    fdctx = drv->fdctx;
+    if (fdctx == NULL) {
+        return HOUND_OK;
+    }
+    info = &fdctx->pull;
+
+    /*
+     * The poll loop has already worked out which data is due.
+     *
+     * NOTE: We don't use drv_ops_next here, which would set the active driver
+     * and take the driver ops mutex. This is because we are already inside a
+     * driver ops callback, so re-taking the mutex will cause a deadlock!
+     */
+    if (drv->ops.next_batch != NULL && xv_size(info->due) > 0) {
+        err = drv->ops.next_batch(xv_data(info->due), xv_size(info->due), 1);
+        if (err != HOUND_OK) {
+            hound_log_err(
+                    err,
+                    "driver %p failed to pull data",
+                    (void *) drv);
+        }
+    }
+    else {
+        for (i = 0; i < xv_size(info->due); ++i) {
+            err = drv->ops.next(xv_A(info->due, i));
+            if (err != HOUND_OK) {
+                hound_log_err(
+                        err,
+                        "driver %p failed to pull data",
+                        (void *) drv);
+            }
+        }
+    }
+    xv_size(info->due) = 0;
+
+    if (events & POLLIN) {
+        err = make_records(
+            drv,
+            fdctx->shard->read_buf,
+            ARRAYLEN(fdctx->shard->read_buf));
+    }
+    else {
+        err = HOUND_OK;
+    }
+
+    return err;
+}
+
+hound_err io_default_push(
+    short events,
+    short *next_events,
+    UNUSED hound_data_period pull_time,
+    bool *timeout_enabled,
+    UNUSED hound_data_period *timeout)
+{
+    struct driver *drv;
+    struct fdctx *fdctx;
+
+    *next_events = POLLIN;
+    *timeout_enabled = false;
+
+    if (!(events & POLLIN)) {
+        return HOUND_OK;
+    }
+
+    /* The fd may be removed while we run, so load its fdctx just once. */
+    drv = get_active_drv();
+    fdctx = drv->fdctx;
+    if (fdctx == NULL) {
+        return HOUND_OK;
+    }
+
+    return make_records(
+        drv,
+        fdctx->shard->read_buf,
+        ARRAYLEN(fdctx->shard->read_buf));
+}
+
+static
+hound_err io_read(
+    struct fdctx *ctx,
+    hound_data_period poll_time,
+    short events,
+    short *next_events,
+    bool *timeout_enabled,
+    hound_data_period *timeout_ns)
+{
+    hound_err err;
+    uint_least64_t start;
+
+    *timeout_enabled = false;
+    *timeout_ns = UINT64_MAX;
+
+    start = stats_now_ns();
+    err = drv_op_poll(
+        ctx->drv,
+        events,
+        next_events,
+        poll_time,
+        timeout_enabled,
+        timeout_ns);
+    stats_histogram_add(&ctx->drv->stats.poll_ns, stats_now_ns() - start);
+
+    return err;
+}
+
+/**
+ * Wait until it's safe for the event loop to continue.
+ */
+static
+void populate_timespec(hound_data_period ts, struct timespec *spec)
+{
+    spec->tv_sec = ts / NSEC_PER_SEC;
+    spec->tv_nsec = ts % NSEC_PER_SEC;
+}
+
+/*
+ * epoll timeouts have only millisecond resolution, which is too coarse for
+ * high-rate pull-mode data, so we wait on a timerfd instead. Returns the
+ * timeout to pass to epoll_wait.
+ */
+static
+int arm_timer(
+    struct io_shard *shard,
+    bool have_timeout,
+    hound_data_period timeout_ns)
+{
+    struct itimerspec spec;
+    int ret;
+
+    if (have_timeout && timeout_ns == 0) {
+        /* Something is already due, so don't wait at all. */
+        return 0;
+    }
+
+    if (!have_timeout && !shard->timer_armed) {
+        return -1;
+    }
+
+    /* A zero it_value disarms the timer. */
+    memset(&spec, 0, sizeof(spec));
+    if (have_timeout) {
+        populate_timespec(timeout_ns, &spec.it_value);
+    }
+    ret = timerfd_settime(shard->timer_fd, 0, &spec, NULL);
+    XASSERT_EQ(ret, 0);
+    shard->timer_armed = have_timeout;
+
+    return -1;
+}
+
+static
+void clear_timer(struct io_shard *shard)
+{
+    ssize_t bytes;
+    uint64_t expirations;
+
+    /* The timerfd is non-blocking, so this is harmless if it didn't fire. */
+    bytes = read(shard->timer_fd, &expirations, sizeof(expirations));
+    XASSERT(bytes == sizeof(expirations) || errno == EAGAIN);
+    shard->timer_armed = false;
+}
+
+static
+bool need_to_wake(
+    struct io_shard *shard,
+    const struct epoll_event *events,
+    int count)
+{
+    char buf[64];
+    ssize_t bytes;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        if (events[i].data.ptr == WAKE_TAG(shard)) {
+            break;
+        }
+    }
+    if (i == count) {
+        return false;
+    }
+
+    /* Drain the wake pipe, as several writers may have kicked us. */
+    do {
+        bytes = read(shard->wake_pipe[READ_END], buf, sizeof(buf));
+        XASSERT(bytes > 0 || errno == EAGAIN);
+    } while (bytes == sizeof(buf));
+
+    return true;
+}
+
+static
+bool fd_is_live(const struct fdctx *ctx)
+{
+    return atomic_load_explicit(&ctx->drv->fdctx, memory_order_relaxed) == ctx;
+}
+
+static
+void set_events(struct fdctx *ctx, short events)
+{
+    struct epoll_event event;
+    int ret;
+
+    if (events == ctx->events) {
+        return;
+    }
+
+    /* The poll and epoll event bits have the same values on Linux. */
+    event.events = (uint32_t) events;
+    event.data.ptr = ctx;
+    ret = epoll_ctl(ctx->shard->epoll_fd, EPOLL_CTL_MOD, ctx->fd, &event);
+    /*
+     * The fd may have been removed while we were reading it, after we checked
+     * that it was live.
+     */
+    XASSERT(ret == 0 || (errno == ENOENT && !fd_is_live(ctx)));
+    ctx->events = events;
+}
+
+static
+void set_fd_timeout(
+    struct fdctx *ctx,
+    bool enabled,
+    hound_data_period now,
+    hound_data_period timeout_ns)
+{
+    hound_data_period deadline;
+    hound_err err;
+    struct heap_timer *timer;
+
+    timer = &ctx->timeout.timer;
+    if (!enabled) {
+        if (timer_pending(timer)) {
+            timer_heap_remove(&ctx->shard->timers, timer);
+        }
+        ctx->timeout_enabled = false;
+        return;
+    }
+
+    if (timeout_ns > UINT64_MAX - now) {
+        deadline = UINT64_MAX;
+    }
+    else {
+        deadline = now + timeout_ns;
+    }
+    err = timer_heap_set(&ctx->shard->timers, timer, deadline);
+    if (err != HOUND_OK) {
+        hound_log_err(err, "Failed to set timeout for fd %d", ctx->fd);
+        ctx->timeout_enabled = false;
+        return;
+    }
+    ctx->timeout_enabled = true;
+}
+
+/*
+ * Bring an fd's pull timers in line with its current requests. Periods that
+ * are still requested keep their deadlines, so changing one context doesn't
+ * disturb the timing of everyone else's data. New periods first come due one
+ * period from now.
+ */
+static
+hound_err sync_pull(
+    struct fdctx *ctx,
+    const struct fd_rqs *rqs,
+    hound_data_period now)
+{
+    size_t count;
+    struct pull_info *info;
+    size_t i;
+    size_t j;
+    struct io_timer *old;
+    const struct pull_period *period;
+    struct io_timer *timer;
+    struct io_timer *timers;
+
+    info = &ctx->pull;
+    if (info->gen == rqs->gen) {
+        return HOUND_OK;
+    }
+
+    /* Folded periods ride along on a faster timer. */
+    count = 0;
+    for (i = 0; i < xv_size(rqs->periods); ++i) {
+        if (!xv_A(rqs->periods, i).folded) {
+            ++count;
+        }
+    }
+    if (count > 0) {
+        timers = malloc(count * sizeof(*timers));
+        if (timers == NULL) {
+            /* Keep the old timers and try again later. */
+            return HOUND_OOM;
+        }
+    }
+    else {
+        timers = NULL;
+    }
+
+    timer = timers;
+    for (i = 0; i < xv_size(rqs->periods); ++i) {
+        period = &xv_A(rqs->periods, i);
+        if (period->folded) {
+            continue;
+        }
+        timer_init(&timer->timer);
+        timer->ctx = ctx;
+        timer->id = period->id;
+        timer->period_ns = period->period_ns;
+        timer->timer.deadline = now + period->period_ns;
+
+        for (j = 0; j < info->timer_count; ++j) {
+            old = &info->timers[j];
+            if (old->id == period->id && old->period_ns == period->period_ns) {
+                timer->timer.deadline = old->timer.deadline;
+                /* Make sure no other period takes this timer's deadline. */
+                old->period_ns = 0;
+                break;
+            }
+        }
+        ++timer;
+    }
+
+    free(info->timers);
+    info->timers = timers;
+    info->timer_count = count;
+    info->gen = rqs->gen;
+
+    return HOUND_OK;
+}
+
+/*
+ * Rebuild the timer heap from the fd table, picking up any request changes
+ * along the way. The heap may still point at timers in fdctxs that have been
+ * freed since the last rebuild, so it gets emptied without looking at them.
+ * Every fd in the table is visited even if we run out of memory, so no timer
+ * is left thinking it's still in the heap.
+ */
+static
+hound_err rebuild_timers(struct io_shard *shard, hound_data_period now)
+{
+    struct fdctx *ctx;
+    hound_err err;
+    hound_err err2;
+    size_t i;
+    size_t j;
+    struct pull_info *info;
+    const struct fd_table *table;
+
+    err = HOUND_OK;
+    timer_heap_reset(&shard->timers);
+    table = atomic_load_explicit(&shard->table, memory_order_acquire);
+    for (i = 0; i < table->len; ++i) {
+        ctx = atomic_load_explicit(&table->ctx[i], memory_order_relaxed);
+        if (ctx == NULL) {
+            continue;
+        }
+        info = &ctx->pull;
+
+        err2 = sync_pull(
+            ctx,
+            atomic_load_explicit(&ctx->rqs, memory_order_acquire),
+            now);
+        if (err2 != HOUND_OK) {
+            err = err2;
+        }
+
+        for (j = 0; j < info->timer_count; ++j) {
+            timer_init(&info->timers[j].timer);
+        }
+        timer_init(&ctx->timeout.timer);
+
+        for (j = 0; j < info->timer_count; ++j) {
+            err2 = timer_heap_set(
+                &shard->timers,
+                &info->timers[j].timer,
+                info->timers[j].timer.deadline);
+            if (err2 != HOUND_OK) {
+                err = err2;
+            }
+        }
+        if (ctx->timeout_enabled) {
+            err2 = timer_heap_set(
+                &shard->timers,
+                &ctx->timeout.timer,
+                ctx->timeout.timer.deadline);
+            if (err2 != HOUND_OK) {
+                err = err2;
+            }
+        }
+    }
+
+    return err;
+}
+
+static
+void mark_ready(struct io_shard *shard, struct fdctx *ctx)
+{
+    struct fdctx **slot;
+
+    if (ctx->ready) {
+        return;
+    }
+
+    slot = xv_pushp(struct fdctx *, shard->ready);
+    if (slot == NULL) {
+        /*
+         * epoll will report the fd again, and any due pulls stay queued until
+         * the next time the fd is serviced.
+         */
+        hound_log_err(HOUND_OOM, "Failed to service fd %d", ctx->fd);
+        return;
+    }
+    *slot = ctx;
+    ctx->ready = true;
+}
+
+/*
+ * Fire every timer that is due. A pull timer's next deadline is always a whole
+ * number of periods after its last one, so pulls stay phase-locked to the
+ * requested period no matter how late the poll loop runs. If we fall behind by
+ * more than a period, we skip the pulls we missed rather than bunching them up.
+ */
+static
+void fire_timers(struct io_shard *shard, hound_data_period now)
+{
+    hound_data_period deadline;
+    hound_data_id *id;
+    struct io_timer *timer;
+    struct heap_timer *top;
+
+    while (true) {
+        top = timer_heap_peek(&shard->timers);
+        if (top == NULL || top->deadline > now) {
+            break;
+        }
+        timer = (struct io_timer *) top;
+
+        if (timer->period_ns == 0) {
+            /* The fd's own timeout, which is one-shot. */
+            timer_heap_remove(&shard->timers, top);
+            timer->ctx->timeout_enabled = false;
+        }
+        else {
+            /*
+             * Count the lateness against both the shard and the driver, since
+             * the pull it triggers is late by just as much.
+             */
+            stats_histogram_add(&shard->wakeup_jitter_ns, now - top->deadline);
+            stats_histogram_add(
+                &timer->ctx->drv->stats.pull_late_ns,
+                now - top->deadline);
+            id = xv_pushp(hound_data_id, timer->ctx->pull.due);
+            if (id == NULL) {
+                hound_log_err(
+                    HOUND_OOM,
+                    "Failed to schedule pull on fd %d",
+                    timer->ctx->fd);
+            }
+            else {
+                *id = timer->id;
+            }
+
+            deadline = top->deadline + timer->period_ns;
+            if (deadline <= now) {
+                deadline +=
+                    ((now - deadline) / timer->period_ns + 1) *
+                    timer->period_ns;
+            }
+            /* The timer is already in the heap, so this can't fail. */
+            timer_heap_set(&shard->timers, top, deadline);
+        }
+
+        mark_ready(shard, timer->ctx);
+    }
+}
+
+/**
+ * Make a driver's queued on-demand requests through its next_batch op, up to
+ * NEXT_BUDGET rounds of them. Each call covers every ID with at least n
+ * requests queued, with n the smallest such count, so the common case of an
+ * equal number of requests for each ID takes a single call.
+ *
+ * @return true if the driver may still have requests queued
+ */
+static
+bool next_driver_batch(struct driver *drv)
+{
+    size_t budget;
+    size_t count;
+    hound_err err;
+    size_t i;
+    size_t n;
+    size_t pending;
+
+    budget = NEXT_BUDGET;
+    while (budget > 0) {
+        n = budget;
+        for (i = 0; i < drv->desc_count; ++i) {
+            pending = atomic_load(&drv->next_counts[i]);
+            if (pending > 0) {
+                n = min(n, pending);
+            }
+        }
+
+        /*
+         * Only we take from the counts, so every count we saw above is still
+         * at least n. A count that was 0 may have grown since, and we include
+         * it if it reached n.
+         */
+        count = 0;
+        for (i = 0; i < drv->desc_count; ++i) {
+            if (atomic_load(&drv->next_counts[i]) >= n) {
+                atomic_fetch_sub(&drv->next_counts[i], n);
+                drv->next_ids[count] = drv->descs[i].data_id;
+                ++count;
+            }
+        }
+        if (count == 0) {
+            return false;
+        }
+
+        err = drv_op_next_batch(drv, drv->next_ids, count, n);
+        if (err != HOUND_OK) {
+            hound_log_err(
+                err,
+                "driver %p failed next_batch() call for %zu IDs",
+                (void *) drv,
+                count);
+        }
+        budget -= n;
+    }
+
+    return true;
+}
+
+/**
+ * Make a driver's queued on-demand requests, up to NEXT_BUDGET of them.
+ *
+ * @return true if the driver may still have requests queued
+ */
+static
+bool next_driver(struct driver *drv)
+{
+    size_t budget;
+    size_t calls;
+    size_t count;
+    hound_err err;
+    hound_data_id id;
+    size_t i;
+    size_t j;
+
+    if (drv->ops.next_batch != NULL) {
+        return next_driver_batch(drv);
+    }
+
+    budget = NEXT_BUDGET;
+    for (i = 0; i < drv->desc_count; ++i) {
+        if (budget == 0) {
+            return true;
+        }
+
+        count = atomic_exchange(&drv->next_counts[i], 0);
+        if (count == 0) {
+            continue;
+        }
+        calls = min(count, budget);
+        if (calls < count) {
+            atomic_fetch_add(&drv->next_counts[i], count - calls);
+        }
+        budget -= calls;
+
+        id = drv->descs[i].data_id;
+        for (j = 0; j < calls; ++j) {
+            err = drv_op_next(drv, id);
+            if (err != HOUND_OK) {
+                hound_log_err(
+                    err,
+                    "driver %p failed next() call for ID 0x%x",
+                    (void *) drv,
+                    id);
+                break;
+            }
+        }
+    }
+
+    /* We may have stopped short in the last ID. */
+    return budget == 0;
+}
+
+/**
+ * Make the on-demand requests queued for the shard's drivers.
+ *
+ * @return true if some requests are still queued, and we should come back for
+ * them without waiting
+ */
+static
+bool drain_next(struct io_shard *shard)
+{
+    struct fdctx *ctx;
+    struct driver *drv;
+    size_t i;
+    bool more;
+    const struct fd_table *table;
+
+    /*
+     * Clear the flags before looking at the counts, so a request that comes in
+     * after we looked sets them again and gets picked up next time.
+     */
+    if (!atomic_exchange(&shard->next_pending, false)) {
+        return false;
+    }
+
+    more = false;
+    table = atomic_load_explicit(&shard->table, memory_order_acquire);
+    for (i = 0; i < table->len; ++i) {
+        ctx = atomic_load_explicit(&table->ctx[i], memory_order_relaxed);
+        if (ctx == NULL || !fd_is_live(ctx)) {
+            continue;
+        }
+
+        drv = ctx->drv;
+        if (!atomic_exchange(&drv->next_pending, false)) {
+            continue;
+        }
+        if (next_driver(drv)) {
+            atomic_store(&drv->next_pending, true);
+            more = true;
+        }
+    }
+
+    if (more) {
+        atomic_store(&shard->next_pending, true);
+    }
+
+    return more;
+}
+
+/**
+ * Queue n on-demand requests for each of a list of data IDs, to be made by the
+ * driver's poll thread. This never waits on the driver, so the caller doesn't
+ * block behind a poll or parse callback. Requests for the same ID are
+ * coalesced into a count.
+ *
+ * @return true if the requests were queued, or false if the driver isn't being
+ * polled, in which case the caller should make them itself
+ */
+bool io_next(
+    struct driver *drv,
+    const hound_data_id *ids,
+    size_t count,
+    size_t n)
+{
+    size_t i;
+    size_t j;
+    struct io_shard *shard;
+
+    if (atomic_load(&drv->fdctx) == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < drv->desc_count; ++j) {
+            if (drv->descs[j].data_id == ids[i]) {
+                break;
+            }
+        }
+        XASSERT_NEQ(j, drv->desc_count);
+        atomic_fetch_add(&drv->next_counts[j], n);
+    }
+    atomic_store(&drv->next_pending, true);
+
+    /* Only the first request since the last drain needs to kick the thread. */
+    shard = &s_ios.shards[io_driver_shard(drv)];
+    if (!atomic_exchange(&shard->next_pending, true)) {
+        wake_poll(shard);
+    }
+
+    return true;
+}
+
+#ifdef CONFIG_HOUND_IO_URING
+/*
+ * Poll an fd that can't be read through io_uring (perhaps the kernel is too old
+ * for multishot reads), the same way we poll everything else.
+ */
+static
+void uring_fall_back(struct io_shard *shard, struct fdctx *ctx)
+{
+    struct epoll_event event;
+    int ret;
+
+    ctx->use_uring = false;
+    event.events = (uint32_t) ctx->events;
+    event.data.ptr = ctx;
+    ret = epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, ctx->fd, &event);
+    if (ret != 0) {
+        hound_log_err(errno, "Failed to poll fd %d", ctx->fd);
+    }
+}
+
+static
+struct io_uring_sqe *uring_get_sqe(struct io_shard *shard)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&shard->uring);
+    if (sqe == NULL) {
+        /* The submission queue is full, so flush it and try again. */
+        io_uring_submit(&shard->uring);
+        sqe = io_uring_get_sqe(&shard->uring);
+    }
+
+    return sqe;
+}
+
+static
+void uring_post_read(struct io_shard *shard, struct fdctx *ctx)
+{
+    struct uring_read *read;
+    struct uring_read **slot;
+    struct io_uring_sqe *sqe;
+
+    read = malloc(sizeof(*read));
+    if (read == NULL) {
+        goto error_alloc;
+    }
+    slot = xv_pushp(struct uring_read *, shard->reads);
+    if (slot == NULL) {
+        goto error_push;
+    }
+    sqe = uring_get_sqe(shard);
+    if (sqe == NULL) {
+        goto error_sqe;
+    }
+
+    read->ctx = ctx;
+    *slot = read;
+    io_uring_prep_read_multishot(sqe, ctx->fd, 0, 0, URING_BUF_GROUP);
+    io_uring_sqe_set_data(sqe, read);
+    ctx->uring = read;
+
+    return;
+
+error_sqe:
+    --xv_size(shard->reads);
+error_push:
+    free(read);
+error_alloc:
+    hound_log_err(HOUND_OOM, "Failed to post a read for fd %d", ctx->fd);
+    uring_fall_back(shard, ctx);
+}
+
+static
+void uring_drop_read(struct io_shard *shard, struct uring_read *read)
+{
+    size_t i;
+
+    for (i = 0; i < xv_size(shard->reads); ++i) {
+        if (xv_A(shard->reads, i) == read) {
+            xv_quickdel(shard->reads, i);
+            break;
+        }
+    }
+    free(read);
+}
+
+static
+void uring_cancel(struct io_shard *shard, struct uring_read *read)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(shard);
+    if (sqe == NULL) {
+        hound_log_err_nofmt(HOUND_OOM, "Failed to cancel a read");
+        return;
+    }
+    io_uring_prep_cancel(sqe, read, 0);
+    /* Cancel completions carry no read, so the reaper skips them. */
+    io_uring_sqe_set_data(sqe, NULL);
+}
+
+/*
+ * Post reads for new fds and cancel the reads of removed ones, which get freed
+ * when their final completion comes in. The fdctx of a removed fd may already
+ * be freed, so we look only at its address.
+ */
+static
+void sync_uring(struct io_shard *shard)
+{
+    struct fdctx *ctx;
+    size_t i;
+    size_t j;
+    struct uring_read *read;
+    const struct fd_table *table;
+
+    if (!shard->uring_ok) {
+        return;
+    }
+
+    table = atomic_load_explicit(&shard->table, memory_order_acquire);
+    for (i = 0; i < xv_size(shard->reads); ++i) {
+        read = xv_A(shard->reads, i);
+        if (read->ctx == NULL) {
+            continue;
+        }
+        for (j = 0; j < table->len; ++j) {
+            if (atomic_load_explicit(&table->ctx[j], memory_order_relaxed) ==
+                read->ctx) {
+                break;
+            }
+        }
+        if (j == table->len) {
+            read->ctx = NULL;
+            uring_cancel(shard, read);
+        }
+    }
+
+    /*
+     * A new fd is in the table slightly before its driver points at it, and
+     * we drop data for fds that aren't live, so wait until it's live. The
+     * writer kicks us again once it is.
+     */
+    for (i = 0; i < table->len; ++i) {
+        ctx = atomic_load_explicit(&table->ctx[i], memory_order_relaxed);
+        if (ctx != NULL &&
+            ctx->use_uring &&
+            ctx->uring == NULL &&
+            fd_is_live(ctx)) {
+            uring_post_read(shard, ctx);
+        }
+    }
+
+    io_uring_submit(&shard->uring);
+}
+
+/*
+ * Handle the completions on a shard's ring. Each one fills a buffer, which goes
+ * straight to the driver's parse op and then back to the kernel.
+ */
+static
+void reap_uring(struct io_shard *shard)
+{
+    unsigned char *buf;
+    unsigned bid;
+    unsigned count;
+    struct io_uring_cqe *cqe;
+    struct fdctx *ctx;
+    unsigned flags;
+    int mask;
+    struct uring_read *read;
+    int res;
+
+    mask = io_uring_buf_ring_mask(URING_BUF_COUNT);
+    count = 0;
+    while (count < URING_BUF_COUNT &&
+           io_uring_peek_cqe(&shard->uring, &cqe) == 0) {
+        read = io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        flags = cqe->flags;
+        io_uring_cqe_seen(&shard->uring, cqe);
+        if (read == NULL) {
+            continue;
+        }
+        ctx = read->ctx;
+
+        if (flags & IORING_CQE_F_BUFFER) {
+            bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            buf = shard->uring_bufs + bid*URING_BUF_SIZE;
+            if (ctx != NULL && res > 0 && fd_is_live(ctx)) {
+                count_read(ctx->drv, ctx->fd, res);
+                parse_read(ctx->drv, ctx->fd, buf, res, false);
+            }
+            io_uring_buf_ring_add(
+                shard->buf_ring,
+                buf,
+                URING_BUF_SIZE,
+                bid,
+                mask,
+                count);
+            ++count;
+        }
+
+        if (flags & IORING_CQE_F_MORE) {
+            continue;
+        }
+
+        /* The kernel is done with this read. */
+        uring_drop_read(shard, read);
+        if (ctx == NULL || !fd_is_live(ctx)) {
+            continue;
+        }
+        ctx->uring = NULL;
+        if (res == -ENOBUFS) {
+            /*
+             * We ran out of buffers. They go back to the kernel before we
+             * submit, so just start over.
+             */
+            uring_post_read(shard, ctx);
+        }
+        else {
+            uring_fall_back(shard, ctx);
+        }
+    }
+
+    io_uring_buf_ring_advance(shard->buf_ring, count);
+    io_uring_submit(&shard->uring);
+}
+#endif
+
+static
+void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * If busy polling is on, spins on zero-timeout waits until something happens,
+ * a timer comes due at deadline, or the busy-poll time runs out. Returns false
+ * if the poll loop should block after all.
+ */
+static
+bool busy_wait(
+    struct io_shard *shard,
+    struct epoll_event *events,
+    hound_data_period deadline,
+    int *nevents)
+{
+    uint_least64_t busy_ns;
+    hound_data_period end;
+    hound_data_period now;
+
+    busy_ns = atomic_load_explicit(&shard->busy_poll_ns, memory_order_relaxed);
+    if (busy_ns == 0) {
+        return false;
+    }
+
+    now = get_time_ns();
+    end = now + busy_ns;
+    while (true) {
+        *nevents = epoll_wait(shard->epoll_fd, events, EPOLL_EVENTS, 0);
+        if (*nevents != 0) {
+            if (*nevents > 0) {
+                stats_add(&shard->busy_wakeups, 1);
+            }
+            return true;
+        }
+
+        now = get_time_ns();
+        if (now >= deadline) {
+            /* A timer is due, which fire_timers will see. */
+            stats_add(&shard->busy_wakeups, 1);
+            return true;
+        }
+        if (now >= end) {
+            return false;
+        }
+        cpu_relax();
+    }
+}
+
+static
+void poll_once(struct io_shard *shard)
+{
+    bool busy;
+    struct fdctx *ctx;
+    hound_err err;
+    struct epoll_event events[EPOLL_EVENTS];
+    uint_least64_t gen;
+    bool have_timeout;
+    size_t i;
+    int j;
+    short next_events;
+    int nevents;
+    hound_data_period now;
+#ifdef CONFIG_HOUND_IO_URING
+    bool reap;
+#endif
+    short revents;
+    bool timeout_enabled;
+    hound_data_period timeout_ns;
+    int timeout_ms;
+    struct heap_timer *top;
+
+    stats_add(&shard->iterations, 1);
+
+    /* Pick up any table or request changes, and find our next deadline. */
+    now = get_time_ns();
+    gen = atomic_load(&shard->gen);
+    have_timeout = false;
+    timeout_ns = UINT64_MAX;
+    if (gen != shard->timers_gen) {
+#ifdef CONFIG_HOUND_IO_URING
+        sync_uring(shard);
+#endif
+        err = rebuild_timers(shard, now);
+        if (err == HOUND_OK) {
+            shard->timers_gen = gen;
+        }
+        else {
+            hound_log_err_nofmt(err, "Failed to rebuild timers");
+            have_timeout = true;
+            timeout_ns = REBUILD_RETRY_NS;
+        }
+    }
+    if (drain_next(shard)) {
+        have_timeout = true;
+        timeout_ns = 0;
+    }
+    top = timer_heap_peek(&shard->timers);
+    if (top != NULL) {
+        have_timeout = true;
+        if (top->deadline <= now) {
+            timeout_ns = 0;
+        }
+        else {
+            timeout_ns = min(timeout_ns, top->deadline - now);
+        }
+    }
+    timeout_ms = arm_timer(shard, have_timeout, timeout_ns);
+
+    /* Wait for I/O, spinning first if we're busy polling. */
+    busy = false;
+    if (timeout_ms != 0) {
+        busy = busy_wait(
+            shard,
+            events,
+            have_timeout ? now + timeout_ns : UINT64_MAX,
+            &nevents);
+    }
+    if (!busy) {
+        nevents = epoll_wait(
+            shard->epoll_fd,
+            events,
+            ARRAYLEN(events),
+            timeout_ms);
+        if (nevents > 0 && timeout_ms != 0) {
+            stats_add(&shard->blocking_wakeups, 1);
+        }
+    }
+    now = get_time_ns();
+    if (nevents > 0 && need_to_wake(shard, events, nevents)) {
+        /* Something changed, so start over with fresh snapshots. */
+        return;
+    }
+    else if (nevents == -1) {
+        /* Error. */
+        if (errno == EINTR) {
+            /* We got a signal. Restart the syscall. */
+            return;
+        }
+        else if (errno == ENOMEM) {
+            hound_log_err_nofmt(errno, "epoll_wait failed with ENOMEM");
+        }
+        else {
+            /* Other error codes are likely program bugs. */
+            XASSERT_ERROR;
+        }
+        nevents = 0;
+    }
+
+    /* Gather the fds that have events or timers that fired. */
+    xv_size(shard->ready) = 0;
+#ifdef CONFIG_HOUND_IO_URING
+    reap = false;
+#endif
+    for (j = 0; j < nevents; ++j) {
+        if (events[j].data.ptr == TIMER_TAG(shard)) {
+            clear_timer(shard);
+            continue;
+        }
+#ifdef CONFIG_HOUND_IO_URING
+        if (events[j].data.ptr == URING_TAG(shard)) {
+            reap = true;
+            continue;
+        }
+#endif
+        ctx = events[j].data.ptr;
+        ctx->revents = (short) events[j].events;
+        mark_ready(shard, ctx);
+    }
+    fire_timers(shard, now);
+#ifdef CONFIG_HOUND_IO_URING
+    if (reap) {
+        reap_uring(shard);
+    }
+#endif
+
+    for (i = 0; i < xv_size(shard->ready); ++i) {
+        ctx = xv_A(shard->ready, i);
+        ctx->ready = false;
+        revents = ctx->revents;
+        ctx->revents = 0;
+
+        /*
+         * The fd may have been removed since epoll reported it or its timer
+         * was set. Its fdctx is still valid until this pass ends, but its
+         * driver is going away.
+         */
+        if (!fd_is_live(ctx)) {
+            continue;
+        }
+
+        next_events = ctx->events;
+        err = io_read(
+            ctx,
+            now,
+            revents,
+            &next_events,
+            &timeout_enabled,
+            &timeout_ns);
+        set_events(ctx, next_events);
+        set_fd_timeout(ctx, timeout_enabled, now, timeout_ns);
+        if (err == HOUND_INTR) {
+            /*
+             * A signal interrupted a read; finish reading later. Any fds we
+             * haven't gotten to yet are still ready, so epoll will report them
+             * again, and their due pulls stay queued until their next timer
+             * fires.
              */
-            drv_free(rec_info);
+            for (++i; i < xv_size(shard->ready); ++i) {
+                ctx = xv_A(shard->ready, i);
+                ctx->ready = false;
+                ctx->revents = 0;
+            }
+            break;
+        }
+        if (err != HOUND_OK) {
+            hound_log_err(err, "Failed to grab record from fd %d", ctx->fd);
+            continue;
         }
     }
-
-    pthread_rwlock_unlock(&s_ios.lock);
 }
 
 static
-hound_data_period get_time_ns(void)
+void *io_poll(void *data)
 {
-    struct timespec ts;
-
-    /*
-     * Use CLOCK_MONOTONIC_RAW, as it's not subject to time discontinuities due
-     * to NTP, leap seconds, etc.
-     */
-    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    unsigned epoch;
+    struct io_shard *shard;
+
+    shard = data;
+    while (!atomic_load_explicit(&shard->stop, memory_order_relaxed)) {
+        epoch = read_lock(shard);
+        poll_once(shard);
+        read_unlock(shard, epoch);
+    }
 
-    return NSEC_PER_SEC*ts.tv_sec + ts.tv_nsec;
+    return NULL;
 }
 
 static
-hound_err make_records(struct driver *drv, unsigned char *buf, size_t size)
+hound_err io_start_poll(struct io_shard *shard)
 {
-    ssize_t bytes_read;
     hound_err err;
-    int fd;
-
-    fd = drv_fd();
-    bytes_read = read(fd, buf, size);
-    if (bytes_read <= 0) {
-        if (bytes_read == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
-            /* No more data to read, so we're done. */
-            return HOUND_OK;
-        }
-
-        /* Someone wanted to pause polling; we can finish reading later. */
-        if (errno == EINTR) {
-            return HOUND_INTR;
-        }
-        else if (errno == EIO) {
-            hound_log_err(errno, "read returned EIO on fd %d", fd);
-            return HOUND_IO_ERROR;
-        }
-        else {
-            /* Other error codes are likely program bugs. */
-            XASSERT_ERROR;
-        }
-    }
 
-    /*
-     * NOTE: We don't use drv_ops_parse here, which would set the active
-     * driver and take the driver ops mutex. This is because we are already
-     * inside a driver ops callback, so re-taking the mutex will cause a
-     * deadlock!
-     */
-    err = drv->ops.parse(buf, bytes_read);
-    if (err != HOUND_OK) {
-        hound_log_err(
-                err,
-                "Driver failed to parse records (size = %zu, drv = 0x%p)",
-                bytes_read, drv);
+    err = pthread_create(&shard->thread, NULL, io_poll, shard);
+    if (err != 0) {
         return err;
     }
 
     return HOUND_OK;
 }
 
-hound_err io_default_pull(
-    short events,
-    short *next_events,
-    hound_data_period poll_time,
-    bool *timeout_enabled,
-    hound_data_period *timeout)
+static
+void io_stop_poll(struct io_shard *shard)
 {
-    struct driver *drv;
     hound_err err;
-    size_t i;
-    struct pull_info *info;
-    xhiter_t iter;
-    hound_data_period lateness;
-    hound_data_period min_timeout;
-    struct pull_timeout_info *timeout_info;
-    hound_data_period time_since_last_poll;
 
-    drv = get_active_drv();
+    atomic_store(&shard->stop, true);
+    wake_poll(shard);
 
-    iter = xh_get(PULL_MAP, s_pull_map, drv_fd());
-    XASSERT_NEQ(iter, xh_end(s_pull_map));
-    info = &xh_val(s_pull_map, iter);
+    err = pthread_join(shard->thread, NULL);
+    XASSERT_EQ(err, 0);
+}
 
-    /* Adjust our timeout data and trigger a pull if a timeout expired. */
-    time_since_last_poll = poll_time - info->last_pull;
-    min_timeout = UINT64_MAX;
-    for (i = 0; i < xv_size(info->timeout_info); ++i) {
-        timeout_info = &xv_A(info->timeout_info, i);
+hound_err io_set_shard_cpus(size_t shard, const int *cpus, size_t cpu_count)
+{
+    cpu_set_t cpu_set;
+    hound_err err;
+    size_t i;
 
-        if (time_since_last_poll >= timeout_info->current_timeout) {
-            /* Driver is ready to pull data. */
-            lateness = time_since_last_poll - timeout_info->current_timeout;
-            /*
-             * NOTE: We don't use drv_ops_next here, which would set the active
-             * driver and take the driver ops mutex. This is because we are already
-             * inside a driver ops callback, so re-taking the mutex will cause a
-             * deadlock!
-             */
-            err = drv->ops.next(timeout_info->id);
-            if (err != HOUND_OK) {
-                hound_log_err(
-                        err,
-                        "driver %p failed to pull data",
-                        (void *) drv);
-            }
-            if (lateness >= timeout_info->max_timeout) {
-                /* We were so late that the driver is ready again. */
-                timeout_info->current_timeout = 0;
-            }
-            else {
-                timeout_info->current_timeout =
-                    timeout_info->max_timeout - lateness;
-            }
-        }
-        else {
-            timeout_info->current_timeout -= time_since_last_poll;
+    if (shard >= CONFIG_HOUND_IO_SHARDS || cpu_count == 0) {
+        return HOUND_INVALID_VAL;
+    }
+
+    CPU_ZERO(&cpu_set);
+    for (i = 0; i < cpu_count; ++i) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            return HOUND_INVALID_VAL;
         }
+        CPU_SET(cpus[i], &cpu_set);
+    }
+    err = pthread_setaffinity_np(
+        s_ios.shards[shard].thread,
+        sizeof(cpu_set),
+        &cpu_set);
+    if (err != 0) {
+        return err;
+    }
 
-        /* Find the next lowest timeout. */
-        min_timeout = min(min_timeout, timeout_info->current_timeout);
+    return HOUND_OK;
+}
+
+hound_err io_set_shard_sched(
+    size_t shard,
+    hound_sched_policy policy,
+    int priority)
+{
+    hound_err err;
+    struct sched_param param;
+    int sched_policy;
+
+    if (shard >= CONFIG_HOUND_IO_SHARDS) {
+        return HOUND_INVALID_VAL;
     }
 
-    if (events & POLLIN) {
-        err = make_records(drv, s_read_buf, ARRAYLEN(s_read_buf));
+    switch (policy) {
+        case HOUND_SCHED_OTHER:
+            sched_policy = SCHED_OTHER;
+            break;
+        case HOUND_SCHED_FIFO:
+            sched_policy = SCHED_FIFO;
+            break;
+        case HOUND_SCHED_RR:
+            sched_policy = SCHED_RR;
+            break;
+        default:
+            return HOUND_INVALID_VAL;
     }
-    else {
-        err = HOUND_OK;
+    if (priority < sched_get_priority_min(sched_policy) ||
+        priority > sched_get_priority_max(sched_policy)) {
+        return HOUND_INVALID_VAL;
     }
 
+    param.sched_priority = priority;
+    err = pthread_setschedparam(
+        s_ios.shards[shard].thread,
+        sched_policy,
+        &param);
+    if (err != 0) {
+        return err;
+    }
 
-    *next_events = POLLIN;
-    *timeout_enabled = true;
-    *timeout = min_timeout;
-    info->last_pull = poll_time;
-
-    return err;
+    return HOUND_OK;
 }
 
-hound_err io_default_push(
-    short events,
-    short *next_events,
-    UNUSED hound_data_period pull_time,
-    bool *timeout_enabled,
-    UNUSED hound_data_period *timeout)
+/*
+ * Asks the kernel to busy poll a socket's device queue for up to busy_ns on
+ * blocking reads and polls. Only sockets support this, and raising it past
+ * the system default takes CAP_NET_ADMIN, so failing is fine.
+ */
+static
+void set_sock_busy_poll(int fd, uint_least64_t busy_ns)
 {
-    *next_events = POLLIN;
-    *timeout_enabled = false;
+    int ret;
+    int usec;
 
-    if (!(events & POLLIN)) {
-        return HOUND_OK;
+    usec = (int) min(busy_ns / NSEC_PER_USEC, INT_MAX);
+    ret = setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+    if (ret != 0 && errno != ENOTSOCK) {
+        hound_log_err(errno, "Failed to set SO_BUSY_POLL on fd %d", fd);
     }
-
-    return make_records(get_active_drv(), s_read_buf, ARRAYLEN(s_read_buf));
 }
 
-static
-hound_err io_read(
-    struct fdctx *ctx,
-    hound_data_period poll_time,
-    short events,
-    short *next_events)
+hound_err io_set_shard_busy_poll(size_t shard_index, uint64_t busy_ns)
 {
-    hound_err err;
+    struct fdctx *ctx;
+    size_t i;
+    struct io_shard *shard;
+    struct fd_table *table;
 
-    ctx->timeout_enabled = false;
-    ctx->timeout_ns = UINT64_MAX;
-    err = drv_op_poll(
-        ctx->drv,
-        events,
-        next_events,
-        poll_time,
-        &ctx->timeout_enabled,
-        &ctx->timeout_ns);
-    if (err != HOUND_OK) {
-        return err;
+    if (shard_index >= CONFIG_HOUND_IO_SHARDS) {
+        return HOUND_INVALID_VAL;
+    }
+    shard = &s_ios.shards[shard_index];
+
+    lock_mutex(&shard->update_lock);
+    atomic_store_explicit(&shard->busy_poll_ns, busy_ns, memory_order_relaxed);
+    table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    for (i = 0; i < table->len; ++i) {
+        ctx = atomic_load_explicit(&table->ctx[i], memory_order_relaxed);
+        if (ctx != NULL) {
+            set_sock_busy_poll(ctx->fd, busy_ns);
+        }
     }
+    unlock_mutex(&shard->update_lock);
+
+    /* Have the poll thread pick up the new setting now. */
+    wake_poll(shard);
 
     return HOUND_OK;
 }
 
-/**
- * Wait until it's safe for the event loop to continue.
- */
+void io_get_shard_latency(size_t shard_index, struct hound_io_latency *stats)
+{
+    struct io_shard *shard;
+
+    XASSERT_LT(shard_index, CONFIG_HOUND_IO_SHARDS);
+    shard = &s_ios.shards[shard_index];
+
+    stats->blocking_wakeups = atomic_load_explicit(
+        &shard->blocking_wakeups,
+        memory_order_relaxed);
+    stats->busy_wakeups = atomic_load_explicit(
+        &shard->busy_wakeups,
+        memory_order_relaxed);
+    stats->timer_fires = atomic_load_explicit(
+        &shard->wakeup_jitter_ns.count,
+        memory_order_relaxed);
+    stats->timer_late_total_ns = atomic_load_explicit(
+        &shard->wakeup_jitter_ns.total,
+        memory_order_relaxed);
+    stats->timer_late_max_ns = atomic_load_explicit(
+        &shard->wakeup_jitter_ns.max,
+        memory_order_relaxed);
+}
+
+void io_get_shard_stats(size_t shard_index, struct hound_io_stats *stats)
+{
+    struct io_shard *shard;
+
+    XASSERT_LT(shard_index, CONFIG_HOUND_IO_SHARDS);
+    shard = &s_ios.shards[shard_index];
+
+    stats->iterations = atomic_load_explicit(
+        &shard->iterations,
+        memory_order_relaxed);
+    stats_histogram_read(&shard->sync_stall_ns, &stats->sync_stall_ns);
+    stats_histogram_read(&shard->wakeup_jitter_ns, &stats->wakeup_jitter_ns);
+}
+
 static
-void io_wait_for_ready(void) {
-    lock_mutex(&s_poll_mutex);
-    while (!s_poll_active_target) {
-        s_poll_active_current = false;
-        cond_signal(&s_poll_cond);
-        cond_wait(&s_poll_cond, &s_poll_mutex);
+struct fd_rqs *rqs_alloc(void)
+{
+    struct fd_rqs *rqs;
+
+    rqs = malloc(sizeof(*rqs));
+    if (rqs == NULL) {
+        return NULL;
     }
-    s_poll_active_current = true;
-    unlock_mutex(&s_poll_mutex);
+    rqs->gen = 1;
+    xv_init(rqs->queues);
+    xv_init(rqs->periods);
+    rqs->spans = NULL;
+    rqs->span_count = 0;
+    rqs->targets = NULL;
+    rqs->pushes = NULL;
+    rqs->push_count = 0;
+
+    return rqs;
 }
 
 static
-void populate_timespec(hound_data_period ts, struct timespec *spec)
+void rqs_free(struct fd_rqs *rqs)
 {
-    spec->tv_sec = ts / NSEC_PER_SEC;
-    spec->tv_nsec = ts % NSEC_PER_SEC;
+    struct queue_entry *entry;
+    size_t i;
+
+    for (i = 0; i < xv_size(rqs->queues); ++i) {
+        entry = &xv_A(rqs->queues, i);
+        if (entry->dec != NULL) {
+            decimator_unref(entry->dec);
+        }
+    }
+    xv_destroy(rqs->queues);
+    xv_destroy(rqs->periods);
+    free(rqs->spans);
+    free(rqs->targets);
+    free(rqs->pushes);
+    free(rqs);
 }
 
 static
-bool need_to_pause(void)
+struct fd_rqs *rqs_copy(const struct fd_rqs *rqs)
 {
-    char buf;
-    ssize_t bytes;
-    struct pollfd *pfd;
-    bool result;
-
-    pthread_rwlock_rdlock(&s_ios.lock);
+    struct fd_rqs *copy;
+    size_t i;
+    struct queue_entry *entry;
+    struct pull_period *period;
 
-    pfd = &xv_A(s_ios.fds, PAUSE_FD_INDEX);
-    if (!(pfd->revents & POLLIN)) {
-        result = false;
-        goto out;
+    copy = rqs_alloc();
+    if (copy == NULL) {
+        return NULL;
     }
+    copy->gen = rqs->gen + 1;
+    /* The copy gets a dispatch table of its own once its entries change. */
 
-    /* Read the self-pipe so it can be used again. */
-    do {
-        bytes = read(pfd->fd, &buf, sizeof(buf));
-        XASSERT_NEQ(bytes, -1);
-    } while (bytes != sizeof(buf));
+    for (i = 0; i < xv_size(rqs->queues); ++i) {
+        entry = xv_pushp(struct queue_entry, copy->queues);
+        if (entry == NULL) {
+            goto error;
+        }
+        *entry = xv_A(rqs->queues, i);
+        /* The copy shares the decimator, so its window carries over. */
+        if (entry->dec != NULL) {
+            decimator_ref(entry->dec);
+        }
+    }
+    for (i = 0; i < xv_size(rqs->periods); ++i) {
+        period = xv_pushp(struct pull_period, copy->periods);
+        if (period == NULL) {
+            goto error;
+        }
+        *period = xv_A(rqs->periods, i);
+    }
 
-    result = true;
+    return copy;
 
-out:
-    pthread_rwlock_unlock(&s_ios.lock);
-    return result;
+error:
+    rqs_free(copy);
+    return NULL;
 }
 
+/*
+ * Works out how a new queue entry folds, from all of its queue's requests for
+ * the entry's data ID, and takes the filter from the first of them. fold_rqs
+ * fills in the stride and decimator later, once it knows what everyone else
+ * asked for.
+ */
 static
-void *io_poll(UNUSED void *data)
+void init_entry_fold(
+    struct queue_entry *entry,
+    const struct hound_data_rq *rqs,
+    size_t rqs_len)
 {
-    struct fdctx *ctx;
-    hound_err err;
-    bool fd_timeout;
+    bool found;
     size_t i;
-    int fds;
-    bool have_timeout;
-    uint_fast64_t last_poll_ns;
-    hound_data_period min_timeout;
-    hound_data_period now;
-    struct pollfd *pfd;
-    struct timespec *timeout;
-    struct timespec timeout_spec;
-    hound_data_period time_since_last_poll;
+    const struct hound_data_rq *rq;
 
-    last_poll_ns = get_time_ns();
+    entry->fold_period = 0;
+    entry->decimate = true;
+    entry->aggregate = HOUND_AGGREGATE_NONE;
+    entry->stride = 1;
+    entry->dec = NULL;
 
-    while (true) {
-        io_wait_for_ready();
-
-        /* Find the timeout we need for the poll (if any). */
-        have_timeout = false;
-        min_timeout = UINT64_MAX;
-        for (i = 0; i < xv_size(s_ios.ctx); ++i) {
-            ctx = &xv_A(s_ios.ctx, i);
-            if (!ctx->timeout_enabled) {
-                continue;
-            }
-            have_timeout = true;
-            min_timeout = min(min_timeout, ctx->timeout_ns);
-        }
-        if (have_timeout) {
-            populate_timespec(min_timeout, &timeout_spec);
-            timeout = &timeout_spec;
+    found = false;
+    for (i = 0; i < rqs_len; ++i) {
+        rq = &rqs[i];
+        if (rq->id != entry->id) {
+            continue;
         }
-        else {
-            timeout = NULL;
+        if (!found) {
+            entry->filter = rq->filter;
+            found = true;
         }
-
-        /*
-         * Wait for I/O. We use ppoll for a more precise timeout, not because we
-         * need to care about signals.
-         */
-        fds = ppoll(xv_data(s_ios.fds), xv_size(s_ios.fds), timeout, NULL);
-        now = get_time_ns();
-        time_since_last_poll = now - last_poll_ns;
-        last_poll_ns = now;
-        if (fds > 0 && need_to_pause()) {
+        if (!driver_rq_foldable(rq)) {
+            /* Decimating would drop records this request asked for. */
+            entry->decimate = false;
             continue;
         }
-        else if (fds == -1) {
-            /* Error. */
-            if (errno == EINTR) {
-                /* We got a signal. Restart the syscall. */
-                continue;
-            }
-            else if (errno == ENOMEM) {
-                hound_log_err_nofmt(errno, "poll failed with ENOMEM");
-            }
-            else if (errno == EIO) {
-                hound_log_err_nofmt(errno, "poll failed with EIO");
-            }
-            else {
-                /* Other error codes are likely program bugs. */
-                XASSERT_ERROR;
-            }
+        if (entry->fold_period == 0 || rq->period_ns < entry->fold_period) {
+            entry->fold_period = rq->period_ns;
+            entry->aggregate = rq->aggregate;
         }
+    }
 
-        /* Read all fds that have data, and adjust timeouts. */
-        pthread_rwlock_rdlock(&s_ios.lock);
-        for (i = DATA_FD_START; i < xv_size(s_ios.fds); ++i) {
-            ctx = get_fdctx_from_fd_index(i);
-            pfd = &xv_A(s_ios.fds, i);
-
-            if (ctx->timeout_enabled) {
-                if (time_since_last_poll >= ctx->timeout_ns) {
-                    ctx->timeout_enabled = false;
-                    fd_timeout = true;
-                }
-                else {
-                    ctx->timeout_ns -= time_since_last_poll;
-                }
-            }
-            else {
-                fd_timeout = false;
-            }
+    if (entry->fold_period == 0) {
+        entry->decimate = false;
+    }
+}
 
-            if (pfd->revents == 0 && !fd_timeout) {
-                continue;
-            }
+/*
+ * Returns the fastest foldable period any queue asked for, which is the period
+ * the driver runs at for the data ID; see make_active_data_vec in driver.c.
+ */
+static
+hound_data_period get_base_period(
+    const struct fd_rqs *fd_rqs,
+    hound_data_id id)
+{
+    hound_data_period base;
+    const struct queue_entry *entry;
+    size_t i;
 
-            err = io_read(ctx, now, pfd->revents, &pfd->events);
-            if (err == HOUND_INTR) {
-                /* Someone wants to pause polling; finish reading later. */
-                break;
-            }
-            if (err != HOUND_OK) {
-                hound_log_err(err, "Failed to grab record from fd %d", pfd->fd);
-                continue;
-            }
+    base = 0;
+    for (i = 0; i < xv_size(fd_rqs->queues); ++i) {
+        entry = &xv_A(fd_rqs->queues, i);
+        if (entry->id == id &&
+            entry->fold_period > 0 &&
+            (base == 0 || entry->fold_period < base)) {
+            base = entry->fold_period;
         }
-        pthread_rwlock_unlock(&s_ios.lock);
     }
 
-    return NULL;
+    return base;
 }
 
 static
-void pause_poll(void)
+const struct hound_datadesc *get_desc(
+    const struct driver *drv,
+    hound_data_id id)
 {
-    ssize_t bytes;
-    static const char payload = 1;
+    size_t i;
 
-    /*
-     * Wait until the poll has actually canceled. io_wait_for_ready will signal
-     * on the condition variable when it is run.
-     */
-    lock_mutex(&s_poll_mutex);
-    s_poll_active_target = false;
-    while (s_poll_active_current) {
-        do {
-            bytes = write(s_self_pipe[WRITE_END], &payload, sizeof(payload));
-            XASSERT_NEQ(bytes, -1);
-        } while (bytes != sizeof(payload));
-        cond_signal(&s_poll_cond);
-        cond_wait(&s_poll_cond, &s_poll_mutex);
+    for (i = 0; i < drv->desc_count; ++i) {
+        if (drv->descs[i].data_id == id) {
+            return &drv->descs[i];
+        }
     }
-    unlock_mutex(&s_poll_mutex);
-}
 
-static
-void resume_poll(void)
-{
-    lock_mutex(&s_poll_mutex);
-    s_poll_active_target = true;
-    cond_signal(&s_poll_cond);
-    unlock_mutex(&s_poll_mutex);
+    /* The driver accepted a request for this ID, so it must have a desc. */
+    XASSERT_ERROR;
 }
 
+/*
+ * Fold every request onto the base period of its data ID. Queue entries at a
+ * whole multiple of the base period get a decimator with the matching stride,
+ * as do queue entries with a filter. Pull periods the base period covers don't
+ * get timers of their own, as the driver pulls only at the base period. Around
+ * a change, a queue may see a few records at the old rate while the driver
+ * catches up.
+ */
 static
-hound_err io_start_poll(void)
+hound_err fold_rqs(struct fd_rqs *fd_rqs, const struct driver *drv)
 {
+    hound_data_period base;
+    struct queue_entry *entry;
     hound_err err;
+    size_t i;
+    size_t j;
+    const struct pull_period *other;
+    struct pull_period *period;
+
+    for (i = 0; i < xv_size(fd_rqs->queues); ++i) {
+        entry = &xv_A(fd_rqs->queues, i);
+        entry->stride = 1;
+        if (entry->decimate) {
+            base = get_base_period(fd_rqs, entry->id);
+            if (entry->fold_period % base == 0) {
+                entry->stride = entry->fold_period / base;
+            }
+        }
 
-    err = pthread_create(&s_poll_thread, NULL, io_poll, NULL);
-    if (err != 0) {
-        return err;
+        /*
+         * Keep a decimator's window across changes only while it still does
+         * what the entry asks for.
+         */
+        if (entry->dec != NULL &&
+            ((entry->stride == 1 && entry->filter.flags == 0) ||
+             !decimator_matches(
+                 entry->dec,
+                 entry->aggregate,
+                 &entry->filter))) {
+            decimator_unref(entry->dec);
+            entry->dec = NULL;
+        }
+        if (entry->dec == NULL &&
+            (entry->stride > 1 || entry->filter.flags != 0)) {
+            err = decimator_alloc(
+                get_desc(drv, entry->id),
+                entry->aggregate,
+                &entry->filter,
+                &entry->dec);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
+    }
+
+    for (i = 0; i < xv_size(fd_rqs->periods); ++i) {
+        period = &xv_A(fd_rqs->periods, i);
+        period->folded = false;
+        if (!period->foldable) {
+            continue;
+        }
+
+        base = get_base_period(fd_rqs, period->id);
+        if (period->period_ns % base != 0) {
+            continue;
+        }
+        if (period->period_ns != base) {
+            period->folded = true;
+            continue;
+        }
+
+        /* Only the first request at the base period gets a timer. */
+        for (j = 0; j < i; ++j) {
+            other = &xv_A(fd_rqs->periods, j);
+            if (other->id == period->id &&
+                other->foldable &&
+                other->period_ns == base) {
+                period->folded = true;
+                break;
+            }
+        }
     }
 
     return HOUND_OK;
 }
 
+/* Orders dispatch targets by data ID, then by entry order. */
 static
-void io_stop_poll(void)
+int compare_targets(const void *a, const void *b)
 {
-    hound_err err;
-    void *ret;
-
-    /* First let the event loop gracefully exit. */
-    pause_poll();
+    const struct queue_entry *x;
+    const struct queue_entry *y;
 
-    /* Now shoot it in the head. */
-    err = pthread_cancel(s_poll_thread);
-    XASSERT_EQ(err, 0);
-
-    /* Wait until the thread is finally dead. */
-    err = pthread_join(s_poll_thread, &ret);
-    XASSERT_EQ(err, 0);
-    XASSERT_EQ(ret, PTHREAD_CANCELED);
+    x = *((const struct queue_entry * const *) a);
+    y = *((const struct queue_entry * const *) b);
+    if (x->id < y->id) {
+        return -1;
+    }
+    else if (x->id > y->id) {
+        return 1;
+    }
+    else if (x < y) {
+        return -1;
+    }
+    else if (x > y) {
+        return 1;
+    }
+    return 0;
 }
 
+/*
+ * Builds the dispatch table for a snapshot whose queue entries are final. The
+ * table points into the entries, so it's rebuilt whenever they change.
+ */
 static
-void set_fd_timeout(int fd, struct fdctx *ctx)
+hound_err index_rqs(struct fd_rqs *fd_rqs)
 {
+    const struct queue_entry *entry;
     size_t i;
-    struct pull_info *info;
-    xhiter_t iter;
-    hound_data_period min_timeout;
-    struct pull_timeout_info *timeout_info;
+    size_t j;
+    size_t len;
+    struct dispatch_span *span;
+
+    free(fd_rqs->spans);
+    free(fd_rqs->targets);
+    free(fd_rqs->pushes);
+    fd_rqs->spans = NULL;
+    fd_rqs->span_count = 0;
+    fd_rqs->targets = NULL;
+    fd_rqs->pushes = NULL;
+    fd_rqs->push_count = 0;
+
+    len = xv_size(fd_rqs->queues);
+    if (len == 0) {
+        return HOUND_OK;
+    }
 
-    /*
-     * This function should be called only for pull-mode drivers, so we should
-     * always find our fd in the pull-mode map.
-     */
-    iter = xh_get(PULL_MAP, s_pull_map, fd);
-    XASSERT_NEQ(iter, xh_end(s_pull_map));
-    info = &xh_val(s_pull_map, iter);
+    fd_rqs->spans = malloc(len * sizeof(*fd_rqs->spans));
+    fd_rqs->targets = malloc(len * sizeof(*fd_rqs->targets));
+    fd_rqs->pushes = malloc(len * sizeof(*fd_rqs->pushes));
+    if (fd_rqs->spans == NULL ||
+        fd_rqs->targets == NULL ||
+        fd_rqs->pushes == NULL) {
+        return HOUND_OOM;
+    }
 
-    if (xv_size(info->timeout_info) == 0) {
-        /* No timing entries; nothing to do here. */
-        ctx->timeout_enabled = false;
-        ctx->timeout_ns = UINT64_MAX;
-        return;
+    for (i = 0; i < len; ++i) {
+        entry = &xv_A(fd_rqs->queues, i);
+        fd_rqs->targets[i] = entry;
+
+        if (entry->cursor != NULL) {
+            continue;
+        }
+        for (j = 0; j < fd_rqs->push_count; ++j) {
+            if (fd_rqs->pushes[j] == entry->queue) {
+                break;
+            }
+        }
+        if (j == fd_rqs->push_count) {
+            fd_rqs->pushes[j] = entry->queue;
+            ++fd_rqs->push_count;
+        }
     }
 
-    min_timeout = UINT64_MAX;
-    for (i = 0; i < xv_size(info->timeout_info); ++i) {
-        timeout_info = &xv_A(info->timeout_info, i);
-        min_timeout = min(min_timeout, timeout_info->current_timeout);
+    qsort(fd_rqs->targets, len, sizeof(*fd_rqs->targets), compare_targets);
+    span = NULL;
+    for (i = 0; i < len; ++i) {
+        entry = fd_rqs->targets[i];
+        if (span == NULL || span->id != entry->id) {
+            span = &fd_rqs->spans[fd_rqs->span_count];
+            span->id = entry->id;
+            span->start = i;
+            span->len = 0;
+            ++fd_rqs->span_count;
+        }
+        ++span->len;
     }
-    ctx->timeout_enabled = true;
-    ctx->timeout_ns = min_timeout;
+
+    return HOUND_OK;
 }
 
 static
-hound_err add_queue_nolock(
-    int fd,
+hound_err add_rqs(
+    struct fd_rqs *fd_rqs,
+    bool pull_mode,
     const struct hound_data_rq *rqs,
     size_t rqs_len,
     struct queue *queue)
 {
-    struct fdctx *ctx;
     struct queue_entry *entry;
-    hound_err err;
     size_t i;
-    struct pull_info *info;
-    xhiter_t iter;
     size_t j;
-    size_t queue_count;
+    struct pull_period *period;
     const struct hound_data_rq *rq;
-    struct pull_timeout_info *timeout_info;
-
-    ctx = get_fdctx(fd);
-    XASSERT_NOT_NULL(ctx);
 
-    err = HOUND_OK;
-    queue_count = 0;
     for (i = 0; i < rqs_len; ++i) {
         /*
          * Add exactly one queue entry per data ID in this request. If we add
@@ -666,16 +2694,17 @@ hound_err add_queue_nolock(
         }
         if (j == i) {
             /* We haven't yet added a queue entry for this data ID. */
-            entry = xv_pushp(struct queue_entry, ctx->queues);
+            entry = xv_pushp(struct queue_entry, fd_rqs->queues);
             if (entry == NULL) {
                 return HOUND_OOM;
             }
             entry->id = rq->id;
             entry->queue = queue;
-            ++queue_count;
+            entry->cursor = queue_cursor(queue);
+            init_entry_fold(entry, rqs, rqs_len);
         }
 
-        if (driver_is_pull_mode(ctx->drv) && rq->period_ns > 0) {
+        if (pull_mode && rq->period_ns > 0) {
             /*
              * Push-mode doesn't need timeout data, as the driver manages the
              * data timing.
@@ -685,93 +2714,162 @@ hound_err add_queue_nolock(
              * hound_next(). Therefore, if the period is 0, we should not add
              * timing data for this request.
              */
-            iter = xh_get(PULL_MAP, s_pull_map, fd);
-            XASSERT_NEQ(iter, xh_end(s_pull_map));
-            info = &xh_val(s_pull_map, iter);
-            timeout_info = xv_pushp(struct pull_timeout_info, info->timeout_info);
-            if (timeout_info == NULL) {
-                for (j = 0; j < queue_count; ++j) {
-                    (void) xv_pop(ctx->queues);
-                }
+            period = xv_pushp(struct pull_period, fd_rqs->periods);
+            if (period == NULL) {
                 return HOUND_OOM;
             }
 
-            timeout_info->id = entry->id;
-            timeout_info->current_timeout = rq->period_ns;
-            timeout_info->max_timeout = rq->period_ns;
+            period->id = rq->id;
+            period->period_ns = rq->period_ns;
+            period->foldable = driver_rq_foldable(rq);
+            period->folded = false;
         }
     }
 
-    /*
-     * For pull-mode drivers, adjust the new fd timeout, as some timing entries
-     * have been deleted.
-     */
-    if (driver_is_pull_mode(ctx->drv)) {
-        set_fd_timeout(fd, ctx);
-    }
-
-    return err;
+    return HOUND_OK;
 }
 
 static
-void remove_queue_nolock(
-    int fd,
+void remove_rqs(
+    struct fd_rqs *fd_rqs,
+    bool pull_mode,
     const struct hound_data_rq *rqs,
     size_t rqs_len,
     struct queue *queue)
 {
-    struct fdctx *ctx;
     struct queue_entry *entry;
     size_t i;
-    struct pull_info *info;
-    xhiter_t iter;
     size_t j;
+    struct pull_period *period;
     const struct hound_data_rq *rq;
-    struct pull_timeout_info *timeout_info;
-
-    ctx = get_fdctx(fd);
-    XASSERT_NOT_NULL(ctx);
-
-    iter = xh_get(PULL_MAP, s_pull_map, fd);
-    if (iter != xh_end(s_pull_map)) {
-        info = &xh_val(s_pull_map, iter);
-    }
-    else {
-        info = NULL;
-    }
 
     /* Remove all matching queue entries. */
     for (i = 0; i < rqs_len; ++i) {
         rq = &rqs[i];
-        for (j = 0; j < xv_size(ctx->queues); ++j) {
-            entry = &xv_A(ctx->queues, j);
+        for (j = 0; j < xv_size(fd_rqs->queues); ++j) {
+            entry = &xv_A(fd_rqs->queues, j);
             if (rq->id != entry->id || queue != entry->queue) {
                 continue;
             }
             /* Remove the queue. */
-            xv_quickdel(ctx->queues, j);
+            if (entry->dec != NULL) {
+                decimator_unref(entry->dec);
+            }
+            xv_quickdel(fd_rqs->queues, j);
         }
 
-        if (driver_is_pull_mode(ctx->drv) && rq->period_ns > 0) {
+        if (pull_mode && rq->period_ns > 0) {
             /* Remove pull-mode timing info, if any. */
-            for (j = 0; j < xv_size(info->timeout_info); ++j) {
-                timeout_info = &xv_A(info->timeout_info, j);
-                if (timeout_info->id == rq->id &&
-                    timeout_info->max_timeout == rq->period_ns) {
-                    xv_quickdel(info->timeout_info, j);
+            for (j = 0; j < xv_size(fd_rqs->periods); ++j) {
+                period = &xv_A(fd_rqs->periods, j);
+                if (period->id == rq->id &&
+                    period->period_ns == rq->period_ns) {
+                    xv_quickdel(fd_rqs->periods, j);
                     break;
                 }
             }
         }
     }
+}
+
+static
+hound_err table_insert(struct io_shard *shard, struct fdctx *ctx)
+{
+    size_t count;
+    struct fdctx *entry;
+    size_t i;
+    struct fd_table *old;
+    struct fd_table *table;
+
+    old = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    count = 0;
+    for (i = 0; i < old->len; ++i) {
+        if (atomic_load_explicit(&old->ctx[i], memory_order_relaxed) != NULL) {
+            ++count;
+        }
+    }
 
-    /*
-     * For pull-mode drivers, adjust the new fd timeout, as some timing entries
-     * have been deleted.
-     */
-    if (driver_is_pull_mode(ctx->drv)) {
-        set_fd_timeout(fd, ctx);
+    table = malloc(sizeof(*table) + (count+1)*sizeof(*table->ctx));
+    if (table == NULL) {
+        return HOUND_OOM;
+    }
+    table->len = 0;
+    for (i = 0; i < old->len; ++i) {
+        entry = atomic_load_explicit(&old->ctx[i], memory_order_relaxed);
+        if (entry != NULL) {
+            atomic_init(&table->ctx[table->len], entry);
+            ++table->len;
+        }
+    }
+    atomic_init(&table->ctx[table->len], ctx);
+    ++table->len;
+
+    atomic_store_explicit(&shard->table, table, memory_order_release);
+    atomic_fetch_add(&shard->gen, 1);
+    synchronize(shard);
+    free(old);
+
+    return HOUND_OK;
+}
+
+static
+void table_clear(struct io_shard *shard, const struct fdctx *ctx)
+{
+    size_t i;
+    struct fd_table *table;
+
+    table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    for (i = 0; i < table->len; ++i) {
+        if (atomic_load_explicit(&table->ctx[i], memory_order_relaxed) == ctx) {
+            atomic_store_explicit(&table->ctx[i], NULL, memory_order_relaxed);
+            atomic_fetch_add(&shard->gen, 1);
+            return;
+        }
+    }
+}
+
+/* Returns whether a set of requests has any entries for a queue. */
+static
+bool has_queue(const struct fd_rqs *rqs, const struct queue *queue)
+{
+    size_t i;
+
+    for (i = 0; i < xv_size(rqs->queues); ++i) {
+        if (xv_A(rqs->queues, i).queue == queue) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Points a multicast queue's cursor at the fd's log, creating it if needed. */
+static
+hound_err attach_cursor(struct fdctx *ctx, struct mcast_cursor *cursor)
+{
+    hound_err err;
+
+    if (ctx->mcast == NULL) {
+        err = mcast_log_alloc(&ctx->mcast);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    return mcast_attach(ctx->mcast, cursor);
+}
+
+static
+void free_fdctx(struct fdctx *ctx)
+{
+    /* This detaches any cursors still on the log. */
+    if (ctx->mcast != NULL) {
+        mcast_log_destroy(ctx->mcast);
     }
+    rqs_free(atomic_load_explicit(&ctx->rqs, memory_order_relaxed));
+    free(ctx->pull.timers);
+    xv_destroy(ctx->pull.due);
+    free(ctx);
 }
 
 hound_err io_add_fd(
@@ -781,13 +2879,16 @@ hound_err io_add_fd(
     size_t rqs_len,
     struct queue *queue)
 {
+    uint_least64_t busy_ns;
     struct fdctx *ctx;
+    struct mcast_cursor *cursor;
     hound_err err;
+    struct epoll_event event;
     int flags;
-    struct pull_info *info;
     xhiter_t iter;
-    struct pollfd *pfd;
     int ret;
+    struct fd_rqs *rqs_out;
+    struct io_shard *shard;
 
     XASSERT_NOT_NULL(drv);
     XASSERT_NEQ(fd, 0);
@@ -798,95 +2899,187 @@ hound_err io_add_fd(
     err = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
     XASSERT_NEQ(err, -1);
 
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-
-    pfd = xv_pushp(struct pollfd, s_ios.fds);
-    if (pfd == NULL) {
-        err = HOUND_OOM;
-        goto error_fds_push;
+    shard = &s_ios.shards[io_driver_shard(drv)];
+    busy_ns = atomic_load_explicit(&shard->busy_poll_ns, memory_order_relaxed);
+    if (busy_ns > 0) {
+        set_sock_busy_poll(fd, busy_ns);
     }
-    pfd->fd = fd;
-    pfd->events = POLL_DEFAULT_EVENTS;
 
-    ctx = xv_pushp(struct fdctx, s_ios.ctx);
+    ctx = malloc(sizeof(*ctx));
     if (ctx == NULL) {
-        err = HOUND_OOM;
-        goto error_ctx_push;
+        return HOUND_OOM;
     }
+    ctx->fd = fd;
     ctx->drv = drv;
+    ctx->shard = shard;
+    ctx->mcast = NULL;
+    ctx->events = POLL_DEFAULT_EVENTS;
+    ctx->revents = 0;
+    ctx->ready = false;
     ctx->timeout_enabled = false;
-    ctx->timeout_ns = UINT64_MAX;
-    xv_init(ctx->queues);
-
-    if (driver_is_pull_mode(drv)) {
-        iter = xh_put(PULL_MAP, s_pull_map, fd, &ret);
-        if (ret == -1) {
-            err = HOUND_OOM;
-            goto error_pull_mode_indices_push;
+    timer_init(&ctx->timeout.timer);
+    ctx->timeout.ctx = ctx;
+    ctx->timeout.id = 0;
+    ctx->timeout.period_ns = 0;
+    ctx->pull.gen = 0;
+    ctx->pull.timers = NULL;
+    ctx->pull.timer_count = 0;
+    xv_init(ctx->pull.due);
+#ifdef CONFIG_HOUND_IO_URING
+    /*
+     * Drivers that use the default push op just read and parse, so io_uring
+     * can do the reading for them, unless they need the message headers only
+     * recvmmsg gives us.
+     */
+    ctx->use_uring =
+        shard->uring_ok &&
+        driver_is_push_mode(drv) &&
+        !drv->read_msg_stamps;
+    ctx->uring = NULL;
+#endif
+
+    rqs_out = rqs_alloc();
+    if (rqs_out == NULL) {
+        err = HOUND_OOM;
+        goto error_rqs_alloc;
+    }
+    err = add_rqs(rqs_out, driver_is_pull_mode(drv), rqs, rqs_len, queue);
+    if (err != HOUND_OK) {
+        goto error_add_rqs;
+    }
+    err = fold_rqs(rqs_out, drv);
+    if (err != HOUND_OK) {
+        goto error_add_rqs;
+    }
+    err = index_rqs(rqs_out);
+    if (err != HOUND_OK) {
+        goto error_add_rqs;
+    }
+    cursor = queue_cursor(queue);
+    if (cursor != NULL && has_queue(rqs_out, queue)) {
+        err = attach_cursor(ctx, cursor);
+        if (err != HOUND_OK) {
+            goto error_attach;
         }
-        info = &xh_val(s_pull_map, iter);
+    }
+    atomic_init(&ctx->rqs, rqs_out);
 
-        info->last_pull = 0;
-        xv_init(info->timeout_info);
+    lock_mutex(&s_ios.lock);
+    iter = xh_put(FD_MAP, s_ios.fd_map, fd, &ret);
+    if (ret != -1) {
+        xh_val(s_ios.fd_map, iter) = ctx;
+    }
+    unlock_mutex(&s_ios.lock);
+    if (ret == -1) {
+        err = HOUND_OOM;
+        goto error_fd_map_put;
     }
 
-    err = add_queue_nolock(fd, rqs, rqs_len, queue);
+    lock_mutex(&shard->update_lock);
+
+    err = table_insert(shard, ctx);
     if (err != HOUND_OK) {
-        remove_queue_nolock(fd, rqs, rqs_len, queue);
+        goto error_table_insert;
     }
 
-    err = HOUND_OK;
-    goto out;
+    /* The driver may push records as soon as epoll reports its fd. */
+    drv->fdctx = ctx;
+#ifdef CONFIG_HOUND_IO_URING
+    if (ctx->use_uring) {
+        /* Have the poll thread post a read now that the fd is live. */
+        atomic_fetch_add(&shard->gen, 1);
+        wake_poll(shard);
+        unlock_mutex(&shard->update_lock);
+        return HOUND_OK;
+    }
+#endif
+    event.events = (uint32_t) ctx->events;
+    event.data.ptr = ctx;
+    ret = epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    if (ret != 0) {
+        err = errno;
+        goto error_epoll_add;
+    }
 
-error_pull_mode_indices_push:
-    (void) xv_pop(s_ios.ctx);
-error_ctx_push:
-    (void) xv_pop(s_ios.fds);
-error_fds_push:
-out:
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    unlock_mutex(&shard->update_lock);
+
+    return HOUND_OK;
+
+error_epoll_add:
+    drv->fdctx = NULL;
+    table_clear(shard, ctx);
+    synchronize(shard);
+error_table_insert:
+    unlock_mutex(&shard->update_lock);
+    lock_mutex(&s_ios.lock);
+    xh_del(FD_MAP, s_ios.fd_map, iter);
+    unlock_mutex(&s_ios.lock);
+error_fd_map_put:
+error_attach:
+    if (ctx->mcast != NULL) {
+        mcast_log_destroy(ctx->mcast);
+    }
+error_add_rqs:
+    rqs_free(rqs_out);
+error_rqs_alloc:
+    free(ctx);
     return err;
 }
 
 void io_remove_fd(int fd)
 {
     struct fdctx *ctx;
-    size_t ctx_index;
-    size_t fd_index;
-    struct pull_info *info;
     xhiter_t iter;
+    int ret;
+    struct io_shard *shard;
 
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-
-    fd_index = get_fd_index(fd);
-    ctx_index = get_fdctx_index(fd_index);
-    ctx = get_fdctx_from_fd_index(fd_index);
-    XASSERT_NOT_NULL(ctx);
+    lock_mutex(&s_ios.lock);
+    iter = xh_get(FD_MAP, s_ios.fd_map, fd);
+    XASSERT_NEQ(iter, xh_end(s_ios.fd_map));
+    ctx = xh_val(s_ios.fd_map, iter);
+    xh_del(FD_MAP, s_ios.fd_map, iter);
+    unlock_mutex(&s_ios.lock);
 
-    if (driver_is_pull_mode(ctx->drv)) {
-        /* If we have a pointer to this index in the pull mode map, remove it. */
-        iter = xh_get(PULL_MAP, s_pull_map, fd);
-        if (iter != xh_end(s_pull_map)) {
-            info = &xh_val(s_pull_map, iter);
-            xv_destroy(info->timeout_info);
-            xh_del(PULL_MAP, s_pull_map, iter);
-        }
-    }
+    shard = ctx->shard;
+    lock_mutex(&shard->update_lock);
 
-    /* Remove fd and ctx. */
-    xv_quickdel(s_ios.fds, fd_index);
-    xv_quickdel(s_ios.ctx, ctx_index);
+    /*
+     * Take the fd out of service before taking it out of epoll, so a poll
+     * thread whose epoll_ctl fails on it can tell that the fd is gone.
+     */
+    ctx->drv->fdctx = NULL;
+    ret = epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    /* An fd read through io_uring isn't in the epoll set. */
+    XASSERT(ret == 0 || errno == ENOENT);
+    table_clear(shard, ctx);
 
-    xv_destroy(ctx->queues);
+    /*
+     * An epoll_wait that was already running may still have handed the poll
+     * thread this fdctx, so wait for it before freeing.
+     */
+    synchronize(shard);
+#ifdef CONFIG_HOUND_IO_URING
+    /*
+     * If the poll thread moved the fd from io_uring to epoll before it saw the
+     * fd was going away, the fd is back in the epoll set.
+     */
+    ret = epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    if (ret == 0) {
+        synchronize(shard);
+    }
+#endif
+    free_fdctx(ctx);
 
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    unlock_mutex(&shard->update_lock);
 }
 
-hound_err io_modify_queue(
+/**
+ * Atomically replace one set of requests on an fd with another, for a single
+ * queue. Once this returns, the poll loop no longer sees the old requests, so
+ * the caller may destroy a queue it removed.
+ */
+static
+hound_err update_rqs(
     int fd,
     const struct hound_data_rq *old_rqs,
     size_t old_rqs_len,
@@ -894,37 +3087,92 @@ hound_err io_modify_queue(
     size_t new_rqs_len,
     struct queue *queue)
 {
+    bool attached;
+    struct fdctx *ctx;
+    struct mcast_cursor *cursor;
     hound_err err;
+    struct fd_rqs *next;
+    struct fd_rqs *prev;
+    bool pull_mode;
+    struct io_shard *shard;
+
+    ctx = get_fdctx(fd);
+    shard = ctx->shard;
+    pull_mode = driver_is_pull_mode(ctx->drv);
+
+    lock_mutex(&shard->update_lock);
 
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-    remove_queue_nolock(fd, old_rqs, old_rqs_len, queue);
-    err = add_queue_nolock(fd, new_rqs, new_rqs_len, queue);
+    prev = atomic_load_explicit(&ctx->rqs, memory_order_relaxed);
+    next = rqs_copy(prev);
+    if (next == NULL) {
+        err = HOUND_OOM;
+        goto out;
+    }
+    remove_rqs(next, pull_mode, old_rqs, old_rqs_len, queue);
+    err = add_rqs(next, pull_mode, new_rqs, new_rqs_len, queue);
+    if (err == HOUND_OK) {
+        err = fold_rqs(next, ctx->drv);
+    }
+    if (err == HOUND_OK) {
+        err = index_rqs(next);
+    }
     if (err != HOUND_OK) {
+        rqs_free(next);
         goto out;
     }
 
+    /*
+     * A multicast cursor must be on the log before the poll loop can see its
+     * entries, and it can leave only once the poll loop no longer sees them.
+     */
+    cursor = queue_cursor(queue);
+    attached = cursor != NULL && has_queue(prev, queue);
+    if (cursor != NULL && !attached && has_queue(next, queue)) {
+        err = attach_cursor(ctx, cursor);
+        if (err != HOUND_OK) {
+            rqs_free(next);
+            goto out;
+        }
+    }
+
+    atomic_store_explicit(&ctx->rqs, next, memory_order_release);
+    atomic_fetch_add(&shard->gen, 1);
+    synchronize(shard);
+    rqs_free(prev);
+
+    if (attached && !has_queue(next, queue)) {
+        mcast_detach(ctx->mcast, cursor);
+    }
+
 out:
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    unlock_mutex(&shard->update_lock);
     return err;
 }
 
+hound_err io_modify_queue(
+    int fd,
+    const struct hound_data_rq *old_rqs,
+    size_t old_rqs_len,
+    const struct hound_data_rq *new_rqs,
+    size_t new_rqs_len,
+    struct queue *queue)
+{
+    return update_rqs(
+        fd,
+        old_rqs,
+        old_rqs_len,
+        new_rqs,
+        new_rqs_len,
+        queue);
+}
+
 hound_err io_add_queue(
     int fd,
     const struct hound_data_rq *rqs,
     size_t rqs_len,
     struct queue *queue)
 {
-    hound_err err;
-
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-    err = add_queue_nolock(fd, rqs, rqs_len, queue);
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
-
-    return err;
+    return update_rqs(fd, NULL, 0, rqs, rqs_len, queue);
 }
 
 void io_remove_queue(
@@ -933,63 +3181,277 @@ void io_remove_queue(
     size_t rqs_len,
     struct queue *queue)
 {
-    pause_poll();
-    pthread_rwlock_wrlock(&s_ios.lock);
-    remove_queue_nolock(fd, rqs, rqs_len, queue);
-    pthread_rwlock_unlock(&s_ios.lock);
-    resume_poll();
+    hound_err err;
+
+    err = update_rqs(fd, rqs, rqs_len, NULL, 0, queue);
+    if (err != HOUND_OK) {
+        /*
+         * We couldn't copy the request list, so this queue is still on the
+         * fd. The caller is about to free it, so that can't be allowed.
+         */
+        hound_log_err_nofmt(err, "Failed to remove queue");
+        XASSERT_ERROR;
+    }
 }
 
-void io_init(void)
+static
+hound_err add_tag(struct io_shard *shard, int fd, void *tag)
 {
-    hound_err err;
-    struct pollfd *pfd;
+    struct epoll_event event;
     int ret;
 
-    pthread_rwlock_init(&s_ios.lock, NULL);
-    xv_init(s_ios.ctx);
-    xv_init(s_ios.fds);
+    event.events = EPOLLIN;
+    event.data.ptr = tag;
+    ret = epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    if (ret != 0) {
+        return errno;
+    }
+
+    return HOUND_OK;
+}
+
+#ifdef CONFIG_HOUND_IO_URING
+/*
+ * Set up a shard's ring and give the kernel its buffers. If this fails, the
+ * shard just polls everything with epoll.
+ */
+static
+void uring_init(struct io_shard *shard)
+{
+    int err;
+    unsigned i;
+    int mask;
+    int ret;
+
+    shard->uring_ok = false;
+    xv_init(shard->reads);
+
+    ret = io_uring_queue_init(URING_ENTRIES, &shard->uring, 0);
+    if (ret != 0) {
+        hound_log_err_nofmt(-ret, "Failed to set up io_uring; using epoll");
+        return;
+    }
+
+    shard->uring_bufs = malloc(URING_BUF_COUNT*URING_BUF_SIZE);
+    if (shard->uring_bufs == NULL) {
+        hound_log_err_nofmt(HOUND_OOM, "Failed to allocate io_uring buffers");
+        goto error_alloc_bufs;
+    }
+
+    shard->buf_ring = io_uring_setup_buf_ring(
+        &shard->uring,
+        URING_BUF_COUNT,
+        URING_BUF_GROUP,
+        0,
+        &err);
+    if (shard->buf_ring == NULL) {
+        hound_log_err_nofmt(-err, "Failed to set up io_uring buffers");
+        goto error_setup_buf_ring;
+    }
+    mask = io_uring_buf_ring_mask(URING_BUF_COUNT);
+    for (i = 0; i < URING_BUF_COUNT; ++i) {
+        io_uring_buf_ring_add(
+            shard->buf_ring,
+            shard->uring_bufs + i*URING_BUF_SIZE,
+            URING_BUF_SIZE,
+            i,
+            mask,
+            i);
+    }
+    io_uring_buf_ring_advance(shard->buf_ring, URING_BUF_COUNT);
+
+    err = add_tag(shard, shard->uring.ring_fd, URING_TAG(shard));
+    if (err != HOUND_OK) {
+        hound_log_err_nofmt(err, "Failed to poll io_uring fd");
+        goto error_add_tag;
+    }
+
+    shard->uring_ok = true;
+    return;
+
+error_add_tag:
+    io_uring_free_buf_ring(
+        &shard->uring,
+        shard->buf_ring,
+        URING_BUF_COUNT,
+        URING_BUF_GROUP);
+error_setup_buf_ring:
+    free(shard->uring_bufs);
+error_alloc_bufs:
+    io_uring_queue_exit(&shard->uring);
+}
+
+static
+void uring_destroy(struct io_shard *shard)
+{
+    struct io_uring_cqe *cqe;
+    size_t i;
+    struct uring_read *read;
+    int ret;
 
-    s_pull_map = xh_init(PULL_MAP);
-    if (s_pull_map == NULL) {
-        hound_log_nofmt(XLOG_ERR, "Failed to initialize pull-mode timing map");
+    if (!shard->uring_ok) {
+        xv_destroy(shard->reads);
         return;
     }
 
     /*
-     * Create our self-pipe, which we use to interrupt the poll loop when
-     * needed. Mark it non-blocking so it can't block a read() during the poll
-     * loop. It really never should block, but this is a defensive precaution.
+     * Cancel any reads still going and wait for them to finish, so the kernel
+     * is done with our buffers before we free them.
      */
-    ret = pipe2(s_self_pipe, O_NONBLOCK);
-    if (ret != 0) {
-        hound_log_nofmt(XLOG_ERR, "Failed to create self pipe");
-        return;
+    for (i = 0; i < xv_size(shard->reads); ++i) {
+        uring_cancel(shard, xv_A(shard->reads, i));
     }
+    io_uring_submit(&shard->uring);
+    while (xv_size(shard->reads) > 0) {
+        ret = io_uring_wait_cqe(&shard->uring, &cqe);
+        if (ret != 0) {
+            hound_log_err_nofmt(-ret, "Failed to wait for io_uring reads");
+            break;
+        }
+        read = io_uring_cqe_get_data(cqe);
+        if (read != NULL && !(cqe->flags & IORING_CQE_F_MORE)) {
+            uring_drop_read(shard, read);
+        }
+        io_uring_cqe_seen(&shard->uring, cqe);
+    }
+    xv_destroy(shard->reads);
+
+    io_uring_free_buf_ring(
+        &shard->uring,
+        shard->buf_ring,
+        URING_BUF_COUNT,
+        URING_BUF_GROUP);
+    io_uring_queue_exit(&shard->uring);
+    free(shard->uring_bufs);
+}
+#endif
 
-    pfd = xv_pushp(struct pollfd, s_ios.fds);
-    if (pfd == NULL) {
-        hound_log_nofmt(XLOG_ERR, "Failed to setup pfd for self pipe");
-        return;
+static
+hound_err shard_init(struct io_shard *shard)
+{
+    hound_err err;
+    int ret;
+    struct fd_table *table;
+
+    init_mutex(&shard->update_lock);
+    atomic_init(&shard->epoch, 0);
+    atomic_init(&shard->readers[0], 0);
+    atomic_init(&shard->readers[1], 0);
+    atomic_init(&shard->gen, 0);
+    atomic_init(&shard->next_pending, false);
+    atomic_init(&shard->busy_poll_ns, 0);
+    atomic_init(&shard->iterations, 0);
+    atomic_init(&shard->blocking_wakeups, 0);
+    atomic_init(&shard->busy_wakeups, 0);
+    stats_histogram_init(&shard->sync_stall_ns);
+    stats_histogram_init(&shard->wakeup_jitter_ns);
+    atomic_init(&shard->stop, false);
+    shard->timer_armed = false;
+    shard->timers_gen = 0;
+    timer_heap_init(&shard->timers);
+    xv_init(shard->ready);
+
+    table = malloc(sizeof(*table));
+    if (table == NULL) {
+        hound_log_err_nofmt(HOUND_OOM, "Failed to allocate fd table");
+        return HOUND_OOM;
+    }
+    table->len = 0;
+    atomic_init(&shard->table, table);
+
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epoll_fd == -1) {
+        hound_log_err_nofmt(errno, "Failed to create epoll fd");
+        return errno;
+    }
+
+    shard->timer_fd = timerfd_create(
+        CLOCK_MONOTONIC,
+        TFD_CLOEXEC | TFD_NONBLOCK);
+    if (shard->timer_fd == -1) {
+        hound_log_err_nofmt(errno, "Failed to create timer fd");
+        return errno;
+    }
+    err = add_tag(shard, shard->timer_fd, TIMER_TAG(shard));
+    if (err != HOUND_OK) {
+        hound_log_err_nofmt(err, "Failed to poll timer fd");
+        return err;
+    }
+
+    /*
+     * Create our wake pipe, which we use to kick the poll loop when something
+     * changes. Mark it non-blocking so a flood of wakeups can't block a writer
+     * and draining it can't block the poll loop.
+     */
+    ret = pipe2(shard->wake_pipe, O_NONBLOCK);
+    if (ret != 0) {
+        hound_log_nofmt(XLOG_ERR, "Failed to create wake pipe");
+        return errno;
+    }
+    err = add_tag(shard, shard->wake_pipe[READ_END], WAKE_TAG(shard));
+    if (err != HOUND_OK) {
+        hound_log_err_nofmt(err, "Failed to poll wake pipe");
+        return err;
     }
-    XASSERT_EQ((void *) pfd, &xv_A(s_ios.fds, PAUSE_FD_INDEX));
-    pfd->fd = s_self_pipe[READ_END];
-    pfd->events = POLLIN;
 
-    err = io_start_poll();
+#ifdef CONFIG_HOUND_IO_URING
+    uring_init(shard);
+#endif
+
+    err = io_start_poll(shard);
     if (err != HOUND_OK) {
         hound_log_err_nofmt(err, "Failed io_start_poll");
+        return err;
+    }
+
+    return HOUND_OK;
+}
+
+static
+void shard_destroy(struct io_shard *shard)
+{
+    io_stop_poll(shard);
+#ifdef CONFIG_HOUND_IO_URING
+    uring_destroy(shard);
+#endif
+    free(atomic_load_explicit(&shard->table, memory_order_relaxed));
+    timer_heap_destroy(&shard->timers);
+    xv_destroy(shard->ready);
+    destroy_mutex(&shard->update_lock);
+    close(shard->wake_pipe[READ_END]);
+    close(shard->wake_pipe[WRITE_END]);
+    close(shard->timer_fd);
+    close(shard->epoll_fd);
+}
+
+void io_init(void)
+{
+    hound_err err;
+    size_t i;
+
+    init_mutex(&s_ios.lock);
+
+    s_ios.fd_map = xh_init(FD_MAP);
+    if (s_ios.fd_map == NULL) {
+        hound_log_nofmt(XLOG_ERR, "Failed to initialize fd map");
         return;
     }
+
+    for (i = 0; i < ARRAYLEN(s_ios.shards); ++i) {
+        err = shard_init(&s_ios.shards[i]);
+        if (err != HOUND_OK) {
+            return;
+        }
+    }
 }
 
 void io_destroy(void)
 {
-    io_stop_poll();
-    xv_destroy(s_ios.ctx);
-    xv_destroy(s_ios.fds);
-    pthread_rwlock_destroy(&s_ios.lock);
-    xh_destroy(PULL_MAP, s_pull_map);
-    close(s_self_pipe[READ_END]);
-    close(s_self_pipe[WRITE_END]);
+    size_t i;
+
+    for (i = 0; i < ARRAYLEN(s_ios.shards); ++i) {
+        shard_destroy(&s_ios.shards[i]);
+    }
+    xh_destroy(FD_MAP, s_ios.fd_map);
+    destroy_mutex(&s_ios.lock);
 }
@@ -0,0 +1,1308 @@
+/**
+ * @file      mcast.c
+ * @brief     Multicast record log, used as an alternative queue backend. Each
+ *            driver has a single log, and each record is written into it just
+ *            once, no matter how many contexts want it. The contexts keep only
+ *            a read cursor into the log, and a record is reclaimed once the
+ *            slowest cursor has passed it. Like the other queues, each cursor
+ *            has a max length, which when exceeded will, by default, begin to
+ *            overwrite the oldest item.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <hound-private/error.h>
+#include <hound-private/log.h>
+#include <hound-private/mcast.h>
+#include <hound-private/queue.h>
+#include <hound-private/refcount.h>
+#include <hound-private/util.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <xlib/xvec.h>
+
+/* The number of slots in a log. This must be a power of 2. */
+#define MCAST_LOG_LEN 4096
+#define EVENT_FD_INVALID (-1)
+
+/*
+ * A record in the log, along with the cursors that want it, one bit per cursor.
+ * A slot's mask never changes once the slot is published.
+ */
+struct mcast_slot {
+    struct record_info *rec;
+    uint64_t mask;
+};
+
+/*
+ * A batch of records that a reader popped straight out of the log and hasn't
+ * released yet. The records are the ones in [start, end) that the cursor
+ * wants, and first is the first of them, which is how mcast_release finds the
+ * batch again.
+ */
+struct mcast_batch {
+    struct record_info *first;
+    size_t count;
+    uint_least64_t start;
+    uint_least64_t end;
+};
+
+XVEC_DEFINE(batch_vec, struct mcast_batch);
+
+/*
+ * Sequence numbers are free-running, and a sequence number maps to the slot at
+ * (seqno % MCAST_LOG_LEN). tail is the next slot the writer fills; head is the
+ * end of what it has published, and cursors read only below it. The log holds
+ * one reference to each record in [reclaimed, tail), and drops it once every
+ * cursor's bound has passed the record.
+ *
+ * Writers serialize on lock, which is uncontended unless a driver pushes from
+ * outside its poll thread. The lock also guards cursors and attached, the set
+ * of bits in use, and touched, the cursors the current write has appended
+ * to. Cursors are locked only after the log, never before.
+ */
+struct mcast_log {
+    pthread_mutex_t lock;
+    _Atomic uint_least64_t head;
+    uint_least64_t tail;
+    uint_least64_t reclaimed;
+    uint64_t attached;
+    uint64_t touched;
+    struct mcast_cursor *cursors[MCAST_MAX_CURSORS];
+    struct mcast_slot slots[MCAST_LOG_LEN];
+};
+
+/*
+ * A cursor is a context's view of the log. pos is the next sequence number it
+ * reads, and bound is the oldest record it may still look at, which is either
+ * pos or the start of a batch a reader hasn't released. Records popped out of
+ * the log carry no references of their own, so the log must keep them until
+ * they are released.
+ *
+ * pushed counts the records the writer has appended for the cursor, published
+ * is pushed as of the last publish, and claimed counts the records that left
+ * the cursor, either popped or dropped. The cursor's length is published -
+ * claimed, and claimed doubles as the sequence number of the next record. The
+ * same goes for bytes.
+ *
+ * If a cursor falls so far behind that its records are about to be reused, or
+ * its context stops reading from the driver, the cursor takes a reference on
+ * each record it still wants and moves it to stash, a private FIFO in front of
+ * the log. Unreleased batches get references at the same time and are
+ * forgotten, so mcast_release drops the references of any records it doesn't
+ * find a batch for.
+ *
+ * wake_len, wake_bytes, interrupt_gen, event_fd and the overflow policy work
+ * the same as in the locked queue. Readers bump waiters before they check
+ * whether to sleep, and the writer takes the cursor lock to wake them only if
+ * it's nonzero, so a publish is lock-free when no one is waiting.
+ */
+struct mcast_cursor {
+    pthread_mutex_t mutex;
+    pthread_cond_t ready_cond;
+
+    /* Set under both the log lock and mutex. */
+    struct mcast_log *log;
+    unsigned index;
+    uint64_t bit;
+
+    /* Guarded by mutex. */
+    uint_least64_t pos;
+    batch_vec batches;
+    struct record_info **stash;
+    size_t stash_cap;
+    size_t stash_front;
+    size_t stash_len;
+    uint64_t interrupt_gen;
+    size_t wake_len;
+    size_t wake_bytes;
+    int event_fd;
+    size_t event_len;
+    bool event_signalled;
+    hound_overflow_policy overflow;
+    size_t grow_len;
+
+    /* Written by the writer, under the log lock. */
+    uint_least64_t pushed;
+    size_t pushed_bytes;
+
+    _Atomic uint_least64_t bound;
+    _Atomic uint_least64_t published;
+    _Atomic size_t published_bytes;
+    _Atomic uint_least64_t claimed;
+    _Atomic size_t claimed_bytes;
+    _Atomic uint_least64_t dropped;
+    _Atomic size_t high_water;
+    _Atomic size_t max_len;
+    atomic_uint waiters;
+    atomic_bool event_watch;
+};
+
+static
+struct mcast_slot *slot_at(struct mcast_log *log, uint_least64_t seqno)
+{
+    return &log->slots[seqno & (MCAST_LOG_LEN - 1)];
+}
+
+/*
+ * Claims can run ahead of publishes when the writer drops a record it hasn't
+ * published yet, so these clamp at 0.
+ */
+static
+size_t pending(struct mcast_cursor *cursor)
+{
+    uint_least64_t claimed;
+    uint_least64_t published;
+
+    claimed = atomic_load(&cursor->claimed);
+    published = atomic_load(&cursor->published);
+    if (published <= claimed) {
+        return 0;
+    }
+
+    return published - claimed;
+}
+
+static
+size_t pending_bytes(struct mcast_cursor *cursor)
+{
+    size_t claimed;
+    size_t published;
+
+    claimed = atomic_load(&cursor->claimed_bytes);
+    published = atomic_load(&cursor->published_bytes);
+    if (published <= claimed) {
+        return 0;
+    }
+
+    return published - claimed;
+}
+
+static
+void claim(struct mcast_cursor *cursor, uint_least64_t count, size_t bytes)
+{
+    atomic_fetch_add(&cursor->claimed, count);
+    atomic_fetch_add(&cursor->claimed_bytes, bytes);
+}
+
+static
+bool wants(struct mcast_cursor *cursor, uint_least64_t seqno)
+{
+    return slot_at(cursor->log, seqno)->mask & cursor->bit;
+}
+
+static
+void set_bound(struct mcast_cursor *cursor)
+{
+    uint_least64_t bound;
+    size_t i;
+
+    bound = cursor->pos;
+    for (i = 0; i < xv_size(cursor->batches); ++i) {
+        if (xv_A(cursor->batches, i).start < bound) {
+            bound = xv_A(cursor->batches, i).start;
+        }
+    }
+    atomic_store_explicit(&cursor->bound, bound, memory_order_release);
+}
+
+static
+void update_event(struct mcast_cursor *cursor)
+{
+    eventfd_t val;
+
+    if (cursor->event_fd == EVENT_FD_INVALID) {
+        return;
+    }
+
+    if (pending(cursor) >= cursor->event_len) {
+        if (!cursor->event_signalled) {
+            (void) eventfd_write(cursor->event_fd, 1);
+            cursor->event_signalled = true;
+        }
+    }
+    else if (cursor->event_signalled) {
+        /*
+         * The fd is nonblocking and known to be readable, so this can't
+         * block.
+         */
+        (void) eventfd_read(cursor->event_fd, &val);
+        cursor->event_signalled = false;
+    }
+}
+
+static
+void wake_readers(struct mcast_cursor *cursor)
+{
+    if (pending(cursor) >= cursor->wake_len ||
+        pending_bytes(cursor) >= cursor->wake_bytes) {
+        cursor->wake_len = SIZE_MAX;
+        cursor->wake_bytes = SIZE_MAX;
+        cond_broadcast(&cursor->ready_cond);
+    }
+    update_event(cursor);
+}
+
+static
+struct record_info *stash_pop(struct mcast_cursor *cursor)
+{
+    struct record_info *rec;
+
+    XASSERT_GT(cursor->stash_len, 0);
+
+    rec = cursor->stash[cursor->stash_front];
+    cursor->stash_front = (cursor->stash_front + 1) % cursor->stash_cap;
+    --cursor->stash_len;
+
+    return rec;
+}
+
+static
+void stash_push(struct mcast_cursor *cursor, struct record_info *rec)
+{
+    size_t back;
+
+    XASSERT_LT(cursor->stash_len, cursor->stash_cap);
+
+    back = (cursor->stash_front + cursor->stash_len) % cursor->stash_cap;
+    cursor->stash[back] = rec;
+    ++cursor->stash_len;
+}
+
+/* Makes room in the stash for count more records, unwrapping it as we go. */
+static
+bool stash_reserve(struct mcast_cursor *cursor, size_t count)
+{
+    size_t cap;
+    size_t i;
+    struct record_info **stash;
+
+    if (cursor->stash_len + count <= cursor->stash_cap) {
+        return true;
+    }
+
+    cap = max(cursor->stash_cap, 16);
+    while (cap < cursor->stash_len + count) {
+        cap *= 2;
+    }
+    stash = malloc(cap * sizeof(*stash));
+    if (stash == NULL) {
+        return false;
+    }
+    for (i = 0; i < cursor->stash_len; ++i) {
+        stash[i] = cursor->stash[(cursor->stash_front + i) % cursor->stash_cap];
+    }
+    free(cursor->stash);
+    cursor->stash = stash;
+    cursor->stash_cap = cap;
+    cursor->stash_front = 0;
+
+    return true;
+}
+
+static
+void stash_drain(struct mcast_cursor *cursor)
+{
+    struct record_info *rec;
+
+    while (cursor->stash_len > 0) {
+        rec = stash_pop(cursor);
+        claim(cursor, 1, rec->record.size);
+        record_ref_dec(rec);
+    }
+}
+
+/* Skips the records at the cursor that it doesn't want. */
+static
+void skip_unwanted(struct mcast_cursor *cursor)
+{
+    uint_least64_t head;
+
+    head = atomic_load_explicit(&cursor->log->head, memory_order_acquire);
+    while (cursor->pos < head && !wants(cursor, cursor->pos)) {
+        ++cursor->pos;
+    }
+}
+
+/*
+ * Drops the oldest record in the cursor, which is in the stash if the stash
+ * isn't empty. The writer may also drop records it appended but hasn't yet
+ * published, up to end; everyone else passes the head of the log.
+ */
+static
+bool evict_oldest(struct mcast_cursor *cursor, uint_least64_t end)
+{
+    uint_least64_t head;
+    struct record_info *rec;
+    uint_least64_t seqno;
+    struct mcast_slot *slot;
+
+    if (cursor->stash_len > 0) {
+        rec = stash_pop(cursor);
+        claim(cursor, 1, rec->record.size);
+        record_ref_dec(rec);
+        return true;
+    }
+    if (cursor->log == NULL) {
+        return false;
+    }
+
+    head = atomic_load_explicit(&cursor->log->head, memory_order_acquire);
+    for (seqno = cursor->pos; seqno < end; ++seqno) {
+        slot = slot_at(cursor->log, seqno);
+        if (!(slot->mask & cursor->bit)) {
+            continue;
+        }
+        if (seqno < head) {
+            cursor->pos = seqno + 1;
+            set_bound(cursor);
+        }
+        else {
+            /* No one can see this slot yet, so just take ourselves off it. */
+            slot->mask &= ~cursor->bit;
+        }
+        claim(cursor, 1, slot->rec->record.size);
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Gives every unreleased batch references of its own, so the log no longer has
+ * to keep it.
+ */
+static
+void own_batches(struct mcast_cursor *cursor)
+{
+    struct mcast_batch batch;
+    uint_least64_t seqno;
+
+    while (xv_size(cursor->batches) > 0) {
+        batch = xv_pop(cursor->batches);
+        for (seqno = batch.start; seqno < batch.end; ++seqno) {
+            if (wants(cursor, seqno)) {
+                atomic_ref_inc(&slot_at(cursor->log, seqno)->rec->refcount);
+            }
+        }
+    }
+}
+
+/*
+ * Moves the records the cursor wants from the log to the stash, up to the
+ * given sequence number. If we can't make room for them, we drop them along
+ * with everything else that's older.
+ */
+static
+void spill(struct mcast_cursor *cursor, uint_least64_t end)
+{
+    size_t bytes;
+    size_t count;
+    struct record_info *rec;
+    uint_least64_t seqno;
+
+    count = 0;
+    for (seqno = cursor->pos; seqno < end; ++seqno) {
+        if (wants(cursor, seqno)) {
+            ++count;
+        }
+    }
+
+    if (!stash_reserve(cursor, count)) {
+        hound_log_err(
+            HOUND_OOM,
+            "dropping %zu records that a multicast cursor fell behind on",
+            count + cursor->stash_len);
+        atomic_fetch_add(&cursor->dropped, count + cursor->stash_len);
+        stash_drain(cursor);
+        bytes = 0;
+        for (seqno = cursor->pos; seqno < end; ++seqno) {
+            if (wants(cursor, seqno)) {
+                bytes += slot_at(cursor->log, seqno)->rec->record.size;
+            }
+        }
+        claim(cursor, count, bytes);
+    }
+    else {
+        for (seqno = cursor->pos; seqno < end; ++seqno) {
+            if (wants(cursor, seqno)) {
+                rec = slot_at(cursor->log, seqno)->rec;
+                atomic_ref_inc(&rec->refcount);
+                stash_push(cursor, rec);
+            }
+        }
+    }
+
+    cursor->pos = end;
+    set_bound(cursor);
+}
+
+static
+void notify(struct mcast_cursor *cursor)
+{
+    if (atomic_load(&cursor->waiters) == 0 &&
+        !atomic_load_explicit(&cursor->event_watch, memory_order_relaxed)) {
+        return;
+    }
+
+    lock_mutex(&cursor->mutex);
+    wake_readers(cursor);
+    unlock_mutex(&cursor->mutex);
+}
+
+/* Makes the appended records visible to the cursors. */
+static
+void publish(struct mcast_log *log)
+{
+    struct mcast_cursor *cursor;
+    size_t i;
+
+    atomic_store_explicit(&log->head, log->tail, memory_order_release);
+    for (i = 0; i < MCAST_MAX_CURSORS; ++i) {
+        if (!(log->touched & ((uint64_t) 1 << i))) {
+            continue;
+        }
+        cursor = log->cursors[i];
+        atomic_store(&cursor->published_bytes, cursor->pushed_bytes);
+        /*
+         * This pairs with the readers bumping waiters before they check the
+         * length, so either they see these records or we see them waiting.
+         */
+        atomic_store(&cursor->published, cursor->pushed);
+        notify(cursor);
+    }
+    log->touched = 0;
+}
+
+/* Drops the log's references to the records every cursor is done with. */
+static
+void reclaim(struct mcast_log *log)
+{
+    uint_least64_t bound;
+    uint_least64_t cursor_bound;
+    size_t i;
+    struct mcast_slot *slot;
+
+    bound = atomic_load_explicit(&log->head, memory_order_relaxed);
+    for (i = 0; i < MCAST_MAX_CURSORS; ++i) {
+        if (!(log->attached & ((uint64_t) 1 << i))) {
+            continue;
+        }
+        cursor_bound = atomic_load_explicit(
+            &log->cursors[i]->bound,
+            memory_order_acquire);
+        if (cursor_bound < bound) {
+            bound = cursor_bound;
+        }
+    }
+
+    while (log->reclaimed < bound) {
+        slot = slot_at(log, log->reclaimed);
+        record_ref_dec(slot->rec);
+        slot->rec = NULL;
+        ++log->reclaimed;
+    }
+}
+
+/*
+ * Frees the slot at the tail of the log. If a cursor is holding up the oldest
+ * slot, it spills everything it wants into its stash and catches up to the
+ * head.
+ */
+static
+void make_room(struct mcast_log *log)
+{
+    struct mcast_cursor *cursor;
+    uint_least64_t head;
+    size_t i;
+
+    while (log->tail - log->reclaimed >= MCAST_LOG_LEN) {
+        reclaim(log);
+        if (log->tail - log->reclaimed < MCAST_LOG_LEN) {
+            break;
+        }
+
+        head = atomic_load_explicit(&log->head, memory_order_relaxed);
+        if (log->reclaimed == head) {
+            /* The cursors can't move past what we haven't published. */
+            publish(log);
+            continue;
+        }
+
+        for (i = 0; i < MCAST_MAX_CURSORS; ++i) {
+            if (!(log->attached & ((uint64_t) 1 << i))) {
+                continue;
+            }
+            cursor = log->cursors[i];
+            if (atomic_load(&cursor->bound) > log->reclaimed) {
+                continue;
+            }
+
+            lock_mutex(&cursor->mutex);
+            skip_unwanted(cursor);
+            if (cursor->pos <= log->reclaimed ||
+                xv_size(cursor->batches) > 0) {
+                own_batches(cursor);
+                spill(cursor, head);
+            }
+            else {
+                set_bound(cursor);
+            }
+            unlock_mutex(&cursor->mutex);
+        }
+    }
+}
+
+/*
+ * Applies a cursor's overflow policy before we append a record to it, and
+ * returns whether the cursor should still get the record.
+ */
+static
+bool admit(struct mcast_log *log, struct mcast_cursor *cursor)
+{
+    bool admitted;
+    size_t max_len;
+
+    max_len = atomic_load_explicit(&cursor->max_len, memory_order_relaxed);
+    if (cursor->pushed - atomic_load(&cursor->claimed) < max_len) {
+        return true;
+    }
+
+    admitted = true;
+    lock_mutex(&cursor->mutex);
+    while (cursor->pushed - atomic_load(&cursor->claimed) >=
+           atomic_load(&cursor->max_len)) {
+        max_len = atomic_load(&cursor->max_len);
+        if (cursor->overflow == HOUND_OVERFLOW_GROW &&
+            max_len < cursor->grow_len) {
+            atomic_store(&cursor->max_len, min(2 * max_len, cursor->grow_len));
+            continue;
+        }
+
+        atomic_fetch_add(&cursor->dropped, 1);
+        if (cursor->overflow == HOUND_OVERFLOW_DROP_NEWEST ||
+            !evict_oldest(cursor, log->tail)) {
+            admitted = false;
+            break;
+        }
+    }
+    unlock_mutex(&cursor->mutex);
+
+    return admitted;
+}
+
+hound_err mcast_log_alloc(struct mcast_log **out_log)
+{
+    struct mcast_log *log;
+
+    XASSERT_NOT_NULL(out_log);
+
+    log = malloc(sizeof(*log));
+    if (log == NULL) {
+        return HOUND_OOM;
+    }
+
+    init_mutex(&log->lock);
+    atomic_init(&log->head, 0);
+    log->tail = 0;
+    log->reclaimed = 0;
+    log->attached = 0;
+    log->touched = 0;
+    memset(log->cursors, 0, sizeof(log->cursors));
+
+    *out_log = log;
+
+    return HOUND_OK;
+}
+
+static
+void detach_nolock(struct mcast_log *log, struct mcast_cursor *cursor)
+{
+    uint_least64_t head;
+
+    XASSERT_EQ(cursor->log, log);
+
+    head = atomic_load_explicit(&log->head, memory_order_relaxed);
+    lock_mutex(&cursor->mutex);
+    own_batches(cursor);
+    spill(cursor, head);
+    cursor->log = NULL;
+    unlock_mutex(&cursor->mutex);
+
+    log->cursors[cursor->index] = NULL;
+    log->attached &= ~cursor->bit;
+}
+
+void mcast_log_destroy(struct mcast_log *log)
+{
+    size_t i;
+
+    XASSERT_NOT_NULL(log);
+
+    lock_mutex(&log->lock);
+    for (i = 0; i < MCAST_MAX_CURSORS; ++i) {
+        if (log->cursors[i] != NULL) {
+            detach_nolock(log, log->cursors[i]);
+        }
+    }
+    reclaim(log);
+    XASSERT_EQ(log->reclaimed, log->tail);
+    unlock_mutex(&log->lock);
+
+    destroy_mutex(&log->lock);
+    free(log);
+}
+
+hound_err mcast_attach(struct mcast_log *log, struct mcast_cursor *cursor)
+{
+    hound_err err;
+    unsigned i;
+
+    XASSERT_NOT_NULL(log);
+    XASSERT_NOT_NULL(cursor);
+
+    lock_mutex(&log->lock);
+
+    for (i = 0; i < MCAST_MAX_CURSORS; ++i) {
+        if (log->cursors[i] == NULL) {
+            break;
+        }
+    }
+    if (i == MCAST_MAX_CURSORS) {
+        err = HOUND_MULTICAST_UNSUPPORTED;
+        goto out;
+    }
+
+    lock_mutex(&cursor->mutex);
+    XASSERT_NULL(cursor->log);
+    XASSERT_EQ(xv_size(cursor->batches), 0);
+    cursor->log = log;
+    cursor->index = i;
+    cursor->bit = (uint64_t) 1 << i;
+    cursor->pos = atomic_load_explicit(&log->head, memory_order_relaxed);
+    set_bound(cursor);
+    unlock_mutex(&cursor->mutex);
+
+    log->cursors[i] = cursor;
+    log->attached |= cursor->bit;
+    err = HOUND_OK;
+
+out:
+    unlock_mutex(&log->lock);
+    return err;
+}
+
+void mcast_detach(struct mcast_log *log, struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(log);
+    XASSERT_NOT_NULL(cursor);
+
+    lock_mutex(&log->lock);
+    detach_nolock(log, cursor);
+    reclaim(log);
+    unlock_mutex(&log->lock);
+}
+
+void mcast_write_begin(struct mcast_log *log)
+{
+    XASSERT_NOT_NULL(log);
+
+    lock_mutex(&log->lock);
+}
+
+void mcast_append(struct mcast_log *log, struct record_info *rec, uint64_t mask)
+{
+    struct mcast_cursor *cursor;
+    size_t i;
+    size_t len;
+    struct mcast_slot *slot;
+
+    XASSERT_NOT_NULL(log);
+    XASSERT_NOT_NULL(rec);
+    XASSERT_EQ(mask & ~log->attached, 0);
+
+    for (i = 0; i < MCAST_MAX_CURSORS; ++i) {
+        if ((mask & ((uint64_t) 1 << i)) && !admit(log, log->cursors[i])) {
+            mask &= ~((uint64_t) 1 << i);
+        }
+    }
+    if (mask == 0) {
+        record_ref_dec(rec);
+        return;
+    }
+
+    make_room(log);
+    slot = slot_at(log, log->tail);
+    slot->rec = rec;
+    slot->mask = mask;
+    ++log->tail;
+
+    for (i = 0; i < MCAST_MAX_CURSORS; ++i) {
+        if (!(mask & ((uint64_t) 1 << i))) {
+            continue;
+        }
+        cursor = log->cursors[i];
+        ++cursor->pushed;
+        cursor->pushed_bytes += rec->record.size;
+        len = cursor->pushed - atomic_load(&cursor->claimed);
+        if (len > atomic_load_explicit(
+                &cursor->high_water,
+                memory_order_relaxed)) {
+            atomic_store_explicit(
+                &cursor->high_water,
+                len,
+                memory_order_relaxed);
+        }
+    }
+    log->touched |= mask;
+}
+
+void mcast_write_end(struct mcast_log *log)
+{
+    XASSERT_NOT_NULL(log);
+
+    publish(log);
+    reclaim(log);
+    unlock_mutex(&log->lock);
+}
+
+uint64_t mcast_cursor_bit(const struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    return cursor->bit;
+}
+
+hound_err mcast_cursor_alloc(struct mcast_cursor **out_cursor, size_t max_len)
+{
+    struct mcast_cursor *cursor;
+
+    XASSERT_NOT_NULL(out_cursor);
+
+    cursor = malloc(sizeof(*cursor));
+    if (cursor == NULL) {
+        return HOUND_OOM;
+    }
+
+    init_mutex(&cursor->mutex);
+    init_cond(&cursor->ready_cond);
+    cursor->log = NULL;
+    cursor->index = 0;
+    cursor->bit = 0;
+    cursor->pos = 0;
+    xv_init(cursor->batches);
+    cursor->stash = NULL;
+    cursor->stash_cap = 0;
+    cursor->stash_front = 0;
+    cursor->stash_len = 0;
+    cursor->interrupt_gen = 0;
+    cursor->wake_len = SIZE_MAX;
+    cursor->wake_bytes = SIZE_MAX;
+    cursor->event_fd = EVENT_FD_INVALID;
+    cursor->event_len = 1;
+    cursor->event_signalled = false;
+    cursor->overflow = HOUND_OVERFLOW_OVERWRITE;
+    cursor->grow_len = max_len;
+    cursor->pushed = 0;
+    cursor->pushed_bytes = 0;
+    atomic_init(&cursor->bound, 0);
+    atomic_init(&cursor->published, 0);
+    atomic_init(&cursor->published_bytes, 0);
+    atomic_init(&cursor->claimed, 0);
+    atomic_init(&cursor->claimed_bytes, 0);
+    atomic_init(&cursor->dropped, 0);
+    atomic_init(&cursor->high_water, 0);
+    atomic_init(&cursor->max_len, max_len);
+    atomic_init(&cursor->waiters, 0);
+    atomic_init(&cursor->event_watch, false);
+
+    *out_cursor = cursor;
+
+    return HOUND_OK;
+}
+
+static
+void drain_nolock(struct mcast_cursor *cursor)
+{
+    size_t bytes;
+    size_t count;
+    uint_least64_t head;
+
+    stash_drain(cursor);
+    if (cursor->log != NULL) {
+        bytes = 0;
+        count = 0;
+        head = atomic_load_explicit(&cursor->log->head, memory_order_acquire);
+        for (; cursor->pos < head; ++cursor->pos) {
+            if (wants(cursor, cursor->pos)) {
+                bytes += slot_at(cursor->log, cursor->pos)->rec->record.size;
+                ++count;
+            }
+        }
+        claim(cursor, count, bytes);
+        set_bound(cursor);
+    }
+    update_event(cursor);
+}
+
+hound_err mcast_cursor_resize(
+    struct mcast_cursor *cursor,
+    size_t max_len,
+    bool flush)
+{
+    uint_least64_t head;
+
+    XASSERT_NOT_NULL(cursor);
+
+    lock_mutex(&cursor->mutex);
+
+    if (flush) {
+        drain_nolock(cursor);
+    }
+    else {
+        head = UINT_LEAST64_MAX;
+        if (cursor->log != NULL) {
+            head = atomic_load_explicit(
+                &cursor->log->head,
+                memory_order_acquire);
+        }
+        while (pending(cursor) > max_len && evict_oldest(cursor, head)) {
+        }
+    }
+    atomic_store(&cursor->max_len, max_len);
+    update_event(cursor);
+
+    unlock_mutex(&cursor->mutex);
+
+    return HOUND_OK;
+}
+
+void mcast_cursor_destroy(struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+    XASSERT_NULL(cursor->log);
+
+    stash_drain(cursor);
+    free(cursor->stash);
+    xv_destroy(cursor->batches);
+    if (cursor->event_fd != EVENT_FD_INVALID) {
+        close(cursor->event_fd);
+    }
+    destroy_mutex(&cursor->mutex);
+    destroy_cond(&cursor->ready_cond);
+    free(cursor);
+}
+
+void mcast_interrupt(struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    lock_mutex(&cursor->mutex);
+    ++cursor->interrupt_gen;
+    cond_broadcast(&cursor->ready_cond);
+    unlock_mutex(&cursor->mutex);
+}
+
+hound_err mcast_get_event_fd(struct mcast_cursor *cursor, int *fd)
+{
+    hound_err err;
+
+    XASSERT_NOT_NULL(cursor);
+    XASSERT_NOT_NULL(fd);
+
+    lock_mutex(&cursor->mutex);
+
+    if (cursor->event_fd == EVENT_FD_INVALID) {
+        cursor->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (cursor->event_fd == EVENT_FD_INVALID) {
+            err = errno;
+            goto out;
+        }
+        cursor->event_signalled = false;
+        atomic_store(&cursor->event_watch, true);
+        update_event(cursor);
+    }
+    *fd = cursor->event_fd;
+    err = HOUND_OK;
+
+out:
+    unlock_mutex(&cursor->mutex);
+    return err;
+}
+
+void mcast_set_event_len(struct mcast_cursor *cursor, size_t len)
+{
+    XASSERT_NOT_NULL(cursor);
+    XASSERT_GT(len, 0);
+
+    lock_mutex(&cursor->mutex);
+    cursor->event_len = len;
+    update_event(cursor);
+    unlock_mutex(&cursor->mutex);
+}
+
+void mcast_set_overflow(
+    struct mcast_cursor *cursor,
+    hound_overflow_policy policy,
+    size_t grow_len)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    lock_mutex(&cursor->mutex);
+    cursor->overflow = policy;
+    cursor->grow_len = grow_len;
+    unlock_mutex(&cursor->mutex);
+}
+
+/*
+ * Takes up to max_records records, totalling no more than bytes, from the
+ * front of the cursor. Records in the stash come first, and a single take never
+ * mixes them with records from the log.
+ */
+static
+size_t take(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    hound_seqno *first_seqno,
+    size_t *out_bytes)
+{
+    struct mcast_batch *batch;
+    uint_least64_t head;
+    size_t i;
+    size_t n;
+    struct record_info *rec;
+    uint_least64_t seqno;
+    uint_least64_t start;
+    size_t total;
+
+    *first_seqno = atomic_load(&cursor->claimed);
+    n = 0;
+    total = 0;
+    if (cursor->stash_len > 0) {
+        while (n < max_records && cursor->stash_len > 0) {
+            rec = cursor->stash[cursor->stash_front];
+            if (rec->record.size > bytes - total) {
+                break;
+            }
+            buf[n] = stash_pop(cursor);
+            total += rec->record.size;
+            ++n;
+        }
+    }
+    else if (cursor->log != NULL) {
+        head = atomic_load_explicit(&cursor->log->head, memory_order_acquire);
+        start = cursor->pos;
+        for (seqno = cursor->pos; seqno < head && n < max_records; ++seqno) {
+            if (!wants(cursor, seqno)) {
+                continue;
+            }
+            rec = slot_at(cursor->log, seqno)->rec;
+            if (rec->record.size > bytes - total) {
+                break;
+            }
+            if (n == 0) {
+                start = seqno;
+            }
+            buf[n] = rec;
+            total += rec->record.size;
+            ++n;
+        }
+        cursor->pos = seqno;
+
+        if (n > 0) {
+            batch = xv_pushp(struct mcast_batch, cursor->batches);
+            if (batch != NULL) {
+                batch->first = buf[0];
+                batch->count = n;
+                batch->start = start;
+                batch->end = seqno;
+            }
+            else {
+                /* Hand out references instead. */
+                for (i = 0; i < n; ++i) {
+                    atomic_ref_inc(&buf[i]->refcount);
+                }
+            }
+        }
+        set_bound(cursor);
+    }
+
+    claim(cursor, n, total);
+    update_event(cursor);
+    *out_bytes = total;
+
+    return n;
+}
+
+size_t mcast_pop_records_timeout(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    const struct timespec *deadline,
+    bool *interrupt)
+{
+    size_t bytes;
+    size_t count;
+    uint64_t gen;
+    hound_seqno *seqno;
+    hound_seqno tmp;
+    bool timed_out;
+
+    XASSERT_NOT_NULL(cursor);
+    XASSERT_NOT_NULL(buf);
+
+    count = 0;
+    *interrupt = false;
+    timed_out = false;
+    lock_mutex(&cursor->mutex);
+    gen = cursor->interrupt_gen;
+    do {
+        atomic_fetch_add(&cursor->waiters, 1);
+        while (pending(cursor) < records - count &&
+               cursor->interrupt_gen == gen) {
+            cursor->wake_len = min(cursor->wake_len, records - count);
+            if (deadline == NULL) {
+                cond_wait(&cursor->ready_cond, &cursor->mutex);
+            }
+            else if (!cond_timedwait(
+                &cursor->ready_cond,
+                &cursor->mutex,
+                deadline)) {
+                /* Out of time, so take whatever is there. */
+                timed_out = true;
+                break;
+            }
+        }
+        atomic_fetch_sub(&cursor->waiters, 1);
+        if (cursor->interrupt_gen != gen) {
+            *interrupt = true;
+            break;
+        }
+
+        /*
+         * We want to return the first sequence number for the entire buffer, so
+         * if we take more than once, just throw away the later values.
+         */
+        if (count == 0) {
+            seqno = first_seqno;
+        }
+        else {
+            seqno = &tmp;
+        }
+
+        count += take(
+            cursor,
+            buf + count,
+            records - count,
+            SIZE_MAX,
+            seqno,
+            &bytes);
+    } while (count < records && !timed_out);
+
+    unlock_mutex(&cursor->mutex);
+
+    return count;
+}
+
+size_t mcast_pop_bytes(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    size_t wait_records,
+    hound_seqno *first_seqno,
+    size_t *records,
+    bool *interrupt)
+{
+    size_t count;
+    uint64_t gen;
+
+    XASSERT_NOT_NULL(cursor);
+    XASSERT_NOT_NULL(buf);
+    XASSERT_NOT_NULL(records);
+
+    *interrupt = false;
+    lock_mutex(&cursor->mutex);
+    gen = cursor->interrupt_gen;
+
+    /*
+     * Wait for enough bytes or enough records, whichever comes first. A full
+     * cursor won't get any more bytes no matter how long we wait, so never wait
+     * for more records than it can hold.
+     */
+    wait_records = min(wait_records, atomic_load(&cursor->max_len));
+    atomic_fetch_add(&cursor->waiters, 1);
+    while (pending_bytes(cursor) < bytes &&
+           pending(cursor) < wait_records &&
+           cursor->interrupt_gen == gen) {
+        cursor->wake_bytes = min(cursor->wake_bytes, bytes);
+        cursor->wake_len = min(cursor->wake_len, wait_records);
+        cond_wait(&cursor->ready_cond, &cursor->mutex);
+    }
+    atomic_fetch_sub(&cursor->waiters, 1);
+
+    if (cursor->interrupt_gen != gen) {
+        *interrupt = true;
+        *records = 0;
+        count = 0;
+    }
+    else {
+        *records = take(cursor, buf, max_records, bytes, first_seqno, &count);
+    }
+
+    unlock_mutex(&cursor->mutex);
+
+    return count;
+}
+
+size_t mcast_pop_bytes_nowait(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    hound_seqno *first_seqno,
+    size_t *records)
+{
+    size_t count;
+
+    XASSERT_NOT_NULL(cursor);
+    XASSERT_NOT_NULL(buf);
+    XASSERT_NOT_NULL(records);
+
+    lock_mutex(&cursor->mutex);
+    *records = take(cursor, buf, max_records, bytes, first_seqno, &count);
+    unlock_mutex(&cursor->mutex);
+
+    return count;
+}
+
+size_t mcast_pop_records_nowait(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    hound_seqno *first_seqno,
+    size_t records)
+{
+    size_t bytes;
+    size_t count;
+    hound_seqno *seqno;
+    hound_seqno tmp;
+    size_t n;
+
+    XASSERT_NOT_NULL(cursor);
+    XASSERT_NOT_NULL(buf);
+
+    /* A take stops where the stash ends, so keep going into the log. */
+    count = 0;
+    seqno = first_seqno;
+    lock_mutex(&cursor->mutex);
+    do {
+        n = take(cursor, buf + count, records - count, SIZE_MAX, seqno, &bytes);
+        count += n;
+        seqno = &tmp;
+    } while (n > 0 && count < records);
+    unlock_mutex(&cursor->mutex);
+
+    return count;
+}
+
+void mcast_release(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t count)
+{
+    struct mcast_batch *batch;
+    size_t i;
+    size_t j;
+
+    XASSERT_NOT_NULL(cursor);
+
+    if (count == 0) {
+        return;
+    }
+    XASSERT_NOT_NULL(buf);
+
+    lock_mutex(&cursor->mutex);
+    i = 0;
+    while (i < count) {
+        for (j = 0; j < xv_size(cursor->batches); ++j) {
+            if (xv_A(cursor->batches, j).first == buf[i]) {
+                break;
+            }
+        }
+        if (j == xv_size(cursor->batches)) {
+            /* This record came with a reference. */
+            record_ref_dec(buf[i]);
+            ++i;
+            continue;
+        }
+
+        batch = &xv_A(cursor->batches, j);
+        XASSERT_LTE(batch->count, count - i);
+        i += batch->count;
+        xv_quickdel(cursor->batches, j);
+    }
+    if (cursor->log != NULL) {
+        set_bound(cursor);
+    }
+    unlock_mutex(&cursor->mutex);
+}
+
+void mcast_keep(
+    struct mcast_cursor *cursor,
+    struct record_info **buf,
+    size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        atomic_ref_inc(&buf[i]->refcount);
+    }
+    mcast_release(cursor, buf, count);
+}
+
+void mcast_drain(struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    lock_mutex(&cursor->mutex);
+    drain_nolock(cursor);
+    unlock_mutex(&cursor->mutex);
+}
+
+size_t mcast_len(struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    return pending(cursor);
+}
+
+size_t mcast_max_len(struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    return atomic_load(&cursor->max_len);
+}
+
+uint64_t mcast_dropped(struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    return atomic_load(&cursor->dropped);
+}
+
+size_t mcast_high_water(struct mcast_cursor *cursor)
+{
+    XASSERT_NOT_NULL(cursor);
+
+    return atomic_load(&cursor->high_water);
+}
@@ -11,10 +11,15 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <hound/hound.h>
+#include <hound-private/driver.h>
 #include <hound-private/log.h>
 #include <hound-private/parse/common.h>
 #include <hound-private/util.h>
+#include <limits.h>
 #include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
 #include <xlib/xassert.h>
 #include <yaml.h>
@@ -25,8 +30,29 @@ struct driver_init {
     const char *name;
     const char *path;
     const char *schema;
+    bool schema_cache;
     size_t arg_count;
     struct hound_init_arg *args;
+    int shard;
+    int cpu;
+    size_t cpu_count;
+    int *cpus;
+    bool set_sched;
+    hound_sched_policy sched_policy;
+    int sched_priority;
+    int busy_poll_ns;
+    int mlock_records;
+
+    /* The result of initializing the driver. */
+    hound_err err;
+};
+
+/* Drivers for init workers to initialize, handed out in config order. */
+struct init_pool {
+    size_t init_count;
+    struct driver_init *init_list;
+    const char *schema_base;
+    atomic_size_t next;
 };
 
 #define CHECK_ERRNO \
@@ -218,6 +244,78 @@ hound_err parse_args(
     return err;
 }
 
+static
+hound_err parse_index(const char *data, int *out)
+{
+    intmax_t val;
+
+    errno = 0;
+    val = strtoimax(data, NULL, 0);
+    CHECK_ERRNO;
+    if (val < 0 || val > INT_MAX) {
+        return HOUND_INVALID_VAL;
+    }
+    *out = (int) val;
+
+    return HOUND_OK;
+}
+
+static
+hound_err parse_sched_policy(const char *data, hound_sched_policy *out)
+{
+    if (strcmp(data, "other") == 0) {
+        *out = HOUND_SCHED_OTHER;
+    }
+    else if (strcmp(data, "fifo") == 0) {
+        *out = HOUND_SCHED_FIFO;
+    }
+    else if (strcmp(data, "rr") == 0) {
+        *out = HOUND_SCHED_RR;
+    }
+    else {
+        return HOUND_INVALID_VAL;
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err parse_cpus(
+    yaml_document_t *doc,
+    yaml_node_t *node,
+    struct driver_init *init)
+{
+    size_t count;
+    yaml_node_t *cpu_node;
+    hound_err err;
+    yaml_node_item_t *item;
+
+    XASSERT_EQ(node->type, YAML_SEQUENCE_NODE);
+    XASSERT_GTE(node->data.sequence.items.top, node->data.sequence.items.start);
+    count = node->data.sequence.items.top - node->data.sequence.items.start;
+    init->cpus = malloc(count * sizeof(*init->cpus));
+    if (init->cpus == NULL) {
+        return HOUND_OOM;
+    }
+
+    for (item = node->data.sequence.items.start;
+         item < node->data.sequence.items.top;
+         ++item) {
+        cpu_node = yaml_document_get_node(doc, *item);
+        XASSERT_NOT_NULL(cpu_node);
+        XASSERT_EQ(cpu_node->type, YAML_SCALAR_NODE);
+        err = parse_index(
+            (const char *) cpu_node->data.scalar.value,
+            &init->cpus[init->cpu_count]);
+        if (err != HOUND_OK) {
+            return err;
+        }
+        ++init->cpu_count;
+    }
+
+    return HOUND_OK;
+}
+
 static
 hound_err parse_driver(
     yaml_document_t *doc,
@@ -232,6 +330,16 @@ hound_err parse_driver(
     const char *val_str;
 
     XASSERT_EQ(node->type, YAML_MAPPING_NODE);
+    init->schema_cache = false;
+    init->shard = -1;
+    init->cpu = -1;
+    init->cpu_count = 0;
+    init->cpus = NULL;
+    init->set_sched = false;
+    init->sched_policy = HOUND_SCHED_FIFO;
+    init->sched_priority = -1;
+    init->busy_poll_ns = -1;
+    init->mlock_records = -1;
     for (pair = node->data.mapping.pairs.start;
          pair < node->data.mapping.pairs.top;
          ++pair) {
@@ -256,12 +364,73 @@ hound_err parse_driver(
             val_str = (const char *) val->data.scalar.value;
             init->schema = val_str;
         }
+        else if (strcmp(key_str, "schema_cache") == 0) {
+            XASSERT_EQ(val->type, YAML_SCALAR_NODE);
+            val_str = (const char *) val->data.scalar.value;
+            init->schema_cache = parse_bool(val_str);
+        }
         else if (strcmp(key_str, "args") == 0) {
             err = parse_args(doc, val, init);
             if (err != HOUND_OK) {
                 return err;
             }
         }
+        else if (strcmp(key_str, "shard") == 0) {
+            XASSERT_EQ(val->type, YAML_SCALAR_NODE);
+            val_str = (const char *) val->data.scalar.value;
+            err = parse_index(val_str, &init->shard);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
+        else if (strcmp(key_str, "cpu") == 0) {
+            XASSERT_EQ(val->type, YAML_SCALAR_NODE);
+            val_str = (const char *) val->data.scalar.value;
+            err = parse_index(val_str, &init->cpu);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
+        else if (strcmp(key_str, "cpus") == 0) {
+            err = parse_cpus(doc, val, init);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
+        else if (strcmp(key_str, "io_policy") == 0) {
+            XASSERT_EQ(val->type, YAML_SCALAR_NODE);
+            val_str = (const char *) val->data.scalar.value;
+            err = parse_sched_policy(val_str, &init->sched_policy);
+            if (err != HOUND_OK) {
+                return err;
+            }
+            init->set_sched = true;
+        }
+        else if (strcmp(key_str, "io_priority") == 0) {
+            XASSERT_EQ(val->type, YAML_SCALAR_NODE);
+            val_str = (const char *) val->data.scalar.value;
+            err = parse_index(val_str, &init->sched_priority);
+            if (err != HOUND_OK) {
+                return err;
+            }
+            init->set_sched = true;
+        }
+        else if (strcmp(key_str, "io_busy_poll_ns") == 0) {
+            XASSERT_EQ(val->type, YAML_SCALAR_NODE);
+            val_str = (const char *) val->data.scalar.value;
+            err = parse_index(val_str, &init->busy_poll_ns);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
+        else if (strcmp(key_str, "mlock") == 0) {
+            XASSERT_EQ(val->type, YAML_SCALAR_NODE);
+            val_str = (const char *) val->data.scalar.value;
+            err = parse_index(val_str, &init->mlock_records);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
         else {
           /* unknown key */
           XASSERT_ERROR;
@@ -315,40 +484,252 @@ int parse_doc(
 }
 
 static
-hound_err register_drivers(
+hound_err apply_io_settings(const struct driver_init *init)
+{
+    hound_err err;
+    int priority;
+
+    if (init->shard >= 0 || init->cpu >= 0) {
+        err = driver_set_io_shard(init->path, init->shard, init->cpu);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    if (init->cpu_count > 0) {
+        err = hound_set_io_cpus(init->path, init->cpus, init->cpu_count);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    if (init->set_sched) {
+        /*
+         * A priority on its own means FIFO, and a real-time policy on its own
+         * means the lowest real-time priority.
+         */
+        priority = init->sched_priority;
+        if (priority < 0) {
+            priority = (init->sched_policy == HOUND_SCHED_OTHER) ? 0 : 1;
+        }
+        err = hound_set_io_sched(init->path, init->sched_policy, priority);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    if (init->busy_poll_ns >= 0) {
+        err = hound_set_io_busy_poll(init->path, init->busy_poll_ns);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    if (init->mlock_records >= 0) {
+        err = hound_lock_memory(init->path, init->mlock_records);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    return HOUND_OK;
+}
+
+static
+void init_driver(struct driver_init *init, const char *schema_base)
+{
+    init->err = driver_init(
+        init->name,
+        init->path,
+        schema_base,
+        init->schema,
+        init->schema_cache,
+        init->arg_count,
+        init->args);
+    if (init->err != HOUND_OK) {
+        hound_log_err(
+            init->err,
+            "failed to initialize driver %s at path %s",
+            init->name,
+            init->path);
+    }
+}
+
+static
+void *init_worker(void *data)
+{
+    size_t i;
+    struct init_pool *pool;
+
+    pool = data;
+    while (true) {
+        i = atomic_fetch_add(&pool->next, 1);
+        if (i >= pool->init_count) {
+            break;
+        }
+        init_driver(&pool->init_list[i], pool->schema_base);
+    }
+
+    return NULL;
+}
+
+/*
+ * Initialize every driver on a pool of threads, including this one. Drivers
+ * are independent and take the driver lock only to register themselves, so
+ * this takes about as long as the slowest driver rather than all of them.
+ */
+static
+void init_drivers_parallel(
+    size_t init_count,
+    struct driver_init *init_list,
+    const char *schema_base,
+    size_t thread_count)
+{
+    size_t i;
+    struct init_pool pool;
+    int ret;
+    size_t started;
+    pthread_t *threads;
+
+    pool.init_count = init_count;
+    pool.init_list = init_list;
+    pool.schema_base = schema_base;
+    atomic_init(&pool.next, 0);
+
+    if (thread_count == 0 || thread_count > init_count) {
+        thread_count = init_count;
+    }
+
+    /*
+     * If we can't start as many threads as we want, the ones we have (at
+     * worst, just this one) pick up the slack.
+     */
+    started = 0;
+    threads = NULL;
+    if (thread_count > 1) {
+        threads = malloc((thread_count - 1) * sizeof(*threads));
+    }
+    if (threads != NULL) {
+        for (i = 0; i < thread_count - 1; ++i) {
+            ret = pthread_create(&threads[i], NULL, init_worker, &pool);
+            if (ret != 0) {
+                hound_log_err_nofmt(ret, "failed to start driver init thread");
+                break;
+            }
+            ++started;
+        }
+    }
+
+    init_worker(&pool);
+
+    for (i = 0; i < started; ++i) {
+        ret = pthread_join(threads[i], NULL);
+        XASSERT_EQ(ret, 0);
+    }
+    free(threads);
+}
+
+static
+void init_drivers_serial(
     size_t init_count,
     struct driver_init *init_list,
     const char *schema_base)
+{
+    size_t i;
+
+    for (i = 0; i < init_count; ++i) {
+        init_driver(&init_list[i], schema_base);
+        if (init_list[i].err != HOUND_OK) {
+            break;
+        }
+    }
+
+    /* Drivers after a failure are never tried. */
+    for (++i; i < init_count; ++i) {
+        init_list[i].err = HOUND_DRIVER_NOT_REGISTERED;
+    }
+}
+
+/* Unregister every driver in the list that initialized successfully. */
+static
+void unregister_drivers(size_t init_count, const struct driver_init *init_list)
+{
+    hound_err err;
+    size_t i;
+    const struct driver_init *init;
+
+    for (i = 0; i < init_count; ++i) {
+        init = &init_list[i];
+        if (init->err != HOUND_OK) {
+            continue;
+        }
+
+        err = hound_destroy_driver(init->path);
+        if (err != HOUND_OK) {
+            hound_log_err(
+                err,
+                "failed to unregister driver %s at path %s",
+                init->name,
+                init->path);
+        }
+    }
+}
+
+static
+hound_err register_drivers(
+    size_t init_count,
+    struct driver_init *init_list,
+    const char *schema_base,
+    size_t thread_count)
 {
     hound_err err;
-    hound_err err2;
     size_t i;
     struct driver_init *init;
 
+    if (init_count == 0) {
+        return HOUND_OK;
+    }
+
+    if (thread_count == 1) {
+        init_drivers_serial(init_count, init_list, schema_base);
+    }
+    else {
+        init_drivers_parallel(init_count, init_list, schema_base, thread_count);
+    }
+
+    /*
+     * Either every driver comes up or none do. Report the first failure in
+     * config order, so the result doesn't depend on thread timing.
+     */
+    err = HOUND_OK;
+    for (i = 0; i < init_count; ++i) {
+        if (init_list[i].err != HOUND_OK) {
+            err = init_list[i].err;
+            goto error;
+        }
+    }
+
+    /*
+     * Apply I/O settings in config order, as several drivers may set up the
+     * same I/O shard.
+     */
     for (i = 0; i < init_count; ++i) {
         init = &init_list[i];
-        err = hound_init_driver(
-            init->name,
-            init->path,
-            schema_base,
-            init->schema,
-            init->arg_count,
-            init->args);
+        err = apply_io_settings(init);
         if (err != HOUND_OK) {
-            for (--i; i < init_count; --i) {
-                err2 = hound_destroy_driver(init->path);
-                if (err2 != HOUND_OK) {
-                    hound_log_err(
-                        err2,
-                        "failed to unregister driver %s at path %s",
-                        init->name,
-                        init->path);
-                }
-            }
-            break;
+            hound_log_err(
+                err,
+                "failed to apply I/O settings for driver %s at path %s",
+                init->name,
+                init->path);
+            goto error;
         }
     }
 
+    return HOUND_OK;
+
+error:
+    unregister_drivers(init_count, init_list);
     return err;
 }
 
@@ -359,13 +740,17 @@ void destroy_init_list(size_t init_count, struct driver_init *init_list)
 
     for (i = 0; i < init_count; ++i) {
         free(init_list[i].args);
+        free(init_list[i].cpus);
     }
 
     free(init_list);
 }
 
 static
-hound_err register_config(FILE *file, const char *schema_base)
+hound_err register_config(
+    FILE *file,
+    const char *schema_base,
+    size_t thread_count)
 {
     yaml_document_t doc;
     hound_err err;
@@ -395,7 +780,7 @@ hound_err register_config(FILE *file, const char *schema_base)
         goto out;
     }
 
-    err = register_drivers(init_count, init_list, schema_base);
+    err = register_drivers(init_count, init_list, schema_base, thread_count);
     if (err != HOUND_OK) {
         goto out;
     }
@@ -407,7 +792,10 @@ out:
     return err;
 }
 
-hound_err parse_config(const char *config_path, const char *schema_base)
+hound_err parse_config(
+    const char *config_path,
+    const char *schema_base,
+    size_t thread_count)
 {
     hound_err err;
     FILE *f;
@@ -424,7 +812,7 @@ hound_err parse_config(const char *config_path, const char *schema_base)
         goto error_fopen;
     }
 
-    err = register_config(f, schema_base);
+    err = register_config(f, schema_base, thread_count);
     fclose(f);
     if (err != HOUND_OK) {
         goto error_parse;
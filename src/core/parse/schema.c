@@ -7,6 +7,7 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
+#include <fcntl.h>
 #include <hound/hound.h>
 #include <hound-private/driver.h>
 #include <hound-private/error.h>
@@ -14,14 +15,62 @@
 #include <hound-private/parse/common.h>
 #include <hound-private/parse/schema.h>
 #include <hound-private/util.h>
+#include <hound-private/log.h>
 #include <linux/limits.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <xlib/xvec.h>
 #include <yaml.h>
 
 #define MAX_FMT_ENTRIES 100
 
+#define CACHE_MAGIC 0x31435348 /* "HSC1" */
+#define CACHE_VERSION 1
+#define CACHE_SUFFIX ".cache"
+#define CACHE_TMP_SUFFIX ".XXXXXX"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325
+#define FNV_PRIME 0x100000001b3
+
+/*
+ * A binary schema cache starts with this header, followed by an array of
+ * struct schema_desc, an array of struct hound_data_fmt, and the strings they
+ * name. Pointers in the descriptors and formats are stored as offsets from the
+ * start of the file, and are turned back into pointers when the cache is
+ * mapped. The cache is only meant to be read by the build that wrote it, so it
+ * uses the native struct layout.
+ */
+struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t desc_size;
+    uint32_t fmt_size;
+
+    /* The YAML schema the cache was compiled from. */
+    int64_t yaml_mtime_sec;
+    int64_t yaml_mtime_nsec;
+    uint64_t yaml_size;
+    uint64_t yaml_hash;
+
+    uint64_t desc_count;
+    uint64_t fmt_count;
+
+    /* A hash of everything after the header, to catch a corrupt cache. */
+    uint64_t body_hash;
+};
+
+/* Where each section of a cache starts. */
+struct cache_layout {
+    size_t descs;
+    size_t fmts;
+    size_t strs;
+};
+
 void destroy_desc_fmts(size_t count, struct hound_data_fmt *fmts)
 {
     size_t i;
@@ -38,6 +87,38 @@ void destroy_schema_desc(struct schema_desc *desc)
     destroy_desc_fmts(desc->fmt_count, desc->fmts);
 }
 
+/**
+ * Free descriptors returned by schema_parse. Descriptors loaded from a cache
+ * live in its mapping, which stays around until schema_cache_unmap.
+ */
+void destroy_schema_descs(
+    const struct schema_cache *cache,
+    size_t count,
+    struct schema_desc *descs)
+{
+    size_t i;
+
+    if (cache->map != NULL) {
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        destroy_schema_desc(&descs[i]);
+    }
+    free(descs);
+}
+
+void schema_cache_unmap(struct schema_cache *cache)
+{
+    if (cache->map == NULL) {
+        return;
+    }
+
+    munmap(cache->map, cache->size);
+    cache->map = NULL;
+    cache->size = 0;
+}
+
 static
 hound_err copy_desc_fmt(
     const struct hound_data_fmt *src,
@@ -254,7 +335,8 @@ hound_err parse_fmts(
     XASSERT_GTE(fmt_count, 1);
     XASSERT_LTE(fmt_count, MAX_FMT_ENTRIES);
 
-    fmts = malloc(fmt_count * sizeof(*fmts));
+    /* Zero this out so that a schema cache never sees uninitialized fields. */
+    fmts = calloc(fmt_count, sizeof(*fmts));
     if (fmts == NULL) {
         return HOUND_OOM;
     }
@@ -327,8 +409,10 @@ hound_err parse_doc(
     return HOUND_OK;
 }
 
+static
 hound_err parse(
-    FILE *file,
+    const unsigned char *yaml,
+    size_t yaml_size,
     size_t *out_desc_count,
     struct schema_desc **out_descs)
 {
@@ -346,7 +430,7 @@ hound_err parse(
     if (ret == 0) {
         return HOUND_OOM;
     }
-    yaml_parser_set_input_file(&parser, file);
+    yaml_parser_set_input_string(&parser, yaml, yaml_size);
 
     err = HOUND_OK;
     xv_init(descs);
@@ -403,38 +487,485 @@ hound_err parse(
     return err;
 }
 
+static
+uint64_t hash_bytes(const unsigned char *buf, size_t size)
+{
+    uint64_t hash;
+    size_t i;
+
+    /* FNV-1a, which is plenty to notice a schema that changed. */
+    hash = FNV_OFFSET_BASIS;
+    for (i = 0; i < size; ++i) {
+        hash ^= buf[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static
+hound_err read_file(
+    const char *path,
+    struct stat *st,
+    unsigned char **out_buf,
+    size_t *out_size)
+{
+    unsigned char *buf;
+    hound_err err;
+    FILE *f;
+    size_t size;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return HOUND_IO_ERROR;
+    }
+
+    if (fstat(fileno(f), st) != 0) {
+        err = HOUND_IO_ERROR;
+        goto out;
+    }
+    size = st->st_size;
+
+    /* Allocate a spare byte, as malloc(0) may return NULL for an empty file. */
+    buf = malloc(size + 1);
+    if (buf == NULL) {
+        err = HOUND_OOM;
+        goto out;
+    }
+
+    if (fread(buf, 1, size, f) != size) {
+        free(buf);
+        err = HOUND_IO_ERROR;
+        goto out;
+    }
+
+    *out_buf = buf;
+    *out_size = size;
+    err = HOUND_OK;
+
+out:
+    fclose(f);
+    return err;
+}
+
+static
+size_t align_up(size_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+static
+void get_cache_layout(
+    size_t desc_count,
+    size_t fmt_count,
+    struct cache_layout *layout)
+{
+    layout->descs = align_up(
+        sizeof(struct cache_header),
+        _Alignof(struct schema_desc));
+    layout->fmts = align_up(
+        layout->descs + desc_count*sizeof(struct schema_desc),
+        _Alignof(struct hound_data_fmt));
+    layout->strs = layout->fmts + fmt_count*sizeof(struct hound_data_fmt);
+}
+
+static
+bool header_matches(
+    const struct cache_header *header,
+    const struct stat *st,
+    uint64_t hash)
+{
+    return
+        header->magic == CACHE_MAGIC &&
+        header->version == CACHE_VERSION &&
+        header->desc_size == sizeof(struct schema_desc) &&
+        header->fmt_size == sizeof(struct hound_data_fmt) &&
+        header->yaml_mtime_sec == st->st_mtim.tv_sec &&
+        header->yaml_mtime_nsec == st->st_mtim.tv_nsec &&
+        header->yaml_size == (uint64_t) st->st_size &&
+        header->yaml_hash == hash;
+}
+
+/*
+ * Turn a string offset from a cache into a pointer, or return NULL if the
+ * offset doesn't point at a null-terminated string in the string section.
+ */
+static
+const char *relocate_str(
+    unsigned char *map,
+    size_t size,
+    const struct cache_layout *layout,
+    const char *str)
+{
+    uintptr_t offset;
+
+    offset = (uintptr_t) str;
+    if (offset < layout->strs || offset >= size) {
+        return NULL;
+    }
+
+    if (memchr(map + offset, '\0', size - offset) == NULL) {
+        return NULL;
+    }
+
+    return (const char *) (map + offset);
+}
+
+/*
+ * Point a cache's descriptors and formats at the mapping they live in,
+ * checking every offset along the way so a corrupt cache can't send us off
+ * into the weeds.
+ */
+static
+bool relocate_cache(
+    unsigned char *map,
+    size_t size,
+    const struct cache_header *header)
+{
+    struct schema_desc *desc;
+    struct schema_desc *descs;
+    struct hound_data_fmt *fmt;
+    struct hound_data_fmt *fmts;
+    size_t i;
+    struct cache_layout layout;
+    uintptr_t offset;
+
+    if (header->desc_count == 0 ||
+        header->desc_count > size / sizeof(*descs) ||
+        header->fmt_count > size / sizeof(*fmts)) {
+        return false;
+    }
+    get_cache_layout(header->desc_count, header->fmt_count, &layout);
+    if (layout.strs > size) {
+        return false;
+    }
+
+    fmts = (struct hound_data_fmt *) (map + layout.fmts);
+    for (i = 0; i < header->fmt_count; ++i) {
+        fmt = &fmts[i];
+        fmt->name = relocate_str(map, size, &layout, fmt->name);
+        if (fmt->name == NULL) {
+            return false;
+        }
+    }
+
+    descs = (struct schema_desc *) (map + layout.descs);
+    for (i = 0; i < header->desc_count; ++i) {
+        desc = &descs[i];
+        desc->name = relocate_str(map, size, &layout, desc->name);
+        if (desc->name == NULL) {
+            return false;
+        }
+
+        offset = (uintptr_t) desc->fmts;
+        if (desc->fmt_count == 0 ||
+            offset < layout.fmts ||
+            (offset - layout.fmts) % sizeof(*fmts) != 0 ||
+            (offset - layout.fmts) / sizeof(*fmts) + desc->fmt_count >
+                header->fmt_count) {
+            return false;
+        }
+        desc->fmts = (struct hound_data_fmt *) (map + offset);
+    }
+
+    return true;
+}
+
+/*
+ * Map a schema cache, if there is an up-to-date one. The mapping is private,
+ * so the caller may write to the descriptors without touching the file.
+ */
+static
+bool load_cache(
+    const char *cache_path,
+    const struct stat *yaml_st,
+    uint64_t yaml_hash,
+    struct schema_cache *cache,
+    size_t *out_desc_count,
+    struct schema_desc **out_descs)
+{
+    int fd;
+    const struct cache_header *header;
+    unsigned char *map;
+    size_t size;
+    struct stat st;
+
+    fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(*header)) {
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    header = (const struct cache_header *) map;
+    if (!header_matches(header, yaml_st, yaml_hash) ||
+        header->body_hash !=
+            hash_bytes(map + sizeof(*header), size - sizeof(*header)) ||
+        !relocate_cache(map, size, header)) {
+        munmap(map, size);
+        return false;
+    }
+
+    cache->map = map;
+    cache->size = size;
+    *out_desc_count = header->desc_count;
+    *out_descs = (struct schema_desc *) (map + align_up(
+        sizeof(*header),
+        _Alignof(struct schema_desc)));
+
+    return true;
+}
+
+static
+hound_err write_all(int fd, const unsigned char *buf, size_t size)
+{
+    ssize_t bytes;
+
+    while (size > 0) {
+        bytes = write(fd, buf, size);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        buf += bytes;
+        size -= bytes;
+    }
+
+    return HOUND_OK;
+}
+
+/* Compile parsed descriptors into a cache image, allocating the result. */
+static
+hound_err make_cache(
+    const struct stat *yaml_st,
+    uint64_t yaml_hash,
+    size_t desc_count,
+    const struct schema_desc *descs,
+    unsigned char **out_image,
+    size_t *out_size)
+{
+    struct schema_desc *cache_desc;
+    struct schema_desc *cache_descs;
+    struct hound_data_fmt *cache_fmt;
+    struct hound_data_fmt *cache_fmts;
+    const struct schema_desc *desc;
+    size_t fmt_count;
+    size_t fmt_pos;
+    struct cache_header *header;
+    size_t i;
+    unsigned char *image;
+    size_t j;
+    struct cache_layout layout;
+    size_t len;
+    size_t size;
+    size_t str_pos;
+
+    fmt_count = 0;
+    size = 0;
+    for (i = 0; i < desc_count; ++i) {
+        desc = &descs[i];
+        fmt_count += desc->fmt_count;
+        size += strlen(desc->name) + 1;
+        for (j = 0; j < desc->fmt_count; ++j) {
+            size += strlen(desc->fmts[j].name) + 1;
+        }
+    }
+    get_cache_layout(desc_count, fmt_count, &layout);
+    size += layout.strs;
+
+    /* Zero the image so padding doesn't leak into the file. */
+    image = calloc(1, size);
+    if (image == NULL) {
+        return HOUND_OOM;
+    }
+
+    header = (struct cache_header *) image;
+    header->magic = CACHE_MAGIC;
+    header->version = CACHE_VERSION;
+    header->desc_size = sizeof(*cache_descs);
+    header->fmt_size = sizeof(*cache_fmts);
+    header->yaml_mtime_sec = yaml_st->st_mtim.tv_sec;
+    header->yaml_mtime_nsec = yaml_st->st_mtim.tv_nsec;
+    header->yaml_size = yaml_st->st_size;
+    header->yaml_hash = yaml_hash;
+    header->desc_count = desc_count;
+    header->fmt_count = fmt_count;
+
+    cache_descs = (struct schema_desc *) (image + layout.descs);
+    cache_fmts = (struct hound_data_fmt *) (image + layout.fmts);
+    fmt_pos = 0;
+    str_pos = layout.strs;
+    for (i = 0; i < desc_count; ++i) {
+        desc = &descs[i];
+        cache_desc = &cache_descs[i];
+        cache_desc->data_id = desc->data_id;
+        cache_desc->fmt_count = desc->fmt_count;
+        cache_desc->fmts = (struct hound_data_fmt *) (uintptr_t)
+            (layout.fmts + fmt_pos*sizeof(*cache_fmts));
+
+        len = strlen(desc->name) + 1;
+        memcpy(image + str_pos, desc->name, len);
+        cache_desc->name = (const char *) (uintptr_t) str_pos;
+        str_pos += len;
+
+        for (j = 0; j < desc->fmt_count; ++j) {
+            cache_fmt = &cache_fmts[fmt_pos];
+            *cache_fmt = desc->fmts[j];
+            len = strlen(cache_fmt->name) + 1;
+            memcpy(image + str_pos, cache_fmt->name, len);
+            cache_fmt->name = (const char *) (uintptr_t) str_pos;
+            str_pos += len;
+            ++fmt_pos;
+        }
+    }
+    XASSERT_EQ(str_pos, size);
+    header->body_hash = hash_bytes(
+        image + sizeof(*header),
+        size - sizeof(*header));
+
+    *out_image = image;
+    *out_size = size;
+
+    return HOUND_OK;
+}
+
+/*
+ * Write a cache next to the YAML schema. Writing goes to a temporary file that
+ * gets renamed into place, so a reader never maps a half-written cache. This is
+ * purely an optimization, so failing (for example because the schema directory
+ * is read-only) just means we parse the YAML again next time.
+ */
+static
+void write_cache(
+    const char *cache_path,
+    const struct stat *yaml_st,
+    uint64_t yaml_hash,
+    size_t desc_count,
+    const struct schema_desc *descs)
+{
+    hound_err err;
+    int fd;
+    unsigned char *image;
+    size_t size;
+    char tmp_path[PATH_MAX];
+
+    err = make_cache(yaml_st, yaml_hash, desc_count, descs, &image, &size);
+    if (err != HOUND_OK) {
+        goto error_make_cache;
+    }
+
+    if (strlen(cache_path) + sizeof(CACHE_TMP_SUFFIX) > sizeof(tmp_path)) {
+        err = HOUND_PATH_TOO_LONG;
+        goto error_tmp_path;
+    }
+    strcpy(tmp_path, cache_path);
+    strcat(tmp_path, CACHE_TMP_SUFFIX);
+
+    fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        err = errno;
+        goto error_tmp_path;
+    }
+
+    err = write_all(fd, image, size);
+    if (close(fd) != 0 && err == HOUND_OK) {
+        err = errno;
+    }
+    if (err == HOUND_OK && rename(tmp_path, cache_path) != 0) {
+        err = errno;
+    }
+    if (err != HOUND_OK) {
+        unlink(tmp_path);
+    }
+
+error_tmp_path:
+    free(image);
+error_make_cache:
+    if (err != HOUND_OK) {
+        hound_log_err(err, "failed to write schema cache %s", cache_path);
+    }
+}
+
 hound_err schema_parse(
     const char *schema_base,
     const char *schema,
+    bool use_cache,
+    struct schema_cache *cache,
     size_t *out_desc_count,
     struct schema_desc **out_descs)
 {
+    char cache_path[PATH_MAX];
     hound_err err;
-    FILE *f;
     size_t desc_count;
     struct schema_desc *descs;
     char path[PATH_MAX];
+    struct stat st;
+    unsigned char *yaml;
+    uint64_t yaml_hash;
+    size_t yaml_size;
 
     XASSERT_NOT_NULL(schema);
+    XASSERT_NOT_NULL(cache);
+
+    cache->map = NULL;
+    cache->size = 0;
 
     err = norm_path(schema_base, schema, ARRAYLEN(path), path);
     if (err != HOUND_OK) {
         return HOUND_PATH_TOO_LONG;
     }
 
-    f = fopen(path, "r");
-    if (f == NULL) {
-        err = HOUND_IO_ERROR;
+    if (use_cache) {
+        if (strlen(path) + sizeof(CACHE_SUFFIX) > sizeof(cache_path)) {
+            return HOUND_PATH_TOO_LONG;
+        }
+        strcpy(cache_path, path);
+        strcat(cache_path, CACHE_SUFFIX);
+    }
+
+    err = read_file(path, &st, &yaml, &yaml_size);
+    if (err != HOUND_OK) {
+        return err;
+    }
+
+    /*
+     * Hashing the YAML is far cheaper than parsing it, and it catches edits
+     * that keep the old mtime, such as cp -p.
+     */
+    yaml_hash = use_cache ? hash_bytes(yaml, yaml_size) : 0;
+    if (use_cache) {
+        if (load_cache(cache_path, &st, yaml_hash, cache, out_desc_count,
+                       out_descs)) {
+            err = HOUND_OK;
+            goto out;
+        }
+    }
+
+    err = parse(yaml, yaml_size, &desc_count, &descs);
+    if (err != HOUND_OK) {
         goto out;
     }
 
-    err = parse(f, &desc_count, &descs);
-    fclose(f);
-    if (err == HOUND_OK) {
-        *out_desc_count = desc_count;
-        *out_descs = descs;
+    if (use_cache) {
+        write_cache(cache_path, &st, yaml_hash, desc_count, descs);
     }
 
+    *out_desc_count = desc_count;
+    *out_descs = descs;
+
 out:
+    free(yaml);
     return err;
 }
@@ -0,0 +1,399 @@
+/**
+ * @file      pool.c
+ * @brief     Pooled record allocator. Each driver gets a pool that hands out a
+ *            record info and its payload as a single block, taken from a set of
+ *            size-classed free lists. The size classes come from the fixed
+ *            record sizes in the driver's schema, plus a few generic classes
+ *            for variable-length records. Every block has room for at least
+ *            CONFIG_HOUND_INLINE_RECORD_SIZE bytes of payload, and all records
+ *            that small share a single class. When a record's refcount drops
+ *            to 0, its block goes back onto its free list rather than back to
+ *            malloc, so a driver in steady state doesn't allocate at all.
+ *
+ *            Blocks are taken from the pool only from within driver callbacks,
+ *            which are serialized by the driver's op lock, so there is only
+ *            ever one allocating thread per pool. Blocks can be returned from
+ *            any thread. Returned blocks are pushed onto a lock-free "remote"
+ *            list, which the allocating thread takes over all at once when its
+ *            private list runs dry. Since only one thread ever removes blocks
+ *            from the remote list, and it removes all of them at once, there is
+ *            no ABA problem.
+ *
+ *            Records can outlive their driver (they may still be sitting in a
+ *            user queue after the driver is destroyed), so the pool is
+ *            refcounted: the driver holds one reference and each outstanding
+ *            block holds one more.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#include <hound-private/error.h>
+#include <hound-private/pool.h>
+#include <hound-private/queue.h>
+#include <hound-private/refcount.h>
+#include <hound-private/util.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+/* Generic classes for variable-length records, as powers of 2. */
+#define POOL_GENERIC_MIN 64
+#define POOL_GENERIC_MAX 4096
+
+/* Blocks too large for any class are allocated and freed directly. */
+#define POOL_NO_CLASS SIZE_MAX
+
+/* The size of a block with the given payload capacity. */
+#define POOL_BLOCK_SIZE(capacity) \
+    max(sizeof(struct record_info), \
+        offsetof(struct record_info, data) + (capacity))
+
+struct size_class {
+    size_t size;
+
+    /* Accessed only by the allocating thread. */
+    struct record_info *local;
+
+    /* Blocks returned by any thread. */
+    _Atomic(struct record_info *) remote;
+};
+
+struct record_pool {
+    atomic_refcount_val refcount;
+    size_t class_count;
+    struct size_class classes[];
+};
+
+static
+int compare_sizes(const void *a, const void *b)
+{
+    size_t x;
+    size_t y;
+
+    x = *((const size_t *) a);
+    y = *((const size_t *) b);
+    if (x < y) {
+        return -1;
+    }
+    else if (x > y) {
+        return 1;
+    }
+    return 0;
+}
+
+static
+size_t get_fixed_size(const struct hound_datadesc *desc)
+{
+    size_t i;
+    size_t size;
+
+    size = 0;
+    for (i = 0; i < desc->fmt_count; ++i) {
+        if (desc->fmts[i].size == 0) {
+            /* Variable-length record, so there's no fixed size. */
+            return 0;
+        }
+        size += desc->fmts[i].size;
+    }
+
+    return size;
+}
+
+hound_err pool_alloc(
+    struct record_pool **out_pool,
+    size_t desc_count,
+    const struct hound_datadesc *descs)
+{
+    size_t count;
+    size_t i;
+    size_t n;
+    struct record_pool *pool;
+    size_t size;
+    size_t *sizes;
+
+    XASSERT_NOT_NULL(out_pool);
+
+    /*
+     * Gather the inline size, the fixed schema sizes and the generic sizes.
+     * Anything smaller than the inline size gets rounded up to it, so all small
+     * records share a class.
+     */
+    count = desc_count + 1;
+    for (size = POOL_GENERIC_MIN; size <= POOL_GENERIC_MAX; size *= 2) {
+        ++count;
+    }
+    sizes = malloc(count * sizeof(*sizes));
+    if (sizes == NULL) {
+        return HOUND_OOM;
+    }
+
+    sizes[0] = CONFIG_HOUND_INLINE_RECORD_SIZE;
+    n = 1;
+    for (i = 0; i < desc_count; ++i) {
+        size = get_fixed_size(&descs[i]);
+        if (size > 0 && size <= POOL_GENERIC_MAX) {
+            sizes[n] = max(size, CONFIG_HOUND_INLINE_RECORD_SIZE);
+            ++n;
+        }
+    }
+    for (size = POOL_GENERIC_MIN; size <= POOL_GENERIC_MAX; size *= 2) {
+        sizes[n] = max(size, CONFIG_HOUND_INLINE_RECORD_SIZE);
+        ++n;
+    }
+
+    /* Sort and remove duplicates so we can binary search the classes. */
+    qsort(sizes, n, sizeof(*sizes), compare_sizes);
+    count = 0;
+    for (i = 0; i < n; ++i) {
+        if (count == 0 || sizes[count-1] != sizes[i]) {
+            sizes[count] = sizes[i];
+            ++count;
+        }
+    }
+
+    pool = malloc(sizeof(*pool) + count*sizeof(*pool->classes));
+    if (pool == NULL) {
+        free(sizes);
+        return HOUND_OOM;
+    }
+
+    atomic_ref_init(&pool->refcount, 1);
+    pool->class_count = count;
+    for (i = 0; i < count; ++i) {
+        pool->classes[i].size = sizes[i];
+        pool->classes[i].local = NULL;
+        atomic_init(&pool->classes[i].remote, NULL);
+    }
+    free(sizes);
+
+    *out_pool = pool;
+
+    return HOUND_OK;
+}
+
+static
+void free_list(struct record_info *info)
+{
+    struct record_info *next;
+
+    while (info != NULL) {
+        next = info->next_free;
+        free(info);
+        info = next;
+    }
+}
+
+static
+void pool_unref(struct record_pool *pool)
+{
+    struct size_class *cls;
+    refcount_val count;
+    size_t i;
+
+    count = atomic_ref_dec(&pool->refcount);
+    if (count != 1) {
+        return;
+    }
+
+    /*
+     * The driver is gone and all blocks have been returned, so no one else can
+     * touch the pool.
+     */
+    for (i = 0; i < pool->class_count; ++i) {
+        cls = &pool->classes[i];
+        free_list(cls->local);
+        free_list(atomic_load_explicit(&cls->remote, memory_order_acquire));
+    }
+    free(pool);
+}
+
+void pool_destroy(struct record_pool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    /* Drop the driver's reference; outstanding blocks keep the pool alive. */
+    pool_unref(pool);
+}
+
+static
+size_t find_class(const struct record_pool *pool, size_t bytes)
+{
+    size_t high;
+    size_t low;
+    size_t mid;
+
+    /* Find the smallest class that fits. */
+    low = 0;
+    high = pool->class_count;
+    while (low < high) {
+        mid = low + (high - low)/2;
+        if (pool->classes[mid].size < bytes) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    if (low == pool->class_count) {
+        return POOL_NO_CLASS;
+    }
+    return low;
+}
+
+/**
+ * Stock the pool with blocks for the records the given descriptors produce,
+ * touching each block so that handing it out later won't page fault.
+ * Variable-length records are stocked in the smallest class. Like pool_get,
+ * this must be called only from the allocating thread.
+ */
+hound_err pool_prefault(
+    struct record_pool *pool,
+    size_t desc_count,
+    const struct hound_datadesc *descs,
+    size_t records)
+{
+    size_t block_size;
+    struct size_class *cls;
+    size_t i;
+    struct record_info *info;
+    size_t j;
+    size_t size;
+    size_t size_class;
+
+    XASSERT_NOT_NULL(pool);
+
+    for (i = 0; i < desc_count; ++i) {
+        size = max(get_fixed_size(&descs[i]), CONFIG_HOUND_INLINE_RECORD_SIZE);
+        size_class = find_class(pool, size);
+        if (size_class == POOL_NO_CLASS) {
+            /* Records this big are allocated directly, so there's no stock. */
+            continue;
+        }
+
+        cls = &pool->classes[size_class];
+        block_size = POOL_BLOCK_SIZE(cls->size);
+        for (j = 0; j < records; ++j) {
+            info = malloc(block_size);
+            if (info == NULL) {
+                return HOUND_OOM;
+            }
+            memset(info, 0, block_size);
+            info->next_free = cls->local;
+            cls->local = info;
+        }
+    }
+
+    return HOUND_OK;
+}
+
+struct record_info *pool_get(struct record_pool *pool, size_t bytes)
+{
+    struct size_class *cls;
+    size_t capacity;
+    struct record_info *info;
+    size_t size_class;
+
+    XASSERT_NOT_NULL(pool);
+
+    size_class = find_class(pool, bytes);
+    if (size_class == POOL_NO_CLASS) {
+        capacity = bytes;
+        info = malloc(POOL_BLOCK_SIZE(capacity));
+    }
+    else {
+        cls = &pool->classes[size_class];
+        capacity = cls->size;
+        if (cls->local == NULL) {
+            cls->local = atomic_exchange_explicit(
+                &cls->remote,
+                NULL,
+                memory_order_acquire);
+        }
+
+        info = cls->local;
+        if (info != NULL) {
+            cls->local = info->next_free;
+        }
+        else {
+            info = malloc(POOL_BLOCK_SIZE(capacity));
+        }
+    }
+    if (info == NULL) {
+        return NULL;
+    }
+
+    atomic_ref_inc(&pool->refcount);
+    info->pool = pool;
+    info->next_free = NULL;
+    info->size_class = size_class;
+    info->capacity = capacity;
+    info->record.data = info->data;
+    info->record.size = bytes;
+
+    return info;
+}
+
+struct record_info *pool_resize(struct record_info *info, size_t bytes)
+{
+    struct record_info *new_info;
+
+    XASSERT_NOT_NULL(info);
+
+    if (bytes <= info->capacity) {
+        info->record.size = bytes;
+        return info;
+    }
+
+    new_info = pool_get(info->pool, bytes);
+    if (new_info == NULL) {
+        return NULL;
+    }
+    memcpy(new_info->record.data, info->record.data, info->record.size);
+    pool_put(info);
+
+    return new_info;
+}
+
+void pool_put(struct record_info *info)
+{
+    struct size_class *cls;
+    struct record_info *head;
+    struct record_pool *pool;
+
+    XASSERT_NOT_NULL(info);
+
+    pool = info->pool;
+    if (info->size_class == POOL_NO_CLASS) {
+        free(info);
+    }
+    else {
+        cls = &pool->classes[info->size_class];
+        head = atomic_load_explicit(&cls->remote, memory_order_relaxed);
+        do {
+            info->next_free = head;
+        } while (!atomic_compare_exchange_weak_explicit(
+            &cls->remote,
+            &head,
+            info,
+            memory_order_release,
+            memory_order_relaxed));
+    }
+
+    pool_unref(pool);
+}
+
+struct record_info *pool_info_from_data(void *data)
+{
+    XASSERT_NOT_NULL(data);
+
+    return (struct record_info *)
+        ((unsigned char *) data - offsetof(struct record_info, data));
+}
@@ -1,43 +1,93 @@
 /**
  * @file      queue.c
  * @brief     Hound record queue implementation. The queue has a max length,
- *            which when exceeded will begin to overwrite the oldest item. It is
+ *            which when exceeded will, by default, begin to overwrite the
+ *            oldest item. It can instead drop the newest item or grow. It is
  *            thread-safe and blocks during the pop operation if the queue is
  *            empty. Thus it is intended for use in a producer-consumer
  *            scenario.
+ *
+ *            A queue can instead be backed by a lock-free ring buffer (see
+ *            ring.c), or be a cursor into its driver's multicast record log
+ *            (see mcast.c). In that case, all operations are forwarded to the
+ *            ring or cursor.
  * @author    Martin Kelly <mkelly@xevo.com>
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
 
+#include <errno.h>
 #include <hound-private/error.h>
+#include <hound-private/mcast.h>
+#include <hound-private/pool.h>
 #include <hound-private/queue.h>
+#include <hound-private/record-log.h>
+#include <hound-private/ring.h>
+#include <hound-private/trace.h>
 #include <hound-private/util.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define EVENT_FD_INVALID (-1)
 
 /*
  * Push to back, pop from front. Back is calculated implicitly as front + len
  * with wraparound.
+ *
+ * wake_len is the smallest queue length that any blocked reader is waiting
+ * for, or SIZE_MAX if no one is waiting, and wake_bytes is the same for readers
+ * waiting on a byte count. Pushes wake readers only when the queue reaches
+ * either one, rather than on every push. Since readers may want different
+ * lengths, a wakeup goes to all of them; each reader that still needs more
+ * records lowers wake_len back to its own target before waiting again.
+ *
+ * interrupt_gen counts the interrupts. Each reader notes it on entry and gives
+ * up once it changes, so an interrupt reaches every blocked reader rather than
+ * just the first one to wake.
+ *
+ * If someone asked for a readiness fd, event_fd is an eventfd that is kept
+ * readable whenever the queue holds at least event_len records, so it can be
+ * used from an application's poll loop.
+ *
+ * overflow says what a push does when the queue is full. For
+ * HOUND_OVERFLOW_GROW, the queue doubles in length up to grow_len and then
+ * falls back to overwriting. dropped counts the records lost to overflow, and
+ * high_water is the longest the queue has been.
+ *
+ * If the context is logging its records, log points to the record log, and
+ * every push appends to it before the records go into the queue. log_users
+ * counts the pushes currently using the log, so queue_swap_record_log can tell
+ * when the old log is safe to close.
  */
 struct queue {
     pthread_mutex_t mutex;
     pthread_cond_t ready_cond;
-    bool interrupt;
+    uint64_t interrupt_gen;
+    size_t wake_len;
+    size_t wake_bytes;
+    int event_fd;
+    size_t event_len;
+    bool event_signalled;
+    hound_overflow_policy overflow;
+    size_t grow_len;
+    uint64_t dropped;
+    size_t high_water;
     size_t max_len;
     size_t len;
+    size_t bytes;
     size_t front;
     hound_seqno front_seqno;
     struct record_info **data;
+    struct ring *ring;
+    struct mcast_cursor *cursor;
+    _Atomic(struct record_log *) log;
+    atomic_size_t log_users;
 };
 
-static
-void free_record_info(struct record_info *info)
-{
-    drv_free(info->record.data);
-    drv_free(info);
-}
-
 void record_ref_dec(struct record_info *info)
 {
     refcount_val count;
@@ -48,13 +98,14 @@ void record_ref_dec(struct record_info *info)
          * atomic_ref_dec returns the value *before* decrement, so this
          * means the refcount has now reached 0.
          */
-        free_record_info(info);
+        pool_put(info);
     }
 }
 
 hound_err queue_alloc(
     struct queue **out_queue,
-    size_t max_len)
+    size_t max_len,
+    hound_queue_type type)
 {
     hound_err err;
     struct queue *queue;
@@ -66,19 +117,56 @@ hound_err queue_alloc(
         return HOUND_OOM;
     }
 
-    queue->data = malloc(max_len * sizeof(*queue->data));
-    if (queue->data == NULL) {
-        err = HOUND_OOM;
-        goto error_alloc_data;
+    switch (type) {
+        case HOUND_QUEUE_LOCKED:
+            queue->ring = NULL;
+            queue->cursor = NULL;
+            queue->data = malloc(max_len * sizeof(*queue->data));
+            if (queue->data == NULL) {
+                err = HOUND_OOM;
+                goto error_alloc_data;
+            }
+            break;
+        case HOUND_QUEUE_RING:
+            queue->data = NULL;
+            queue->cursor = NULL;
+            err = ring_alloc(&queue->ring, max_len);
+            if (err != HOUND_OK) {
+                goto error_alloc_data;
+            }
+            break;
+        case HOUND_QUEUE_MULTICAST:
+            queue->data = NULL;
+            queue->ring = NULL;
+            err = mcast_cursor_alloc(&queue->cursor, max_len);
+            if (err != HOUND_OK) {
+                goto error_alloc_data;
+            }
+            break;
+        default:
+            err = HOUND_INVALID_QUEUE_TYPE;
+            goto error_alloc_data;
     }
 
     init_mutex(&queue->mutex);
     init_cond(&queue->ready_cond);
-    queue->interrupt = false;
+    queue->interrupt_gen = 0;
+    queue->wake_len = SIZE_MAX;
+    queue->wake_bytes = SIZE_MAX;
+    queue->event_fd = EVENT_FD_INVALID;
+    queue->event_len = 1;
+    queue->event_signalled = false;
+    queue->overflow = HOUND_OVERFLOW_OVERWRITE;
+    queue->grow_len = max_len;
+    queue->dropped = 0;
+    queue->high_water = 0;
     queue->max_len = max_len;
     queue->len = 0;
+    queue->bytes = 0;
     queue->front = 0;
     queue->front_seqno = 0;
+    atomic_init(&queue->log, NULL);
+    atomic_init(&queue->log_users, 0);
 
     *out_queue = queue;
 
@@ -89,6 +177,31 @@ error_alloc_data:
     return err;
 }
 
+static
+void update_event(struct queue *queue)
+{
+    eventfd_t val;
+
+    if (queue->event_fd == EVENT_FD_INVALID) {
+        return;
+    }
+
+    if (queue->len >= queue->event_len) {
+        if (!queue->event_signalled) {
+            (void) eventfd_write(queue->event_fd, 1);
+            queue->event_signalled = true;
+        }
+    }
+    else if (queue->event_signalled) {
+        /*
+         * The fd is nonblocking and known to be readable, so this can't
+         * block.
+         */
+        (void) eventfd_read(queue->event_fd, &val);
+        queue->event_signalled = false;
+    }
+}
+
 static
 void drain_until(struct queue *queue, size_t new_len)
 {
@@ -101,12 +214,14 @@ void drain_until(struct queue *queue, size_t new_len)
 
     drain_count = queue->len - new_len;
     for (i = 0; i < drain_count; i++) {
+        queue->bytes -= queue->data[queue->front]->record.size;
         record_ref_dec(queue->data[queue->front]);
         queue->front = (queue->front + 1) % queue->max_len;
     }
 
     queue->front_seqno += drain_count;
     queue->len = new_len;
+    update_event(queue);
 }
 
 static
@@ -150,8 +265,14 @@ void contract_queue(struct queue *queue, size_t new_max_len)
      * f     indicates the front position of the queue
      * b     indicates the back position of the queue
      * -->   indicates how the queue will change after truncation
+     *
+     * A contiguous queue that runs to the end of the array has its back at
+     * max_len rather than wrapped around to 0.
      */
-    back = (queue->front + queue->len) % queue->max_len;
+    back = queue->front + queue->len;
+    if (back > queue->max_len) {
+        back -= queue->max_len;
+    }
     if (is_contiguous(queue)) {
         /* Queue data is contiguous. */
         if (queue->front >= new_max_len) {
@@ -222,7 +343,8 @@ void contract_queue(struct queue *queue, size_t new_max_len)
             /*
              * The new queue will cut through part of the records at the end of
              * the array. Move these records to the start, keeping the queue as
-             * wrap-around.
+             * wrap-around. Since the queue wraps, every slot past the cut holds
+             * a record.
              *
              *   b  f
              * |3______1-2|
@@ -232,7 +354,7 @@ void contract_queue(struct queue *queue, size_t new_max_len)
              *
              */
             start = new_max_len;
-            count = queue->len - new_max_len;
+            count = queue->max_len - new_max_len;
         }
 
         /*
@@ -298,15 +420,15 @@ void expand_queue(struct queue *queue, size_t new_max_len)
          * |____123|
          */
         memcpy(
-            queue->data + queue->len,
+            queue->data + queue->max_len,
             queue->data,
             back * sizeof(*queue->data));
     }
     else {
         /*
-         * We *cannot* fit all the data from the start of the array at the end of the
-         * new array. Copy as much as we can and then move everything past that
-         * to the start of the array.
+         * We *cannot* fit all the data from the start of the array at the end
+         * of the new array. Copy as much as we can and then move everything
+         * past that to the start of the array.
          *
          * Array size increasing from 6 to 7.
          *
@@ -317,7 +439,7 @@ void expand_queue(struct queue *queue, size_t new_max_len)
          * |3____12|
          */
         memcpy(
-            queue->data + queue->len,
+            queue->data + queue->max_len,
             queue->data,
             diff * sizeof(*queue->data));
         memmove(
@@ -334,6 +456,13 @@ hound_err queue_resize(struct queue *queue, size_t max_len, bool flush)
 
     XASSERT_NOT_NULL(queue);
 
+    if (queue->ring != NULL) {
+        return ring_resize(queue->ring, max_len, flush);
+    }
+    if (queue->cursor != NULL) {
+        return mcast_cursor_resize(queue->cursor, max_len, flush);
+    }
+
     lock_mutex(&queue->mutex);
 
     if (flush) {
@@ -375,18 +504,113 @@ void queue_destroy(struct queue *queue)
 {
     XASSERT_NOT_NULL(queue);
 
-    queue_drain(queue);
+    if (queue->ring != NULL) {
+        ring_destroy(queue->ring);
+    }
+    else if (queue->cursor != NULL) {
+        mcast_cursor_destroy(queue->cursor);
+    }
+    else {
+        queue_drain(queue);
+    }
+    if (queue->event_fd != EVENT_FD_INVALID) {
+        close(queue->event_fd);
+    }
     destroy_mutex(&queue->mutex);
     destroy_cond(&queue->ready_cond);
     free(queue->data);
     free(queue);
 }
 
+hound_err queue_get_event_fd(struct queue *queue, int *fd)
+{
+    hound_err err;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(fd);
+
+    if (queue->ring != NULL) {
+        return ring_get_event_fd(queue->ring, fd);
+    }
+    if (queue->cursor != NULL) {
+        return mcast_get_event_fd(queue->cursor, fd);
+    }
+
+    lock_mutex(&queue->mutex);
+
+    if (queue->event_fd == EVENT_FD_INVALID) {
+        queue->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (queue->event_fd == EVENT_FD_INVALID) {
+            err = errno;
+            goto out;
+        }
+        queue->event_signalled = false;
+        update_event(queue);
+    }
+    *fd = queue->event_fd;
+    err = HOUND_OK;
+
+out:
+    unlock_mutex(&queue->mutex);
+    return err;
+}
+
+void queue_set_event_len(struct queue *queue, size_t len)
+{
+    XASSERT_NOT_NULL(queue);
+    XASSERT_GT(len, 0);
+
+    if (queue->ring != NULL) {
+        ring_set_event_len(queue->ring, len);
+        return;
+    }
+    if (queue->cursor != NULL) {
+        mcast_set_event_len(queue->cursor, len);
+        return;
+    }
+
+    lock_mutex(&queue->mutex);
+    queue->event_len = len;
+    update_event(queue);
+    unlock_mutex(&queue->mutex);
+}
+
+void queue_set_overflow(
+    struct queue *queue,
+    hound_overflow_policy policy,
+    size_t grow_len)
+{
+    XASSERT_NOT_NULL(queue);
+
+    if (queue->ring != NULL) {
+        ring_set_overflow(queue->ring, policy, grow_len);
+        return;
+    }
+    if (queue->cursor != NULL) {
+        mcast_set_overflow(queue->cursor, policy, grow_len);
+        return;
+    }
+
+    lock_mutex(&queue->mutex);
+    queue->overflow = policy;
+    queue->grow_len = grow_len;
+    unlock_mutex(&queue->mutex);
+}
+
 void queue_interrupt(struct queue *queue)
 {
+    if (queue->ring != NULL) {
+        ring_interrupt(queue->ring);
+        return;
+    }
+    if (queue->cursor != NULL) {
+        mcast_interrupt(queue->cursor);
+        return;
+    }
+
     lock_mutex(&queue->mutex);
-    queue->interrupt = true;
-    cond_signal(&queue->ready_cond);
+    ++queue->interrupt_gen;
+    cond_broadcast(&queue->ready_cond);
     unlock_mutex(&queue->mutex);
 }
 
@@ -397,6 +621,7 @@ void pop_helper(
     hound_seqno *first_seqno,
     size_t records)
 {
+    size_t i;
     size_t right_records;
 
     XASSERT_LTE(records, queue->max_len);
@@ -422,15 +647,20 @@ void pop_helper(
             (records - right_records) * sizeof(*buf));
         queue->front = records - right_records;
     }
+    for (i = 0; i < records; ++i) {
+        queue->bytes -= buf[i]->record.size;
+    }
     queue->len -= records;
     *first_seqno = queue->front_seqno;
     queue->front_seqno += records;
+    update_event(queue);
 }
 
 static
 size_t pop_bytes(
     struct queue *queue,
     struct record_info **buf,
+    size_t max_records,
     size_t bytes,
     hound_seqno *first_seqno,
     size_t *out_records)
@@ -444,7 +674,7 @@ size_t pop_bytes(
     remainder = bytes;
     i = queue->front;
     while (true) {
-        if (records == queue->len) {
+        if (records == queue->len || records == max_records) {
             break;
         }
 
@@ -483,16 +713,49 @@ size_t pop_records(
     return target;
 }
 
+static
+bool grow_nolock(struct queue *queue)
+{
+    struct record_info **data;
+    size_t max_len;
 
-void queue_push(struct queue *queue, struct record_info *rec)
+    if (queue->max_len >= queue->grow_len) {
+        return false;
+    }
+
+    max_len = min(2 * queue->max_len, queue->grow_len);
+    data = realloc(queue->data, max_len * sizeof(*data));
+    if (data == NULL) {
+        return false;
+    }
+    queue->data = data;
+    expand_queue(queue, max_len);
+    queue->max_len = max_len;
+
+    return true;
+}
+
+/*
+ * Pushes a record, returning whichever record overflow forced us to drop (which
+ * may be the new record itself), or NULL if nothing was dropped.
+ */
+static
+struct record_info *push_nolock(struct queue *queue, struct record_info *rec)
 {
     size_t back;
     struct record_info *tmp;
 
-    XASSERT_NOT_NULL(queue);
-    XASSERT_NOT_NULL(rec);
+    if (queue->len == queue->max_len) {
+        if (queue->overflow == HOUND_OVERFLOW_DROP_NEWEST) {
+            ++queue->dropped;
+            return rec;
+        }
+        if (queue->overflow == HOUND_OVERFLOW_GROW) {
+            /* If we can't grow, overwrite instead. */
+            (void) grow_nolock(queue);
+        }
+    }
 
-    lock_mutex(&queue->mutex);
     back = (queue->front + queue->len) % queue->max_len;
     if (queue->len < queue->max_len) {
         ++queue->len;
@@ -508,11 +771,92 @@ void queue_push(struct queue *queue, struct record_info *rec)
         tmp = queue->data[queue->front];
         queue->front = (queue->front + 1) % queue->max_len;
         ++queue->front_seqno;
+        ++queue->dropped;
     }
 
     queue->data[back] = rec;
+    queue->bytes += rec->record.size;
+    if (tmp != NULL) {
+        queue->bytes -= tmp->record.size;
+    }
+    queue->high_water = max(queue->high_water, queue->len);
+
+    return tmp;
+}
+
+static
+void wake_readers(struct queue *queue)
+{
+    if (queue->len >= queue->wake_len || queue->bytes >= queue->wake_bytes) {
+        queue->wake_len = SIZE_MAX;
+        queue->wake_bytes = SIZE_MAX;
+        cond_broadcast(&queue->ready_cond);
+    }
+    update_event(queue);
+}
 
-    cond_signal(&queue->ready_cond);
+/*
+ * Appends records to the queue's record log, if it has one. The first load
+ * keeps the common, unlogged case to a single atomic read. Once we've counted
+ * ourselves as a user, the second load tells us whether the log is still
+ * there; if it is, queue_swap_record_log will wait for us before handing it
+ * back.
+ */
+void queue_log_records(
+    struct queue *queue,
+    struct record_info *const *recs,
+    size_t count)
+{
+    struct record_log *log;
+
+    if (atomic_load(&queue->log) == NULL) {
+        return;
+    }
+
+    atomic_fetch_add(&queue->log_users, 1);
+    log = atomic_load(&queue->log);
+    if (log != NULL) {
+        record_log_append(log, recs, count);
+    }
+    atomic_fetch_sub(&queue->log_users, 1);
+}
+
+struct record_log *queue_swap_record_log(
+    struct queue *queue,
+    struct record_log *log)
+{
+    struct record_log *old;
+
+    XASSERT_NOT_NULL(queue);
+
+    old = atomic_exchange(&queue->log, log);
+    while (atomic_load(&queue->log_users) > 0) {
+        sched_yield();
+    }
+
+    return old;
+}
+
+void queue_push(struct queue *queue, struct record_info *rec)
+{
+    struct record_info *tmp;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(rec);
+    /* Multicast records go straight into the driver's log. */
+    XASSERT_NULL(queue->cursor);
+
+    TRACE3(queue_push, queue, rec, rec->record.data_id);
+    queue_log_records(queue, &rec, 1);
+
+    if (queue->ring != NULL) {
+        ring_push(queue->ring, rec);
+        return;
+    }
+
+    lock_mutex(&queue->mutex);
+    tmp = push_nolock(queue, rec);
+    wake_readers(queue);
     unlock_mutex(&queue->mutex);
 
     if (tmp != NULL) {
@@ -520,34 +864,146 @@ void queue_push(struct queue *queue, struct record_info *rec)
     }
 }
 
+void queue_push_many(
+    struct queue *queue,
+    struct record_info **recs,
+    size_t count)
+{
+    size_t i;
+    struct record_info *tmp;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(recs);
+    XASSERT_NULL(queue->cursor);
+
+    if (count == 0) {
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        TRACE3(queue_push, queue, recs[i], recs[i]->record.data_id);
+    }
+    queue_log_records(queue, recs, count);
+
+    if (queue->ring != NULL) {
+        ring_push_many(queue->ring, recs, count);
+        return;
+    }
+
+    lock_mutex(&queue->mutex);
+    for (i = 0; i < count; ++i) {
+        tmp = push_nolock(queue, recs[i]);
+        if (tmp != NULL) {
+            /*
+             * Overflow should be rare, so just drop the record under the lock
+             * rather than keeping a list to drop afterwards.
+             */
+            record_ref_dec(tmp);
+        }
+    }
+    wake_readers(queue);
+    unlock_mutex(&queue->mutex);
+}
+
+/*
+ * Fires a probe for each popped record. first_seqno is a pointer because the
+ * pop leaves it unset when it returns nothing.
+ */
+static
+void trace_pop(
+    const struct queue *queue,
+    struct record_info *const *buf,
+    const hound_seqno *first_seqno,
+    size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        TRACE4(
+            queue_pop,
+            queue,
+            buf[i],
+            buf[i]->record.data_id,
+            *first_seqno + i);
+    }
+}
+
 size_t queue_pop_records(
     struct queue *queue,
     struct record_info **buf,
     size_t records,
     hound_seqno *first_seqno,
     bool *interrupt)
+{
+    return queue_pop_records_timeout(
+        queue,
+        buf,
+        records,
+        first_seqno,
+        NULL,
+        interrupt);
+}
+
+size_t queue_pop_records_timeout(
+    struct queue *queue,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    const struct timespec *deadline,
+    bool *interrupt)
 {
     size_t count;
+    uint64_t gen;
     hound_seqno *seqno;
     hound_seqno tmp;
+    bool timed_out;
 
     XASSERT_NOT_NULL(queue);
     XASSERT_NOT_NULL(buf);
 
+    if (queue->ring != NULL) {
+        count = ring_pop_records_timeout(
+            queue->ring,
+            buf,
+            records,
+            first_seqno,
+            deadline,
+            interrupt);
+        goto out;
+    }
+    if (queue->cursor != NULL) {
+        count = mcast_pop_records_timeout(
+            queue->cursor,
+            buf,
+            records,
+            first_seqno,
+            deadline,
+            interrupt);
+        goto out;
+    }
+
     count = 0;
     *interrupt = false;
+    timed_out = false;
     lock_mutex(&queue->mutex);
+    gen = queue->interrupt_gen;
     do {
-        /* TODO: Possible optimization: wake up only when n records/bytes are
-         * ready, rather than when 1 is ready. Probably would need to use a heap
-         * structure for this, to always wait for the smallest next wakeup
-         * target. */
-        while (queue->len < records && !queue->interrupt) {
-            cond_wait(&queue->ready_cond, &queue->mutex);
+        while (queue->len < records - count && queue->interrupt_gen == gen) {
+            queue->wake_len = min(queue->wake_len, records - count);
+            if (deadline == NULL) {
+                cond_wait(&queue->ready_cond, &queue->mutex);
+            }
+            else if (!cond_timedwait(
+                &queue->ready_cond,
+                &queue->mutex,
+                deadline)) {
+                /* Out of time, so take whatever is there. */
+                timed_out = true;
+                break;
+            }
         }
-        if (queue->interrupt) {
+        if (queue->interrupt_gen != gen) {
             *interrupt = true;
-            queue->interrupt = false;
             break;
         }
 
@@ -564,30 +1020,130 @@ size_t queue_pop_records(
         }
 
         count += pop_records(queue, buf + count, seqno, records - count);
-    } while (count < records);
+    } while (count < records && !timed_out);
 
     unlock_mutex(&queue->mutex);
 
+out:
+    trace_pop(queue, buf, first_seqno, count);
     return count;
 }
 
-size_t queue_pop_bytes_nowait(
+size_t queue_pop_bytes(
     struct queue *queue,
     struct record_info **buf,
+    size_t max_records,
     size_t bytes,
+    size_t wait_records,
     hound_seqno *first_seqno,
-    size_t *records)
+    size_t *records,
+    bool *interrupt)
 {
     size_t count;
+    uint64_t gen;
 
     XASSERT_NOT_NULL(queue);
     XASSERT_NOT_NULL(buf);
     XASSERT_NOT_NULL(records);
 
+    if (queue->ring != NULL) {
+        count = ring_pop_bytes(
+            queue->ring,
+            buf,
+            max_records,
+            bytes,
+            wait_records,
+            first_seqno,
+            records,
+            interrupt);
+        goto out;
+    }
+    if (queue->cursor != NULL) {
+        count = mcast_pop_bytes(
+            queue->cursor,
+            buf,
+            max_records,
+            bytes,
+            wait_records,
+            first_seqno,
+            records,
+            interrupt);
+        goto out;
+    }
+
+    *interrupt = false;
     lock_mutex(&queue->mutex);
-    count = pop_bytes(queue, buf, bytes, first_seqno, records);
+    gen = queue->interrupt_gen;
+
+    /*
+     * Wait for enough bytes or enough records, whichever comes first. A full
+     * queue won't get any more bytes no matter how long we wait, so never wait
+     * for more records than the queue can hold.
+     */
+    wait_records = min(wait_records, queue->max_len);
+    while (queue->bytes < bytes &&
+           queue->len < wait_records &&
+           queue->interrupt_gen == gen) {
+        queue->wake_bytes = min(queue->wake_bytes, bytes);
+        queue->wake_len = min(queue->wake_len, wait_records);
+        cond_wait(&queue->ready_cond, &queue->mutex);
+    }
+
+    if (queue->interrupt_gen != gen) {
+        *interrupt = true;
+        *records = 0;
+        count = 0;
+    }
+    else {
+        count = pop_bytes(queue, buf, max_records, bytes, first_seqno, records);
+    }
+
     unlock_mutex(&queue->mutex);
 
+out:
+    trace_pop(queue, buf, first_seqno, *records);
+    return count;
+}
+
+size_t queue_pop_bytes_nowait(
+    struct queue *queue,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    hound_seqno *first_seqno,
+    size_t *records)
+{
+    size_t count;
+
+    XASSERT_NOT_NULL(queue);
+    XASSERT_NOT_NULL(buf);
+    XASSERT_NOT_NULL(records);
+
+    if (queue->ring != NULL) {
+        count = ring_pop_bytes_nowait(
+            queue->ring,
+            buf,
+            max_records,
+            bytes,
+            first_seqno,
+            records);
+    }
+    else if (queue->cursor != NULL) {
+        count = mcast_pop_bytes_nowait(
+            queue->cursor,
+            buf,
+            max_records,
+            bytes,
+            first_seqno,
+            records);
+    }
+    else {
+        lock_mutex(&queue->mutex);
+        count = pop_bytes(queue, buf, max_records, bytes, first_seqno, records);
+        unlock_mutex(&queue->mutex);
+    }
+
+    trace_pop(queue, buf, first_seqno, *records);
     return count;
 }
 
@@ -602,17 +1158,65 @@ size_t queue_pop_records_nowait(
     XASSERT_NOT_NULL(queue);
     XASSERT_NOT_NULL(buf);
 
-    lock_mutex(&queue->mutex);
-    count = pop_records(queue, buf, first_seqno, records);
-    unlock_mutex(&queue->mutex);
+    if (queue->ring != NULL) {
+        count = ring_pop_records_nowait(queue->ring, buf, first_seqno, records);
+    }
+    else if (queue->cursor != NULL) {
+        count = mcast_pop_records_nowait(
+            queue->cursor,
+            buf,
+            first_seqno,
+            records);
+    }
+    else {
+        lock_mutex(&queue->mutex);
+        count = pop_records(queue, buf, first_seqno, records);
+        unlock_mutex(&queue->mutex);
+    }
 
+    trace_pop(queue, buf, first_seqno, count);
     return count;
 }
 
+void queue_release(struct queue *queue, struct record_info **buf, size_t count)
+{
+    size_t i;
+
+    XASSERT_NOT_NULL(queue);
+
+    if (queue->cursor != NULL) {
+        mcast_release(queue->cursor, buf, count);
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        record_ref_dec(buf[i]);
+    }
+}
+
+void queue_keep(struct queue *queue, struct record_info **buf, size_t count)
+{
+    XASSERT_NOT_NULL(queue);
+
+    /* Other queues already hand each popped record out with a reference. */
+    if (queue->cursor != NULL) {
+        mcast_keep(queue->cursor, buf, count);
+    }
+}
+
 void queue_drain(struct queue *queue)
 {
     XASSERT_NOT_NULL(queue);
 
+    if (queue->ring != NULL) {
+        ring_drain(queue->ring);
+        return;
+    }
+    if (queue->cursor != NULL) {
+        mcast_drain(queue->cursor);
+        return;
+    }
+
     lock_mutex(&queue->mutex);
     drain_nolock(queue);
     unlock_mutex(&queue->mutex);
@@ -624,6 +1228,13 @@ size_t queue_len(struct queue *queue)
 
     XASSERT_NOT_NULL(queue);
 
+    if (queue->ring != NULL) {
+        return ring_len(queue->ring);
+    }
+    if (queue->cursor != NULL) {
+        return mcast_len(queue->cursor);
+    }
+
     lock_mutex(&queue->mutex);
     len = queue->len;
     unlock_mutex(&queue->mutex);
@@ -637,9 +1248,77 @@ size_t queue_max_len(struct queue *queue)
 
     XASSERT_NOT_NULL(queue);
 
+    if (queue->ring != NULL) {
+        return ring_max_len(queue->ring);
+    }
+    if (queue->cursor != NULL) {
+        return mcast_max_len(queue->cursor);
+    }
+
     lock_mutex(&queue->mutex);
     len = queue->max_len;
     unlock_mutex(&queue->mutex);
 
     return len;
 }
+
+uint64_t queue_dropped(struct queue *queue)
+{
+    uint64_t dropped;
+
+    XASSERT_NOT_NULL(queue);
+
+    if (queue->ring != NULL) {
+        return ring_dropped(queue->ring);
+    }
+    if (queue->cursor != NULL) {
+        return mcast_dropped(queue->cursor);
+    }
+
+    lock_mutex(&queue->mutex);
+    dropped = queue->dropped;
+    unlock_mutex(&queue->mutex);
+
+    return dropped;
+}
+
+size_t queue_high_water(struct queue *queue)
+{
+    size_t len;
+
+    XASSERT_NOT_NULL(queue);
+
+    if (queue->ring != NULL) {
+        return ring_high_water(queue->ring);
+    }
+    if (queue->cursor != NULL) {
+        return mcast_high_water(queue->cursor);
+    }
+
+    lock_mutex(&queue->mutex);
+    len = queue->high_water;
+    unlock_mutex(&queue->mutex);
+
+    return len;
+}
+
+hound_queue_type queue_type(struct queue *queue)
+{
+    XASSERT_NOT_NULL(queue);
+
+    if (queue->ring != NULL) {
+        return HOUND_QUEUE_RING;
+    }
+    if (queue->cursor != NULL) {
+        return HOUND_QUEUE_MULTICAST;
+    }
+
+    return HOUND_QUEUE_LOCKED;
+}
+
+struct mcast_cursor *queue_cursor(struct queue *queue)
+{
+    XASSERT_NOT_NULL(queue);
+
+    return queue->cursor;
+}
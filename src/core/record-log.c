@@ -0,0 +1,518 @@
+/**
+ * @file      record-log.c
+ * @brief     Binary record log writer and reader. The writer appends records
+ *            to the log through a mapping of its current chunk, so an append
+ *            is just a copy, and the reader maps the whole log at once. See
+ *            record-log.h for the format.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <hound/hound.h>
+#include <hound-private/error.h>
+#include <hound-private/log.h>
+#include <hound-private/queue.h>
+#include <hound-private/record-log.h>
+#include <hound-private/util.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xlib/xvec.h>
+
+XVEC_DEFINE(index_vec, struct record_log_index);
+
+struct record_log {
+    pthread_mutex_t lock;
+    int fd;
+
+    /* The first error we hit. Once it's set, appends are dropped. */
+    hound_err err;
+
+    size_t page_size;
+    /* The mapping of the chunk we're appending to, or NULL. */
+    struct record_log_chunk *chunk;
+    size_t chunk_map_size;
+    uint64_t chunk_offset;
+    /* Where the next chunk goes. */
+    uint64_t end;
+
+    index_vec index;
+};
+
+static
+uint64_t align_up(uint64_t n, uint64_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+static
+hound_err pwrite_all(int fd, const void *buf, size_t size, off_t offset)
+{
+    const unsigned char *p;
+    ssize_t bytes;
+
+    p = buf;
+    while (size > 0) {
+        bytes = pwrite(fd, p, size, offset);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        p += bytes;
+        size -= bytes;
+        offset += bytes;
+    }
+
+    return HOUND_OK;
+}
+
+hound_err record_log_open(const char *path, struct record_log **out_log)
+{
+    hound_err err;
+    struct record_log_header header;
+    struct record_log *log;
+    long page_size;
+
+    NULL_CHECK(path);
+    NULL_CHECK(out_log);
+
+    page_size = sysconf(_SC_PAGESIZE);
+    if (page_size == -1) {
+        return errno;
+    }
+
+    log = malloc(sizeof(*log));
+    if (log == NULL) {
+        return HOUND_OOM;
+    }
+
+    log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (log->fd == -1) {
+        err = errno;
+        goto error_open;
+    }
+
+    /* Chunks must be page-aligned for us to map them, so start at a page. */
+    memset(&header, 0, sizeof(header));
+    header.magic = RECORD_LOG_MAGIC;
+    header.version = RECORD_LOG_VERSION;
+    header.first_chunk = page_size;
+    err = pwrite_all(log->fd, &header, sizeof(header), 0);
+    if (err != HOUND_OK) {
+        goto error_write;
+    }
+
+    init_mutex(&log->lock);
+    log->err = HOUND_OK;
+    log->page_size = page_size;
+    log->chunk = NULL;
+    log->chunk_map_size = 0;
+    log->chunk_offset = 0;
+    log->end = page_size;
+    xv_init(log->index);
+
+    *out_log = log;
+
+    return HOUND_OK;
+
+error_write:
+    close(log->fd);
+error_open:
+    free(log);
+    return err;
+}
+
+static
+void finish_chunk(struct record_log *log)
+{
+    struct record_log_chunk *chunk;
+    struct record_log_index *index;
+    int ret;
+
+    chunk = log->chunk;
+    if (chunk == NULL) {
+        return;
+    }
+
+    index = &xv_A(log->index, xv_size(log->index) - 1);
+    index->count = chunk->count;
+    index->first_ns = chunk->first_ns;
+    index->last_ns = chunk->last_ns;
+
+    ret = munmap(chunk, log->chunk_map_size);
+    XASSERT_EQ(ret, 0);
+    log->chunk = NULL;
+}
+
+static
+hound_err start_chunk(struct record_log *log, size_t entry_size)
+{
+    struct record_log_chunk *chunk;
+    struct record_log_index *index;
+    void *map;
+    int ret;
+    uint64_t size;
+
+    size = align_up(sizeof(*chunk) + entry_size, log->page_size);
+    size = max(size, RECORD_LOG_CHUNK_SIZE);
+
+    index = xv_pushp(struct record_log_index, log->index);
+    if (index == NULL) {
+        return HOUND_OOM;
+    }
+
+    ret = ftruncate(log->fd, log->end + size);
+    if (ret == -1) {
+        --xv_size(log->index);
+        return errno;
+    }
+
+    map = mmap(
+        NULL,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        log->fd,
+        log->end);
+    if (map == MAP_FAILED) {
+        --xv_size(log->index);
+        return errno;
+    }
+
+    chunk = map;
+    chunk->magic = RECORD_LOG_CHUNK_MAGIC;
+    chunk->count = 0;
+    chunk->size = size;
+    chunk->used = sizeof(*chunk);
+    chunk->first_ns = 0;
+    chunk->last_ns = 0;
+
+    memset(index, 0, sizeof(*index));
+    index->offset = log->end;
+
+    log->chunk = chunk;
+    log->chunk_map_size = size;
+    log->chunk_offset = log->end;
+    log->end += size;
+
+    return HOUND_OK;
+}
+
+static
+hound_err append_record(struct record_log *log, const struct hound_record *rec)
+{
+    struct record_log_chunk *chunk;
+    struct record_log_entry *entry;
+    uint64_t entry_size;
+    hound_err err;
+    int64_t timestamp_ns;
+
+    entry_size = align_up(sizeof(*entry) + rec->size, RECORD_LOG_ALIGN);
+    if (log->chunk == NULL ||
+        log->chunk->used + entry_size > log->chunk->size) {
+        finish_chunk(log);
+        err = start_chunk(log, entry_size);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+    chunk = log->chunk;
+
+    timestamp_ns = NSEC_PER_SEC*rec->timestamp.tv_sec + rec->timestamp.tv_nsec;
+    entry = (struct record_log_entry *) ((unsigned char *) chunk + chunk->used);
+    entry->timestamp_ns = timestamp_ns;
+    entry->data_id = rec->data_id;
+    entry->size = rec->size;
+    memcpy(entry + 1, rec->data, rec->size);
+
+    /*
+     * Publish the entry only once it's written, so a reader of a log whose
+     * writer died never sees a partial entry.
+     */
+    if (chunk->count == 0) {
+        chunk->first_ns = timestamp_ns;
+    }
+    chunk->last_ns = timestamp_ns;
+    chunk->used += entry_size;
+    ++chunk->count;
+
+    return HOUND_OK;
+}
+
+void record_log_append(
+    struct record_log *log,
+    struct record_info *const *recs,
+    size_t count)
+{
+    size_t i;
+
+    XASSERT_NOT_NULL(log);
+
+    lock_mutex(&log->lock);
+    for (i = 0; i < count && log->err == HOUND_OK; ++i) {
+        log->err = append_record(log, &recs[i]->record);
+        if (log->err != HOUND_OK) {
+            hound_log_err(
+                log->err,
+                "record log %p failed to append; dropping further records",
+                (void *) log);
+        }
+    }
+    unlock_mutex(&log->lock);
+}
+
+hound_err record_log_close(struct record_log *log)
+{
+    hound_err err;
+    uint64_t index_offset;
+    size_t index_size;
+    int ret;
+    struct record_log_trailer trailer;
+
+    NULL_CHECK(log);
+
+    /* Trim the last chunk so the index follows its last entry. */
+    if (log->chunk != NULL) {
+        log->chunk->size = log->chunk->used;
+        index_offset = log->chunk_offset + log->chunk->used;
+        finish_chunk(log);
+    }
+    else {
+        index_offset = log->end;
+    }
+
+    index_size = xv_size(log->index) * sizeof(struct record_log_index);
+    err = pwrite_all(log->fd, xv_data(log->index), index_size, index_offset);
+    if (err != HOUND_OK) {
+        goto out;
+    }
+
+    trailer.magic = RECORD_LOG_INDEX_MAGIC;
+    trailer.chunk_count = xv_size(log->index);
+    trailer.index_offset = index_offset;
+    err = pwrite_all(
+        log->fd,
+        &trailer,
+        sizeof(trailer),
+        index_offset + index_size);
+    if (err != HOUND_OK) {
+        goto out;
+    }
+
+    ret = ftruncate(log->fd, index_offset + index_size + sizeof(trailer));
+    if (ret == -1) {
+        err = errno;
+        goto out;
+    }
+
+out:
+    if (err == HOUND_OK) {
+        err = log->err;
+    }
+    ret = close(log->fd);
+    if (ret == -1 && err == HOUND_OK) {
+        err = errno;
+    }
+    xv_destroy(log->index);
+    destroy_mutex(&log->lock);
+    free(log);
+
+    return err;
+}
+
+/*
+ * Use the index from a cleanly closed log, as long as it makes sense. Without
+ * it, we can still walk the chunks using their headers.
+ */
+static
+void find_index(struct record_log_reader *reader)
+{
+    uint64_t index_size;
+    const struct record_log_trailer *trailer;
+
+    reader->index = NULL;
+    reader->chunk_count = 0;
+
+    if (reader->size < sizeof(struct record_log_header) + sizeof(*trailer)) {
+        return;
+    }
+    trailer = (const struct record_log_trailer *)
+        (reader->map + reader->size - sizeof(*trailer));
+    if (trailer->magic != RECORD_LOG_INDEX_MAGIC ||
+        trailer->index_offset % RECORD_LOG_ALIGN != 0) {
+        return;
+    }
+
+    index_size = (uint64_t) trailer->chunk_count *
+        sizeof(struct record_log_index);
+    if (trailer->index_offset > reader->size ||
+        reader->size - trailer->index_offset !=
+            index_size + sizeof(*trailer)) {
+        return;
+    }
+
+    reader->index = (const struct record_log_index *)
+        (reader->map + trailer->index_offset);
+    reader->chunk_count = trailer->chunk_count;
+}
+
+hound_err record_log_reader_open(
+    const char *path,
+    struct record_log_reader *reader)
+{
+    hound_err err;
+    int fd;
+    const struct record_log_header *header;
+    void *map;
+    int ret;
+    struct stat st;
+
+    NULL_CHECK(path);
+    NULL_CHECK(reader);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno;
+    }
+
+    ret = fstat(fd, &st);
+    if (ret == -1) {
+        err = errno;
+        goto out;
+    }
+    if ((size_t) st.st_size < sizeof(*header)) {
+        err = HOUND_INVALID_VAL;
+        goto out;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        err = errno;
+        goto out;
+    }
+
+    header = map;
+    if (header->magic != RECORD_LOG_MAGIC ||
+        header->version != RECORD_LOG_VERSION ||
+        header->first_chunk % RECORD_LOG_ALIGN != 0) {
+        munmap(map, st.st_size);
+        err = HOUND_INVALID_VAL;
+        goto out;
+    }
+
+    reader->map = map;
+    reader->size = st.st_size;
+    find_index(reader);
+    record_log_reader_rewind(reader);
+    err = HOUND_OK;
+
+out:
+    close(fd);
+    return err;
+}
+
+void record_log_reader_close(struct record_log_reader *reader)
+{
+    int ret;
+
+    XASSERT_NOT_NULL(reader);
+
+    ret = munmap((void *) reader->map, reader->size);
+    XASSERT_EQ(ret, 0);
+}
+
+void record_log_reader_rewind(struct record_log_reader *reader)
+{
+    const struct record_log_header *header;
+
+    XASSERT_NOT_NULL(reader);
+
+    header = (const struct record_log_header *) reader->map;
+    reader->chunk = 0;
+    if (reader->index != NULL) {
+        reader->chunk_offset =
+            reader->chunk_count > 0 ? reader->index[0].offset : reader->size;
+    }
+    else {
+        reader->chunk_offset = header->first_chunk;
+    }
+    reader->pos = sizeof(struct record_log_chunk);
+}
+
+/* Returns the current chunk, or NULL if there isn't a valid one. */
+static
+const struct record_log_chunk *get_chunk(
+    const struct record_log_reader *reader)
+{
+    const struct record_log_chunk *chunk;
+    uint64_t offset;
+
+    offset = reader->chunk_offset;
+    if (offset % RECORD_LOG_ALIGN != 0 ||
+        offset > reader->size ||
+        reader->size - offset < sizeof(*chunk)) {
+        return NULL;
+    }
+
+    chunk = (const struct record_log_chunk *) (reader->map + offset);
+    if (chunk->magic != RECORD_LOG_CHUNK_MAGIC ||
+        chunk->used < sizeof(*chunk) ||
+        chunk->used > chunk->size ||
+        chunk->used > reader->size - offset) {
+        return NULL;
+    }
+
+    return chunk;
+}
+
+const struct record_log_entry *record_log_reader_next(
+    struct record_log_reader *reader)
+{
+    const struct record_log_chunk *chunk;
+    const struct record_log_entry *entry;
+    uint64_t entry_size;
+
+    XASSERT_NOT_NULL(reader);
+
+    while (true) {
+        chunk = get_chunk(reader);
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        if (chunk->used - reader->pos >= sizeof(*entry)) {
+            entry = (const struct record_log_entry *)
+                ((const unsigned char *) chunk + reader->pos);
+            entry_size = align_up(
+                sizeof(*entry) + entry->size,
+                RECORD_LOG_ALIGN);
+            if (entry_size > chunk->used - reader->pos) {
+                /* A corrupt entry; treat it as the end of the log. */
+                return NULL;
+            }
+            reader->pos += entry_size;
+            return entry;
+        }
+
+        /* Move on to the next chunk. */
+        ++reader->chunk;
+        if (reader->index != NULL) {
+            if (reader->chunk >= reader->chunk_count) {
+                return NULL;
+            }
+            reader->chunk_offset = reader->index[reader->chunk].offset;
+        }
+        else {
+            reader->chunk_offset += chunk->size;
+        }
+        reader->pos = sizeof(*chunk);
+    }
+}
@@ -30,5 +30,9 @@ refcount_val atomic_ref_dec(atomic_refcount_val *count)
 {
     XASSERT_NEQ(count, NULL);
     XASSERT_GT(*count, 0);
-    return atomic_fetch_sub_explicit(count, 1, memory_order_relaxed);
+    /*
+     * Whoever drops the last reference frees the object, so it must see every
+     * other owner's accesses first.
+     */
+    return atomic_fetch_sub_explicit(count, 1, memory_order_acq_rel);
 }
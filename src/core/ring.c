@@ -0,0 +1,966 @@
+/**
+ * @file      ring.c
+ * @brief     Lock-free record ring buffer, used as an alternative queue
+ *            backend. The ring has any number of producers (the I/O threads)
+ *            and consumers. Like the locked queue, it has a max length, which
+ *            when exceeded will begin to overwrite the oldest item. Pops don't
+ *            take a lock; consumers block on a futex only when the ring does
+ *            not hold enough records to satisfy them.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <hound-private/error.h>
+#include <hound-private/queue.h>
+#include <hound-private/ring.h>
+#include <hound-private/util.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+#define EVENT_FD_INVALID (-1)
+
+struct ring_slot {
+    _Atomic(struct record_info *) rec;
+    _Atomic hound_record_size size;
+};
+
+/*
+ * head and tail are free-running sequence numbers rather than indices, so head
+ * is also the sequence number of the record at the front of the ring. A
+ * sequence number maps to the slot at (seqno % max_len).
+ *
+ * Producers serialize on push_lock, which is uncontended unless drivers in
+ * different I/O shards feed the same ring. The producer holding it owns tail,
+ * and consumers claim records by a compare-and-swap on head. When the ring is
+ * full, the producer overwrites the oldest record by claiming it with the same
+ * compare-and-swap, so a consumer that raced with the producer will simply fail
+ * its swap and try again. The fields are grouped by writer so the producer and
+ * consumers don't bounce cache lines.
+ *
+ * The byte count of the ring is pushed_bytes - popped_bytes. The producer
+ * updates pushed_bytes before publishing tail, and consumers (plus the
+ * producer, when it overwrites) update popped_bytes after claiming records, so
+ * reading popped_bytes first gives a count that can't go negative.
+ *
+ * wake_len is the smallest ring length that any sleeping consumer is waiting
+ * for, or SIZE_MAX if no one is waiting, and wake_bytes is the same for byte
+ * counts, so the producer wakes consumers only once they have enough to do. A
+ * wakeup goes to every sleeper; anyone who still needs more lowers wake_len
+ * back to its own target before sleeping again.
+ *
+ * interrupt_gen counts the interrupts. Each consumer notes it on entry and
+ * gives up once it changes, so an interrupt reaches every sleeper rather than
+ * just the first one to wake.
+ *
+ * event_fd is an optional eventfd that is kept readable whenever the ring holds
+ * at least event_len records. event_signalled says whether we have written to
+ * it; whoever flips it from false to true does the write, and a consumer that
+ * clears it always rechecks the length afterwards, so a racing push can't leave
+ * a non-empty ring with an unreadable fd.
+ *
+ * overflow says what the producer does when the ring is full. For
+ * HOUND_OVERFLOW_GROW, the producer resizes the ring itself, doubling it up to
+ * grow_len, and then falls back to overwriting. Only the producer writes
+ * dropped and high_water, so they live on its cache line.
+ *
+ * Resizing and draining need the ring to themselves. They set the resizing flag
+ * and wait for the active producer and consumer counts to hit 0; producers and
+ * consumers that see the flag back off and sleep until it clears.
+ */
+struct ring {
+    /* Written by the producer. */
+    alignas(CACHE_LINE_SIZE) _Atomic uint_least64_t tail;
+    _Atomic size_t pushed_bytes;
+    _Atomic uint_least64_t dropped;
+    _Atomic size_t high_water;
+    atomic_uint prod_active;
+    _Atomic uint32_t wake_seq;
+    pthread_mutex_t push_lock;
+
+    /* Written by consumers. */
+    alignas(CACHE_LINE_SIZE) _Atomic uint_least64_t head;
+    _Atomic size_t popped_bytes;
+    atomic_uint cons_active;
+    atomic_uint waiters;
+    _Atomic size_t wake_len;
+    _Atomic size_t wake_bytes;
+
+    /* Written rarely. */
+    alignas(CACHE_LINE_SIZE) _Atomic uint_least64_t interrupt_gen;
+    atomic_int event_fd;
+    _Atomic size_t event_len;
+    atomic_bool event_signalled;
+    atomic_int overflow;
+    _Atomic size_t grow_len;
+    atomic_bool resizing;
+    pthread_mutex_t resize_lock;
+    _Atomic size_t max_len;
+    struct ring_slot *slots;
+};
+
+typedef enum {
+    WAIT_READY,
+    WAIT_INTERRUPTED,
+    WAIT_TIMED_OUT
+} wait_result;
+
+static
+bool futex_wait(
+    _Atomic uint32_t *addr,
+    uint32_t val,
+    const struct timespec *deadline)
+{
+    long ret;
+
+    /*
+     * EAGAIN (the value already changed) and EINTR are both fine, as all
+     * callers recheck their wait condition in a loop. A bitset wait takes an
+     * absolute CLOCK_MONOTONIC deadline, or NULL to wait forever.
+     */
+    ret = syscall(
+        SYS_futex,
+        (uint32_t *) addr,
+        FUTEX_WAIT_BITSET_PRIVATE,
+        val,
+        deadline,
+        NULL,
+        FUTEX_BITSET_MATCH_ANY);
+
+    return ret == 0 || errno != ETIMEDOUT;
+}
+
+static
+void futex_wake_all(_Atomic uint32_t *addr)
+{
+    syscall(
+        SYS_futex,
+        (uint32_t *) addr,
+        FUTEX_WAKE_PRIVATE,
+        INT_MAX,
+        NULL,
+        NULL,
+        0);
+}
+
+static
+void wake_all(struct ring *ring)
+{
+    atomic_fetch_add(&ring->wake_seq, 1);
+    futex_wake_all(&ring->wake_seq);
+}
+
+static
+void enter(struct ring *ring, atomic_uint *active)
+{
+    uint32_t seq;
+
+    while (true) {
+        atomic_fetch_add(active, 1);
+        if (!atomic_load(&ring->resizing)) {
+            break;
+        }
+
+        /* Someone needs exclusive access, so back off until they're done. */
+        atomic_fetch_sub(active, 1);
+        seq = atomic_load(&ring->wake_seq);
+        if (atomic_load(&ring->resizing)) {
+            (void) futex_wait(&ring->wake_seq, seq, NULL);
+        }
+    }
+}
+
+static
+void leave(atomic_uint *active)
+{
+    atomic_fetch_sub(active, 1);
+}
+
+static
+void lock_ring(struct ring *ring)
+{
+    lock_mutex(&ring->resize_lock);
+    atomic_store(&ring->resizing, true);
+    while (atomic_load(&ring->prod_active) > 0 ||
+           atomic_load(&ring->cons_active) > 0) {
+        sched_yield();
+    }
+}
+
+static
+void unlock_ring(struct ring *ring)
+{
+    atomic_store(&ring->resizing, false);
+    wake_all(ring);
+    unlock_mutex(&ring->resize_lock);
+}
+
+static
+void signal_event(struct ring *ring)
+{
+    int fd;
+
+    fd = atomic_load_explicit(&ring->event_fd, memory_order_relaxed);
+    if (fd == EVENT_FD_INVALID) {
+        return;
+    }
+
+    if (ring_len(ring) >= atomic_load(&ring->event_len) &&
+        !atomic_exchange(&ring->event_signalled, true)) {
+        (void) eventfd_write(fd, 1);
+    }
+}
+
+static
+void clear_event(struct ring *ring)
+{
+    int fd;
+    eventfd_t val;
+
+    fd = atomic_load_explicit(&ring->event_fd, memory_order_relaxed);
+    if (fd == EVENT_FD_INVALID || !atomic_load(&ring->event_signalled)) {
+        return;
+    }
+
+    if (ring_len(ring) >= atomic_load(&ring->event_len)) {
+        return;
+    }
+
+    /*
+     * Read first and clear the flag second. A push that comes in between sees
+     * the flag still set and skips its write, but then our recheck catches it.
+     * The fd is nonblocking, so if another consumer already read it, this just
+     * fails with EAGAIN.
+     */
+    (void) eventfd_read(fd, &val);
+    atomic_store(&ring->event_signalled, false);
+    signal_event(ring);
+}
+
+hound_err ring_alloc(struct ring **out_ring, size_t max_len)
+{
+    hound_err err;
+    size_t i;
+    struct ring *ring;
+
+    XASSERT_NOT_NULL(out_ring);
+
+    ring = aligned_alloc(alignof(struct ring), sizeof(*ring));
+    if (ring == NULL) {
+        return HOUND_OOM;
+    }
+
+    ring->slots = malloc(max_len * sizeof(*ring->slots));
+    if (ring->slots == NULL) {
+        err = HOUND_OOM;
+        goto error_alloc_slots;
+    }
+    for (i = 0; i < max_len; ++i) {
+        atomic_init(&ring->slots[i].rec, NULL);
+        atomic_init(&ring->slots[i].size, 0);
+    }
+
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->pushed_bytes, 0);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->high_water, 0);
+    atomic_init(&ring->prod_active, 0);
+    atomic_init(&ring->wake_seq, 0);
+    init_mutex(&ring->push_lock);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->popped_bytes, 0);
+    atomic_init(&ring->cons_active, 0);
+    atomic_init(&ring->waiters, 0);
+    atomic_init(&ring->wake_len, SIZE_MAX);
+    atomic_init(&ring->wake_bytes, SIZE_MAX);
+    atomic_init(&ring->interrupt_gen, 0);
+    atomic_init(&ring->event_fd, EVENT_FD_INVALID);
+    atomic_init(&ring->event_len, 1);
+    atomic_init(&ring->event_signalled, false);
+    atomic_init(&ring->overflow, HOUND_OVERFLOW_OVERWRITE);
+    atomic_init(&ring->grow_len, max_len);
+    atomic_init(&ring->resizing, false);
+    init_mutex(&ring->resize_lock);
+    atomic_init(&ring->max_len, max_len);
+
+    *out_ring = ring;
+
+    return HOUND_OK;
+
+error_alloc_slots:
+    free(ring);
+    return err;
+}
+
+static
+void drop_nolock(struct ring *ring, size_t count)
+{
+    size_t bytes;
+    uint_least64_t head;
+    size_t i;
+    size_t max_len;
+    struct ring_slot *slot;
+
+    head = atomic_load(&ring->head);
+    max_len = atomic_load(&ring->max_len);
+    bytes = 0;
+    for (i = 0; i < count; ++i) {
+        slot = &ring->slots[(head + i) % max_len];
+        bytes += atomic_load(&slot->size);
+        record_ref_dec(atomic_load(&slot->rec));
+    }
+    atomic_store(&ring->head, head + count);
+    atomic_fetch_add(&ring->popped_bytes, bytes);
+}
+
+hound_err ring_resize(struct ring *ring, size_t max_len, bool flush)
+{
+    uint_least64_t head;
+    size_t len;
+    size_t old_max_len;
+    uint_least64_t seqno;
+    struct ring_slot *slots;
+    struct ring_slot *src;
+
+    XASSERT_NOT_NULL(ring);
+
+    old_max_len = atomic_load(&ring->max_len);
+    if (max_len != old_max_len) {
+        slots = malloc(max_len * sizeof(*slots));
+        if (slots == NULL) {
+            return HOUND_OOM;
+        }
+    }
+    else {
+        slots = NULL;
+    }
+
+    lock_ring(ring);
+
+    /* Drop whatever won't fit, oldest first, as the locked queue does. */
+    len = atomic_load(&ring->tail) - atomic_load(&ring->head);
+    if (flush) {
+        drop_nolock(ring, len);
+    }
+    else if (len > max_len) {
+        drop_nolock(ring, len - max_len);
+    }
+
+    if (slots != NULL) {
+        /*
+         * Slots are indexed by sequence number, so each remaining record just
+         * moves to wherever its sequence number maps in the new array.
+         */
+        head = atomic_load(&ring->head);
+        for (seqno = head; seqno < atomic_load(&ring->tail); ++seqno) {
+            src = &ring->slots[seqno % old_max_len];
+            atomic_init(&slots[seqno % max_len].rec, atomic_load(&src->rec));
+            atomic_init(&slots[seqno % max_len].size, atomic_load(&src->size));
+        }
+        free(ring->slots);
+        ring->slots = slots;
+        atomic_store(&ring->max_len, max_len);
+    }
+
+    unlock_ring(ring);
+    clear_event(ring);
+
+    return HOUND_OK;
+}
+
+void ring_drain(struct ring *ring)
+{
+    XASSERT_NOT_NULL(ring);
+
+    lock_ring(ring);
+    drop_nolock(ring, atomic_load(&ring->tail) - atomic_load(&ring->head));
+    unlock_ring(ring);
+    clear_event(ring);
+}
+
+void ring_destroy(struct ring *ring)
+{
+    int fd;
+
+    XASSERT_NOT_NULL(ring);
+
+    ring_drain(ring);
+    fd = atomic_load(&ring->event_fd);
+    if (fd != EVENT_FD_INVALID) {
+        close(fd);
+    }
+    destroy_mutex(&ring->resize_lock);
+    destroy_mutex(&ring->push_lock);
+    free(ring->slots);
+    free(ring);
+}
+
+void ring_interrupt(struct ring *ring)
+{
+    XASSERT_NOT_NULL(ring);
+
+    atomic_fetch_add(&ring->interrupt_gen, 1);
+    wake_all(ring);
+}
+
+hound_err ring_get_event_fd(struct ring *ring, int *fd)
+{
+    hound_err err;
+    int event_fd;
+
+    XASSERT_NOT_NULL(ring);
+    XASSERT_NOT_NULL(fd);
+
+    /* Use the resize lock just to serialize callers creating the fd. */
+    lock_mutex(&ring->resize_lock);
+    event_fd = atomic_load(&ring->event_fd);
+    if (event_fd == EVENT_FD_INVALID) {
+        event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (event_fd == EVENT_FD_INVALID) {
+            err = errno;
+            goto out;
+        }
+        atomic_store(&ring->event_fd, event_fd);
+    }
+    *fd = event_fd;
+    err = HOUND_OK;
+
+out:
+    unlock_mutex(&ring->resize_lock);
+
+    /* Records may have arrived before the fd existed. */
+    signal_event(ring);
+
+    return err;
+}
+
+void ring_set_event_len(struct ring *ring, size_t len)
+{
+    XASSERT_NOT_NULL(ring);
+    XASSERT_GT(len, 0);
+
+    atomic_store(&ring->event_len, len);
+    signal_event(ring);
+    clear_event(ring);
+}
+
+void ring_set_overflow(
+    struct ring *ring,
+    hound_overflow_policy policy,
+    size_t grow_len)
+{
+    XASSERT_NOT_NULL(ring);
+
+    atomic_store(&ring->overflow, policy);
+    atomic_store(&ring->grow_len, grow_len);
+}
+
+/*
+ * Called by the producer, from inside ring_push_many, when the ring is full.
+ * Resizing needs the ring to itself, so we have to step out of the producer
+ * count while we do it.
+ */
+static
+bool grow(struct ring *ring, size_t *max_len, uint_least64_t *head)
+{
+    hound_err err;
+    size_t grow_len;
+
+    grow_len = atomic_load(&ring->grow_len);
+    if (*max_len >= grow_len) {
+        return false;
+    }
+
+    leave(&ring->prod_active);
+    err = ring_resize(ring, min(2 * *max_len, grow_len), false);
+    enter(ring, &ring->prod_active);
+
+    *max_len = atomic_load_explicit(&ring->max_len, memory_order_relaxed);
+    *head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    return err == HOUND_OK;
+}
+
+/*
+ * Only the producer writes the drop count and high-water mark, so they don't
+ * need atomic read-modify-writes.
+ */
+static
+void count_drop(struct ring *ring)
+{
+    uint_least64_t dropped;
+
+    dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    atomic_store_explicit(&ring->dropped, dropped + 1, memory_order_relaxed);
+}
+
+static
+void update_high_water(
+    struct ring *ring,
+    uint_least64_t tail,
+    uint_least64_t *head,
+    size_t max_len)
+{
+    size_t high_water;
+
+    high_water = atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+    if (tail - *head <= high_water) {
+        return;
+    }
+
+    /* Our copy of head may be stale, so check the real length. */
+    *head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - *head > high_water) {
+        atomic_store_explicit(
+            &ring->high_water,
+            min(tail - *head, max_len),
+            memory_order_relaxed);
+    }
+}
+
+void ring_push_many(
+    struct ring *ring,
+    struct record_info **recs,
+    size_t count)
+{
+    bool can_grow;
+    struct record_info *dropped;
+    uint_least64_t head;
+    size_t i;
+    size_t max_len;
+    hound_overflow_policy overflow;
+    struct ring_slot *slot;
+    uint_least64_t tail;
+    size_t wake_bytes;
+    size_t wake_len;
+
+    XASSERT_NOT_NULL(ring);
+    XASSERT_NOT_NULL(recs);
+
+    lock_mutex(&ring->push_lock);
+    enter(ring, &ring->prod_active);
+
+    overflow = atomic_load_explicit(&ring->overflow, memory_order_relaxed);
+    can_grow = overflow == HOUND_OVERFLOW_GROW;
+    max_len = atomic_load_explicit(&ring->max_len, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (i = 0; i < count; ++i) {
+        if (tail - head >= max_len) {
+            /* Our copy of head may be stale, so make sure we're really full. */
+            head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        }
+
+        if (tail - head >= max_len) {
+            if (overflow == HOUND_OVERFLOW_DROP_NEWEST) {
+                count_drop(ring);
+                record_ref_dec(recs[i]);
+                continue;
+            }
+
+            /* If we can't grow any more, overwrite instead. */
+            while (can_grow && tail - head >= max_len) {
+                can_grow = grow(ring, &max_len, &head);
+            }
+        }
+
+        dropped = NULL;
+        while (tail - head >= max_len) {
+            /*
+             * Overflow. Claim the oldest entry so we can overwrite it,
+             * preserving our max length. If a consumer beats us to it, head
+             * will have moved, and we may no longer be full.
+             */
+            if (atomic_compare_exchange_weak(&ring->head, &head, head + 1)) {
+                dropped = atomic_load_explicit(
+                    &ring->slots[head % max_len].rec,
+                    memory_order_relaxed);
+                atomic_fetch_add(&ring->popped_bytes, dropped->record.size);
+                count_drop(ring);
+                ++head;
+                break;
+            }
+        }
+
+        slot = &ring->slots[tail % max_len];
+        atomic_store_explicit(&slot->rec, recs[i], memory_order_relaxed);
+        atomic_store_explicit(
+            &slot->size,
+            recs[i]->record.size,
+            memory_order_relaxed);
+        ++tail;
+        atomic_store_explicit(
+            &ring->pushed_bytes,
+            atomic_load_explicit(&ring->pushed_bytes, memory_order_relaxed) +
+                recs[i]->record.size,
+            memory_order_relaxed);
+
+        /*
+         * Publish each record as we go rather than once at the end, since head
+         * must never pass the published tail if the batch overflows the ring.
+         */
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        update_high_water(ring, tail, &head, max_len);
+
+        if (dropped != NULL) {
+            record_ref_dec(dropped);
+        }
+    }
+
+    leave(&ring->prod_active);
+    unlock_mutex(&ring->push_lock);
+
+    /*
+     * Skip the syscall unless someone is actually sleeping and now has enough
+     * records. The fence pairs with the waiter announcing itself before it
+     * rechecks the ring length, so either we see the waiter's target or it
+     * sees our records.
+     */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&ring->waiters) > 0) {
+        wake_len = atomic_load(&ring->wake_len);
+        wake_bytes = atomic_load(&ring->wake_bytes);
+        if (tail - atomic_load(&ring->head) >= wake_len ||
+            ring_bytes(ring) >= wake_bytes) {
+            /*
+             * If a new waiter lowered a target in the meantime, leave its
+             * target alone; it gets woken either way.
+             */
+            (void) atomic_compare_exchange_strong(
+                &ring->wake_len,
+                &wake_len,
+                SIZE_MAX);
+            (void) atomic_compare_exchange_strong(
+                &ring->wake_bytes,
+                &wake_bytes,
+                SIZE_MAX);
+            wake_all(ring);
+        }
+    }
+
+    signal_event(ring);
+}
+
+void ring_push(struct ring *ring, struct record_info *rec)
+{
+    ring_push_many(ring, &rec, 1);
+}
+
+size_t ring_len(struct ring *ring)
+{
+    uint_least64_t head;
+    uint_least64_t tail;
+
+    XASSERT_NOT_NULL(ring);
+
+    /*
+     * Load head first so that tail - head can't go negative. It can briefly
+     * exceed max_len if we race with an overwrite, so clamp it.
+     */
+    head = atomic_load(&ring->head);
+    tail = atomic_load(&ring->tail);
+
+    return min(tail - head, atomic_load(&ring->max_len));
+}
+
+size_t ring_bytes(struct ring *ring)
+{
+    size_t popped;
+
+    XASSERT_NOT_NULL(ring);
+
+    popped = atomic_load(&ring->popped_bytes);
+    return atomic_load(&ring->pushed_bytes) - popped;
+}
+
+uint64_t ring_dropped(struct ring *ring)
+{
+    XASSERT_NOT_NULL(ring);
+
+    return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
+
+size_t ring_high_water(struct ring *ring)
+{
+    XASSERT_NOT_NULL(ring);
+
+    return atomic_load_explicit(&ring->high_water, memory_order_relaxed);
+}
+
+size_t ring_max_len(struct ring *ring)
+{
+    XASSERT_NOT_NULL(ring);
+
+    return atomic_load(&ring->max_len);
+}
+
+static
+size_t pop_helper(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t records,
+    size_t bytes,
+    hound_seqno *first_seqno,
+    size_t *out_bytes)
+{
+    size_t avail;
+    size_t count;
+    uint_least64_t head;
+    size_t max_len;
+    struct ring_slot *slot;
+    hound_record_size size;
+    uint_least64_t tail;
+    size_t total;
+
+    enter(ring, &ring->cons_active);
+
+    max_len = atomic_load_explicit(&ring->max_len, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    do {
+        /*
+         * Copy out the slots first and then try to claim them. If the swap
+         * fails, the producer overwrote the front or another consumer got there
+         * first, so what we copied may be stale; just try again. Since nothing
+         * is dereferenced until the claim succeeds, reading a stale slot is
+         * harmless.
+         */
+        tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        avail = min(min(records, tail - head), max_len);
+        total = 0;
+        for (count = 0; count < avail; ++count) {
+            slot = &ring->slots[(head + count) % max_len];
+            size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+            if (bytes - total < size) {
+                break;
+            }
+            total += size;
+            buf[count] = atomic_load_explicit(&slot->rec, memory_order_relaxed);
+        }
+    } while (!atomic_compare_exchange_weak(&ring->head, &head, head + count));
+    atomic_fetch_add(&ring->popped_bytes, total);
+
+    leave(&ring->cons_active);
+
+    if (count > 0) {
+        clear_event(ring);
+    }
+
+    *first_seqno = head;
+    if (out_bytes != NULL) {
+        *out_bytes = total;
+    }
+
+    return count;
+}
+
+static
+void lower_target(_Atomic size_t *target, size_t val)
+{
+    size_t cur;
+
+    cur = atomic_load(target);
+    while (val < cur && !atomic_compare_exchange_weak(target, &cur, val)) {
+    }
+}
+
+static
+bool has_enough(struct ring *ring, size_t records, size_t bytes)
+{
+    return ring_len(ring) >= records || ring_bytes(ring) >= bytes;
+}
+
+/*
+ * Wait until the ring holds at least the given number of records or the given
+ * number of bytes, whichever comes first, or until the interrupt generation
+ * moves past gen.
+ */
+static
+wait_result wait_for(
+    struct ring *ring,
+    size_t records,
+    size_t bytes,
+    uint_least64_t gen,
+    const struct timespec *deadline)
+{
+    bool ready;
+    uint32_t seq;
+
+    while (true) {
+        if (atomic_load(&ring->interrupt_gen) != gen) {
+            return WAIT_INTERRUPTED;
+        }
+
+        if (has_enough(ring, records, bytes)) {
+            return WAIT_READY;
+        }
+
+        /*
+         * Announce ourselves and our target before rechecking so that a
+         * concurrent push either sees us and wakes us, or happened early enough
+         * that the recheck sees its record. Read the wake sequence before
+         * setting the target, so that if a push resets the target before we set
+         * it, its wakeup also bumps the sequence and the wait returns at once.
+         */
+        atomic_fetch_add(&ring->waiters, 1);
+        seq = atomic_load(&ring->wake_seq);
+        lower_target(&ring->wake_len, records);
+        lower_target(&ring->wake_bytes, bytes);
+        ready = true;
+        if (!has_enough(ring, records, bytes) &&
+            atomic_load(&ring->interrupt_gen) == gen) {
+            ready = futex_wait(&ring->wake_seq, seq, deadline);
+        }
+        atomic_fetch_sub(&ring->waiters, 1);
+
+        if (!ready) {
+            return WAIT_TIMED_OUT;
+        }
+    }
+}
+
+size_t ring_pop_records(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    bool *interrupt)
+{
+    return ring_pop_records_timeout(
+        ring,
+        buf,
+        records,
+        first_seqno,
+        NULL,
+        interrupt);
+}
+
+size_t ring_pop_records_timeout(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t records,
+    hound_seqno *first_seqno,
+    const struct timespec *deadline,
+    bool *interrupt)
+{
+    size_t count;
+    uint_least64_t gen;
+    wait_result result;
+    hound_seqno *seqno;
+    hound_seqno tmp;
+
+    XASSERT_NOT_NULL(ring);
+    XASSERT_NOT_NULL(buf);
+
+    count = 0;
+    *interrupt = false;
+    gen = atomic_load(&ring->interrupt_gen);
+    do {
+        result = wait_for(ring, records - count, SIZE_MAX, gen, deadline);
+        if (result == WAIT_INTERRUPTED) {
+            *interrupt = true;
+            break;
+        }
+
+        /*
+         * Another consumer may steal records between our wait and our pop, so
+         * we may need more than one pop. We want to return the first sequence
+         * number for the entire buffer, so once we have any records, throw
+         * away the later values.
+         */
+        if (count == 0) {
+            seqno = first_seqno;
+        }
+        else {
+            seqno = &tmp;
+        }
+
+        /* On a timeout, take whatever is there. */
+        count += pop_helper(
+            ring,
+            buf + count,
+            records - count,
+            SIZE_MAX,
+            seqno,
+            NULL);
+    } while (count < records && result != WAIT_TIMED_OUT);
+
+    return count;
+}
+
+size_t ring_pop_bytes(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    size_t wait_records,
+    hound_seqno *first_seqno,
+    size_t *records,
+    bool *interrupt)
+{
+    size_t count;
+    uint_least64_t gen;
+
+    XASSERT_NOT_NULL(ring);
+    XASSERT_NOT_NULL(buf);
+    XASSERT_NOT_NULL(records);
+
+    /*
+     * A full ring won't get any more bytes no matter how long we wait, so never
+     * wait for more records than the ring can hold.
+     */
+    wait_records = min(wait_records, atomic_load(&ring->max_len));
+    *interrupt = false;
+    gen = atomic_load(&ring->interrupt_gen);
+    if (wait_for(ring, wait_records, bytes, gen, NULL) == WAIT_INTERRUPTED) {
+        *interrupt = true;
+        *records = 0;
+        return 0;
+    }
+
+    *records = pop_helper(ring, buf, max_records, bytes, first_seqno, &count);
+
+    return count;
+}
+
+size_t ring_pop_bytes_nowait(
+    struct ring *ring,
+    struct record_info **buf,
+    size_t max_records,
+    size_t bytes,
+    hound_seqno *first_seqno,
+    size_t *records)
+{
+    size_t count;
+
+    XASSERT_NOT_NULL(ring);
+    XASSERT_NOT_NULL(buf);
+    XASSERT_NOT_NULL(records);
+
+    *records = pop_helper(ring, buf, max_records, bytes, first_seqno, &count);
+
+    return count;
+}
+
+size_t ring_pop_records_nowait(
+    struct ring *ring,
+    struct record_info **buf,
+    hound_seqno *first_seqno,
+    size_t records)
+{
+    XASSERT_NOT_NULL(ring);
+    XASSERT_NOT_NULL(buf);
+
+    return pop_helper(ring, buf, records, SIZE_MAX, first_seqno, NULL);
+}
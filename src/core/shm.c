@@ -0,0 +1,1205 @@
+/**
+ * @file      shm.c
+ * @brief     Shared-memory record distribution. A server runs an ordinary
+ *            context and copies each of its records into a ring in shared
+ *            memory, one ring per data ID, so that other processes can read
+ *            them without doing their own device I/O. Clients find the server
+ *            through a UNIX socket, which hands them the ring's memfd; after
+ *            that, reads are plain loads from the mapping, with a futex to
+ *            sleep on when the ring is empty.
+ *
+ *            Each ring slot is a seqlock with a single writer, so readers
+ *            never block the server. A reader that falls behind by more than
+ *            a ring's worth of records skips ahead and counts the rest as
+ *            dropped.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <hound/hound.h>
+#include <hound-private/ctx.h>
+#include <hound-private/driver.h>
+#include <hound-private/error.h>
+#include <hound-private/log.h>
+#include <hound-private/shm.h>
+#include <hound-private/util.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <xlib/xvec.h>
+
+#define SHM_MAGIC UINT64_C(0x4d4853444e554f48) /* "HOUNDSHM" */
+#define SHM_VERSION 1
+#define CACHE_LINE_SIZE 64
+#define SLOT_ALIGN 8
+#define FD_INVALID (-1)
+
+/* The fixed pollfds at the start of the server's poll set. */
+#define POLL_STOP 0
+#define POLL_LISTEN 1
+#define POLL_CTX 2
+#define POLL_FIXED 3
+
+/*
+ * A ring is a header followed by slot_count slots of slot_size bytes each.
+ * write_seq is the number of records published so far, so record n lives in
+ * slot n % slot_count. Every field is in host byte order, as the server and
+ * its clients are always on the same machine.
+ */
+struct shm_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t data_id;
+    uint64_t slot_count;
+    uint64_t slot_size;
+    /* The most payload bytes a slot holds. */
+    uint64_t data_size;
+
+    alignas(CACHE_LINE_SIZE) _Atomic uint64_t write_seq;
+    /* Bumped after each batch of records, for clients to sleep on. */
+    alignas(CACHE_LINE_SIZE) _Atomic uint32_t wake_seq;
+};
+
+/*
+ * seq is 2n+1 while record n is being written into the slot, and 2n+2 once
+ * it's done. A reader that sees the same even value before and after reading
+ * the slot knows it read record n whole.
+ */
+struct shm_slot {
+    _Atomic uint64_t seq;
+    int64_t tv_sec;
+    int64_t tv_nsec;
+    uint32_t size;
+    uint32_t dev_id;
+    unsigned char data[];
+};
+
+/* What a client sends to attach, after which the server replies. */
+struct shm_attach_rq {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t data_id;
+};
+
+/* The server's reply; on success, the ring's memfd comes along with it. */
+struct shm_attach_reply {
+    int32_t err;
+};
+
+struct shm_ring {
+    hound_data_id id;
+    int fd;
+    struct shm_header *header;
+    size_t map_size;
+
+    /* The number of attached clients. */
+    size_t clients;
+    /* True if we published records that clients have not been woken for. */
+    bool pending;
+};
+
+struct shm_conn {
+    int fd;
+    /* The ring the client attached to, or NULL until it sends a request. */
+    struct shm_ring *ring;
+};
+
+XVEC_DEFINE(conn_vec, struct shm_conn);
+
+struct hound_shm_server {
+    struct hound_ctx *ctx;
+    int ctx_fd;
+    int listen_fd;
+    int stop_fd;
+    pthread_t thread;
+    char socket_path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+
+    struct shm_ring *rings;
+    size_t ring_count;
+
+    conn_vec conns;
+    struct pollfd *pfds;
+    size_t pfds_len;
+};
+
+struct hound_shm_client {
+    int sock;
+    const struct shm_header *header;
+    size_t map_size;
+    const unsigned char *slots;
+    uint64_t mask;
+    uint64_t slot_size;
+
+    /* The sequence number of the next record to read. */
+    uint64_t cursor;
+    uint64_t dropped;
+
+    /* Where each record is copied and checked before the callback sees it. */
+    unsigned char *buf;
+};
+
+static
+size_t align_up(size_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+static
+size_t round_up_pow2(size_t n)
+{
+    size_t pow2;
+
+    pow2 = 1;
+    while (pow2 < n) {
+        pow2 <<= 1;
+    }
+
+    return pow2;
+}
+
+static
+size_t get_slots_offset(void)
+{
+    return align_up(sizeof(struct shm_header), CACHE_LINE_SIZE);
+}
+
+static
+struct shm_slot *get_slot(
+    const struct shm_header *header,
+    const unsigned char *slots,
+    uint64_t seq)
+{
+    return (struct shm_slot *)
+        (slots + (seq & (header->slot_count - 1)) * header->slot_size);
+}
+
+static
+void futex_wake_all(_Atomic uint32_t *addr)
+{
+    /* The ring is shared between processes, so this is not a private futex. */
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static
+bool futex_wait(
+    const _Atomic uint32_t *addr,
+    uint32_t val,
+    const struct timespec *deadline)
+{
+    long ret;
+
+    /*
+     * As in ring.c, EAGAIN and EINTR are fine, as the caller rechecks the
+     * ring in a loop, and the bitset wait takes an absolute CLOCK_MONOTONIC
+     * deadline.
+     */
+    ret = syscall(
+        SYS_futex,
+        (const uint32_t *) addr,
+        FUTEX_WAIT_BITSET,
+        val,
+        deadline,
+        NULL,
+        FUTEX_BITSET_MATCH_ANY);
+
+    return ret == 0 || errno != ETIMEDOUT;
+}
+
+/*
+ * Gets the payload size a ring needs for a data ID: the size of a record when
+ * every format has a fixed size and the data is not packed, and otherwise the
+ * caller's maximum.
+ */
+static
+hound_err get_data_size(
+    const struct hound_datadesc_snapshot *snapshot,
+    const struct hound_data_rq *data_rq,
+    size_t max_record_size,
+    size_t *out_size)
+{
+    const struct hound_datadesc *desc;
+    const struct hound_data_fmt *fmt;
+    size_t i;
+    size_t size;
+
+    desc = NULL;
+    for (i = 0; i < snapshot->len; ++i) {
+        if (snapshot->descs[i].data_id == data_rq->id) {
+            desc = &snapshot->descs[i];
+            break;
+        }
+    }
+    if (desc == NULL) {
+        return HOUND_DATA_ID_DOES_NOT_EXIST;
+    }
+
+    size = 0;
+    if (data_rq->pack <= 1) {
+        for (i = 0; i < desc->fmt_count; ++i) {
+            fmt = &desc->fmts[i];
+            if (fmt->size == 0) {
+                size = 0;
+                break;
+            }
+            size = max(size, fmt->offset + fmt->size);
+        }
+    }
+
+    if (size == 0) {
+        if (max_record_size == 0 || max_record_size > UINT32_MAX) {
+            return HOUND_INVALID_VAL;
+        }
+        size = max_record_size;
+    }
+
+    *out_size = size;
+
+    return HOUND_OK;
+}
+
+static
+hound_err init_ring(
+    struct shm_ring *ring,
+    hound_data_id id,
+    size_t slot_count,
+    size_t data_size)
+{
+    hound_err err;
+    struct shm_header *header;
+    size_t map_size;
+    int ret;
+    size_t slot_size;
+
+    slot_size = align_up(sizeof(struct shm_slot) + data_size, SLOT_ALIGN);
+    map_size = get_slots_offset() + slot_count*slot_size;
+
+    ring->fd = memfd_create("hound-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->fd == FD_INVALID) {
+        return errno;
+    }
+
+    ret = ftruncate(ring->fd, map_size);
+    if (ret == -1) {
+        err = errno;
+        goto error_ftruncate;
+    }
+
+    /* Clients can't resize the ring out from under us or each other. */
+    ret = fcntl(
+        ring->fd,
+        F_ADD_SEALS,
+        F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL);
+    if (ret == -1) {
+        err = errno;
+        goto error_ftruncate;
+    }
+
+    header = mmap(
+        NULL,
+        map_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        ring->fd,
+        0);
+    if (header == MAP_FAILED) {
+        err = errno;
+        goto error_ftruncate;
+    }
+
+    /* The memfd starts zeroed, so every slot's seq starts at 0. */
+    header->magic = SHM_MAGIC;
+    header->version = SHM_VERSION;
+    header->data_id = id;
+    header->slot_count = slot_count;
+    header->slot_size = slot_size;
+    header->data_size = data_size;
+    atomic_init(&header->write_seq, 0);
+    atomic_init(&header->wake_seq, 0);
+
+    ring->id = id;
+    ring->header = header;
+    ring->map_size = map_size;
+    ring->clients = 0;
+    ring->pending = false;
+
+    return HOUND_OK;
+
+error_ftruncate:
+    close(ring->fd);
+    return err;
+}
+
+static
+void destroy_ring(struct shm_ring *ring)
+{
+    /* Wake anyone still waiting, so they see there is nothing more. */
+    atomic_fetch_add_explicit(&ring->header->wake_seq, 1, memory_order_release);
+    futex_wake_all(&ring->header->wake_seq);
+
+    munmap(ring->header, ring->map_size);
+    close(ring->fd);
+}
+
+static
+struct shm_ring *get_ring(struct hound_shm_server *server, hound_data_id id)
+{
+    size_t i;
+
+    for (i = 0; i < server->ring_count; ++i) {
+        if (server->rings[i].id == id) {
+            return &server->rings[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * The server context's callback, which runs on the server thread, the only
+ * writer for every ring.
+ */
+static
+void publish(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct shm_header *header;
+    struct shm_ring *ring;
+    uint64_t seq;
+    struct hound_shm_server *server;
+    struct shm_slot *slot;
+
+    server = cb_ctx;
+    ring = get_ring(server, rec->data_id);
+    XASSERT_NOT_NULL(ring);
+    header = ring->header;
+
+    if (rec->size > header->data_size) {
+        hound_log_err(
+            HOUND_INVALID_VAL,
+            "shm: dropping record of %zu bytes for data ID 0x%x, as the "
+            "ring holds %zu bytes",
+            rec->size,
+            rec->data_id,
+            (size_t) header->data_size);
+        return;
+    }
+
+    seq = atomic_load_explicit(&header->write_seq, memory_order_relaxed);
+    slot = get_slot(header, (unsigned char *) header + get_slots_offset(), seq);
+
+    atomic_store_explicit(&slot->seq, 2*seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->tv_sec = rec->timestamp.tv_sec;
+    slot->tv_nsec = rec->timestamp.tv_nsec;
+    slot->size = rec->size;
+    slot->dev_id = rec->dev_id;
+    memcpy(slot->data, rec->data, rec->size);
+    atomic_store_explicit(&slot->seq, 2*seq + 2, memory_order_release);
+
+    atomic_store_explicit(&header->write_seq, seq + 1, memory_order_release);
+    ring->pending = true;
+}
+
+static
+void wake_clients(struct hound_shm_server *server)
+{
+    size_t i;
+    struct shm_ring *ring;
+
+    for (i = 0; i < server->ring_count; ++i) {
+        ring = &server->rings[i];
+        if (!ring->pending) {
+            continue;
+        }
+        ring->pending = false;
+        atomic_fetch_add_explicit(
+            &ring->header->wake_seq,
+            1,
+            memory_order_release);
+        /* Skip the syscall when there's nobody to wake. */
+        if (ring->clients > 0) {
+            futex_wake_all(&ring->header->wake_seq);
+        }
+    }
+}
+
+static
+hound_err send_reply(int fd, hound_err err, int ring_fd)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    struct msghdr msg;
+    struct shm_attach_reply reply;
+    ssize_t ret;
+
+    reply.err = err;
+    iov.iov_base = &reply;
+    iov.iov_len = sizeof(reply);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (ring_fd != FD_INVALID) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &ring_fd, sizeof(int));
+    }
+
+    ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (ret == -1) {
+        return errno;
+    }
+
+    return HOUND_OK;
+}
+
+/*
+ * Handles activity on a client connection. Returns false if the connection
+ * should be closed.
+ */
+static
+bool handle_conn(struct hound_shm_server *server, struct shm_conn *conn)
+{
+    hound_err err;
+    struct shm_ring *ring;
+    struct shm_attach_rq rq;
+    ssize_t ret;
+
+    ret = recv(conn->fd, &rq, sizeof(rq), 0);
+    if (ret == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return true;
+    }
+    if (ret != sizeof(rq) || conn->ring != NULL) {
+        /*
+         * Attached clients never send anything more, so any activity means
+         * they hung up, or broke protocol.
+         */
+        return false;
+    }
+
+    if (rq.magic != SHM_MAGIC || rq.version != SHM_VERSION) {
+        (void) send_reply(conn->fd, HOUND_INVALID_VAL, FD_INVALID);
+        return false;
+    }
+
+    ring = get_ring(server, rq.data_id);
+    if (ring == NULL) {
+        (void) send_reply(conn->fd, HOUND_DATA_ID_DOES_NOT_EXIST, FD_INVALID);
+        return false;
+    }
+
+    err = send_reply(conn->fd, HOUND_OK, ring->fd);
+    if (err != HOUND_OK) {
+        hound_log_err_nofmt(err, "shm: failed to send ring to client");
+        return false;
+    }
+
+    conn->ring = ring;
+    ++ring->clients;
+
+    return true;
+}
+
+static
+void close_conn(struct shm_conn *conn)
+{
+    if (conn->ring != NULL) {
+        --conn->ring->clients;
+    }
+    close(conn->fd);
+}
+
+static
+void accept_conn(struct hound_shm_server *server)
+{
+    struct shm_conn *conn;
+    int fd;
+    struct pollfd *pfds;
+
+    fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd == FD_INVALID) {
+        if (errno != EAGAIN && errno != EINTR) {
+            hound_log_err_nofmt(errno, "shm: failed to accept client");
+        }
+        return;
+    }
+
+    if (server->pfds_len < POLL_FIXED + xv_size(server->conns) + 1) {
+        pfds = realloc(server->pfds, 2 * server->pfds_len * sizeof(*pfds));
+        if (pfds == NULL) {
+            goto error;
+        }
+        server->pfds = pfds;
+        server->pfds_len *= 2;
+    }
+
+    conn = xv_pushp(struct shm_conn, server->conns);
+    if (conn == NULL) {
+        goto error;
+    }
+    conn->fd = fd;
+    conn->ring = NULL;
+
+    return;
+
+error:
+    hound_log_err_nofmt(HOUND_OOM, "shm: failed to add client");
+    close(fd);
+}
+
+static
+void *serve(void *data)
+{
+    struct shm_conn *conn;
+    hound_err err;
+    size_t i;
+    size_t n;
+    struct pollfd *pfd;
+    size_t read;
+    int ret;
+    struct hound_shm_server *server;
+
+    server = data;
+
+    server->pfds[POLL_STOP].fd = server->stop_fd;
+    server->pfds[POLL_LISTEN].fd = server->listen_fd;
+    server->pfds[POLL_CTX].fd = server->ctx_fd;
+    while (true) {
+        n = POLL_FIXED + xv_size(server->conns);
+        for (i = 0; i < n; ++i) {
+            pfd = &server->pfds[i];
+            if (i >= POLL_FIXED) {
+                pfd->fd = xv_A(server->conns, i - POLL_FIXED).fd;
+            }
+            pfd->events = POLLIN;
+            pfd->revents = 0;
+        }
+
+        ret = poll(server->pfds, n, -1);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            hound_log_err_nofmt(errno, "shm: poll failed");
+            break;
+        }
+
+        if (server->pfds[POLL_STOP].revents != 0) {
+            break;
+        }
+
+        if (server->pfds[POLL_CTX].revents != 0) {
+            err = ctx_read_all_nowait(server->ctx, &read);
+            if (err != HOUND_OK) {
+                hound_log_err_nofmt(err, "shm: failed to read context");
+            }
+            wake_clients(server);
+        }
+
+        /*
+         * Walk backwards, so that dropping a connection moves only ones we
+         * have already handled.
+         */
+        for (i = n; i > POLL_FIXED; --i) {
+            if (server->pfds[i-1].revents == 0) {
+                continue;
+            }
+            conn = &xv_A(server->conns, i - 1 - POLL_FIXED);
+            if (!handle_conn(server, conn)) {
+                close_conn(conn);
+                xv_quickdel(server->conns, i - 1 - POLL_FIXED);
+            }
+        }
+
+        if (server->pfds[POLL_LISTEN].revents != 0) {
+            accept_conn(server);
+        }
+    }
+
+    return NULL;
+}
+
+static
+hound_err init_rings(
+    struct hound_shm_server *server,
+    const struct hound_rq *rq,
+    size_t slot_count,
+    size_t max_record_size)
+{
+    size_t data_size;
+    hound_err err;
+    size_t i;
+    const struct hound_datadesc_snapshot *snapshot;
+
+    err = driver_acquire_datadescs(&snapshot);
+    if (err != HOUND_OK) {
+        return err;
+    }
+
+    server->rings = malloc(rq->rq_list.len * sizeof(*server->rings));
+    if (server->rings == NULL) {
+        err = HOUND_OOM;
+        goto out;
+    }
+
+    server->ring_count = 0;
+    for (i = 0; i < rq->rq_list.len; ++i) {
+        if (get_ring(server, rq->rq_list.data[i].id) != NULL) {
+            /* The context took care of rejecting real duplicates. */
+            continue;
+        }
+        err = get_data_size(
+            snapshot,
+            &rq->rq_list.data[i],
+            max_record_size,
+            &data_size);
+        if (err != HOUND_OK) {
+            goto error_ring;
+        }
+        err = init_ring(
+            &server->rings[server->ring_count],
+            rq->rq_list.data[i].id,
+            slot_count,
+            data_size);
+        if (err != HOUND_OK) {
+            goto error_ring;
+        }
+        ++server->ring_count;
+    }
+
+    err = HOUND_OK;
+    goto out;
+
+error_ring:
+    for (i = 0; i < server->ring_count; ++i) {
+        destroy_ring(&server->rings[i]);
+    }
+    free(server->rings);
+out:
+    driver_release_datadescs(snapshot);
+    return err;
+}
+
+static
+hound_err init_socket(struct hound_shm_server *server, const char *path)
+{
+    struct sockaddr_un addr;
+    hound_err err;
+    int ret;
+
+    server->listen_fd = socket(
+        AF_UNIX,
+        SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK,
+        0);
+    if (server->listen_fd == FD_INVALID) {
+        return errno;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    ret = bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == -1) {
+        err = errno;
+        goto error;
+    }
+
+    ret = listen(server->listen_fd, SOMAXCONN);
+    if (ret == -1) {
+        err = errno;
+        unlink(path);
+        goto error;
+    }
+
+    strcpy(server->socket_path, path);
+
+    return HOUND_OK;
+
+error:
+    close(server->listen_fd);
+    return err;
+}
+
+hound_err shm_serve(
+    const char *socket_path,
+    const struct hound_rq *rq,
+    size_t slot_count,
+    size_t max_record_size,
+    struct hound_shm_server **out_server)
+{
+    hound_err err;
+    size_t i;
+    struct hound_rq server_rq;
+    struct hound_shm_server *server;
+
+    NULL_CHECK(socket_path);
+    NULL_CHECK(rq);
+    NULL_CHECK(out_server);
+
+    if (strnlen(socket_path, sizeof(server->socket_path)) ==
+        sizeof(server->socket_path)) {
+        return HOUND_PATH_TOO_LONG;
+    }
+    if (slot_count == 0 || slot_count > SIZE_MAX / 2) {
+        return HOUND_INVALID_VAL;
+    }
+    slot_count = round_up_pow2(slot_count);
+
+    server = malloc(sizeof(*server));
+    if (server == NULL) {
+        return HOUND_OOM;
+    }
+
+    /* The context validates the request for us. */
+    server_rq = *rq;
+    server_rq.cb = publish;
+    server_rq.cb_ctx = server;
+    err = ctx_alloc(&server_rq, &server->ctx);
+    if (err != HOUND_OK) {
+        goto error_ctx_alloc;
+    }
+
+    err = ctx_get_fd(server->ctx, &server->ctx_fd);
+    if (err != HOUND_OK) {
+        goto error_rings;
+    }
+
+    err = init_rings(server, rq, slot_count, max_record_size);
+    if (err != HOUND_OK) {
+        goto error_rings;
+    }
+
+    server->pfds_len = POLL_FIXED + 1;
+    server->pfds = malloc(server->pfds_len * sizeof(*server->pfds));
+    if (server->pfds == NULL) {
+        err = HOUND_OOM;
+        goto error_pfds;
+    }
+    xv_init(server->conns);
+
+    server->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (server->stop_fd == FD_INVALID) {
+        err = errno;
+        goto error_eventfd;
+    }
+
+    err = init_socket(server, socket_path);
+    if (err != HOUND_OK) {
+        goto error_socket;
+    }
+
+    err = ctx_start(server->ctx);
+    if (err != HOUND_OK) {
+        goto error_start;
+    }
+
+    err = pthread_create(&server->thread, NULL, serve, server);
+    if (err != 0) {
+        goto error_thread;
+    }
+
+    *out_server = server;
+
+    return HOUND_OK;
+
+error_thread:
+    ctx_stop(server->ctx);
+error_start:
+    unlink(server->socket_path);
+    close(server->listen_fd);
+error_socket:
+    close(server->stop_fd);
+error_eventfd:
+    free(server->pfds);
+error_pfds:
+    for (i = 0; i < server->ring_count; ++i) {
+        destroy_ring(&server->rings[i]);
+    }
+    free(server->rings);
+error_rings:
+    ctx_free(server->ctx);
+error_ctx_alloc:
+    free(server);
+    return err;
+}
+
+hound_err shm_stop(struct hound_shm_server *server)
+{
+    hound_err err;
+    size_t i;
+    int ret;
+
+    NULL_CHECK(server);
+
+    ret = eventfd_write(server->stop_fd, 1);
+    XASSERT_EQ(ret, 0);
+    ret = pthread_join(server->thread, NULL);
+    XASSERT_EQ(ret, 0);
+
+    err = ctx_stop(server->ctx);
+    if (err != HOUND_OK) {
+        hound_log_err_nofmt(err, "shm: failed to stop context");
+    }
+    err = ctx_free(server->ctx);
+
+    for (i = 0; i < xv_size(server->conns); ++i) {
+        close_conn(&xv_A(server->conns, i));
+    }
+    xv_destroy(server->conns);
+    free(server->pfds);
+
+    unlink(server->socket_path);
+    close(server->listen_fd);
+    close(server->stop_fd);
+
+    for (i = 0; i < server->ring_count; ++i) {
+        destroy_ring(&server->rings[i]);
+    }
+    free(server->rings);
+    free(server);
+
+    return err;
+}
+
+static
+hound_err recv_reply(int sock, int *ring_fd)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    struct msghdr msg;
+    struct shm_attach_reply reply;
+    ssize_t ret;
+
+    iov.iov_base = &reply;
+    iov.iov_len = sizeof(reply);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (ret == -1) {
+        return errno;
+    }
+
+    *ring_fd = FD_INVALID;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL &&
+        cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+        memcpy(ring_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    if (ret != sizeof(reply)) {
+        reply.err = HOUND_IO_ERROR;
+    }
+    if (reply.err == HOUND_OK && *ring_fd == FD_INVALID) {
+        reply.err = HOUND_IO_ERROR;
+    }
+    if (reply.err != HOUND_OK && *ring_fd != FD_INVALID) {
+        close(*ring_fd);
+    }
+
+    return reply.err;
+}
+
+/* Maps a ring read-only and checks that it's the one we asked for. */
+static
+hound_err map_ring(
+    struct hound_shm_client *client,
+    int ring_fd,
+    hound_data_id id)
+{
+    const struct shm_header *header;
+    size_t min_size;
+    int ret;
+    struct stat st;
+
+    ret = fstat(ring_fd, &st);
+    if (ret == -1) {
+        return errno;
+    }
+    if ((size_t) st.st_size < get_slots_offset()) {
+        return HOUND_IO_ERROR;
+    }
+
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, ring_fd, 0);
+    if (header == MAP_FAILED) {
+        return errno;
+    }
+
+    min_size = get_slots_offset() + header->slot_count*header->slot_size;
+    if (header->magic != SHM_MAGIC ||
+        header->version != SHM_VERSION ||
+        header->data_id != id ||
+        header->slot_count == 0 ||
+        (header->slot_count & (header->slot_count - 1)) != 0 ||
+        header->slot_size < sizeof(struct shm_slot) + header->data_size ||
+        (size_t) st.st_size < min_size) {
+        munmap((void *) header, st.st_size);
+        return HOUND_IO_ERROR;
+    }
+
+    client->header = header;
+    client->map_size = st.st_size;
+    client->slots = (const unsigned char *) header + get_slots_offset();
+    client->mask = header->slot_count - 1;
+    client->slot_size = header->slot_size;
+
+    return HOUND_OK;
+}
+
+hound_err shm_attach(
+    const char *socket_path,
+    hound_data_id id,
+    struct hound_shm_client **out_client)
+{
+    struct sockaddr_un addr;
+    struct hound_shm_client *client;
+    hound_err err;
+    int ret;
+    int ring_fd;
+    ssize_t sent;
+    struct shm_attach_rq rq;
+
+    NULL_CHECK(socket_path);
+    NULL_CHECK(out_client);
+
+    if (strnlen(socket_path, sizeof(addr.sun_path)) == sizeof(addr.sun_path)) {
+        return HOUND_PATH_TOO_LONG;
+    }
+
+    client = malloc(sizeof(*client));
+    if (client == NULL) {
+        return HOUND_OOM;
+    }
+
+    client->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (client->sock == FD_INVALID) {
+        err = errno;
+        goto error_socket;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    ret = connect(client->sock, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == -1) {
+        err = errno;
+        goto error_connect;
+    }
+
+    rq.magic = SHM_MAGIC;
+    rq.version = SHM_VERSION;
+    rq.data_id = id;
+    sent = send(client->sock, &rq, sizeof(rq), MSG_NOSIGNAL);
+    if (sent != sizeof(rq)) {
+        err = sent == -1 ? errno : HOUND_IO_ERROR;
+        goto error_connect;
+    }
+
+    err = recv_reply(client->sock, &ring_fd);
+    if (err != HOUND_OK) {
+        goto error_connect;
+    }
+
+    /* The mapping keeps the ring alive, so we don't need the fd. */
+    err = map_ring(client, ring_fd, id);
+    close(ring_fd);
+    if (err != HOUND_OK) {
+        goto error_connect;
+    }
+
+    client->buf = malloc(max(client->header->data_size, 1));
+    if (client->buf == NULL) {
+        err = HOUND_OOM;
+        goto error_buf;
+    }
+
+    client->cursor = atomic_load_explicit(
+        &client->header->write_seq,
+        memory_order_acquire);
+    client->dropped = 0;
+
+    *out_client = client;
+
+    return HOUND_OK;
+
+error_buf:
+    munmap((void *) client->header, client->map_size);
+error_connect:
+    close(client->sock);
+error_socket:
+    free(client);
+    return err;
+}
+
+void shm_detach(struct hound_shm_client *client)
+{
+    if (client == NULL) {
+        return;
+    }
+
+    /* Closing the socket tells the server we're gone. */
+    close(client->sock);
+    munmap((void *) client->header, client->map_size);
+    free(client->buf);
+    free(client);
+}
+
+/*
+ * Reads what the ring holds right now, up to a maximum number of records.
+ * Returns the number of records read.
+ */
+static
+size_t read_ring(
+    struct hound_shm_client *client,
+    size_t records,
+    hound_cb cb,
+    void *cb_ctx)
+{
+    size_t count;
+    uint64_t expected;
+    struct hound_record rec;
+    uint64_t seq;
+    const struct shm_slot *slot;
+    uint64_t write_seq;
+
+    count = 0;
+    write_seq = atomic_load_explicit(
+        &client->header->write_seq,
+        memory_order_acquire);
+    while (count < records && client->cursor < write_seq) {
+        if (write_seq - client->cursor > client->mask + 1) {
+            /* We fell more than a ring behind, so skip what's gone. */
+            client->dropped += write_seq - client->cursor - (client->mask + 1);
+            client->cursor = write_seq - (client->mask + 1);
+        }
+
+        slot = (const struct shm_slot *)
+            (client->slots + (client->cursor & client->mask)*client->slot_size);
+        expected = 2*client->cursor + 2;
+
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != expected) {
+            /* The server has already started overwriting this record. */
+            goto drop;
+        }
+
+        rec.data_id = client->header->data_id;
+        rec.dev_id = slot->dev_id;
+        rec.timestamp.tv_sec = slot->tv_sec;
+        rec.timestamp.tv_nsec = slot->tv_nsec;
+        rec.size = slot->size;
+        if (rec.size > client->header->data_size) {
+            /* A torn size; the seq check below would catch it too. */
+            goto drop;
+        }
+
+        /*
+         * Copy the payload out and check the slot again, so that the callback
+         * only ever sees a record that wasn't overwritten while we read it.
+         */
+        memcpy(client->buf, slot->data, rec.size);
+        atomic_thread_fence(memory_order_acquire);
+        seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+        if (seq != expected) {
+            goto drop;
+        }
+        rec.data = client->buf;
+
+        cb(&rec, client->cursor, cb_ctx);
+        ++count;
+        ++client->cursor;
+        continue;
+
+drop:
+        ++client->dropped;
+        ++client->cursor;
+    }
+
+    return count;
+}
+
+hound_err shm_read(
+    struct hound_shm_client *client,
+    size_t records,
+    hound_data_period timeout_ns,
+    hound_cb cb,
+    void *cb_ctx,
+    size_t *read)
+{
+    size_t count;
+    struct timespec deadline;
+    bool waiting;
+    uint32_t wake_seq;
+
+    NULL_CHECK(client);
+    NULL_CHECK(cb);
+    NULL_CHECK(read);
+
+    if (timeout_ns > 0) {
+        deadline_after(timeout_ns, &deadline);
+    }
+
+    count = 0;
+    waiting = true;
+    while (records > 0) {
+        /* Load wake_seq first, so we can't miss a wakeup for new records. */
+        wake_seq = atomic_load_explicit(
+            &client->header->wake_seq,
+            memory_order_acquire);
+        count = read_ring(client, records, cb, cb_ctx);
+        if (count > 0 || timeout_ns == 0 || !waiting) {
+            break;
+        }
+        waiting = futex_wait(&client->header->wake_seq, wake_seq, &deadline);
+    }
+
+    *read = count;
+
+    return HOUND_OK;
+}
+
+hound_err shm_dropped(struct hound_shm_client *client, uint64_t *count)
+{
+    NULL_CHECK(client);
+    NULL_CHECK(count);
+
+    *count = client->dropped;
+
+    return HOUND_OK;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file      stats.c
+ * @brief     Runtime statistics. Counters and histograms are cheap enough to
+ *            leave on: each update is a few relaxed atomic adds, with no
+ *            locks, and the values any one thread writes sit together, so they
+ *            rarely share a cache line with another thread's.
+ *
+ *            Histograms have power-of-2 buckets, so finding a bucket is just
+ *            a count of leading zeros.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+#include <hound-private/stats.h>
+#include <hound-private/util.h>
+#include <time.h>
+
+uint_least64_t stats_now_ns(void)
+{
+    struct timespec ts;
+
+    /* Match the I/O loop's clock, which NTP can't slew. */
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return NSEC_PER_SEC*ts.tv_sec + ts.tv_nsec;
+}
+
+void stats_add(atomic_uint_least64_t *counter, uint_least64_t val)
+{
+    atomic_fetch_add_explicit(counter, val, memory_order_relaxed);
+}
+
+void stats_histogram_init(struct stats_histogram *hist)
+{
+    size_t i;
+
+    atomic_init(&hist->count, 0);
+    atomic_init(&hist->total, 0);
+    atomic_init(&hist->max, 0);
+    for (i = 0; i < ARRAYLEN(hist->buckets); ++i) {
+        atomic_init(&hist->buckets[i], 0);
+    }
+}
+
+static
+size_t get_bucket(uint_least64_t val)
+{
+    size_t bucket;
+
+    if (val <= 1) {
+        return 0;
+    }
+
+    /* val is in [2^bucket, 2^(bucket+1)). */
+    bucket = 63 - (size_t) __builtin_clzll(val);
+    return min(bucket, HOUND_HISTOGRAM_BUCKETS - 1);
+}
+
+void stats_histogram_add(struct stats_histogram *hist, uint_least64_t val)
+{
+    uint_least64_t max;
+
+    stats_add(&hist->count, 1);
+    stats_add(&hist->total, val);
+    stats_add(&hist->buckets[get_bucket(val)], 1);
+
+    max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    while (val > max &&
+           !atomic_compare_exchange_weak_explicit(
+               &hist->max,
+               &max,
+               val,
+               memory_order_relaxed,
+               memory_order_relaxed)) {
+    }
+}
+
+void stats_histogram_read(
+    const struct stats_histogram *hist,
+    struct hound_histogram *out)
+{
+    size_t i;
+
+    out->count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    out->total = atomic_load_explicit(&hist->total, memory_order_relaxed);
+    out->max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    for (i = 0; i < ARRAYLEN(out->buckets); ++i) {
+        out->buckets[i] = atomic_load_explicit(
+            &hist->buckets[i],
+            memory_order_relaxed);
+    }
+}
+
+void stats_histogram_merge(
+    struct hound_histogram *into,
+    const struct hound_histogram *from)
+{
+    size_t i;
+
+    into->count += from->count;
+    into->total += from->total;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    for (i = 0; i < ARRAYLEN(into->buckets); ++i) {
+        into->buckets[i] += from->buckets[i];
+    }
+}
+
+void driver_stats_init(struct driver_stats *stats)
+{
+    atomic_init(&stats->records, 0);
+    atomic_init(&stats->bytes, 0);
+    atomic_init(&stats->reads, 0);
+    stats_histogram_init(&stats->parse_ns);
+    stats_histogram_init(&stats->poll_ns);
+    stats_histogram_init(&stats->pull_late_ns);
+}
+
+void driver_stats_read(
+    const struct driver_stats *stats,
+    struct hound_driver_stats *out)
+{
+    out->records = atomic_load_explicit(&stats->records, memory_order_relaxed);
+    out->bytes = atomic_load_explicit(&stats->bytes, memory_order_relaxed);
+    out->reads = atomic_load_explicit(&stats->reads, memory_order_relaxed);
+    stats_histogram_read(&stats->parse_ns, &out->parse_ns);
+    stats_histogram_read(&stats->poll_ns, &out->poll_ns);
+    stats_histogram_read(&stats->pull_late_ns, &out->pull_late_ns);
+}
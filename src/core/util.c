@@ -5,10 +5,13 @@
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
 #include <hound-private/log.h>
 #include <hound-private/util.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 size_t min(size_t a, size_t b)
 {
@@ -78,10 +81,24 @@ void destroy_mutex(pthread_mutex_t *mutex)
 
 void init_cond(pthread_cond_t *cond)
 {
+    pthread_condattr_t attr;
     int rc;
 
+    rc = pthread_condattr_init(&attr);
+    XASSERT_EQ(rc, 0);
+
+    /*
+     * Use the monotonic clock for timed waits, so deadlines aren't affected by
+     * changes to the system time.
+     */
+    rc = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    XASSERT_EQ(rc, 0);
+
     /* This is documented never to fail. */
-    rc = pthread_cond_init(cond, NULL);
+    rc = pthread_cond_init(cond, &attr);
+    XASSERT_EQ(rc, 0);
+
+    rc = pthread_condattr_destroy(&attr);
     XASSERT_EQ(rc, 0);
 }
 
@@ -123,6 +140,34 @@ void cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
     XASSERT_EQ(rc, 0);
 }
 
+bool cond_timedwait(
+    pthread_cond_t *cond,
+    pthread_mutex_t *mutex,
+    const struct timespec *deadline)
+{
+    int rc;
+
+    /* This routine must be called with the associated mutex held. */
+
+    /* The deadline is an absolute CLOCK_MONOTONIC time. */
+    rc = pthread_cond_timedwait(cond, mutex, deadline);
+    if (rc == ETIMEDOUT) {
+        return false;
+    }
+    XASSERT_EQ(rc, 0);
+
+    return true;
+}
+
+void cond_broadcast(pthread_cond_t *cond)
+{
+    int rc;
+
+    /* If the condition variable is valid, this should never fail. */
+    rc = pthread_cond_broadcast(cond);
+    XASSERT_EQ(rc, 0);
+}
+
 void cond_signal(pthread_cond_t *cond)
 {
     int rc;
@@ -131,3 +176,18 @@ void cond_signal(pthread_cond_t *cond)
     rc = pthread_cond_signal(cond);
     XASSERT_EQ(rc, 0);
 }
+
+void deadline_after(hound_data_period timeout_ns, struct timespec *deadline)
+{
+    int rc;
+
+    rc = clock_gettime(CLOCK_MONOTONIC, deadline);
+    XASSERT_EQ(rc, 0);
+
+    deadline->tv_sec += timeout_ns / NSEC_PER_SEC;
+    deadline->tv_nsec += timeout_ns % NSEC_PER_SEC;
+    if ((hound_data_period) deadline->tv_nsec >= NSEC_PER_SEC) {
+        ++deadline->tv_sec;
+        deadline->tv_nsec -= NSEC_PER_SEC;
+    }
+}
@@ -0,0 +1,219 @@
+/**
+ * @file      houndd.c
+ * @brief     Hound daemon. Owns the drivers from a config file and publishes
+ *            every enabled data ID over shared memory (see hound_shm_serve),
+ *            so that several processes can read the same devices.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <hound/hound.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_SLOT_COUNT 1024
+#define DEFAULT_MAX_RECORD_SIZE 4096
+#define DEFAULT_QUEUE_LEN 1024
+/* The period to ask for when a descriptor doesn't list any, in ns. */
+#define DEFAULT_PERIOD_NS 0
+
+static
+void usage(const char *name)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-n SLOTS] [-s MAX-RECORD-SIZE] [-p DEFAULT-PERIOD-NS] "
+        "CONFIG SCHEMA-BASE SOCKET\n",
+        name);
+}
+
+static
+bool parse_size(const char *s, uint64_t *out)
+{
+    char *end;
+    unsigned long long val;
+
+    errno = 0;
+    val = strtoull(s, &end, 0);
+    if (errno != 0 || *s == '\0' || *end != '\0') {
+        return false;
+    }
+    *out = val;
+
+    return true;
+}
+
+/* The server ignores the callback, but a request must have one. */
+static
+void unused_cb(
+    __attribute__((unused)) const struct hound_record *rec,
+    __attribute__((unused)) hound_seqno seqno,
+    __attribute__((unused)) void *cb_ctx)
+{
+}
+
+/* Requests every enabled data ID at its fastest listed period. */
+static
+bool make_rq(
+    const struct hound_datadesc_snapshot *snapshot,
+    hound_data_period default_period_ns,
+    struct hound_rq *rq)
+{
+    const struct hound_datadesc *desc;
+    struct hound_data_rq *data_rq;
+    size_t i;
+    size_t j;
+    hound_data_period period;
+
+    rq->rq_list.data = calloc(snapshot->len, sizeof(*rq->rq_list.data));
+    if (rq->rq_list.data == NULL && snapshot->len > 0) {
+        return false;
+    }
+
+    rq->rq_list.len = 0;
+    for (i = 0; i < snapshot->len; ++i) {
+        desc = &snapshot->descs[i];
+        period = default_period_ns;
+        if (desc->period_count > 0) {
+            period = desc->avail_periods[0];
+            for (j = 1; j < desc->period_count; ++j) {
+                if (desc->avail_periods[j] < period) {
+                    period = desc->avail_periods[j];
+                }
+            }
+        }
+
+        data_rq = &rq->rq_list.data[rq->rq_list.len];
+        data_rq->id = desc->data_id;
+        data_rq->period_ns = period;
+        ++rq->rq_list.len;
+    }
+
+    rq->queue_len = DEFAULT_QUEUE_LEN;
+    rq->cb = unused_cb;
+    rq->cb_ctx = NULL;
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *config;
+    uint64_t default_period_ns;
+    hound_err err;
+    uint64_t max_record_size;
+    int opt;
+    struct hound_rq rq;
+    const char *schema_base;
+    struct hound_shm_server *server;
+    sigset_t set;
+    int sig;
+    uint64_t slot_count;
+    const struct hound_datadesc_snapshot *snapshot;
+    const char *socket_path;
+
+    default_period_ns = DEFAULT_PERIOD_NS;
+    max_record_size = DEFAULT_MAX_RECORD_SIZE;
+    slot_count = DEFAULT_SLOT_COUNT;
+    while ((opt = getopt(argc, argv, "n:p:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                if (!parse_size(optarg, &slot_count) || slot_count == 0) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                if (!parse_size(optarg, &default_period_ns)) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                if (!parse_size(optarg, &max_record_size)) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    config = argv[optind];
+    schema_base = argv[optind+1];
+    socket_path = argv[optind+2];
+
+    /*
+     * Block the signals we stop on before hound starts its threads, so that
+     * only sigwait sees them.
+     */
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    err = hound_init_config(config, schema_base);
+    if (err != HOUND_OK) {
+        fprintf(stderr, "failed to load %s: %s\n", config, hound_strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    err = hound_acquire_datadescs(&snapshot);
+    if (err != HOUND_OK) {
+        fprintf(stderr, "failed to get descriptors: %s\n", hound_strerror(err));
+        goto error;
+    }
+
+    memset(&rq, 0, sizeof(rq));
+    if (!make_rq(snapshot, default_period_ns, &rq)) {
+        fprintf(stderr, "out of memory\n");
+        hound_release_datadescs(snapshot);
+        goto error;
+    }
+    hound_release_datadescs(snapshot);
+
+    err = hound_shm_serve(
+        socket_path,
+        &rq,
+        slot_count,
+        max_record_size,
+        &server);
+    free(rq.rq_list.data);
+    if (err != HOUND_OK) {
+        fprintf(
+            stderr,
+            "failed to serve on %s: %s\n",
+            socket_path,
+            hound_strerror(err));
+        goto error;
+    }
+
+    do {
+        sig = 0;
+        err = sigwait(&set, &sig);
+    } while (err == EINTR);
+
+    err = hound_shm_stop(server);
+    if (err != HOUND_OK) {
+        fprintf(stderr, "failed to stop: %s\n", hound_strerror(err));
+    }
+    hound_destroy_all_drivers();
+
+    return err == HOUND_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+
+error:
+    hound_destroy_all_drivers();
+    return EXIT_FAILURE;
+}
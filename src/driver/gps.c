@@ -15,6 +15,11 @@
 #include <hound-private/log.h>
 #include <hound-private/util.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Every gpsd JSON object starts by naming its class. */
+#define CLASS_KEY "\"class\":\""
+#define TPV_CLASS "TPV\""
 
 /* Make sure gps.h looks the way we expect. */
 static_assert(
@@ -29,6 +34,15 @@ struct gps_ctx {
     struct gps_data_t gps;
     char *host;
     char *port;
+
+    /*
+     * gpsd sends one JSON object per line, but a read can end partway through
+     * a line, so we keep the start of it here until the rest shows up.
+     */
+    char line[GPS_JSON_RESPONSE_MAX + 1];
+    size_t line_len;
+    /* Set while we drop a line too long to be anything we want. */
+    bool skip_line;
 };
 
 static
@@ -214,20 +228,43 @@ void populate_gps_data(struct gps_data *data, struct gps_fix_t *fix)
 	data->climb_uncertainty = fix->epc;
 }
 
+/*
+ * Check whether a line holds a TPV (time-position-velocity) object, the only
+ * class we care about, without parsing it. Most of what gpsd sends is SKY
+ * objects, which are long and expensive to parse, so this saves a lot.
+ */
 static
-hound_err gps_parse(unsigned char *buf, size_t bytes)
+bool is_tpv(const char *line)
 {
-    struct gps_ctx *ctx;
-    struct hound_record record;
-    int status;
+    const char *class;
 
-    XASSERT_NOT_NULL(buf);
-    XASSERT_GT(bytes, 0);
+    class = strstr(line, CLASS_KEY);
+    if (class == NULL) {
+        return false;
+    }
 
-    ctx = drv_ctx();
-    XASSERT_NOT_NULL(ctx);
+    return strncmp(
+        class + sizeof(CLASS_KEY) - 1,
+        TPV_CLASS,
+        sizeof(TPV_CLASS) - 1) == 0;
+}
+
+/* Parse a complete, null-terminated line, adding a record if it has a fix. */
+static
+hound_err parse_line(
+    struct gps_ctx *ctx,
+    char *line,
+    struct hound_record *records,
+    size_t *n)
+{
+    struct hound_record *record;
+    int status;
+
+    if (!is_tpv(line)) {
+        return HOUND_OK;
+    }
 
-    status = gps_unpack((char *) buf, &ctx->gps);
+    status = gps_unpack(line, &ctx->gps);
     if (status != 0) {
         return errno;
     }
@@ -237,21 +274,91 @@ hound_err gps_parse(unsigned char *buf, size_t bytes)
         return HOUND_OK;
     }
 
-    record.data = drv_alloc(sizeof(struct gps_data));
-    if (record.data == NULL) {
+    record = &records[*n];
+    record->data = drv_record_alloc(sizeof(struct gps_data));
+    if (record->data == NULL) {
         return HOUND_OOM;
     }
-    populate_gps_data((struct gps_data *) record.data, &ctx->gps.fix);
-    record.size = sizeof(ctx->gps.fix);
+    populate_gps_data((struct gps_data *) record->data, &ctx->gps.fix);
+    record->size = sizeof(struct gps_data);
 
-    record.data_id = HOUND_DATA_GPS;
-    convert_time(ctx->gps.fix.time, &record.timestamp);
+    record->data_id = HOUND_DATA_GPS;
+    convert_time(ctx->gps.fix.time, &record->timestamp);
 
-    drv_push_records(&record, 1);
+    ++*n;
+    if (*n == DRV_PUSH_BATCH_SIZE) {
+        drv_push_records(records, *n);
+        *n = 0;
+    }
 
     return HOUND_OK;
 }
 
+static
+hound_err gps_parse(unsigned char *buf, size_t bytes)
+{
+    struct gps_ctx *ctx;
+    char *end;
+    hound_err err;
+    size_t len;
+    char *line;
+    size_t n;
+    char *newline;
+    struct hound_record records[DRV_PUSH_BATCH_SIZE];
+
+    XASSERT_NOT_NULL(buf);
+    XASSERT_GT(bytes, 0);
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    n = 0;
+    err = HOUND_OK;
+    line = (char *) buf;
+    end = line + bytes;
+    while (line < end) {
+        newline = memchr(line, '\n', end - line);
+        len = (newline == NULL ? end : newline) - line;
+
+        if (ctx->skip_line ||
+            ctx->line_len + len > ARRAYLEN(ctx->line) - 1) {
+            /* Too long to be a TPV, so drop it. */
+            ctx->skip_line = (newline == NULL);
+            ctx->line_len = 0;
+        }
+        else if (newline == NULL) {
+            /* Hold on to the start of the line until we get the rest. */
+            memcpy(&ctx->line[ctx->line_len], line, len);
+            ctx->line_len += len;
+        }
+        else if (ctx->line_len > 0) {
+            memcpy(&ctx->line[ctx->line_len], line, len);
+            ctx->line[ctx->line_len + len] = '\0';
+            ctx->line_len = 0;
+            err = parse_line(ctx, ctx->line, records, &n);
+        }
+        else {
+            /* A whole line in the buffer; parse it in place. */
+            *newline = '\0';
+            err = parse_line(ctx, line, records, &n);
+        }
+        if (err != HOUND_OK) {
+            break;
+        }
+
+        if (newline == NULL) {
+            break;
+        }
+        line = newline + 1;
+    }
+
+    if (n > 0) {
+        drv_push_records(records, n);
+    }
+
+    return err;
+}
+
 static
 hound_err gps_start(int *out_fd)
 {
@@ -282,6 +389,8 @@ hound_err gps_start(int *out_fd)
     }
 
     *out_fd = ctx->gps.gps_fd;
+    ctx->line_len = 0;
+    ctx->skip_line = false;
     ctx->active = true;
 
     err = HOUND_OK;
@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -27,6 +28,9 @@
 #define IIO_TOPDIR "/sys/bus/iio/devices"
 #define FD_INVALID (-1)
 
+/* The most scans a request may pack into one record. */
+#define IIO_PACK_MAX 256
+
 struct chan_desc {
     hound_data_id id;
     const char *scale_file;
@@ -43,11 +47,38 @@ struct device_entry {
     const char *freqs_avail_file;
 };
 
+struct device_parse_entry;
+
+/**
+ * Decodes one entry's channels from a batch of scans into float records.
+ *
+ * @param entry the entry to decode
+ * @param scans the first scan in the batch
+ * @param scan_size the size of each scan, in bytes
+ * @param scan_count the number of scans in the batch
+ * @param outs where to put each scan's channel values
+ */
+typedef void (*decode_func)(
+    const struct device_parse_entry *entry,
+    const unsigned char *scans,
+    size_t scan_size,
+    size_t scan_count,
+    float *const *outs);
+
 struct device_parse_entry {
     hound_data_id id;
     size_t num_channels;
+    /** The size of one sample's channel values. */
     size_t data_size;
     struct chan_parse_desc *channels;
+    /** The decoder for this entry, picked once its scan layout is known. */
+    decode_func decode;
+    /** The number of scans to pack into each record, 1 for no packing. */
+    size_t pack;
+    /** The record being packed, and how many scans are in it so far. */
+    struct hound_record packed;
+    size_t packed_count;
+    uint_fast64_t packed_base_ns;
 };
 
 /*
@@ -263,6 +294,154 @@ DEFINE_COPY_FUNC(16)
 DEFINE_COPY_FUNC(32)
 DEFINE_COPY_FUNC(64)
 
+/*
+ * Decoders for the common case of an entry whose channels sit back to back in
+ * the scan and share a type, shift, mask and scale, as the axes of an IMU
+ * usually do. With all of that fixed for the whole batch, the inner loop has
+ * no calls and no per-channel lookups, so the compiler can unroll and
+ * vectorize it. The results match the generic decoder bit for bit.
+ */
+#define _DEFINE_DECODE_FUNC(bits, name, endian, endian_func, type) \
+static \
+void decode_##endian##bits##_##name( \
+    const struct device_parse_entry *entry, \
+    const unsigned char *scans, \
+    size_t scan_size, \
+    size_t scan_count, \
+    float *const *outs) \
+{ \
+    float *data; \
+    size_t i; \
+    size_t j; \
+    uint_fast64_t mask; \
+    size_t num_channels; \
+    float scale; \
+    uint_fast8_t shift; \
+    const unsigned char *src; \
+    BITS_TYPE_UNSIGNED(bits) u; \
+    \
+    num_channels = entry->num_channels; \
+    scale = entry->channels[0].scale; \
+    shift = entry->channels[0].shift; \
+    mask = entry->channels[0].mask; \
+    src = scans + entry->channels[0].index; \
+    for (i = 0; i < scan_count; ++i) { \
+        data = outs[i]; \
+        for (j = 0; j < num_channels; ++j) { \
+            memcpy(&u, &src[j*sizeof(u)], sizeof(u)); \
+            u = endian_func(u); \
+            u >>= shift; \
+            u &= mask; \
+            data[j] = ((float) (type) u) * scale; \
+        } \
+        src += scan_size; \
+    } \
+}
+
+#define DEFINE_DECODE_FUNC_ENDIAN(bits, endian) \
+    _DEFINE_DECODE_FUNC( \
+        bits, \
+        unsigned, \
+        endian, \
+        ENDIAN_FUNC(bits, endian), \
+        BITS_TYPE_UNSIGNED(bits)) \
+    _DEFINE_DECODE_FUNC( \
+        bits, \
+        signed, \
+        endian, \
+        ENDIAN_FUNC(bits, endian), \
+        BITS_TYPE_SIGNED(bits))
+
+#define DEFINE_DECODE_FUNC(bits) \
+    DEFINE_DECODE_FUNC_ENDIAN(bits, be) \
+    DEFINE_DECODE_FUNC_ENDIAN(bits, le)
+
+DEFINE_DECODE_FUNC(16)
+DEFINE_DECODE_FUNC(32)
+
+/** Maps a channel copy function to the decoder for a uniform layout of it. */
+static const struct {
+    void (*copy_func)(
+        unsigned char *dest,
+        const unsigned char *src,
+        uint_fast8_t shift,
+        uint_fast64_t mask);
+    decode_func decode;
+} s_decoders[] = {
+    { be16_copy_unsigned, decode_be16_unsigned },
+    { be16_copy_signed, decode_be16_signed },
+    { le16_copy_unsigned, decode_le16_unsigned },
+    { le16_copy_signed, decode_le16_signed },
+    { be32_copy_unsigned, decode_be32_unsigned },
+    { be32_copy_signed, decode_be32_signed },
+    { le32_copy_unsigned, decode_le32_unsigned },
+    { le32_copy_signed, decode_le32_signed }
+};
+
+/** Decodes any layout, one channel at a time. */
+static
+void decode_generic(
+    const struct device_parse_entry *entry,
+    const unsigned char *scans,
+    size_t scan_size,
+    size_t scan_count,
+    float *const *outs)
+{
+    float *data;
+    const struct chan_parse_desc *desc;
+    size_t i;
+    size_t j;
+    const unsigned char *scan;
+
+    scan = scans;
+    for (i = 0; i < scan_count; ++i) {
+        data = outs[i];
+        for (j = 0; j < entry->num_channels; ++j) {
+            desc = &entry->channels[j];
+            data[j] = desc->scale * desc->copy_func_float(
+                &scan[desc->index],
+                desc->shift,
+                desc->mask);
+        }
+        scan += scan_size;
+    }
+}
+
+/**
+ * Picks the fastest decoder that handles an entry's scan layout.
+ *
+ * @param entry an entry whose channel indices have been finalized
+ *
+ * @return a decoder
+ */
+static
+decode_func iio_select_decoder(const struct device_parse_entry *entry)
+{
+    const struct chan_parse_desc *first;
+    const struct chan_parse_desc *desc;
+    size_t i;
+
+    first = &entry->channels[0];
+    for (i = 1; i < entry->num_channels; ++i) {
+        desc = &entry->channels[i];
+        if (desc->copy_func != first->copy_func ||
+            desc->shift != first->shift ||
+            desc->mask != first->mask ||
+            desc->scale != first->scale ||
+            desc->index != first->index + i*first->storage_bytes) {
+            return decode_generic;
+        }
+    }
+
+    for (i = 0; i < ARRAYLEN(s_decoders); ++i) {
+        if (s_decoders[i].copy_func == first->copy_func) {
+            return s_decoders[i].decode;
+        }
+    }
+
+    return decode_generic;
+}
+
 static
 void iio_make_path(const char *dev_dir, char *path, size_t maxlen, const char *file)
 {
@@ -521,6 +700,16 @@ out:
     return err;
 }
 
+/** Drop a record that is only partly packed. */
+static
+void iio_drop_packed(struct device_parse_entry *entry)
+{
+    if (entry->packed_count > 0) {
+        drv_record_free(entry->packed.data);
+        entry->packed_count = 0;
+    }
+}
+
 static
 hound_err iio_disable_device(const char *dev_dir)
 {
@@ -570,6 +759,7 @@ hound_err iio_stop(void)
 {
     struct iio_ctx *ctx;
     hound_err err;
+    size_t i;
 
     ctx = drv_ctx();
     XASSERT_NOT_NULL(ctx);
@@ -580,6 +770,11 @@ hound_err iio_stop(void)
         ctx->active = false;
     }
 
+    /* Scans left over from a partial pack would be stale by the next start. */
+    for (i = 0; i < ctx->num_entries; ++i) {
+        iio_drop_packed(&ctx->entries[i]);
+    }
+
     return err;
 }
 
@@ -694,6 +889,7 @@ void free_parse_entries(struct device_parse_entry *entries, size_t num_entries)
     size_t i;
 
     for (i = 0; i < num_entries; ++i) {
+        iio_drop_packed(&entries[i]);
         free(entries[i].channels);
     }
     free(entries);
@@ -821,6 +1017,7 @@ hound_err iio_datadesc(size_t desc_count, struct drv_datadesc *descs)
         }
 
         desc->period_count = period_count;
+        desc->max_pack = IIO_PACK_MAX;
         desc->avail_periods = drv_alloc(period_count * sizeof(*avail_periods));
         if (descs->avail_periods == NULL) {
             for (--i; i < desc_count; --i) {
@@ -1195,16 +1392,28 @@ hound_err get_channel_sort_entries(
 }
 
 static
-hound_err iio_set_buffer_length(const char *dev_dir, uint_fast64_t n)
+hound_err iio_write_u64(const char *dev_dir, const char *file, uint_fast64_t n)
 {
     /* Must fit the max integer width possible. */
     char buf[30];
     int len;
 
-    len = snprintf(buf, ARRAYLEN(buf), "%" PRIu64, n);
+    len = snprintf(buf, ARRAYLEN(buf), "%" PRIuFAST64, n);
     XASSERT_GT(len, 0);
 
-    return iio_write(dev_dir, "buffer/length", buf, len);
+    return iio_write(dev_dir, file, buf, len);
+}
+
+static
+hound_err iio_set_buffer_length(const char *dev_dir, uint_fast64_t n)
+{
+    return iio_write_u64(dev_dir, "buffer/length", n);
+}
+
+static
+hound_err iio_set_watermark(const char *dev_dir, uint_fast64_t n)
+{
+    return iio_write_u64(dev_dir, "buffer/watermark", n);
 }
 
 /**
@@ -1299,6 +1508,10 @@ hound_err iio_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
     bool restart;
     const struct chan_sort_entry *sort_entry;
     struct chan_sort_entry *sort_entries;
+    struct hound_data_rq unique_rqs[DESC_COUNT_MAX];
+    size_t unique_len;
+    uint_fast64_t watermark;
+    uint_fast64_t watermark_scans;
 
     XASSERT_NOT_NULL(rqs);
     XASSERT_GT(rqs_len, 0);
@@ -1307,6 +1520,36 @@ hound_err iio_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
     XASSERT_NOT_NULL(ctx);
     XASSERT_NOT_NULL(ctx->dev_dir);
 
+    /*
+     * Contexts with different latency budgets for the same data show up as
+     * separate requests, but every scan carries all the channels, so merge
+     * them into one request per ID with the tightest budget. All the records
+     * for an ID share a layout, so they must pack alike.
+     */
+    unique_len = 0;
+    for (i = 0; i < rqs_len; ++i) {
+        for (j = 0; j < unique_len; ++j) {
+            if (unique_rqs[j].id == rqs[i].id) {
+                break;
+            }
+        }
+        if (j == unique_len) {
+            XASSERT_LT(unique_len, ARRAYLEN(unique_rqs));
+            unique_rqs[unique_len] = rqs[i];
+            ++unique_len;
+            continue;
+        }
+
+        if (unique_rqs[j].pack != rqs[i].pack) {
+            return HOUND_PACK_UNSUPPORTED;
+        }
+        if (rqs[i].latency_ns < unique_rqs[j].latency_ns) {
+            unique_rqs[j].latency_ns = rqs[i].latency_ns;
+        }
+    }
+    rqs = unique_rqs;
+    rqs_len = unique_len;
+
     /* If we're currently active, we need to stop and start the device first. */
     restart = ctx->active;
     if (restart) {
@@ -1337,6 +1580,7 @@ hound_err iio_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
     /* Set the data frequency, and calculate the buffer we'll need. */
     buf_sec = ((double) ctx->buf_ns) / NSEC_PER_SEC;
     buf_samples = 0;
+    watermark = UINT_FAST64_MAX;
     for (i = 0; i < rqs_len; ++i) {
         period = rqs[i].period_ns;
         /* Find our corresponding device entry. */
@@ -1358,20 +1602,37 @@ hound_err iio_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
                 goto out_error;
             }
             buf_samples += (uint_fast64_t) (hz*buf_sec);
+
+            /* Collect as many scans as fit in this request's budget. */
+            watermark_scans = rqs[i].latency_ns * hz / NSEC_PER_SEC;
+            if (watermark_scans < watermark) {
+                watermark = watermark_scans;
+            }
         }
     }
+    if (watermark == 0 || watermark == UINT_FAST64_MAX) {
+        watermark = 1;
+    }
 
-    /* Set the buffer length to buffer the amount of time the user requested. */
+    /*
+     * Set the buffer length to buffer the amount of time the user requested,
+     * leaving room for the kernel to keep filling the buffer while we drain a
+     * watermark's worth of scans.
+     */
+    if (buf_samples < 2*watermark) {
+        buf_samples = 2*watermark;
+    }
     err = iio_set_buffer_length(ctx->dev_dir, buf_samples);
     if (err != HOUND_OK) {
         goto out_error;
     }
 
     /*
-     * We always set the watermark to 1 so that poll will return immediately
-     * when a sample is available.
+     * The watermark is how many scans the kernel collects before poll returns,
+     * so we wake once per batch rather than once per scan. With no latency
+     * budget it's 1, and poll returns as soon as a scan is available.
      */
-    err = iio_write(ctx->dev_dir, "buffer/watermark", "1", 1);
+    err = iio_set_watermark(ctx->dev_dir, watermark);
     if (err != HOUND_OK) {
         goto out_error;
     }
@@ -1414,10 +1675,10 @@ hound_err iio_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
      * request specifying the same ID multiple times, the size of the data list
      * is also the number of unique data IDs we are handling.
      */
-    ctx->num_entries = rqs_len;
     if (ctx->entries != NULL) {
         free_parse_entries(ctx->entries, ctx->num_entries);
     }
+    ctx->num_entries = rqs_len;
     ctx->entries = malloc(ctx->num_entries * sizeof(*ctx->entries));
     if (ctx->entries == NULL) {
         err = HOUND_OOM;
@@ -1450,6 +1711,14 @@ hound_err iio_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
             parse_entry->num_channels = j - i;
             parse_entry->data_size =
                 parse_entry->num_channels * sizeof(float);
+            parse_entry->pack = 1;
+            for (j = 0; j < rqs_len; ++j) {
+                if (rqs[j].id == id) {
+                    parse_entry->pack = max(rqs[j].pack, 1);
+                    break;
+                }
+            }
+            parse_entry->packed_count = 0;
 
             parse_entry->channels =
                 malloc(parse_entry->num_channels * sizeof(*parse_entry->channels));
@@ -1500,6 +1769,11 @@ hound_err iio_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
         ctx->entries,
         &ctx->timestamp_channel);
 
+    for (i = 0; i < ctx->num_entries; ++i) {
+        parse_entry = &ctx->entries[i];
+        parse_entry->decode = iio_select_decoder(parse_entry);
+    }
+
     err = HOUND_OK;
     goto out_success;
 
@@ -1508,7 +1782,9 @@ error_chan_parse:
         free(ctx->entries[i].channels);
     }
     free(ctx->entries);
+    ctx->entries = NULL;
 error_malloc_entries:
+    ctx->num_entries = 0;
 out_success:
     free(sort_entries);
 out_error:
@@ -1523,41 +1799,86 @@ out_error:
 }
 
 static
-hound_err iio_make_record(
-    const struct device_parse_entry *entry,
-    const unsigned char *buf,
+hound_err iio_init_record(
     struct hound_record *record,
-    const struct timespec *ts)
+    hound_data_id id,
+    size_t size,
+    uint_fast64_t epoch_ns)
 {
-    const struct chan_parse_desc *desc;
-    float *data;
-    float f;
-    size_t i;
-
-    record->data = drv_alloc(entry->data_size);
+    record->data = drv_record_alloc(size);
     if (record->data == NULL) {
         return HOUND_OOM;
     }
-    data = (__typeof__(*data) *) record->data;
 
-    record->size = entry->data_size;
-    record->data_id = entry->id;
-    record->timestamp = *ts;
+    record->size = size;
+    record->data_id = id;
+    record->timestamp.tv_sec = epoch_ns / NSEC_PER_SEC;
+    record->timestamp.tv_nsec = epoch_ns % NSEC_PER_SEC;
 
-    for (i = 0; i < entry->num_channels; ++i) {
-        desc = &entry->channels[i];
-        /*
-         * Copy sensor data, with the timestamp channel special-cased, since we put
-         * it into the timestamp field instead of the data field.
-         */
-        f = desc->copy_func_float(
-            &buf[desc->index],
-            desc->shift,
-            desc->mask);
-        data[i] = f * desc->scale;
+    return HOUND_OK;
+}
+
+/**
+ * Finds room for an entry's next sample. Unpacked samples get a record of their
+ * own, while packed samples go into the entry's current packed record, which
+ * is started if need be. Records are added to the batch once they're full.
+ *
+ * @param entry the entry the sample belongs to
+ * @param epoch_ns the sample's timestamp
+ * @param out filled in with where to decode the sample's channel values
+ * @param records the batch of records to push
+ * @param num_records the number of records in the batch, to be updated
+ *
+ * @return an error code
+ */
+static
+hound_err iio_add_sample(
+    struct device_parse_entry *entry,
+    uint_fast64_t epoch_ns,
+    float **out,
+    struct hound_record *records,
+    size_t *num_records)
+{
+    hound_err err;
+    uint64_t *offsets;
+    struct hound_record *record;
+
+    if (entry->pack == 1) {
+        record = &records[*num_records];
+        err = iio_init_record(record, entry->id, entry->data_size, epoch_ns);
+        if (err != HOUND_OK) {
+            return err;
+        }
+        *out = (float *) record->data;
+        ++*num_records;
+        return HOUND_OK;
+    }
+
+    /* A packed record is the scan offsets, then the samples. */
+    record = &entry->packed;
+    if (entry->packed_count == 0) {
+        err = iio_init_record(
+            record,
+            entry->id,
+            entry->pack * (sizeof(*offsets) + entry->data_size),
+            epoch_ns);
+        if (err != HOUND_OK) {
+            return err;
+        }
+        entry->packed_base_ns = epoch_ns;
     }
 
-    drv_push_records(record, 1);
+    offsets = (uint64_t *) record->data;
+    offsets[entry->packed_count] = epoch_ns - entry->packed_base_ns;
+    *out = (float *) &offsets[entry->pack] +
+        entry->packed_count*entry->num_channels;
+
+    ++entry->packed_count;
+    if (entry->packed_count == entry->pack) {
+        records[*num_records] = *record;
+        ++*num_records;
+        entry->packed_count = 0;
+    }
 
     return HOUND_OK;
 }
@@ -1565,54 +1886,88 @@ hound_err iio_make_record(
 static
 hound_err iio_parse(unsigned char *buf, size_t bytes)
 {
-    const struct iio_ctx *ctx;
+    size_t batch_scans;
+    size_t count;
+    size_t counts[DESC_COUNT_MAX];
+    struct iio_ctx *ctx;
+    struct device_parse_entry *entry;
     uint_fast64_t epoch_ns;
     hound_err err;
     size_t i;
     size_t j;
+    size_t num_records;
+    float *outs[DESC_COUNT_MAX][DRV_PUSH_BATCH_SIZE];
     const unsigned char *pos;
-    struct hound_record record;
-    const struct chan_parse_desc *timestamp_desc;
-    struct timespec ts;
+    struct hound_record records[DRV_PUSH_BATCH_SIZE];
+    size_t scan;
     size_t scan_count;
+    const struct chan_parse_desc *timestamp_desc;
 
     XASSERT_NOT_NULL(buf);
     XASSERT_GT(bytes, 0);
 
     ctx = drv_ctx();
     XASSERT_NOT_NULL(ctx);
+    XASSERT_LTE(ctx->num_entries, DESC_COUNT_MAX);
 
     scan_count = bytes / ctx->scan_size;
 
     /* IIO should not provide partial scans. */
     XASSERT_EQ(bytes % ctx->scan_size, 0);
 
-    pos = buf;
+    /*
+     * Work in batches of scans small enough that every sample could get its
+     * own record. We find room for each sample in a batch first, then have each
+     * entry's decoder fill in its samples for the whole batch at once.
+     */
+    batch_scans = ARRAYLEN(records) / ctx->num_entries;
+    XASSERT_GT(batch_scans, 0);
     err = HOUND_OK;
     timestamp_desc = &ctx->timestamp_channel;
-    for (i = 0; i < scan_count; ++i) {
-        /* Process a scan. */
-        timestamp_desc->copy_func(
-            (unsigned char *) &epoch_ns,
-            &buf[timestamp_desc->index],
-            timestamp_desc->shift,
-            timestamp_desc->mask);
-        ts.tv_sec = epoch_ns / NSEC_PER_SEC;
-        ts.tv_nsec = epoch_ns % NSEC_PER_SEC;
-
+    for (scan = 0; scan < scan_count; scan += count) {
+        count = min(batch_scans, scan_count - scan);
+        pos = &buf[scan * ctx->scan_size];
+        num_records = 0;
         for (j = 0; j < ctx->num_entries; ++j) {
-            /* Process a record from several channels. */
-            err = iio_make_record(
-                &ctx->entries[j],
-                pos,
-                &record,
-                &ts);
+            counts[j] = 0;
+        }
+
+        for (i = 0; i < count; ++i) {
+            timestamp_desc->copy_func(
+                (unsigned char *) &epoch_ns,
+                &pos[i*ctx->scan_size + timestamp_desc->index],
+                timestamp_desc->shift,
+                timestamp_desc->mask);
+
+            for (j = 0; j < ctx->num_entries; ++j) {
+                err = iio_add_sample(
+                    &ctx->entries[j],
+                    epoch_ns,
+                    &outs[j][i],
+                    records,
+                    &num_records);
+                if (err != HOUND_OK) {
+                    break;
+                }
+                ++counts[j];
+            }
             if (err != HOUND_OK) {
                 break;
-            };
+            }
+        }
+
+        for (j = 0; j < ctx->num_entries; ++j) {
+            entry = &ctx->entries[j];
+            entry->decode(entry, pos, ctx->scan_size, counts[j], outs[j]);
         }
 
-        pos += ctx->scan_size;
+        /* Push whatever we made, even if we failed partway through. */
+        if (num_records > 0) {
+            drv_push_records(records, num_records);
+        }
+        if (err != HOUND_OK) {
+            break;
+        }
     }
 
     return err;
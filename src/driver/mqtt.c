@@ -16,6 +16,7 @@
 #include <msgpack.h>
 #include <mosquitto.h>
 #include <poll.h>
+#include <pthread.h>
 #include <xlib/xassert.h>
 #include <xlib/xhash.h>
 #include <xlib/xvec.h>
@@ -29,10 +30,19 @@
         *out_size = sizeof(type); \
     } while (0);
 
+/* A topic we can subscribe to, and the layout of its records. */
+struct mqtt_topic {
+    const struct schema_desc *schema;
+    /* The record size, not counting variable-length fields. */
+    hound_record_size fixed_size;
+};
+
 XHASH_MAP_INIT_INT(ID_MAP, const struct schema_desc *)
-XHASH_MAP_INIT_STR(TOPIC_MAP, const struct schema_desc *)
+XHASH_MAP_INIT_STR(TOPIC_MAP, struct mqtt_topic)
 XHASH_SET_INIT_INT(ACTIVE_IDS)
 
+typedef xvec_t(const char *) topic_vec;
+
 typedef enum {
     /* Still waiting for the callback. */
     CB_PENDING,
@@ -67,11 +77,24 @@ struct mqtt_ctx {
     /* Map from MQTT topic to schema, for faster topic lookup. */
     xhash_t(TOPIC_MAP) *topic_map;
 
+    /*
+     * The topic of the last message we got. Messages tend to come in runs on
+     * the same topic, so this usually saves a hash lookup.
+     */
+    const struct mqtt_topic *last_topic;
+
+    /* Memory for unpacking messages, reused from one message to the next. */
+    msgpack_zone zone;
+
     /* Set of active data IDs (which map to schema). */
     xhash_t(ACTIVE_IDS) *active_ids;
 
     /* Count of pending subscribe requests. */
     size_t pending_subscribe_count;
+
+    /* The message IDs of our outstanding subscribe and unsubscribe requests. */
+    int subscribe_mid;
+    int unsubscribe_mid;
 };
 
 static
@@ -173,27 +196,44 @@ static
 void on_subscribe(
     UNUSED struct mosquitto *mosq,
     void *data,
-    UNUSED int mid,
+    int mid,
     int qos_count,
-    UNUSED const int *granted_qos)
+    const int *granted_qos)
 {
     struct mqtt_ctx *ctx;
+    int i;
 
     ctx = data;
+    if (ctx->subscribe_state != CB_PENDING || mid != ctx->subscribe_mid) {
+        /* A late reply to a request we already gave up on. */
+        return;
+    }
     XASSERT_EQ(qos_count, (int) ctx->pending_subscribe_count);
 
+    /* The broker answers 0x80 for each topic it refused. */
+    for (i = 0; i < qos_count; ++i) {
+        if (granted_qos[i] == 0x80) {
+            hound_log(LOG_ERR, "MQTT broker refused subscription %d", i);
+            ctx->subscribe_state = CB_FAIL;
+            return;
+        }
+    }
+
     ctx->subscribe_state = CB_SUCCESS;
 }
 
 static
 void on_unsubscribe(
     UNUSED struct mosquitto *mosq,
-    UNUSED void *data,
-    UNUSED int mid)
+    void *data,
+    int mid)
 {
     struct mqtt_ctx *ctx;
 
     ctx = data;
+    if (ctx->unsubscribe_state != CB_PENDING || mid != ctx->unsubscribe_mid) {
+        return;
+    }
     ctx->unsubscribe_state = CB_SUCCESS;
 }
 
@@ -254,15 +294,13 @@ bool serialize_obj(
             /* FLOAT and FLOAT64 are treated the same. */
             SET_DATA(data, obj, out_size, double, f64);
             break;
-        case MSGPACK_OBJECT_ARRAY:
-            /* This should have been handled in the caller. */
-            XASSERT_ERROR;
         case MSGPACK_OBJECT_BIN:
         case MSGPACK_OBJECT_STR:
             memcpy(data, obj->via.bin.ptr, obj->via.bin.size);
             *out_size = obj->via.bin.size;
             break;
         /* Not supported. */
+        case MSGPACK_OBJECT_ARRAY:
         case MSGPACK_OBJECT_NIL:
         case MSGPACK_OBJECT_MAP:
         case MSGPACK_OBJECT_EXT:
@@ -273,125 +311,200 @@ bool serialize_obj(
 }
 
 static
-void *alloc_data(
-    size_t fmt_count,
-    const struct hound_data_fmt *fmts,
-    hound_record_size *out_size)
+hound_record_size get_fixed_size(const struct schema_desc *schema)
 {
     size_t i;
-    size_t size;
+    hound_record_size size;
 
     size = 0;
-    for (i = 0; i < fmt_count; ++i) {
-        size += get_type_size(fmts[i].type);
+    for (i = 0; i < schema->fmt_count; ++i) {
+        size += get_type_size(schema->fmts[i].type);
     }
 
-    *out_size = size;
-
-    return drv_alloc(size);
+    return size;
 }
 
+/*
+ * Turn a single sample, an array of fields in schema order, into a record. The
+ * record's data ID and timestamp are left to the caller.
+ */
 static
-bool parse_payload(
-    const unsigned char *buf,
-    size_t size,
-    const struct schema_desc *schema,
+bool parse_sample(
+    const msgpack_object *objects,
+    size_t len,
+    const struct mqtt_topic *topic,
     struct hound_record *record)
 {
     size_t i;
-    size_t len;
     const msgpack_object *obj;
-    const msgpack_object *objects;
     size_t offset;
-    msgpack_unpack_return rc;
-    msgpack_unpacked result;
+    const struct schema_desc *schema;
     size_t type_size;
     bool success;
 
-    msgpack_unpacked_init(&result);
-    offset = 0;
-    rc = msgpack_unpack_next(&result, (const char *) buf, size, &offset);
-    if (rc != MSGPACK_UNPACK_SUCCESS) {
-        success = false;
-        goto out;
-    }
-
-    if (result.data.type == MSGPACK_OBJECT_ARRAY) {
-        len = result.data.via.array.size;
-        objects = result.data.via.array.ptr;
-    }
-    else {
-        len = 1;
-        objects = &result.data;
-    }
-
+    schema = topic->schema;
     if (len != schema->fmt_count) {
-        success = false;
-        goto out;
+        return false;
     }
 
-    record->data = alloc_data(schema->fmt_count, schema->fmts, &record->size);
-    if (record->data == NULL) {
-        success = false;
-        goto out;
-    }
-
-    offset = 0;
+    /* Size the variable-length fields first, so we allocate only once. */
+    record->size = topic->fixed_size;
     for (i = 0; i < len; ++i) {
         obj = &objects[i];
         if (obj->type == MSGPACK_OBJECT_BIN ||
             obj->type == MSGPACK_OBJECT_STR) {
-            /* Variable-size data; expand our record data to make room. */
             record->size += obj->via.bin.size;
-            record->data = realloc(record->data, record->size);
-            if (record->data == NULL) {
-                success = false;
-                goto error_parse;
-            }
         }
+    }
+
+    record->data = drv_record_alloc(record->size);
+    if (record->data == NULL) {
+        return false;
+    }
 
+    offset = 0;
+    for (i = 0; i < len; ++i) {
+        obj = &objects[i];
         success = serialize_obj(
             obj,
             record->data + offset,
             &type_size,
             &schema->fmts[i]);
         if (!success) {
-            goto error_parse;
+            drv_record_free(record->data);
+            return false;
         }
         offset += type_size;
     }
 
-    success = true;
-    goto out;
+    return true;
+}
 
-error_parse:
-    drv_free(record->data);
-out:
-    msgpack_unpacked_destroy(&result);
-    return success;
+/*
+ * Turn a batch of samples into records. Each sample is an array holding its
+ * timestamp, in nanoseconds since the Unix epoch, followed by its fields. We
+ * skip samples we can't parse, but keep the rest.
+ */
+static
+size_t parse_batch(
+    const msgpack_object_array *samples,
+    const struct mqtt_topic *topic,
+    struct hound_record *records,
+    size_t *n)
+{
+    size_t failed;
+    size_t i;
+    const msgpack_object *obj;
+    struct hound_record *record;
+    const msgpack_object_array *sample;
+    uint64_t ts_ns;
+
+    failed = 0;
+    for (i = 0; i < samples->size; ++i) {
+        obj = &samples->ptr[i];
+        if (obj->type != MSGPACK_OBJECT_ARRAY ||
+            obj->via.array.size < 1 ||
+            obj->via.array.ptr[0].type != MSGPACK_OBJECT_POSITIVE_INTEGER) {
+            ++failed;
+            continue;
+        }
+        sample = &obj->via.array;
+
+        record = &records[*n];
+        if (!parse_sample(
+                &sample->ptr[1],
+                sample->size - 1,
+                topic,
+                record)) {
+            ++failed;
+            continue;
+        }
+        ts_ns = sample->ptr[0].via.u64;
+        record->data_id = topic->schema->data_id;
+        record->timestamp.tv_sec = ts_ns / NSEC_PER_SEC;
+        record->timestamp.tv_nsec = ts_ns % NSEC_PER_SEC;
+
+        ++*n;
+        if (*n == DRV_PUSH_BATCH_SIZE) {
+            drv_push_records(records, *n);
+            *n = 0;
+        }
+    }
+
+    return failed;
 }
 
+/*
+ * Turn a message into records. A message holds either one sample, which is a
+ * single field or an array of fields, or a batch of samples, which is an array
+ * of arrays. A lone sample is stamped with the time we got it.
+ */
 static
-void make_record(
+void make_records(
+    struct mqtt_ctx *ctx,
     const struct mosquitto_message *msg,
     const struct timespec *ts,
-    const struct schema_desc *schema)
+    const struct mqtt_topic *topic)
 {
-    struct hound_record record;
-    bool success;
+    size_t failed;
+    size_t len;
+    size_t n;
+    const msgpack_object *objects;
+    size_t offset;
+    msgpack_unpack_return rc;
+    struct hound_record records[DRV_PUSH_BATCH_SIZE];
+    msgpack_object root;
+
+    n = 0;
+    failed = 0;
+    offset = 0;
+    rc = msgpack_unpack(
+        msg->payload,
+        msg->payloadlen,
+        &offset,
+        &ctx->zone,
+        &root);
+    if (rc != MSGPACK_UNPACK_SUCCESS && rc != MSGPACK_UNPACK_EXTRA_BYTES) {
+        failed = 1;
+        goto out;
+    }
+
+    if (root.type == MSGPACK_OBJECT_ARRAY) {
+        len = root.via.array.size;
+        objects = root.via.array.ptr;
+    }
+    else {
+        len = 1;
+        objects = &root;
+    }
+
+    if (len > 0 && objects[0].type == MSGPACK_OBJECT_ARRAY) {
+        failed = parse_batch(&root.via.array, topic, records, &n);
+    }
+    else if (parse_sample(objects, len, topic, &records[0])) {
+        records[0].data_id = topic->schema->data_id;
+        records[0].timestamp = *ts;
+        n = 1;
+    }
+    else {
+        failed = 1;
+    }
 
-    success = parse_payload(msg->payload, msg->payloadlen, schema, &record);
-    if (!success) {
+out:
+    /* Everything we unpacked is in the records now, so recycle the zone. */
+    msgpack_zone_clear(&ctx->zone);
+
+    if (n > 0) {
+        drv_push_records(records, n);
+    }
+
+    if (failed > 0) {
         hound_log(
             LOG_WARNING,
-            "failed to parse payload for data ID 0x%x",
-            schema->data_id);
-        return;
+            "failed to parse %zu sample(s) for data ID 0x%x",
+            failed,
+            topic->schema->data_id);
     }
-    record.data_id = schema->data_id;
-    record.timestamp = *ts;
-
-    drv_push_records(&record, 1);
 }
 
 static
@@ -403,7 +516,7 @@ void on_message(
     struct mqtt_ctx *ctx;
     xhiter_t iter;
     int rc;
-    const struct schema_desc *schema;
+    const struct mqtt_topic *topic;
     struct timespec ts;
 
     rc = clock_gettime(CLOCK_REALTIME, &ts);
@@ -411,21 +524,29 @@ void on_message(
 
     ctx = data;
 
-    iter = xh_get(TOPIC_MAP, ctx->topic_map, msg->topic);
-    if (iter == xh_end(ctx->topic_map)) {
-        /*
-         * We don't know anything about this topic, so we shouldn't have
-         * received this message!
-         */
-        hound_log(
-            LOG_WARNING,
-            "received topic we didn't subscribe to: %s",
-            msg->topic);
-        return;
+    /*
+     * libmosquitto gives each message its own copy of the topic, so we have to
+     * compare the string itself rather than the pointer.
+     */
+    topic = ctx->last_topic;
+    if (topic == NULL || strcmp(topic->schema->name, msg->topic) != 0) {
+        iter = xh_get(TOPIC_MAP, ctx->topic_map, msg->topic);
+        if (iter == xh_end(ctx->topic_map)) {
+            /*
+             * We don't know anything about this topic, so we shouldn't have
+             * received this message!
+             */
+            hound_log(
+                LOG_WARNING,
+                "received topic we didn't subscribe to: %s",
+                msg->topic);
+            return;
+        }
+        topic = &xh_val(ctx->topic_map, iter);
+        ctx->last_topic = topic;
     }
-    schema = xh_val(ctx->topic_map, iter);
 
-    make_record(msg, &ts, schema);
+    make_records(ctx, msg, &ts, topic);
 }
 
 static
@@ -645,6 +766,42 @@ bool mosq_init_is_safe(void)
     return mosquitto_lib_version(NULL, NULL, NULL) >= 1006010;
 }
 
+/*
+ * mosquitto's init refcount isn't atomic, and drivers may initialize in
+ * parallel, so serialize init and cleanup ourselves.
+ */
+static pthread_mutex_t s_mosq_lib_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void mosq_lib_init(void)
+{
+    int rc;
+
+    if (!mosq_init_is_safe()) {
+        return;
+    }
+
+    lock_mutex(&s_mosq_lib_lock);
+    rc = mosquitto_lib_init();
+    unlock_mutex(&s_mosq_lib_lock);
+    XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
+}
+
+static
+void mosq_lib_cleanup(void)
+{
+    int rc;
+
+    if (!mosq_init_is_safe()) {
+        return;
+    }
+
+    lock_mutex(&s_mosq_lib_lock);
+    rc = mosquitto_lib_cleanup();
+    unlock_mutex(&s_mosq_lib_lock);
+    XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
+}
+
 static
 hound_err mqtt_init(
     const char *location,
@@ -721,11 +878,13 @@ hound_err mqtt_init(
         goto error_alloc_active_ids;
     }
 
-    if (mosq_init_is_safe()) {
-        rc = mosquitto_lib_init();
-        XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
+    if (!msgpack_zone_init(&ctx->zone, MSGPACK_ZONE_CHUNK_SIZE)) {
+        err = HOUND_OOM;
+        goto error_zone_init;
     }
 
+    mosq_lib_init();
+
     errno = 0;
     mosq = mosquitto_new(NULL, true, ctx);
     if (mosq == NULL) {
@@ -760,8 +919,11 @@ hound_err mqtt_init(
     ctx->mosq = mosq;
     ctx->id_map = id_map;
     ctx->topic_map = topic_map;
+    ctx->last_topic = NULL;
     ctx->active_ids = active_ids;
     ctx->pending_subscribe_count = 0;
+    ctx->subscribe_mid = 0;
+    ctx->unsubscribe_mid = 0;
 
     drv_set_ctx(ctx);
 
@@ -770,10 +932,9 @@ hound_err mqtt_init(
 error_mosq_set_threaded:
     mosquitto_destroy(mosq);
 error_mosq_new:
-    if (mosq_init_is_safe()) {
-        rc = mosquitto_lib_cleanup();
-        XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
-    }
+    mosq_lib_cleanup();
+    msgpack_zone_destroy(&ctx->zone);
+error_zone_init:
     xh_destroy(ACTIVE_IDS, active_ids);
 error_alloc_active_ids:
     xh_destroy(TOPIC_MAP, topic_map);
@@ -791,19 +952,16 @@ hound_err mqtt_destroy(void)
 {
     struct mqtt_ctx *ctx;
     xhiter_t iter;
-    int rc;
     const struct schema_desc *schema;
 
     ctx = drv_ctx();
 
     mosquitto_destroy(ctx->mosq);
 
-    if (mosq_init_is_safe()) {
-        rc = mosquitto_lib_cleanup();
-        XASSERT_EQ(rc, MOSQ_ERR_SUCCESS);
-    }
+    mosq_lib_cleanup();
 
     xh_destroy(ACTIVE_IDS, ctx->active_ids);
+    msgpack_zone_destroy(&ctx->zone);
 
     /*
      * Don't destroy the keys in the topic map, since we share schema
@@ -859,6 +1017,7 @@ hound_err mqtt_datadesc(size_t desc_count, struct drv_datadesc *descs)
     xhiter_t iter;
     int ret;
     struct schema_desc *schema;
+    struct mqtt_topic *topic;
 
     ctx = drv_ctx();
 
@@ -915,7 +1074,10 @@ hound_err mqtt_datadesc(size_t desc_count, struct drv_datadesc *descs)
             err = HOUND_OOM;
             goto error_loop;
         }
-        xh_val(ctx->topic_map, iter) = schema;
+        topic = &xh_val(ctx->topic_map, iter);
+        topic->schema = schema;
+        /* Work out the record layout now rather than for every message. */
+        topic->fixed_size = get_fixed_size(schema);
     }
 
     return HOUND_OK;
@@ -929,6 +1091,7 @@ error_loop:
     );
     xh_clear(ID_MAP, ctx->id_map);
     xh_clear(TOPIC_MAP, ctx->topic_map);
+    ctx->last_topic = NULL;
     return err;
 }
 
@@ -1028,16 +1191,20 @@ hound_err do_disconnect(struct mqtt_ctx *ctx)
     return HOUND_OK;
 }
 
+/*
+ * Queue a subscribe request without waiting for the broker to acknowledge it;
+ * see wait_for_acks.
+ */
 static
-hound_err do_subscribe(
+hound_err send_subscribe(
     struct mqtt_ctx *ctx,
     size_t len,
     const char **topics)
 {
-    hound_err err;
     int rc;
 
     if (len == 0) {
+        ctx->subscribe_state = CB_SUCCESS;
         return HOUND_OK;
     }
 
@@ -1045,73 +1212,168 @@ hound_err do_subscribe(
     ctx->pending_subscribe_count = len;
     rc = mosquitto_subscribe_multiple(
         ctx->mosq,
-        NULL,
+        &ctx->subscribe_mid,
         len,
         (char * const * const) topics,
         0,
         0,
         NULL);
     if (rc != MOSQ_ERR_SUCCESS) {
+        ctx->subscribe_state = CB_FAIL;
         return HOUND_IO_ERROR;
     }
 
-    err = wait_for_reply_cb(ctx, &ctx->subscribe_state);
-    if (err != 0) {
-        return HOUND_IO_ERROR;
-    }
-
-    ctx->pending_subscribe_count = 0;
-
     return HOUND_OK;
 }
 
+/*
+ * Queue an unsubscribe request without waiting for the broker to acknowledge
+ * it; see wait_for_acks.
+ */
 static
-hound_err do_unsubscribe(
+hound_err send_unsubscribe(
     struct mqtt_ctx *ctx,
     size_t len,
     const char **topics)
 {
-    hound_err err;
     int rc;
 
     if (len == 0) {
+        ctx->unsubscribe_state = CB_SUCCESS;
         return HOUND_OK;
     }
 
     reset_cb(&ctx->unsubscribe_state);
     rc = mosquitto_unsubscribe_multiple(
         ctx->mosq,
-        NULL,
+        &ctx->unsubscribe_mid,
         len,
         (char * const * const) topics,
         NULL);
     if (rc != MOSQ_ERR_SUCCESS) {
+        ctx->unsubscribe_state = CB_FAIL;
         return HOUND_IO_ERROR;
     }
 
-    err = wait_for_reply_cb(ctx, &ctx->unsubscribe_state);
+    return HOUND_OK;
+}
+
+/*
+ * Flush everything we've queued and wait until the broker has acknowledged
+ * all our outstanding subscribe and unsubscribe requests. Since the requests
+ * all go out before we wait, this takes one round trip however many there are.
+ */
+static
+hound_err wait_for_acks(struct mqtt_ctx *ctx)
+{
+    hound_err err;
+    short events;
+    int timeout;
+
+    timeout = ctx->timeout_ms;
+    while (true) {
+        if (ctx->subscribe_state == CB_FAIL ||
+            ctx->unsubscribe_state == CB_FAIL) {
+            return HOUND_IO_ERROR;
+        }
+        if (ctx->subscribe_state == CB_SUCCESS &&
+            ctx->unsubscribe_state == CB_SUCCESS) {
+            break;
+        }
+
+        /* Keep writing until our requests are all out, reading as we go. */
+        events = POLLIN;
+        if (mosquitto_want_write(ctx->mosq)) {
+            events |= POLLOUT;
+        }
+        err = do_poll(mosquitto_socket(ctx->mosq), events, &timeout);
+        if (err != HOUND_OK) {
+            return err;
+        }
+
+        err = do_write(ctx);
+        if (err != HOUND_OK) {
+            return err;
+        }
+
+        err = do_read(ctx);
+        if (err != HOUND_OK) {
+            return err;
+        }
+    }
+
+    ctx->pending_subscribe_count = 0;
+
+    return HOUND_OK;
+}
+
+static
+hound_err do_subscribe(
+    struct mqtt_ctx *ctx,
+    size_t len,
+    const char **topics)
+{
+    hound_err err;
+
+    ctx->unsubscribe_state = CB_SUCCESS;
+    err = send_subscribe(ctx, len, topics);
     if (err != HOUND_OK) {
-        return HOUND_IO_ERROR;
+        return err;
+    }
+
+    return wait_for_acks(ctx);
+}
+
+static
+hound_err do_unsubscribe(
+    struct mqtt_ctx *ctx,
+    size_t len,
+    const char **topics)
+{
+    hound_err err;
+
+    ctx->subscribe_state = CB_SUCCESS;
+    err = send_unsubscribe(ctx, len, topics);
+    if (err != HOUND_OK) {
+        return err;
     }
 
+    return wait_for_acks(ctx);
+}
+
+static
+hound_err push_topic(
+    struct mqtt_ctx *ctx,
+    hound_data_id id,
+    topic_vec *topics)
+{
+    xhiter_t iter;
+    const char **val;
+
+    iter = xh_get(ID_MAP, ctx->id_map, id);
+    XASSERT_NEQ(iter, xh_end(ctx->id_map));
+
+    val = xv_pushp(const char *, *topics);
+    if (val == NULL) {
+        return HOUND_OOM;
+    }
+    *val = xh_val(ctx->id_map, iter)->name;
+
     return HOUND_OK;
 }
 
+/* Find the topics in the request list that we aren't yet subscribed to. */
 static
-hound_err subscribe_new(
+hound_err get_new_topics(
     struct mqtt_ctx *ctx,
     const struct hound_data_rq *rqs,
-    size_t rqs_len)
+    size_t rqs_len,
+    topic_vec *topics)
 {
     hound_err err;
     size_t i;
     xhiter_t iter;
-    xvec_t(const char *) topics;
-    const struct schema_desc *schema;
-    const char **val;
 
-    /* Subscribe to any new topics in the request list. */
-    xv_init(topics);
     for (i = 0; i < rqs_len; ++i) {
         iter = xh_get(ACTIVE_IDS, ctx->active_ids, rqs[i].id);
         if (iter != xh_end(ctx->active_ids)) {
@@ -1119,42 +1381,27 @@ hound_err subscribe_new(
             continue;
         }
 
-        iter = xh_get(ID_MAP, ctx->id_map, rqs[i].id);
-        XASSERT_NEQ(iter, xh_end(ctx->id_map));
-        schema = xh_val(ctx->id_map, iter);
-
-        val = xv_pushp(const char *, topics);
-        if (val == NULL) {
-            err = HOUND_OOM;
-            goto out;
+        err = push_topic(ctx, rqs[i].id, topics);
+        if (err != HOUND_OK) {
+            return err;
         }
-        *val = schema->name;
     }
 
-    err = do_subscribe(ctx, xv_size(topics), xv_data(topics));
-
-out:
-    xv_destroy(topics);
-    return err;
+    return HOUND_OK;
 }
 
+/* Find the topics we're subscribed to that are no longer in the list. */
 static
-hound_err unsubscribe_old(
+hound_err get_old_topics(
     struct mqtt_ctx *ctx,
     const struct hound_data_rq *rqs,
-    size_t rqs_len)
-
+    size_t rqs_len,
+    topic_vec *topics)
 {
     hound_data_id id;
     hound_err err;
     size_t i;
-    xhiter_t iter;
-    xvec_t(const char *) topics;
-    const struct schema_desc *schema;
-    const char **val;
 
-    /* Unsubscribe from any old topics that we no longer care about. */
-    xv_init(topics);
     xh_foreach_key(ctx->active_ids, id,
         for (i = 0; i < rqs_len; ++i) {
             if (id == rqs[i].id) {
@@ -1169,22 +1416,63 @@ hound_err unsubscribe_old(
             continue;
         }
 
-        iter = xh_get(ID_MAP, ctx->id_map, rqs[i].id);
-        XASSERT_NEQ(iter, xh_end(ctx->id_map));
-        schema = xh_val(ctx->id_map, iter);
-
-        val = xv_pushp(const char *, topics);
-        if (val == NULL) {
-            err = HOUND_OOM;
-            goto out;
+        err = push_topic(ctx, id, topics);
+        if (err != HOUND_OK) {
+            return err;
         }
-        *val = schema->name;
     );
 
-    err = do_unsubscribe(ctx, xv_size(topics), xv_data(topics));
+    return HOUND_OK;
+}
+
+/*
+ * Subscribe to the new topics in the request list and unsubscribe from the
+ * ones it dropped, sending both requests before waiting for either reply.
+ */
+static
+hound_err update_subscriptions(
+    struct mqtt_ctx *ctx,
+    const struct hound_data_rq *rqs,
+    size_t rqs_len)
+{
+    hound_err err;
+    topic_vec new_topics;
+    topic_vec old_topics;
+
+    xv_init(new_topics);
+    xv_init(old_topics);
+
+    err = get_new_topics(ctx, rqs, rqs_len, &new_topics);
+    if (err != HOUND_OK) {
+        goto out;
+    }
+
+    err = get_old_topics(ctx, rqs, rqs_len, &old_topics);
+    if (err != HOUND_OK) {
+        goto out;
+    }
+
+    err = send_subscribe(ctx, xv_size(new_topics), xv_data(new_topics));
+    if (err != HOUND_OK) {
+        goto out;
+    }
+
+    /*
+     * If the unsubscribe fails to queue, still wait for the subscribe, so we
+     * don't leave a stale reply behind for the next request to trip over.
+     */
+    err = send_unsubscribe(ctx, xv_size(old_topics), xv_data(old_topics));
+    if (err != HOUND_OK) {
+        ctx->unsubscribe_state = CB_SUCCESS;
+        wait_for_acks(ctx);
+        goto out;
+    }
+
+    err = wait_for_acks(ctx);
 
 out:
-    xv_destroy(topics);
+    xv_destroy(old_topics);
+    xv_destroy(new_topics);
     return err;
 }
 
@@ -1197,12 +1485,7 @@ hound_err mqtt_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
     ctx = drv_ctx();
 
     if (ctx->active) {
-        err = subscribe_new(ctx, rqs, rqs_len);
-        if (err != HOUND_OK) {
-            return err;
-        }
-
-        err = unsubscribe_old(ctx, rqs, rqs_len);
+        err = update_subscriptions(ctx, rqs, rqs_len);
         if (err != HOUND_OK) {
             return err;
         }
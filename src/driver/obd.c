@@ -17,11 +17,8 @@
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <linux/socket.h>
-#include <linux/sockios.h>
 #include <net/if.h>
 #include <stdbool.h>
-#include <sys/ioctl.h>
-#include <sys/time.h>
 #include <unistd.h>
 #include <xlib/xhash.h>
 #include <yobd/yobd.h>
@@ -32,8 +29,53 @@
 
 #define FD_INVALID (-1)
 
+/* Mode 01, "show current data", is the only mode that lets us pack PIDs. */
+#define OBD_MODE_CURRENT 0x01
+/* SAE J1979 allows up to six PIDs in a single mode 01 request. */
+#define OBD_PACK_MAX 6
+/* A positive response's mode byte is the request's mode plus this. */
+#define OBD_RESPONSE_MODE 0x40
+/* Mode 01 PIDs are a single byte. */
+#define OBD_CURRENT_PID_COUNT (UINT8_MAX + 1)
+/* Where a PID's data starts in a single-frame mode 01 response. */
+#define OBD_CURRENT_DATA_OFFSET 3
+
+/* The number of ECUs that may respond, one for each response ID. */
+#define OBD_ECU_COUNT (YOBD_OBD_II_RESPONSE_END - YOBD_OBD_II_RESPONSE_BASE)
+/* An ECU listens for flow control at its response ID minus this. */
+#define OBD_ECU_RX_OFFSET 8
+
+/*
+ * ISO-TP (ISO 15765-2) frame types, in the high nibble of the first data byte.
+ * Responses to packed requests usually don't fit in a single frame.
+ */
+#define ISOTP_TYPE(byte) ((byte) >> 4)
+#define ISOTP_SINGLE 0x0
+#define ISOTP_FIRST 0x1
+#define ISOTP_CONSECUTIVE 0x2
+#define ISOTP_FLOW_CONTROL 0x3
+/* The largest response we reassemble; a packed mode 01 response is smaller. */
+#define ISOTP_PAYLOAD_MAX 64
+
 XHASH_MAP_INIT_INT(FRAME_MAP, struct can_frame)
 
+/* A multi-frame response we are in the middle of reassembling. */
+struct isotp_rx {
+    size_t len;
+    size_t received;
+    uint8_t seq;
+    unsigned char payload[ISOTP_PAYLOAD_MAX];
+};
+
+/* Everything obd_parse needs to decode a requested mode 01 PID. */
+struct pid_decoder {
+    bool active;
+    size_t can_bytes;
+    hound_data_id data_id;
+    /* A response frame for the PID, waiting for its data to be filled in. */
+    struct can_frame frame;
+};
+
 struct obd_ctx {
     char iface[IFNAMSIZ];
     canid_t tx_id;
@@ -42,6 +84,9 @@ struct obd_ctx {
     const char *yobd_schema;
     struct yobd_ctx *yobd_ctx;
     xhash_t(FRAME_MAP) *frame_cache;
+    size_t rq_count;
+    struct isotp_rx rx[OBD_ECU_COUNT];
+    struct pid_decoder current[OBD_CURRENT_PID_COUNT];
 };
 
 static
@@ -76,6 +121,7 @@ hound_err obd_init(
     struct obd_ctx *ctx;
     hound_err err;
     int fd;
+    size_t i;
     unsigned int if_index;
     yobd_err yerr;
     struct yobd_ctx *yobd_ctx;
@@ -139,7 +185,11 @@ hound_err obd_init(
     ctx->tx_id = YOBD_OBD_II_QUERY_ADDRESS;
     ctx->tx_fd = FD_INVALID;
     ctx->rx_fd = FD_INVALID;
+    ctx->rq_count = 0;
     ctx->yobd_ctx = yobd_ctx;
+    for (i = 0; i < ARRAYLEN(ctx->current); ++i) {
+        ctx->current[i].active = false;
+    }
 
     drv_set_ctx(ctx);
     return HOUND_OK;
@@ -193,7 +243,10 @@ hound_err obd_datadesc(size_t desc_count, struct drv_datadesc *descs)
     struct obd_ctx *ctx;
     struct drv_datadesc *desc;
     size_t i;
+    yobd_mode mode;
+    yobd_pid pid;
     size_t pid_count;
+    const struct yobd_pid_desc *pid_desc;
     yobd_err yerr;
 
     ctx = drv_ctx();
@@ -212,6 +265,32 @@ hound_err obd_datadesc(size_t desc_count, struct drv_datadesc *descs)
         desc->enabled = true;
         desc->period_count = 0;
         desc->avail_periods = NULL;
+
+        /*
+         * obd_parse_current decodes a mode 01 PID by dropping its data into a
+         * single response frame for yobd, so a PID whose data can't fit in
+         * one frame can't be decoded. Disable it rather than accept requests
+         * we would never answer.
+         */
+        hound_obd_get_mode_pid(desc->schema_desc->data_id, &mode, &pid);
+        if (mode != OBD_MODE_CURRENT) {
+            continue;
+        }
+        yerr = yobd_get_pid_descriptor(
+            ctx->yobd_ctx,
+            mode,
+            pid,
+            &pid_desc);
+        XASSERT_EQ(yerr, YOBD_OK);
+        if (pid_desc->can_bytes > CAN_MAX_DLEN - OBD_CURRENT_DATA_OFFSET) {
+            hound_log(
+                LOG_WARNING,
+                "OBD mode 01 PID 0x%02x has %zu data bytes, more than a "
+                "single frame holds, so it is disabled",
+                (unsigned int) pid,
+                pid_desc->can_bytes);
+            desc->enabled = false;
+        }
     }
 
     return HOUND_OK;
@@ -270,10 +349,93 @@ out:
     return err;
 }
 
+/*
+ * Have the kernel drop everything except responses to our queries. See
+ * https://en.wikipedia.org/wiki/OBD-II_PIDs#CAN_(11-bit)_bus_format or the
+ * OBD-II standards for details.
+ *
+ * Each filter matches one ID exactly, including the EFF and RTR flags. Without
+ * those flags in the mask, any 29-bit frame (which is most of the traffic on a
+ * J1939 bus) whose low 11 bits look like a response would get through too.
+ * Exact filters are also the kernel's fast path: it looks them up by ID rather
+ * than checking each one in turn.
+ *
+ * If nothing is requested, we don't want to hear from the bus at all.
+ */
+static
+hound_err obd_set_rx_filters(const struct obd_ctx *ctx, int fd)
+{
+    canid_t can_id;
+    int err;
+    struct can_filter filters[OBD_ECU_COUNT];
+    size_t i;
+
+    if (ctx->rq_count == 0) {
+        err = setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+    }
+    else {
+        can_id = YOBD_OBD_II_RESPONSE_BASE;
+        for (i = 0; i < ARRAYLEN(filters); ++i) {
+            filters[i].can_id = can_id;
+            filters[i].can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+            ++can_id;
+        }
+        err = setsockopt(
+            fd,
+            SOL_CAN_RAW,
+            CAN_RAW_FILTER,
+            &filters,
+            sizeof(filters));
+    }
+    if (err != 0) {
+        return errno;
+    }
+
+    return HOUND_OK;
+}
+
+/*
+ * Fill in the decode table entry for a mode 01 PID, so obd_parse can decode it
+ * without asking yobd to look anything up.
+ */
+static
+void make_pid_decoder(struct obd_ctx *ctx, yobd_pid pid, hound_data_id id)
+{
+    unsigned char data[CAN_MAX_DLEN];
+    struct pid_decoder *decoder;
+    const struct yobd_pid_desc *desc;
+    yobd_err yerr;
+
+    decoder = &ctx->current[pid];
+    yerr = yobd_get_pid_descriptor(
+        ctx->yobd_ctx,
+        OBD_MODE_CURRENT,
+        pid,
+        &desc);
+    XASSERT_EQ(yerr, YOBD_OK);
+    /* obd_datadesc disables any PID too wide to decode from one frame. */
+    XASSERT_LTE(desc->can_bytes, CAN_MAX_DLEN - OBD_CURRENT_DATA_OFFSET);
+
+    memset(data, 0, sizeof(data));
+    memset(&decoder->frame, 0, sizeof(decoder->frame));
+    yerr = yobd_make_can_response(
+        ctx->yobd_ctx,
+        OBD_MODE_CURRENT,
+        pid,
+        data,
+        desc->can_bytes,
+        &decoder->frame);
+    XASSERT_EQ(yerr, YOBD_OK);
+
+    decoder->can_bytes = desc->can_bytes;
+    decoder->data_id = id;
+    decoder->active = true;
+}
+
 static
 hound_err obd_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
 {
-    const struct obd_ctx *ctx;
+    struct obd_ctx *ctx;
     struct can_frame *frame;
     size_t i;
     hound_data_id id;
@@ -288,13 +450,21 @@ hound_err obd_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
     ctx = drv_ctx();
     XASSERT_NOT_NULL(ctx);
 
+    for (i = 0; i < ARRAYLEN(ctx->current); ++i) {
+        ctx->current[i].active = false;
+    }
+
     /*
      * Populate the frame map so we can make pre-"canned" (haha) requests in
-     * the next call.
+     * the next call, and the decode table for the responses.
      */
     for (i = 0; i < rqs_len; ++i) {
         id = rqs[i].id;
         hound_obd_get_mode_pid(id, &mode, &pid);
+        if (mode == OBD_MODE_CURRENT && pid < ARRAYLEN(ctx->current)) {
+            make_pid_decoder(ctx, pid, id);
+        }
+
         iter = xh_get(FRAME_MAP, ctx->frame_cache, id);
         if (iter != xh_end(ctx->frame_cache)) {
             continue;
@@ -316,21 +486,219 @@ hound_err obd_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
         XASSERT_EQ(yerr, YOBD_OK);
     }
 
+    ctx->rq_count = rqs_len;
+    if (ctx->rx_fd != FD_INVALID) {
+        return obd_set_rx_filters(ctx, ctx->rx_fd);
+    }
+
     return HOUND_OK;
 }
 
+/*
+ * Feed a frame to the reassembler for the ECU that sent it. Returns true and
+ * points payload at the ECU's response once a response is complete, which for
+ * a single frame is right away. The payload stays valid until the next call.
+ */
 static
-hound_err obd_parse(unsigned char *buf, size_t bytes)
+bool isotp_recv(
+    struct obd_ctx *ctx,
+    const struct can_frame *frame,
+    const unsigned char **payload,
+    size_t *len)
 {
-    size_t count;
-    const struct obd_ctx *ctx;
+    size_t bytes;
+    struct can_frame fc;
     hound_err err;
+    canid_t index;
+    struct isotp_rx *rx;
+
+    index = (frame->can_id & CAN_SFF_MASK) - YOBD_OBD_II_RESPONSE_BASE;
+    if (index >= ARRAYLEN(ctx->rx) || frame->can_dlc < 1) {
+        return false;
+    }
+    rx = &ctx->rx[index];
+
+    switch (ISOTP_TYPE(frame->data[0])) {
+        case ISOTP_SINGLE:
+            bytes = frame->data[0] & 0x0f;
+            if (bytes == 0 || bytes >= frame->can_dlc) {
+                return false;
+            }
+            *payload = &frame->data[1];
+            *len = bytes;
+            return true;
+
+        case ISOTP_FIRST:
+            if (frame->can_dlc < CAN_MAX_DLEN) {
+                return false;
+            }
+            rx->len = ((frame->data[0] & 0x0f) << 8) | frame->data[1];
+            if (rx->len > ARRAYLEN(rx->payload)) {
+                /* Too big to be meant for us, so let it time out. */
+                rx->len = 0;
+                return false;
+            }
+            rx->received = CAN_MAX_DLEN - 2;
+            rx->seq = 1;
+            memcpy(rx->payload, &frame->data[2], rx->received);
+
+            /* Ask for the rest all at once, with no gap between frames. */
+            memset(&fc, 0, sizeof(fc));
+            fc.can_id = (frame->can_id & CAN_SFF_MASK) - OBD_ECU_RX_OFFSET;
+            fc.can_dlc = CAN_MAX_DLEN;
+            fc.data[0] = ISOTP_FLOW_CONTROL << 4;
+            err = write_loop(ctx->tx_fd, &fc, sizeof(fc));
+            if (err != HOUND_OK) {
+                hound_log_err(
+                    err,
+                    "failed to send flow control to 0x%x",
+                    fc.can_id);
+                rx->len = 0;
+            }
+            return false;
+
+        case ISOTP_CONSECUTIVE:
+            if (rx->len == 0 || (frame->data[0] & 0x0f) != rx->seq) {
+                /* Out of order, so drop the response. */
+                rx->len = 0;
+                return false;
+            }
+            bytes = min(frame->can_dlc - 1, rx->len - rx->received);
+            memcpy(&rx->payload[rx->received], &frame->data[1], bytes);
+            rx->received += bytes;
+            rx->seq = (rx->seq + 1) & 0x0f;
+            if (rx->received < rx->len) {
+                return false;
+            }
+            *payload = rx->payload;
+            *len = rx->len;
+            rx->len = 0;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static
+hound_err obd_add_record(
+    const struct obd_ctx *ctx,
+    hound_data_id id,
+    const struct can_frame *frame,
+    const struct timespec *timestamp,
+    struct hound_record *records,
+    size_t *n)
+{
+    struct hound_record *record;
+    yobd_err yerr;
+
+    record = &records[*n];
+    record->size = sizeof(float);
+    record->data = drv_record_alloc(record->size);
+    if (record->data == NULL) {
+        return HOUND_OOM;
+    }
+    record->timestamp = *timestamp;
+    record->data_id = id;
+
+    yerr = yobd_parse_can_response(
+        ctx->yobd_ctx,
+        (struct can_frame *) frame,
+        (float *) record->data);
+    XASSERT_EQ(yerr, YOBD_OK);
+
+    ++*n;
+    if (*n == DRV_PUSH_BATCH_SIZE) {
+        drv_push_records(records, *n);
+        *n = 0;
+    }
+
+    return HOUND_OK;
+}
+
+/*
+ * Split a mode 01 response into its PIDs. yobd knows how to decode each PID
+ * only from a response frame of its own, so we drop each PID's data into the
+ * frame its decode table entry keeps ready.
+ */
+static
+hound_err obd_parse_current(
+    const struct obd_ctx *ctx,
+    const unsigned char *payload,
+    size_t len,
+    const struct timespec *timestamp,
+    struct hound_record *records,
+    size_t *n)
+{
+    size_t bytes;
+    const struct pid_decoder *decoder;
+    const struct yobd_pid_desc *desc;
+    hound_err err;
+    struct can_frame frame;
     size_t i;
+    yobd_err yerr;
+
+    i = 1;
+    while (i < len) {
+        decoder = &ctx->current[payload[i]];
+        if (!decoder->active) {
+            /*
+             * Someone else asked for this PID, so just find out how big it is
+             * in order to skip it.
+             */
+            yerr = yobd_get_pid_descriptor(
+                ctx->yobd_ctx,
+                OBD_MODE_CURRENT,
+                payload[i],
+                &desc);
+            if (yerr != YOBD_OK) {
+                /* We can't tell where the next PID starts, so give up. */
+                break;
+            }
+            i += 1 + desc->can_bytes;
+            continue;
+        }
+
+        bytes = decoder->can_bytes;
+        if (i + 1 + bytes > len) {
+            break;
+        }
+
+        frame = decoder->frame;
+        memcpy(&frame.data[OBD_CURRENT_DATA_OFFSET], &payload[i + 1], bytes);
+        err = obd_add_record(
+            ctx,
+            decoder->data_id,
+            &frame,
+            timestamp,
+            records,
+            n);
+        if (err != HOUND_OK) {
+            return err;
+        }
+
+        i += 1 + bytes;
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err obd_parse(unsigned char *buf, size_t bytes)
+{
+    struct obd_ctx *ctx;
+    const unsigned char *end;
+    hound_err err;
+    struct can_frame *frame;
+    const struct drv_msg_header *header;
+    hound_data_id id;
+    size_t len;
     yobd_mode mode;
+    size_t n;
+    const unsigned char *payload;
     yobd_pid pid;
     const unsigned char *pos;
-    struct hound_record record;
-    struct timeval tv;
+    struct hound_record records[DRV_PUSH_BATCH_SIZE];
     yobd_err yerr;
 
     XASSERT_NOT_NULL(buf);
@@ -338,43 +706,62 @@ hound_err obd_parse(unsigned char *buf, size_t bytes)
 
     ctx = drv_ctx();
     XASSERT_NOT_NULL(ctx);
-    XASSERT_EQ(bytes % sizeof(struct can_frame), 0);
 
-    count = bytes / sizeof(struct can_frame);
+    /*
+     * Each frame comes behind a header carrying its own kernel receive
+     * timestamp; see obd_start.
+     */
+    n = 0;
     pos = buf;
-    for (i = 0; i < count; ++i) {
-        record.size = sizeof(float);
-        record.data = drv_alloc(record.size);
-        if (record.data == NULL) {
-            return HOUND_OOM;
+    end = buf + bytes;
+    err = HOUND_OK;
+    while (pos < end) {
+        XASSERT_LTE(pos + sizeof(*header), end);
+        header = (const struct drv_msg_header *) pos;
+        pos += DRV_MSG_SPACE(header->size);
+        XASSERT_LTE(pos, end);
+        if (header->size != sizeof(*frame)) {
+            /* Never happens with CAN_RAW unless CAN FD is enabled. */
+            continue;
         }
+        frame = (struct can_frame *) (header + 1);
 
-        /* Get the kernel-provided timestamp for our last message. */
-        err = ioctl(ctx->rx_fd, SIOCGSTAMP, &tv);
-        XASSERT_NEQ(err, -1);
-        record.timestamp.tv_sec = tv.tv_sec;
-        record.timestamp.tv_nsec = tv.tv_usec * NSEC_PER_USEC;
-
-        yerr = yobd_parse_can_headers(
-            ctx->yobd_ctx,
-            (struct can_frame *) buf,
-            &mode,
-            &pid);
-        XASSERT_EQ(yerr, YOBD_OK);
-        hound_obd_get_data_id(mode, pid, &record.data_id);
-
-        yerr = yobd_parse_can_response(
-            ctx->yobd_ctx,
-            (struct can_frame *) buf,
-            (float *) record.data);
-        XASSERT_EQ(yerr, YOBD_OK);
+        if (!isotp_recv(ctx, frame, &payload, &len)) {
+            continue;
+        }
 
-        drv_push_records(&record, 1);
+        if (payload[0] == (OBD_RESPONSE_MODE | OBD_MODE_CURRENT)) {
+            err = obd_parse_current(
+                ctx,
+                payload,
+                len,
+                &header->timestamp,
+                records,
+                &n);
+        }
+        else if (payload == &frame->data[1]) {
+            /* Other modes have one PID per response, which yobd handles. */
+            yerr = yobd_parse_can_headers(ctx->yobd_ctx, frame, &mode, &pid);
+            XASSERT_EQ(yerr, YOBD_OK);
+            hound_obd_get_data_id(mode, pid, &id);
+            err = obd_add_record(
+                ctx,
+                id,
+                frame,
+                &header->timestamp,
+                records,
+                &n);
+        }
+        if (err != HOUND_OK) {
+            break;
+        }
+    }
 
-        pos += sizeof(struct can_frame);
+    if (n > 0) {
+        drv_push_records(records, n);
     }
 
-    return HOUND_OK;
+    return err;
 }
 
 static
@@ -404,10 +791,87 @@ hound_err obd_next(hound_data_id id)
     return HOUND_OK;
 }
 
+static
+hound_err obd_send_current(
+    const struct obd_ctx *ctx,
+    const yobd_pid *pids,
+    size_t count)
+{
+    struct can_frame frame;
+    size_t i;
+
+    XASSERT_GT(count, 0);
+    XASSERT_LTE(count, OBD_PACK_MAX);
+
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = ctx->tx_id;
+    frame.can_dlc = CAN_MAX_DLEN;
+    frame.data[0] = 1 + count;
+    frame.data[1] = OBD_MODE_CURRENT;
+    for (i = 0; i < count; ++i) {
+        frame.data[2 + i] = pids[i];
+    }
+
+    return write_loop(ctx->tx_fd, &frame, sizeof(frame));
+}
+
+/*
+ * Pack mode 01 PIDs into as few requests as we can. ECUs answer a packed
+ * request with one response covering all the PIDs, which obd_parse splits back
+ * up. Other modes take one PID per request.
+ */
+static
+hound_err obd_next_batch(const hound_data_id *ids, size_t count, size_t n)
+{
+    const struct obd_ctx *ctx;
+    hound_err err;
+    size_t i;
+    size_t j;
+    yobd_mode mode;
+    yobd_pid pid;
+    yobd_pid pids[OBD_PACK_MAX];
+    size_t pid_count;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    for (i = 0; i < n; ++i) {
+        pid_count = 0;
+        for (j = 0; j < count; ++j) {
+            hound_obd_get_mode_pid(ids[j], &mode, &pid);
+            if (mode != OBD_MODE_CURRENT || pid > UINT8_MAX) {
+                err = obd_next(ids[j]);
+                if (err != HOUND_OK) {
+                    return err;
+                }
+                continue;
+            }
+
+            pids[pid_count] = pid;
+            ++pid_count;
+            if (pid_count == ARRAYLEN(pids)) {
+                err = obd_send_current(ctx, pids, pid_count);
+                if (err != HOUND_OK) {
+                    return err;
+                }
+                pid_count = 0;
+            }
+        }
+
+        if (pid_count > 0) {
+            err = obd_send_current(ctx, pids, pid_count);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
+    }
+
+    return HOUND_OK;
+}
+
 static
 hound_err obd_start(int *out_fd)
 {
-    canid_t can_id;
     struct obd_ctx *ctx;
     int enabled;
     hound_err err;
@@ -415,9 +879,6 @@ hound_err obd_start(int *out_fd)
     int tx_fd;
     int rx_fd;
 
-    canid_t range = YOBD_OBD_II_RESPONSE_END - YOBD_OBD_II_RESPONSE_BASE;
-    struct can_filter filters[range];
-
     ctx = drv_ctx();
     XASSERT_NOT_NULL(ctx);
 
@@ -429,53 +890,56 @@ hound_err obd_start(int *out_fd)
         goto error_rx_fd;
     }
 
-    /*
-     * Filter out everything except responses to our queries. See
-     * https://en.wikipedia.org/wiki/OBD-II_PIDs#CAN_(11-bit)_bus_format or the
-     * OBD-II standards for details.
-     */
-    can_id = YOBD_OBD_II_RESPONSE_BASE;
-    for (i = 0; i < ARRAYLEN(filters); ++i) {
-        filters[i].can_id = can_id;
-        filters[i].can_mask = CAN_SFF_MASK;
-        ++can_id;
-    }
-
-    err = setsockopt(
-        rx_fd,
-        SOL_CAN_RAW,
-        CAN_RAW_FILTER,
-        &filters,
-        sizeof(filters));
-    if (err != 0) {
-        err = errno;
+    err = obd_set_rx_filters(ctx, rx_fd);
+    if (err != HOUND_OK) {
         goto error_sockopt;
     }
 
-    enabled = 0;
+    /*
+     * Have the kernel timestamp every frame, and read frames in batches along
+     * with their timestamps, rather than making a syscall per frame.
+     */
+    enabled = 1;
     err = setsockopt(
         rx_fd,
         SOL_SOCKET,
-        SO_TIMESTAMP,
+        SO_TIMESTAMPNS,
         &enabled,
         sizeof(enabled));
     if (err != HOUND_OK) {
         err = errno;
         goto error_sockopt;
     }
+    drv_set_read_msgs(sizeof(struct can_frame));
+    drv_set_read_msg_stamps(true);
 
     err = make_socket(ctx, &tx_fd);
     if (err != HOUND_OK) {
         goto error_tx_fd;
     }
 
+    /*
+     * Nobody reads the tx socket, so don't make the kernel queue the whole bus
+     * on it.
+     */
+    err = setsockopt(tx_fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+    if (err != 0) {
+        err = errno;
+        goto error_tx_sockopt;
+    }
+
     ctx->tx_fd = tx_fd;
     ctx->rx_fd = rx_fd;
+    for (i = 0; i < ARRAYLEN(ctx->rx); ++i) {
+        ctx->rx[i].len = 0;
+    }
     *out_fd = rx_fd;
 
     err = HOUND_OK;
     goto out;
 
+error_tx_sockopt:
+    close(tx_fd);
 error_tx_fd:
 error_sockopt:
     close(rx_fd);
@@ -531,6 +995,7 @@ static struct driver_ops obd_driver = {
     .parse = obd_parse,
     .start = obd_start,
     .next = obd_next,
+    .next_batch = obd_next_batch,
     .stop = obd_stop
 };
 
@@ -0,0 +1,420 @@
+/**
+ * @file      replay.c
+ * @brief     Replay driver, which plays back a binary record log (see
+ *            hound_start_record_log) as if the records were arriving live.
+ *            The log is memory-mapped and played either at its original
+ *            timing or as fast as the consumers can take it.
+ *
+ *            The driver's path is the log file. It takes one optional bool
+ *            argument, which is true (the default) to keep the log's original
+ *            timing and false to replay as fast as possible. The schema should
+ *            be the one used by the driver whose records were logged; records
+ *            for data IDs nobody requested are skipped.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <hound/hound.h>
+#include <hound-private/driver.h>
+#include <hound-private/error.h>
+#include <hound-private/log.h>
+#include <hound-private/record-log.h>
+#include <hound-private/util.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FD_INVALID (-1)
+
+/*
+ * When replaying as fast as possible, the most batches to push per poll, so
+ * that one replay can't starve the other fds in its I/O shard.
+ */
+#define FAST_BATCHES_PER_POLL 16
+
+/* How long to wait before trying again when we run out of record memory. */
+#define OOM_RETRY_NS (NSEC_PER_SEC / 100)
+
+struct replay_ctx {
+    struct record_log_reader reader;
+    bool realtime;
+    int fd;
+
+    hound_data_id *active_ids;
+    size_t active_count;
+
+    /* The next entry to push, or NULL when the log is done. */
+    const struct record_log_entry *pending;
+    /*
+     * For realtime replay, the log time of the first entry and the monotonic
+     * time at which we replayed it.
+     */
+    int64_t log_start_ns;
+    hound_data_period start_ns;
+};
+
+static
+hound_data_period get_mono_ns(void)
+{
+    struct timespec ts;
+    int ret;
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    XASSERT_EQ(ret, 0);
+
+    return NSEC_PER_SEC*ts.tv_sec + ts.tv_nsec;
+}
+
+static
+hound_err replay_init(
+    const char *path,
+    size_t arg_count,
+    const struct hound_init_arg *args)
+{
+    struct replay_ctx *ctx;
+    hound_err err;
+    bool realtime;
+
+    if (arg_count == 0) {
+        realtime = true;
+    }
+    else if (arg_count == 1 && args[0].type == HOUND_TYPE_BOOL) {
+        realtime = args[0].data.as_bool;
+    }
+    else {
+        return HOUND_INVALID_VAL;
+    }
+
+    ctx = drv_alloc(sizeof(*ctx));
+    if (ctx == NULL) {
+        return HOUND_OOM;
+    }
+
+    err = record_log_reader_open(path, &ctx->reader);
+    if (err != HOUND_OK) {
+        drv_free(ctx);
+        return err;
+    }
+
+    ctx->realtime = realtime;
+    ctx->fd = FD_INVALID;
+    ctx->active_ids = NULL;
+    ctx->active_count = 0;
+    ctx->pending = NULL;
+    ctx->log_start_ns = 0;
+    ctx->start_ns = 0;
+
+    drv_set_ctx(ctx);
+
+    return HOUND_OK;
+}
+
+static
+hound_err replay_destroy(void)
+{
+    struct replay_ctx *ctx;
+
+    ctx = drv_ctx();
+    record_log_reader_close(&ctx->reader);
+    drv_free(ctx->active_ids);
+    drv_free(ctx);
+
+    return HOUND_OK;
+}
+
+static
+hound_err replay_device_name(char *device_name)
+{
+    XASSERT_NOT_NULL(device_name);
+
+    strcpy(device_name, "replay");
+
+    return HOUND_OK;
+}
+
+static
+hound_err replay_datadesc(size_t desc_count, struct drv_datadesc *descs)
+{
+    struct drv_datadesc *desc;
+    size_t i;
+
+    /*
+     * Records arrive when the log says they do, so like other event-based
+     * drivers, everything is available at period 0.
+     */
+    for (i = 0; i < desc_count; ++i) {
+        desc = &descs[i];
+        desc->enabled = true;
+        desc->period_count = 1;
+        desc->avail_periods = drv_alloc(sizeof(*desc->avail_periods));
+        if (desc->avail_periods == NULL) {
+            goto error;
+        }
+        desc->avail_periods[0] = 0;
+    }
+
+    return HOUND_OK;
+
+error:
+    for (; i > 0; --i) {
+        drv_free(descs[i-1].avail_periods);
+    }
+    return HOUND_OOM;
+}
+
+static
+hound_err replay_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
+{
+    struct replay_ctx *ctx;
+    size_t i;
+    hound_data_id *ids;
+
+    ctx = drv_ctx();
+
+    ids = drv_realloc(ctx->active_ids, rqs_len * sizeof(*ids));
+    if (ids == NULL && rqs_len > 0) {
+        return HOUND_OOM;
+    }
+    for (i = 0; i < rqs_len; ++i) {
+        ids[i] = rqs[i].id;
+    }
+    ctx->active_ids = ids;
+    ctx->active_count = rqs_len;
+
+    return HOUND_OK;
+}
+
+static
+bool is_active(const struct replay_ctx *ctx, hound_data_id id)
+{
+    size_t i;
+
+    for (i = 0; i < ctx->active_count; ++i) {
+        if (ctx->active_ids[i] == id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Returns the monotonic time at which an entry should be pushed. */
+static
+hound_data_period get_due_ns(
+    const struct replay_ctx *ctx,
+    const struct record_log_entry *entry)
+{
+    /* A clock step backwards in the log shouldn't hold up the replay. */
+    if (entry->timestamp_ns <= ctx->log_start_ns) {
+        return ctx->start_ns;
+    }
+
+    return ctx->start_ns + (entry->timestamp_ns - ctx->log_start_ns);
+}
+
+/*
+ * Arms the timer for the next entry. A zero deadline means as soon as
+ * possible, and no pending entry disarms the timer, as the replay is done.
+ */
+static
+void arm_timer(struct replay_ctx *ctx, hound_data_period deadline_ns)
+{
+    int flags;
+    struct itimerspec spec;
+    int ret;
+
+    memset(&spec, 0, sizeof(spec));
+    flags = 0;
+    if (ctx->pending != NULL) {
+        if (deadline_ns == 0) {
+            /* An all-zero it_value disarms the timer, so use 1 ns. */
+            spec.it_value.tv_nsec = 1;
+        }
+        else {
+            spec.it_value.tv_sec = deadline_ns / NSEC_PER_SEC;
+            spec.it_value.tv_nsec = deadline_ns % NSEC_PER_SEC;
+            flags = TFD_TIMER_ABSTIME;
+        }
+    }
+
+    ret = timerfd_settime(ctx->fd, flags, &spec, NULL);
+    XASSERT_EQ(ret, 0);
+}
+
+static
+void make_record(
+    const struct record_log_entry *entry,
+    void *data,
+    struct hound_record *record)
+{
+    memcpy(data, record_log_entry_data(entry), entry->size);
+    record->data = data;
+    record->data_id = entry->data_id;
+    record->size = entry->size;
+    record->timestamp.tv_sec = entry->timestamp_ns / NSEC_PER_SEC;
+    record->timestamp.tv_nsec = entry->timestamp_ns % NSEC_PER_SEC;
+}
+
+/*
+ * Pushes the entries that are due, in batches. Returns the deadline to arm
+ * the timer with.
+ */
+static
+hound_data_period push_due(struct replay_ctx *ctx, hound_data_period now)
+{
+    size_t batches;
+    void *data;
+    hound_data_period deadline;
+    const struct record_log_entry *entry;
+    size_t n;
+    struct hound_record records[DRV_PUSH_BATCH_SIZE];
+
+    batches = 0;
+    deadline = 0;
+    n = 0;
+    while (ctx->pending != NULL) {
+        entry = ctx->pending;
+        if (ctx->realtime) {
+            deadline = get_due_ns(ctx, entry);
+            if (deadline > now) {
+                break;
+            }
+        }
+
+        if (is_active(ctx, entry->data_id)) {
+            data = drv_record_alloc(entry->size);
+            if (data == NULL) {
+                hound_log_err_nofmt(HOUND_OOM, "replay: failed to push record");
+                deadline = now + OOM_RETRY_NS;
+                break;
+            }
+            make_record(entry, data, &records[n]);
+            ++n;
+        }
+        ctx->pending = record_log_reader_next(&ctx->reader);
+
+        if (n == ARRAYLEN(records)) {
+            drv_push_records(records, n);
+            n = 0;
+            ++batches;
+            if (!ctx->realtime && batches == FAST_BATCHES_PER_POLL) {
+                break;
+            }
+        }
+    }
+    if (n > 0) {
+        drv_push_records(records, n);
+    }
+
+    if (!ctx->realtime && deadline == 0) {
+        /* Come back right away for the rest. */
+        return 0;
+    }
+
+    return deadline;
+}
+
+static
+hound_err replay_poll(
+    short events,
+    short *next_events,
+    UNUSED hound_data_period poll_time,
+    bool *timeout_enabled,
+    UNUSED hound_data_period *timeout)
+{
+    struct replay_ctx *ctx;
+    uint64_t expirations;
+    ssize_t bytes;
+
+    ctx = drv_ctx();
+
+    if (events & POLLIN) {
+        /*
+         * Clear the timer; if it raced with a rearm, there's nothing to
+         * read.
+         */
+        bytes = read(ctx->fd, &expirations, sizeof(expirations));
+        if (bytes == -1 && errno != EAGAIN) {
+            return errno;
+        }
+        arm_timer(ctx, push_due(ctx, get_mono_ns()));
+    }
+
+    *next_events = POLLIN;
+    *timeout_enabled = false;
+
+    return HOUND_OK;
+}
+
+static
+hound_err replay_start(int *out_fd)
+{
+    struct replay_ctx *ctx;
+
+    ctx = drv_ctx();
+
+    ctx->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ctx->fd == -1) {
+        return errno;
+    }
+
+    /* Each start replays the log from the beginning. */
+    record_log_reader_rewind(&ctx->reader);
+    ctx->pending = record_log_reader_next(&ctx->reader);
+    if (ctx->pending != NULL) {
+        ctx->log_start_ns = ctx->pending->timestamp_ns;
+    }
+    ctx->start_ns = get_mono_ns();
+    arm_timer(ctx, 0);
+
+    *out_fd = ctx->fd;
+
+    return HOUND_OK;
+}
+
+static
+hound_err replay_next(UNUSED hound_data_id id)
+{
+    /* Records come out on the log's schedule, not on demand. */
+    return HOUND_OK;
+}
+
+static
+hound_err replay_stop(void)
+{
+    struct replay_ctx *ctx;
+    int ret;
+
+    ctx = drv_ctx();
+
+    ret = close(ctx->fd);
+    ctx->fd = FD_INVALID;
+    if (ret == -1) {
+        return errno;
+    }
+
+    return HOUND_OK;
+}
+
+static struct driver_ops replay_driver = {
+    .init = replay_init,
+    .destroy = replay_destroy,
+    .device_name = replay_device_name,
+    .datadesc = replay_datadesc,
+    .setdata = replay_setdata,
+    .poll = replay_poll,
+    .start = replay_start,
+    .next = replay_next,
+    .stop = replay_stop
+};
+
+HOUND_DRIVER_REGISTER_FUNC
+static void register_replay_driver(void)
+{
+    driver_register("replay", &replay_driver);
+}
@@ -2,6 +2,8 @@
 #include <hound-private/driver-ops.h>
 #include <hound-private/error.h>
 #include <hound-private/parse/schema.h>
+#include <hound-private/pool.h>
+#include <hound-private/queue.h>
 #include <hound-private/util.h>
 #include <string.h>
 
@@ -31,6 +33,47 @@ void drv_free(void *p)
     free(p);
 }
 
+PUBLIC_API
+void *drv_record_alloc(size_t bytes)
+{
+    const struct driver *drv;
+    struct record_info *info;
+
+    /*
+     * This should be called only from a driver's callback, so we should already
+     * hold the driver's mutex, which makes us the only thread allocating from
+     * the driver's pool.
+     */
+    drv = get_active_drv();
+    XASSERT_NOT_NULL(drv);
+
+    info = pool_get(drv->pool, bytes);
+    if (info == NULL) {
+        return NULL;
+    }
+    return info->record.data;
+}
+
+PUBLIC_API
+void *drv_record_realloc(void *data, size_t bytes)
+{
+    struct record_info *info;
+
+    XASSERT_NOT_NULL(get_active_drv());
+
+    info = pool_resize(pool_info_from_data(data), bytes);
+    if (info == NULL) {
+        return NULL;
+    }
+    return info->record.data;
+}
+
+PUBLIC_API
+void drv_record_free(void *data)
+{
+    pool_put(pool_info_from_data(data));
+}
+
 PUBLIC_API
 void *drv_ctx(void)
 {
@@ -72,3 +115,35 @@ int drv_fd(void)
     XASSERT_NOT_NULL(drv);
     return drv->fd;
 }
+
+PUBLIC_API
+void drv_set_read_budget(size_t reads)
+{
+    struct driver *drv;
+
+    XASSERT_GT(reads, 0);
+
+    drv = get_active_drv();
+    XASSERT_NOT_NULL(drv);
+    drv->read_budget = reads;
+}
+
+PUBLIC_API
+void drv_set_read_msgs(size_t msg_size)
+{
+    struct driver *drv;
+
+    drv = get_active_drv();
+    XASSERT_NOT_NULL(drv);
+    drv->read_msg_size = msg_size;
+}
+
+PUBLIC_API
+void drv_set_read_msg_stamps(bool enable)
+{
+    struct driver *drv;
+
+    drv = get_active_drv();
+    XASSERT_NOT_NULL(drv);
+    drv->read_msg_stamps = enable;
+}
@@ -0,0 +1,378 @@
+/**
+ * @file      ingest.c
+ * @brief     Benchmark for the path from a driver's fd to user callbacks. The
+ *            counter driver makes on-demand records of a given size, which fan
+ *            out to one or more contexts, each drained by its own thread using
+ *            one of the read calls. Each run reports records/sec and
+ *            percentiles of the time from the driver stamping a record to its
+ *            callback running, and the whole suite is printed as JSON.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_RECORDS 20000
+#define MAX_CONTEXTS 4
+
+enum read_mode {
+    READ_BLOCKING,
+    READ_NOWAIT,
+    READ_BYTES_NOWAIT
+};
+
+static const char *s_mode_names[] = {
+    [READ_BLOCKING] = "hound_read",
+    [READ_NOWAIT] = "hound_read_nowait",
+    [READ_BYTES_NOWAIT] = "hound_read_bytes_nowait"
+};
+
+static const size_t s_record_sizes[] = { 8, 64, 512, 4096 };
+static const size_t s_context_counts[] = { 1, MAX_CONTEXTS };
+static const size_t s_queue_lens[] = { 64, 1024 };
+
+struct reader {
+    struct hound_ctx *ctx;
+    pthread_t thread;
+    enum read_mode mode;
+    size_t record_size;
+    size_t batch;
+    size_t records;
+
+    /* Written by the callback, and read by the producer for flow control. */
+    atomic_size_t consumed;
+    uint64_t *latencies;
+};
+
+struct result {
+    double records_per_sec;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+};
+
+static
+uint64_t timespec_ns(const struct timespec *ts)
+{
+    return (uint64_t) ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static
+uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return timespec_ns(&ts);
+}
+
+static
+void bench_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    size_t count;
+    uint64_t now;
+    struct reader *reader;
+    uint64_t stamp;
+
+    /* The counter driver stamps records with CLOCK_REALTIME as it parses. */
+    now = now_ns(CLOCK_REALTIME);
+    stamp = timespec_ns(&rec->timestamp);
+
+    reader = cb_ctx;
+    XASSERT_EQ(rec->size, reader->record_size);
+    count = atomic_load_explicit(&reader->consumed, memory_order_relaxed);
+    XASSERT_LT(count, reader->records);
+    reader->latencies[count] = now > stamp ? now - stamp : 0;
+    atomic_store_explicit(&reader->consumed, count + 1, memory_order_release);
+}
+
+static
+void *run_reader(void *data)
+{
+    size_t bytes_read;
+    size_t count;
+    hound_err err;
+    size_t read;
+    struct reader *reader;
+    size_t want;
+
+    reader = data;
+    while (true) {
+        count = atomic_load_explicit(&reader->consumed, memory_order_relaxed);
+        if (count == reader->records) {
+            break;
+        }
+        want = min(reader->batch, reader->records - count);
+
+        switch (reader->mode) {
+            case READ_BLOCKING:
+                err = hound_read(reader->ctx, want, &read);
+                break;
+            case READ_NOWAIT:
+                err = hound_read_nowait(reader->ctx, want, &read);
+                break;
+            case READ_BYTES_NOWAIT:
+                err = hound_read_bytes_nowait(
+                    reader->ctx,
+                    want * reader->record_size,
+                    &read,
+                    &bytes_read);
+                break;
+            default:
+                XASSERT_ERROR;
+        }
+        XASSERT_OK(err);
+        if (read == 0) {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns how far the slowest reader is behind the producer. */
+static
+size_t get_backlog(struct reader *readers, size_t count, size_t produced)
+{
+    size_t backlog;
+    size_t consumed;
+    size_t i;
+
+    backlog = 0;
+    for (i = 0; i < count; ++i) {
+        consumed = atomic_load_explicit(
+            &readers[i].consumed,
+            memory_order_acquire);
+        backlog = max(backlog, produced - consumed);
+    }
+
+    return backlog;
+}
+
+static
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x;
+    uint64_t y;
+
+    x = *(const uint64_t *) a;
+    y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static
+uint64_t percentile(const uint64_t *sorted, size_t count, size_t per_mille)
+{
+    return sorted[min(count - 1, count * per_mille / 1000)];
+}
+
+static
+void run_one(
+    const char *schema_base,
+    enum read_mode mode,
+    size_t record_size,
+    size_t contexts,
+    size_t queue_len,
+    size_t records,
+    struct result *result)
+{
+    struct hound_init_arg args[2];
+    size_t chunk;
+    struct hound_data_rq data_rq;
+    uint64_t elapsed;
+    hound_err err;
+    size_t i;
+    uint64_t *latencies;
+    size_t produced;
+    struct reader readers[MAX_CONTEXTS];
+    struct hound_rq rq;
+    uint64_t start;
+
+    args[0].type = HOUND_TYPE_UINT64;
+    args[0].data.as_uint64 = 0;
+    args[1].type = HOUND_TYPE_UINT64;
+    args[1].data.as_uint64 = record_size;
+    err = hound_init_driver(
+        "counter",
+        "/dev/counter",
+        schema_base,
+        "counter.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_OK(err);
+
+    latencies = malloc(contexts * records * sizeof(*latencies));
+    XASSERT_NOT_NULL(latencies);
+
+    data_rq.id = HOUND_DATA_COUNTER;
+    data_rq.period_ns = 0;
+    memset(&rq, 0, sizeof(rq));
+    rq.queue_len = queue_len;
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.cb = bench_cb;
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rq;
+    for (i = 0; i < contexts; ++i) {
+        readers[i].mode = mode;
+        readers[i].record_size = record_size;
+        readers[i].batch = queue_len / 2;
+        readers[i].records = records;
+        atomic_init(&readers[i].consumed, 0);
+        readers[i].latencies = latencies + i*records;
+        rq.cb_ctx = &readers[i];
+        err = hound_alloc_ctx(&rq, &readers[i].ctx);
+        XASSERT_OK(err);
+        err = hound_start(readers[i].ctx);
+        XASSERT_OK(err);
+    }
+
+    start = now_ns(CLOCK_MONOTONIC);
+    for (i = 0; i < contexts; ++i) {
+        err = pthread_create(&readers[i].thread, NULL, run_reader, &readers[i]);
+        XASSERT_EQ(err, 0);
+    }
+
+    /*
+     * Every context sees every record, so asking through the first context is
+     * enough. Keep the slowest reader's backlog within its queue, so that no
+     * record is overwritten and every run does the same work.
+     */
+    produced = 0;
+    while (produced < records) {
+        chunk = min(queue_len / 2, records - produced);
+        while (get_backlog(readers, contexts, produced) + chunk > queue_len) {
+            sched_yield();
+        }
+        err = hound_next(readers[0].ctx, chunk);
+        XASSERT_OK(err);
+        produced += chunk;
+    }
+
+    for (i = 0; i < contexts; ++i) {
+        err = pthread_join(readers[i].thread, NULL);
+        XASSERT_EQ(err, 0);
+    }
+    elapsed = now_ns(CLOCK_MONOTONIC) - start;
+
+    for (i = 0; i < contexts; ++i) {
+        err = hound_stop(readers[i].ctx);
+        XASSERT_OK(err);
+        err = hound_free_ctx(readers[i].ctx);
+        XASSERT_OK(err);
+    }
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    qsort(latencies, contexts * records, sizeof(*latencies), compare_u64);
+    result->records_per_sec = (double) records * NSEC_PER_SEC / elapsed;
+    result->p50_ns = percentile(latencies, contexts * records, 500);
+    result->p99_ns = percentile(latencies, contexts * records, 990);
+    result->p999_ns = percentile(latencies, contexts * records, 999);
+    result->max_ns = latencies[contexts * records - 1];
+    free(latencies);
+}
+
+static
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n RECORDS] SCHEMA-BASE-PATH\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    size_t c;
+    char *end;
+    bool first;
+    enum read_mode mode;
+    int opt;
+    size_t q;
+    size_t records;
+    struct result result;
+    size_t s;
+    const char *schema_base;
+
+    records = DEFAULT_RECORDS;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                errno = 0;
+                records = strtoul(optarg, &end, 0);
+                if (errno != 0 || *optarg == '\0' || *end != '\0' ||
+                    records == 0) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    schema_base = argv[optind];
+
+    printf("{\n  \"benchmark\": \"ingest\",\n  \"records\": %zu,\n", records);
+    printf("  \"results\": [");
+    first = true;
+    for (mode = READ_BLOCKING; mode <= READ_BYTES_NOWAIT; ++mode) {
+        for (s = 0; s < ARRAYLEN(s_record_sizes); ++s) {
+            for (c = 0; c < ARRAYLEN(s_context_counts); ++c) {
+                for (q = 0; q < ARRAYLEN(s_queue_lens); ++q) {
+                    run_one(
+                        schema_base,
+                        mode,
+                        s_record_sizes[s],
+                        s_context_counts[c],
+                        s_queue_lens[q],
+                        records,
+                        &result);
+                    printf(
+                        "%s\n    {\"mode\": \"%s\", \"record_size\": %zu, "
+                        "\"contexts\": %zu, \"queue_len\": %zu, "
+                        "\"records_per_sec\": %.0f, "
+                        "\"latency_ns\": {\"p50\": %" PRIu64 ", "
+                        "\"p99\": %" PRIu64 ", \"p999\": %" PRIu64 ", "
+                        "\"max\": %" PRIu64 "}}",
+                        first ? "" : ",",
+                        s_mode_names[mode],
+                        s_record_sizes[s],
+                        s_context_counts[c],
+                        s_queue_lens[q],
+                        result.records_per_sec,
+                        result.p50_ns,
+                        result.p99_ns,
+                        result.p999_ns,
+                        result.max_ns);
+                    fflush(stdout);
+                    first = false;
+                }
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    return EXIT_SUCCESS;
+}
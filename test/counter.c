@@ -13,7 +13,11 @@
 #include <hound-test/assert.h>
 #include <hound-test/id.h>
 #include <linux/limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <time.h>
 #include <valgrind.h>
 
 struct cb_ctx {
@@ -60,14 +64,39 @@ void data_cb(const struct hound_record *rec, hound_seqno seqno, void *cb_ctx)
     ++ctx->seqno;
 }
 
-int main(int argc, const char **argv)
+static
+void check_batch(
+    struct cb_ctx *ctx,
+    const struct hound_record **recs,
+    hound_seqno first_seqno,
+    size_t n)
+{
+    size_t i;
+
+    XASSERT_EQ(first_seqno, ctx->seqno);
+    for (i = 0; i < n; ++i) {
+        XASSERT_EQ(recs[i]->size, sizeof(size_t));
+        XASSERT_EQ(ctx->count, *((size_t *) recs[i]->data));
+        XASSERT_EQ(recs[i]->dev_id, ctx->dev_id);
+        ++ctx->count;
+        ++ctx->seqno;
+    }
+}
+
+static
+void test_ctx(hound_queue_type queue_type, size_t total_records)
 {
     size_t bytes_read;
-    const char *config_path;
+    void *columns[1];
+    uint64_t *counts;
     struct hound_datadesc *desc;
+    uint64_t dropped;
     hound_err err;
     size_t count_bytes;
     size_t count_records;
+    hound_seqno first_seqno;
+    size_t i;
+    struct pollfd pfd;
     struct hound_data_rq rq_list[] =
         {
             {.id = HOUND_DATA_COUNTER, .period_ns = NSEC_PER_SEC/10000},
@@ -75,46 +104,26 @@ int main(int argc, const char **argv)
         };
     const struct hound_data_fmt *fmt;
     size_t len;
+    uint64_t prev_dropped;
     size_t records_read;
+    const struct hound_record **recs;
+    int ret;
     struct hound_rq rq;
-    const char *schema_base;
     size_t size;
     struct cb_ctx cb_ctx;
+    int64_t *timestamps;
     size_t total_bytes;
-    size_t total_records;
-
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s SCHEMA-BASE-PATH CONFIG-PATH\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
-        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
-        exit(EXIT_FAILURE);
-    }
-    schema_base = argv[1];
-    config_path = argv[2];
 
-    /*
-     * Valgrind substantially slows down runtime performance, so reduce the
-     * sample count so that tests will still finish in a reasonable amount of
-     * time.
-     */
-    if (RUNNING_ON_VALGRIND) {
-        total_records = 3;
-    }
-    else {
-        total_records = 100;
-    }
     total_bytes = total_records * sizeof(size_t);
 
-    err = hound_init_config(config_path, schema_base);
-    XASSERT_OK(err);
-
     cb_ctx.count = 0;
     cb_ctx.seqno = 0;
     cb_ctx.ctx = NULL;
     cb_ctx.allow_drops = false;
     rq.queue_len = 100 * total_records;
+    rq.queue_type = queue_type;
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.queue_max_len = rq.queue_len;
     rq.cb = data_cb;
     rq.cb_ctx = &cb_ctx;
     rq.rq_list.len = ARRAYLEN(rq_list);
@@ -155,6 +164,92 @@ int main(int argc, const char **argv)
     XASSERT_OK(err);
         XASSERT_EQ(records_read, total_records);
 
+    /* Do a timed read, with plenty of time to finish. */
+    err = hound_read_timeout(
+        cb_ctx.ctx,
+        total_records,
+        10*NSEC_PER_SEC,
+        &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, total_records);
+
+    /* A timed read that expires should return whatever is available. */
+    err = hound_read_timeout(cb_ctx.ctx, rq.queue_len, 0, &records_read);
+    XASSERT_OK(err);
+    XASSERT_LTE(records_read, rq.queue_len);
+
+    /* Do a sync batch read, which skips the callback. */
+    recs = malloc(total_records * sizeof(*recs));
+    XASSERT_NOT_NULL(recs);
+    err = hound_read_batch(
+        cb_ctx.ctx,
+        total_records,
+        recs,
+        &first_seqno,
+        &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, total_records);
+    check_batch(&cb_ctx, recs, first_seqno, records_read);
+    err = hound_release_batch(recs, records_read);
+    XASSERT_OK(err);
+
+    /* Do async batch reads. */
+    count_records = 0;
+    while (count_records < total_records) {
+        err = hound_read_batch_nowait(
+            cb_ctx.ctx,
+            total_records - count_records,
+            recs,
+            &first_seqno,
+            &records_read);
+        XASSERT_OK(err);
+        check_batch(&cb_ctx, recs, first_seqno, records_read);
+        err = hound_release_batch(recs, records_read);
+        XASSERT_OK(err);
+        count_records += records_read;
+    }
+    XASSERT_EQ(count_records, total_records);
+    free(recs);
+
+    /* Do columnar reads, which also skip the callback. */
+    counts = malloc(total_records * sizeof(*counts));
+    XASSERT_NOT_NULL(counts);
+    timestamps = malloc(total_records * sizeof(*timestamps));
+    XASSERT_NOT_NULL(timestamps);
+    columns[0] = counts;
+    err = hound_read_columns(
+        cb_ctx.ctx,
+        HOUND_DATA_NOP1,
+        total_records,
+        timestamps,
+        columns,
+        &records_read);
+    XASSERT_ERRCODE(err, HOUND_DATA_ID_DOES_NOT_EXIST);
+    count_records = 0;
+    while (count_records < total_records) {
+        err = hound_read_columns(
+            cb_ctx.ctx,
+            HOUND_DATA_COUNTER,
+            total_records - count_records,
+            timestamps + count_records,
+            columns,
+            &records_read);
+        XASSERT_OK(err);
+        columns[0] = counts + count_records + records_read;
+        count_records += records_read;
+    }
+    XASSERT_EQ(count_records, total_records);
+    for (i = 0; i < total_records; ++i) {
+        XASSERT_EQ(counts[i], cb_ctx.count);
+        if (i > 0) {
+            XASSERT_GTE(timestamps[i], timestamps[i-1]);
+        }
+        ++cb_ctx.count;
+        ++cb_ctx.seqno;
+    }
+    free(timestamps);
+    free(counts);
+
     /* Do single async reads. */
     count_records = 0;
     while (count_records < total_records) {
@@ -205,6 +300,39 @@ int main(int argc, const char **argv)
     XASSERT_EQ(count_bytes, total_bytes)
     XASSERT_GTE(count_records, total_records);
 
+    /* Do a sync byte read. */
+    err = hound_read_bytes(
+        cb_ctx.ctx,
+        total_bytes,
+        &records_read,
+        &bytes_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(bytes_read, total_bytes);
+    XASSERT_EQ(records_read, total_records);
+
+    /* Wait for data using the readiness fd. */
+    err = hound_ctx_set_fd_watermark(cb_ctx.ctx, 0);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    err = hound_ctx_set_fd_watermark(cb_ctx.ctx, rq.queue_len + 1);
+    XASSERT_ERRCODE(err, HOUND_QUEUE_TOO_SMALL);
+    err = hound_ctx_set_fd_watermark(cb_ctx.ctx, total_records);
+    XASSERT_OK(err);
+    err = hound_ctx_get_fd(cb_ctx.ctx, &pfd.fd);
+    XASSERT_OK(err);
+    pfd.events = POLLIN;
+    ret = poll(&pfd, 1, -1);
+    XASSERT_EQ(ret, 1);
+    XASSERT(pfd.revents & POLLIN);
+    err = hound_queue_length(cb_ctx.ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_GTE(len, total_records);
+    err = hound_read_nowait(cb_ctx.ctx, total_records, &records_read);
+    XASSERT_OK(err);
+    XASSERT_EQ(records_read, total_records);
+    err = hound_queue_high_water(cb_ctx.ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_GTE(len, total_records);
+
     /* Expand the queue length and verify we don't lose data. */
     rq.queue_len *= 5;
     cb_ctx.allow_drops = false;
@@ -239,6 +367,55 @@ int main(int argc, const char **argv)
     }
     XASSERT_EQ(count_records, total_records);
 
+    /* With no one reading, the small queue soon overflows. */
+    do {
+        err = hound_queue_dropped(cb_ctx.ctx, &dropped);
+        XASSERT_OK(err);
+    } while (dropped == 0);
+
+    /* Dropping new records leaves the queue full. */
+    rq.overflow_policy = HOUND_OVERFLOW_DROP_NEWEST;
+    err = hound_modify_ctx(cb_ctx.ctx, &rq, false);
+    XASSERT_OK(err);
+    prev_dropped = dropped;
+    do {
+        err = hound_queue_dropped(cb_ctx.ctx, &dropped);
+        XASSERT_OK(err);
+    } while (dropped == prev_dropped);
+    err = hound_queue_length(cb_ctx.ctx, &len);
+    XASSERT_OK(err);
+    XASSERT_EQ(len, rq.queue_len);
+
+    /* A growing queue should grow up to its cap. */
+    rq.overflow_policy = HOUND_OVERFLOW_GROW;
+    rq.queue_max_len = 4 * rq.queue_len;
+    err = hound_modify_ctx(cb_ctx.ctx, &rq, false);
+    XASSERT_OK(err);
+    do {
+        err = hound_max_queue_length(cb_ctx.ctx, &len);
+        XASSERT_OK(err);
+    } while (len < rq.queue_max_len);
+    XASSERT_EQ(len, rq.queue_max_len);
+
+    rq.queue_max_len = rq.queue_len - 1;
+    err = hound_modify_ctx(cb_ctx.ctx, &rq, false);
+    XASSERT_ERRCODE(err, HOUND_INVALID_OVERFLOW_POLICY);
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.queue_max_len = rq.queue_len;
+    err = hound_modify_ctx(cb_ctx.ctx, &rq, false);
+    XASSERT_OK(err);
+
+    /* The queue type is fixed for the life of the context. */
+    if (queue_type == HOUND_QUEUE_LOCKED) {
+        rq.queue_type = HOUND_QUEUE_RING;
+    }
+    else {
+        rq.queue_type = HOUND_QUEUE_LOCKED;
+    }
+    err = hound_modify_ctx(cb_ctx.ctx, &rq, false);
+    XASSERT_ERRCODE(err, HOUND_INVALID_QUEUE_TYPE);
+    rq.queue_type = queue_type;
+
     /* Change the data frequency. */
     rq_list[0].period_ns /= 2;
     rq_list[1].period_ns *= 2;
@@ -255,9 +432,886 @@ int main(int argc, const char **argv)
     XASSERT_OK(err);
     XASSERT_EQ(len, 0);
 
-    hound_free_ctx(cb_ctx.ctx);
+    err = hound_free_ctx(cb_ctx.ctx);
+    XASSERT_OK(err);
+}
+
+struct decimate_ctx {
+    uint64_t *values;
+    int64_t *timestamps;
+    size_t count;
+};
+
+static
+void decimate_cb(
+    const struct hound_record *rec,
+    UNUSED hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct decimate_ctx *ctx;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    ctx = cb_ctx;
+
+    XASSERT_EQ(rec->size, sizeof(uint64_t));
+    memcpy(&ctx->values[ctx->count], rec->data, sizeof(uint64_t));
+    ++ctx->count;
+}
+
+/*
+ * Run the counter at one period for a fast context, and check that contexts at
+ * a multiple of that period get every Nth value or the aggregate of every N
+ * values.
+ */
+static
+void test_decimate(hound_queue_type queue_type, size_t total_records)
+{
+    hound_aggregate aggregates[] = {
+        HOUND_AGGREGATE_NONE,
+        HOUND_AGGREGATE_MEAN,
+        HOUND_AGGREGATE_MIN,
+        HOUND_AGGREGATE_MAX
+    };
+    struct hound_ctx *bad;
+    struct hound_ctx *ctxs[ARRAYLEN(aggregates) + 1];
+    struct hound_data_rq data_rqs[ARRAYLEN(aggregates) + 1];
+    struct decimate_ctx dctxs[ARRAYLEN(aggregates) + 1];
+    hound_err err;
+    size_t i;
+    size_t j;
+    size_t read;
+    struct hound_rq rq;
+    const size_t stride = 4;
+
+    rq.queue_len = total_records;
+    rq.queue_type = queue_type;
+    rq.overflow_policy = HOUND_OVERFLOW_DROP_NEWEST;
+    rq.queue_max_len = rq.queue_len;
+    rq.cb = decimate_cb;
+    rq.rq_list.len = 1;
+
+    /* Context 0 sets the driver's period, and the others are folded onto it. */
+    memset(data_rqs, 0, sizeof(data_rqs));
+    for (i = 0; i < ARRAYLEN(ctxs); ++i) {
+        data_rqs[i].id = HOUND_DATA_COUNTER;
+        data_rqs[i].period_ns = NSEC_PER_SEC/1000;
+        if (i > 0) {
+            data_rqs[i].period_ns *= stride;
+            data_rqs[i].aggregate = aggregates[i-1];
+        }
+
+        dctxs[i].values = malloc(total_records * sizeof(*dctxs[i].values));
+        XASSERT_NOT_NULL(dctxs[i].values);
+        dctxs[i].timestamps = NULL;
+        dctxs[i].count = 0;
+
+        rq.cb_ctx = &dctxs[i];
+        rq.rq_list.data = &data_rqs[i];
+        err = hound_alloc_ctx(&rq, &ctxs[i]);
+        XASSERT_OK(err);
+        err = hound_start(ctxs[i]);
+        XASSERT_OK(err);
+    }
+
+    data_rqs[0].aggregate = ARRAYLEN(aggregates);
+    rq.rq_list.data = &data_rqs[0];
+    err = hound_alloc_ctx(&rq, &bad);
+    XASSERT_ERRCODE(err, HOUND_AGGREGATE_UNSUPPORTED);
+
+    /* Packed data can't be aggregated. */
+    data_rqs[0].aggregate = HOUND_AGGREGATE_MEAN;
+    data_rqs[0].pack = 2;
+    err = hound_alloc_ctx(&rq, &bad);
+    XASSERT_ERRCODE(err, HOUND_AGGREGATE_UNSUPPORTED);
+    data_rqs[0].aggregate = HOUND_AGGREGATE_NONE;
+    data_rqs[0].pack = 0;
+
+    /*
+     * Each slow context starts its first window wherever the counter happens
+     * to be, but from then on, its values come exactly one stride apart.
+     */
+    for (i = 1; i < ARRAYLEN(ctxs); ++i) {
+        err = hound_read(ctxs[i], total_records, &read);
+        XASSERT_OK(err);
+        XASSERT_EQ(read, total_records);
+        for (j = 1; j < total_records; ++j) {
+            XASSERT_EQ(dctxs[i].values[j] - dctxs[i].values[j-1], stride);
+        }
+    }
+
+    /* The fast context's queue filled up long ago, but it has every value. */
+    err = hound_read_all_nowait(ctxs[0], &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, total_records);
+    for (j = 1; j < total_records; ++j) {
+        XASSERT_EQ(dctxs[0].values[j], dctxs[0].values[j-1] + 1);
+    }
+
+    for (i = ARRAYLEN(ctxs); i > 0; --i) {
+        err = hound_stop(ctxs[i-1]);
+        XASSERT_OK(err);
+        err = hound_free_ctx(ctxs[i-1]);
+        XASSERT_OK(err);
+        free(dctxs[i-1].values);
+    }
+}
+
+static
+void decimate_ts_cb(
+    const struct hound_record *rec,
+    hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct decimate_ctx *ctx;
+
+    ctx = cb_ctx;
+    ctx->timestamps[ctx->count] =
+        NSEC_PER_SEC*rec->timestamp.tv_sec + rec->timestamp.tv_nsec;
+    decimate_cb(rec, seqno, cb_ctx);
+}
+
+/*
+ * Check that each filter rule holds back the records it should, before they
+ * reach the context's queue.
+ */
+static
+void test_filter(size_t total_records)
+{
+    struct hound_ctx *bad;
+    struct hound_ctx *ctxs[3];
+    struct hound_data_rq data_rqs[ARRAYLEN(ctxs)];
+    struct decimate_ctx dctxs[ARRAYLEN(ctxs)];
+    struct hound_datadesc *descs;
+    hound_dev_id dev_id;
+    hound_err err;
+    size_t i;
+    size_t j;
+    size_t len;
+    size_t read;
+    struct hound_rq rq;
+    const hound_data_period min_interval_ns = 5*(NSEC_PER_SEC/1000);
+
+    err = hound_get_datadescs(&descs, &len);
+    XASSERT_OK(err);
+    XASSERT_EQ(len, 1);
+    dev_id = descs[0].dev_id;
+    hound_free_datadescs(descs);
+
+    rq.queue_len = total_records;
+    rq.queue_type = HOUND_QUEUE_LOCKED;
+    rq.overflow_policy = HOUND_OVERFLOW_DROP_NEWEST;
+    rq.queue_max_len = rq.queue_len;
+    rq.cb = decimate_ts_cb;
+    rq.rq_list.len = 1;
+
+    memset(data_rqs, 0, sizeof(data_rqs));
+    for (i = 0; i < ARRAYLEN(ctxs); ++i) {
+        data_rqs[i].id = HOUND_DATA_COUNTER;
+        data_rqs[i].period_ns = NSEC_PER_SEC/1000;
+    }
+    /* Values more than 2.5 apart, from the right device. */
+    data_rqs[0].filter.flags = HOUND_FILTER_DEADBAND | HOUND_FILTER_DEV_ID;
+    data_rqs[0].filter.dev_id = dev_id;
+    data_rqs[0].filter.fmt_index = 0;
+    data_rqs[0].filter.deadband = 2.5;
+    /* No more than one record per interval. */
+    data_rqs[1].filter.flags = HOUND_FILTER_MIN_INTERVAL;
+    data_rqs[1].filter.min_interval_ns = min_interval_ns;
+    /* Only records from a device that isn't there. */
+    data_rqs[2].filter.flags = HOUND_FILTER_DEV_ID;
+    data_rqs[2].filter.dev_id = dev_id + 1;
+
+    for (i = 0; i < ARRAYLEN(ctxs); ++i) {
+        dctxs[i].values = malloc(total_records * sizeof(*dctxs[i].values));
+        XASSERT_NOT_NULL(dctxs[i].values);
+        dctxs[i].timestamps =
+            malloc(total_records * sizeof(*dctxs[i].timestamps));
+        XASSERT_NOT_NULL(dctxs[i].timestamps);
+        dctxs[i].count = 0;
+
+        rq.cb_ctx = &dctxs[i];
+        rq.rq_list.data = &data_rqs[i];
+        err = hound_alloc_ctx(&rq, &ctxs[i]);
+        XASSERT_OK(err);
+        err = hound_start(ctxs[i]);
+        XASSERT_OK(err);
+    }
+
+    /* Unknown flags and fields that can't be compared are rejected. */
+    data_rqs[0].filter.flags = UINT32_C(1) << 31;
+    rq.rq_list.data = &data_rqs[0];
+    err = hound_alloc_ctx(&rq, &bad);
+    XASSERT_ERRCODE(err, HOUND_INVALID_FILTER);
+    data_rqs[0].filter.flags = HOUND_FILTER_DEADBAND;
+    data_rqs[0].filter.fmt_index = 1;
+    err = hound_alloc_ctx(&rq, &bad);
+    XASSERT_ERRCODE(err, HOUND_INVALID_FILTER);
+
+    err = hound_read(ctxs[0], total_records, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, total_records);
+    for (j = 1; j < total_records; ++j) {
+        XASSERT_EQ(dctxs[0].values[j] - dctxs[0].values[j-1], 3);
+    }
+
+    err = hound_read(ctxs[1], total_records, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, total_records);
+    for (j = 1; j < total_records; ++j) {
+        XASSERT_GTE(
+            dctxs[1].timestamps[j] - dctxs[1].timestamps[j-1],
+            (int64_t) min_interval_ns);
+    }
+
+    err = hound_read_all_nowait(ctxs[2], &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, 0);
+
+    for (i = ARRAYLEN(ctxs); i > 0; --i) {
+        err = hound_stop(ctxs[i-1]);
+        XASSERT_OK(err);
+        err = hound_free_ctx(ctxs[i-1]);
+        XASSERT_OK(err);
+        free(dctxs[i-1].values);
+        free(dctxs[i-1].timestamps);
+    }
+}
+
+/*
+ * Check that changing only a running context's filter takes effect, even
+ * though the driver's data stays the same.
+ */
+static
+void test_modify_filter(size_t total_records)
+{
+    struct hound_ctx *ctx;
+    struct hound_data_rq data_rq;
+    struct decimate_ctx dctx;
+    struct hound_datadesc *descs;
+    hound_dev_id dev_id;
+    hound_err err;
+    size_t j;
+    size_t len;
+    size_t read;
+    struct hound_rq rq;
+    const struct timespec wait = { .tv_sec = 0, .tv_nsec = 20*NSEC_PER_MSEC };
+
+    err = hound_get_datadescs(&descs, &len);
     XASSERT_OK(err);
+    XASSERT_EQ(len, 1);
+    dev_id = descs[0].dev_id;
+    hound_free_datadescs(descs);
 
+    dctx.values = malloc(total_records * sizeof(*dctx.values));
+    XASSERT_NOT_NULL(dctx.values);
+    dctx.timestamps = NULL;
+    dctx.count = 0;
+
+    memset(&data_rq, 0, sizeof(data_rq));
+    data_rq.id = HOUND_DATA_COUNTER;
+    data_rq.period_ns = NSEC_PER_SEC/1000;
+    data_rq.filter.flags = HOUND_FILTER_DEADBAND;
+    data_rq.filter.fmt_index = 0;
+    data_rq.filter.deadband = 2.5;
+
+    rq.queue_len = total_records;
+    rq.queue_type = HOUND_QUEUE_LOCKED;
+    rq.overflow_policy = HOUND_OVERFLOW_DROP_NEWEST;
+    rq.queue_max_len = rq.queue_len;
+    rq.cb = decimate_cb;
+    rq.cb_ctx = &dctx;
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rq;
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+
+    err = hound_read(ctx, total_records, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, total_records);
+    for (j = 1; j < total_records; ++j) {
+        XASSERT_EQ(dctx.values[j] - dctx.values[j-1], 3);
+    }
+
+    /*
+     * Switch to a filter that passes nothing. A record or two may already be
+     * on its way under the old filter, so drop those, and then nothing more
+     * should come.
+     */
+    data_rq.filter.flags = HOUND_FILTER_DEV_ID;
+    data_rq.filter.dev_id = dev_id + 1;
+    err = hound_modify_ctx(ctx, &rq, true);
+    XASSERT_OK(err);
+    nanosleep(&wait, NULL);
+    dctx.count = 0;
+    err = hound_read_all_nowait(ctx, &read);
+    XASSERT_OK(err);
+    dctx.count = 0;
+    nanosleep(&wait, NULL);
+    err = hound_read_all_nowait(ctx, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, 0);
+
+    /* A wider deadband takes effect too. */
+    data_rq.filter.flags = HOUND_FILTER_DEADBAND;
+    data_rq.filter.deadband = 5.5;
+    err = hound_modify_ctx(ctx, &rq, true);
+    XASSERT_OK(err);
+    err = hound_read(ctx, total_records, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, total_records);
+    for (j = 1; j < total_records; ++j) {
+        XASSERT_EQ(dctx.values[j] - dctx.values[j-1], 6);
+    }
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+    free(dctx.values);
+}
+
+static
+void test_callback_threads(size_t total_records)
+{
+    struct hound_datadesc *desc;
+    hound_err err;
+    struct hound_data_rq data_rq;
+    size_t i;
+    size_t read;
+    struct hound_rq rq;
+    size_t size;
+    struct cb_ctx cb_ctx;
+    const size_t threads[] = { 4, 1, 2 };
+
+    err = hound_get_datadescs(&desc, &size);
+    XASSERT_OK(err);
+    XASSERT_EQ(size, 1);
+    memset(&cb_ctx, 0, sizeof(cb_ctx));
+    cb_ctx.dev_id = desc->dev_id;
+    hound_free_datadescs(desc);
+
+    memset(&data_rq, 0, sizeof(data_rq));
+    data_rq.id = HOUND_DATA_COUNTER;
+    data_rq.period_ns = NSEC_PER_SEC/10000;
+    rq.queue_len = 100 * total_records;
+    rq.queue_type = HOUND_QUEUE_LOCKED;
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.queue_max_len = rq.queue_len;
+    rq.cb = data_cb;
+    rq.cb_ctx = &cb_ctx;
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rq;
+    err = hound_alloc_ctx(&rq, &cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    err = hound_ctx_set_callback_threads(NULL, 2);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+    err = hound_ctx_set_callback_threads(cb_ctx.ctx, 0);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+    err = hound_ctx_set_callback_threads(cb_ctx.ctx, 65);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+
+    err = hound_start(cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    /* Records for one data ID stay in order, whatever the thread count. */
+    for (i = 0; i < ARRAYLEN(threads); ++i) {
+        err = hound_ctx_set_callback_threads(cb_ctx.ctx, threads[i]);
+        XASSERT_OK(err);
+        err = hound_read(cb_ctx.ctx, total_records, &read);
+        XASSERT_OK(err);
+        XASSERT_EQ(read, total_records);
+    }
+    XASSERT_EQ(cb_ctx.seqno, ARRAYLEN(threads) * total_records);
+
+    err = hound_stop(cb_ctx.ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(cb_ctx.ctx);
+    XASSERT_OK(err);
+}
+
+static
+void test_busy_poll(size_t total_records)
+{
+    struct hound_io_latency after;
+    struct hound_io_latency before;
+    struct hound_datadesc *desc;
+    hound_err err;
+    struct hound_data_rq data_rq;
+    size_t read;
+    struct hound_rq rq;
+    size_t size;
+    struct cb_ctx cb_ctx;
+
+    err = hound_set_io_busy_poll("/dev/nonexistent", NSEC_PER_MSEC);
+    XASSERT_ERRCODE(err, HOUND_DRIVER_NOT_REGISTERED);
+    err = hound_get_io_latency("/dev/counter", NULL);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+
+    err = hound_get_io_latency("/dev/counter", &before);
+    XASSERT_OK(err);
+    err = hound_set_io_busy_poll("/dev/counter", NSEC_PER_MSEC);
+    XASSERT_OK(err);
+
+    err = hound_get_datadescs(&desc, &size);
+    XASSERT_OK(err);
+    XASSERT_EQ(size, 1);
+    memset(&cb_ctx, 0, sizeof(cb_ctx));
+    cb_ctx.dev_id = desc->dev_id;
+    cb_ctx.allow_drops = true;
+    hound_free_datadescs(desc);
+    memset(&data_rq, 0, sizeof(data_rq));
+    data_rq.id = HOUND_DATA_COUNTER;
+    data_rq.period_ns = NSEC_PER_SEC/10000;
+    rq.queue_len = total_records;
+    rq.queue_type = HOUND_QUEUE_LOCKED;
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.queue_max_len = rq.queue_len;
+    rq.cb = data_cb;
+    rq.cb_ctx = &cb_ctx;
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rq;
+    err = hound_alloc_ctx(&rq, &cb_ctx.ctx);
+    XASSERT_OK(err);
+    err = hound_start(cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    err = hound_read(cb_ctx.ctx, total_records, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, total_records);
+
+    /* At 10 kHz, a 1 ms spin finds every pull without sleeping. */
+    err = hound_get_io_latency("/dev/counter", &after);
+    XASSERT_OK(err);
+    XASSERT_GTE(after.timer_fires - before.timer_fires, total_records);
+    XASSERT_GT(after.busy_wakeups, before.busy_wakeups);
+    XASSERT_GTE(after.timer_late_total_ns, before.timer_late_total_ns);
+    XASSERT_GTE(after.timer_late_max_ns, before.timer_late_max_ns);
+
+    err = hound_stop(cb_ctx.ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    err = hound_set_io_busy_poll(NULL, 0);
+    XASSERT_OK(err);
+}
+
+static
+void check_histogram(const struct hound_histogram *hist)
+{
+    uint64_t count;
+    size_t i;
+
+    count = 0;
+    for (i = 0; i < ARRAYLEN(hist->buckets); ++i) {
+        count += hist->buckets[i];
+    }
+    XASSERT_EQ(count, hist->count);
+    XASSERT_LTE(hist->max, hist->total);
+}
+
+static
+void test_stats(size_t total_records)
+{
+    struct cb_ctx cb_ctx;
+    struct hound_ctx_stats ctx_stats;
+    struct hound_datadesc *desc;
+    struct hound_driver_stats drv_stats;
+    hound_err err;
+    struct hound_io_stats io_stats;
+    struct hound_data_rq data_rq;
+    size_t read;
+    struct hound_rq rq;
+    size_t size;
+
+    err = hound_get_driver_stats("/dev/nonexistent", &drv_stats);
+    XASSERT_ERRCODE(err, HOUND_DRIVER_NOT_REGISTERED);
+    err = hound_get_driver_stats("/dev/counter", NULL);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+    err = hound_get_io_stats("/dev/nonexistent", &io_stats);
+    XASSERT_ERRCODE(err, HOUND_DRIVER_NOT_REGISTERED);
+    err = hound_get_ctx_stats(NULL, &ctx_stats);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+
+    err = hound_get_datadescs(&desc, &size);
+    XASSERT_OK(err);
+    XASSERT_EQ(size, 1);
+    memset(&cb_ctx, 0, sizeof(cb_ctx));
+    cb_ctx.dev_id = desc->dev_id;
+    hound_free_datadescs(desc);
+    memset(&data_rq, 0, sizeof(data_rq));
+    data_rq.id = HOUND_DATA_COUNTER;
+    data_rq.period_ns = NSEC_PER_SEC/1000;
+    memset(&rq, 0, sizeof(rq));
+    rq.queue_len = total_records;
+    rq.cb = data_cb;
+    rq.cb_ctx = &cb_ctx;
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rq;
+    err = hound_alloc_ctx(&rq, &cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    err = hound_get_ctx_stats(cb_ctx.ctx, &ctx_stats);
+    XASSERT_OK(err);
+    XASSERT_EQ(ctx_stats.queue_len, 0);
+    XASSERT_EQ(ctx_stats.read_batch.count, 0);
+    XASSERT_EQ(ctx_stats.callback_latency_ns.count, 0);
+
+    err = hound_start(cb_ctx.ctx);
+    XASSERT_OK(err);
+    err = hound_read(cb_ctx.ctx, total_records, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, total_records);
+    err = hound_stop(cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    err = hound_get_ctx_stats(cb_ctx.ctx, &ctx_stats);
+    XASSERT_OK(err);
+    XASSERT_EQ(ctx_stats.read_batch.total, total_records);
+    XASSERT_EQ(ctx_stats.callback_latency_ns.count, total_records);
+    XASSERT_GTE(ctx_stats.high_water, ctx_stats.read_batch.max);
+    check_histogram(&ctx_stats.read_batch);
+    check_histogram(&ctx_stats.callback_latency_ns);
+
+    err = hound_free_ctx(cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    /* Each counter record is a single uint64_t, pulled on a timer. */
+    err = hound_get_driver_stats("/dev/counter", &drv_stats);
+    XASSERT_OK(err);
+    XASSERT_GTE(drv_stats.records, total_records);
+    XASSERT_EQ(drv_stats.bytes, drv_stats.records * sizeof(uint64_t));
+    XASSERT_GT(drv_stats.reads, 0);
+    XASSERT_GT(drv_stats.parse_ns.count, 0);
+    XASSERT_GT(drv_stats.poll_ns.count, 0);
+    XASSERT_GTE(drv_stats.pull_late_ns.count, total_records);
+    check_histogram(&drv_stats.parse_ns);
+    check_histogram(&drv_stats.poll_ns);
+    check_histogram(&drv_stats.pull_late_ns);
+
+    err = hound_get_io_stats("/dev/counter", &io_stats);
+    XASSERT_OK(err);
+    XASSERT_GT(io_stats.iterations, 0);
+    XASSERT_GTE(io_stats.wakeup_jitter_ns.count, drv_stats.pull_late_ns.count);
+    XASSERT_GT(io_stats.sync_stall_ns.count, 0);
+    check_histogram(&io_stats.sync_stall_ns);
+    check_histogram(&io_stats.wakeup_jitter_ns);
+
+    err = hound_get_io_stats(NULL, &io_stats);
+    XASSERT_OK(err);
+    XASSERT_GT(io_stats.iterations, 0);
+}
+
+struct multicast_ctx {
+    struct hound_ctx *ctx;
+    size_t count;
+    hound_seqno first_seqno;
+    uint64_t first_value;
+};
+
+static
+void multicast_cb(
+    const struct hound_record *rec,
+    hound_seqno seqno,
+    void *cb_ctx)
+{
+    struct multicast_ctx *ctx;
+    uint64_t value;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    ctx = cb_ctx;
+
+    XASSERT_EQ(rec->size, sizeof(value));
+    memcpy(&value, rec->data, sizeof(value));
+
+    /*
+     * Each context starts wherever the counter happens to be, but from then on,
+     * it sees every value, in order.
+     */
+    if (ctx->count == 0) {
+        ctx->first_seqno = seqno;
+        ctx->first_value = value;
+    }
+    XASSERT_EQ(seqno - ctx->first_seqno, ctx->count);
+    XASSERT_EQ(value - ctx->first_value, ctx->count);
+    ++ctx->count;
+}
+
+/*
+ * Share the counter between several multicast contexts, and check that each of
+ * them sees every record, including one that falls far behind the rest and
+ * one that is stopped with records still queued.
+ */
+static
+void test_multicast(size_t total_records)
+{
+    struct multicast_ctx ctxs[4];
+    struct hound_data_rq data_rq;
+    uint64_t dropped;
+    hound_err err;
+    size_t i;
+    size_t lag_records;
+    size_t len;
+    size_t read;
+    struct hound_rq rq;
+    const size_t lagging = ARRAYLEN(ctxs) - 1;
+    const size_t stopped = ARRAYLEN(ctxs) - 2;
+
+    lag_records = 100 * total_records;
+
+    memset(&data_rq, 0, sizeof(data_rq));
+    data_rq.id = HOUND_DATA_COUNTER;
+    data_rq.period_ns = NSEC_PER_SEC/10000;
+    rq.queue_len = 2 * lag_records;
+    rq.queue_type = HOUND_QUEUE_MULTICAST;
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.queue_max_len = rq.queue_len;
+    rq.cb = multicast_cb;
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rq;
+
+    memset(ctxs, 0, sizeof(ctxs));
+    for (i = 0; i < ARRAYLEN(ctxs); ++i) {
+        rq.cb_ctx = &ctxs[i];
+        err = hound_alloc_ctx(&rq, &ctxs[i].ctx);
+        XASSERT_OK(err);
+        err = hound_start(ctxs[i].ctx);
+        XASSERT_OK(err);
+    }
+
+    /* Everyone but the lagging context keeps up. */
+    while (ctxs[0].count < lag_records) {
+        for (i = 0; i < lagging; ++i) {
+            err = hound_read(ctxs[i].ctx, total_records, &read);
+            XASSERT_OK(err);
+            XASSERT_EQ(read, total_records);
+        }
+    }
+
+    /* Records queued when a context stops can still be read. */
+    err = hound_stop(ctxs[stopped].ctx);
+    XASSERT_OK(err);
+    err = hound_queue_length(ctxs[stopped].ctx, &len);
+    XASSERT_OK(err);
+    err = hound_read_all_nowait(ctxs[stopped].ctx, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, len);
+    err = hound_read_all_nowait(ctxs[stopped].ctx, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, 0);
+
+    /* The lagging context still has everything since it started. */
+    err = hound_read_all_nowait(ctxs[lagging].ctx, &read);
+    XASSERT_OK(err);
+    XASSERT_GTE(
+        ctxs[lagging].first_value + ctxs[lagging].count,
+        ctxs[0].first_value + ctxs[0].count);
+    err = hound_queue_dropped(ctxs[lagging].ctx, &dropped);
+    XASSERT_OK(err);
+    XASSERT_EQ(dropped, 0);
+
+    for (i = 0; i < ARRAYLEN(ctxs); ++i) {
+        if (i != stopped) {
+            err = hound_stop(ctxs[i].ctx);
+            XASSERT_OK(err);
+        }
+        err = hound_free_ctx(ctxs[i].ctx);
+        XASSERT_OK(err);
+    }
+}
+
+struct stop_reader {
+    pthread_t thread;
+    struct hound_ctx *ctx;
+    atomic_size_t *entered;
+    hound_err err;
+    size_t read;
+};
+
+static
+void *stop_reader_thread(void *data)
+{
+    struct stop_reader *reader;
+
+    reader = data;
+    atomic_fetch_add(reader->entered, 1);
+    reader->err = hound_read(reader->ctx, 1, &reader->read);
+
+    return NULL;
+}
+
+static
+void test_stop_readers(hound_queue_type queue_type)
+{
+    struct hound_data_rq data_rq;
+    atomic_size_t entered;
+    hound_err err;
+    size_t i;
+    struct stop_reader readers[3];
+    struct hound_rq rq;
+    struct cb_ctx cb_ctx;
+    const struct timespec settle = { .tv_sec = 0, .tv_nsec = NSEC_PER_SEC/20 };
+
+    memset(&cb_ctx, 0, sizeof(cb_ctx));
+    memset(&data_rq, 0, sizeof(data_rq));
+    data_rq.id = HOUND_DATA_COUNTER;
+    data_rq.period_ns = 0;
+    rq.queue_len = 16;
+    rq.queue_type = queue_type;
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.queue_max_len = rq.queue_len;
+    rq.cb = data_cb;
+    rq.cb_ctx = &cb_ctx;
+    rq.rq_list.len = 1;
+    rq.rq_list.data = &data_rq;
+    err = hound_alloc_ctx(&rq, &cb_ctx.ctx);
+    XASSERT_OK(err);
+    err = hound_start(cb_ctx.ctx);
+    XASSERT_OK(err);
+
+    /*
+     * Nothing asks for on-demand data, so every reader blocks until the stop,
+     * which must wake all of them and not just the first.
+     */
+    atomic_init(&entered, 0);
+    for (i = 0; i < ARRAYLEN(readers); ++i) {
+        readers[i].ctx = cb_ctx.ctx;
+        readers[i].entered = &entered;
+        err = pthread_create(
+            &readers[i].thread,
+            NULL,
+            stop_reader_thread,
+            &readers[i]);
+        XASSERT_EQ(err, 0);
+    }
+    while (atomic_load(&entered) < ARRAYLEN(readers)) {
+        nanosleep(&settle, NULL);
+    }
+    nanosleep(&settle, NULL);
+
+    err = hound_stop(cb_ctx.ctx);
+    XASSERT_OK(err);
+    for (i = 0; i < ARRAYLEN(readers); ++i) {
+        err = pthread_join(readers[i].thread, NULL);
+        XASSERT_EQ(err, 0);
+        XASSERT_ERRCODE(readers[i].err, HOUND_CTX_STOPPED);
+        XASSERT_EQ(readers[i].read, 0);
+    }
+
+    err = hound_free_ctx(cb_ctx.ctx);
+    XASSERT_OK(err);
+}
+
+int main(int argc, const char **argv)
+{
+    const char *config_path;
+    hound_err err;
+    const char *schema_base;
+    size_t total_records;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s SCHEMA-BASE-PATH CONFIG-PATH\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    schema_base = argv[1];
+    config_path = argv[2];
+
+    /*
+     * Valgrind substantially slows down runtime performance, so reduce the
+     * sample count so that tests will still finish in a reasonable amount of
+     * time.
+     */
+    if (RUNNING_ON_VALGRIND) {
+        total_records = 3;
+    }
+    else {
+        total_records = 100;
+    }
+
+    /*
+     * Each run expects the counter to start from 0, so give each queue type a
+     * fresh driver.
+     */
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_ctx(HOUND_QUEUE_LOCKED, total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_ctx(HOUND_QUEUE_RING, total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_ctx(HOUND_QUEUE_MULTICAST, total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_decimate(HOUND_QUEUE_LOCKED, total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_decimate(HOUND_QUEUE_MULTICAST, total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_multicast(total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_callback_threads(total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_busy_poll(total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_stats(total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_filter(total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_modify_filter(total_records);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+    test_stop_readers(HOUND_QUEUE_LOCKED);
+    test_stop_readers(HOUND_QUEUE_RING);
+    test_stop_readers(HOUND_QUEUE_MULTICAST);
     err = hound_destroy_driver("/dev/counter");
     XASSERT_OK(err);
 
@@ -2,7 +2,9 @@
  * @file      counter.c
  * @brief     Counter driver implementation. This driver simply increments a
  *            counter every time it is read from in order to do a basic test of
- *            the I/O subsystem.
+ *            the I/O subsystem. An optional second init argument pads each
+ *            record out to the given size, with the count in its first bytes,
+ *            so benchmarks can vary the record size.
  * @author    Martin Kelly <mkelly@xevo.com>
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
@@ -12,7 +14,9 @@
 #include <hound-private/util.h>
 #include <hound-test/assert.h>
 #include <hound-test/id.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -24,6 +28,8 @@
 struct counter_ctx {
     int pipe[2];
     uint64_t count;
+    size_t record_size;
+    unsigned char *buf;
 };
 
 static
@@ -37,7 +43,12 @@ hound_err counter_init(
     if (args == NULL) {
         return HOUND_NULL_VAL;
     }
-    if (arg_count != 1 || args->type != HOUND_TYPE_UINT64) {
+    if (arg_count < 1 || arg_count > 2 || args[0].type != HOUND_TYPE_UINT64) {
+        return HOUND_INVALID_VAL;
+    }
+    if (arg_count == 2 &&
+        (args[1].type != HOUND_TYPE_UINT64 ||
+         args[1].data.as_uint64 < sizeof(ctx->count))) {
         return HOUND_INVALID_VAL;
     }
 
@@ -47,7 +58,14 @@ hound_err counter_init(
     }
     ctx->pipe[READ_END] = FD_INVALID;
     ctx->pipe[WRITE_END] = FD_INVALID;
-    ctx->count = args->data.as_uint64;
+    ctx->count = args[0].data.as_uint64;
+    ctx->record_size =
+        arg_count == 2 ? args[1].data.as_uint64 : sizeof(ctx->count);
+    ctx->buf = calloc(1, ctx->record_size);
+    if (ctx->buf == NULL) {
+        free(ctx);
+        return HOUND_OOM;
+    }
 
     drv_set_ctx(ctx);
 
@@ -57,7 +75,11 @@ hound_err counter_init(
 static
 hound_err counter_destroy(void)
 {
-    free(drv_ctx());
+    struct counter_ctx *ctx;
+
+    ctx = drv_ctx();
+    free(ctx->buf);
+    free(ctx);
 
     return HOUND_OK;
 }
@@ -99,8 +121,10 @@ hound_err counter_parse(unsigned char *buf, size_t bytes)
     struct counter_ctx *ctx;
     hound_err err;
     size_t i;
-    struct hound_record record;
+    size_t n;
     const unsigned char *pos;
+    struct hound_record *record;
+    struct hound_record records[DRV_PUSH_BATCH_SIZE];
 
     XASSERT_NOT_NULL(buf);
     XASSERT_GT(bytes, 0);
@@ -108,32 +132,44 @@ hound_err counter_parse(unsigned char *buf, size_t bytes)
     ctx = drv_ctx();
     XASSERT_NOT_NULL(ctx);
 
-    /* We write full counts, so we should not get partial reads. */
-    if (bytes % sizeof(ctx->count) != 0) {
+    /* We write full records, so we should not get partial reads. */
+    if (bytes % ctx->record_size != 0) {
         return HOUND_DRIVER_FAIL;
     }
 
-    count = bytes / sizeof(ctx->count);
+    count = bytes / ctx->record_size;
+    n = 0;
     pos = buf;
+    err = HOUND_OK;
     for (i = 0; i < count; ++i) {
-        record.data = drv_alloc(sizeof(ctx->count));
-        if (record.data == NULL) {
-            return HOUND_OOM;
+        record = &records[n];
+        record->data = drv_record_alloc(ctx->record_size);
+        if (record->data == NULL) {
+            err = HOUND_OOM;
+            break;
         }
 
         /* We have at least a full record. */
-        err = clock_gettime(CLOCK_REALTIME, &record.timestamp);
+        err = clock_gettime(CLOCK_REALTIME, &record->timestamp);
         XASSERT_EQ(err, 0);
-        record.data_id = HOUND_DATA_COUNTER;
-        record.size = sizeof(ctx->count);
-        memcpy(record.data, pos, sizeof(ctx->count));
+        record->data_id = HOUND_DATA_COUNTER;
+        record->size = ctx->record_size;
+        memcpy(record->data, pos, ctx->record_size);
+
+        ++n;
+        if (n == ARRAYLEN(records)) {
+            drv_push_records(records, n);
+            n = 0;
+        }
 
-        drv_push_records(&record, 1);
+        pos += ctx->record_size;
+    }
 
-        pos += sizeof(ctx->count);
+    if (n > 0) {
+        drv_push_records(records, n);
     }
 
-    return HOUND_OK;
+    return err;
 }
 
 static
@@ -148,10 +184,15 @@ hound_err counter_start(int *fd)
     XASSERT_EQ(ctx->pipe[READ_END], FD_INVALID);
     XASSERT_EQ(ctx->pipe[WRITE_END], FD_INVALID);
 
-    err = pipe(ctx->pipe);
+    /*
+     * Use a datagram socket pair rather than a pipe, so this driver covers the
+     * core's recvmmsg path.
+     */
+    err = socketpair(AF_UNIX, SOCK_DGRAM, 0, ctx->pipe);
     if (err != 0) {
-        return err;
+        return errno;
     }
+    drv_set_read_msgs(ctx->record_size);
     *fd = ctx->pipe[READ_END];
 
     return HOUND_OK;
@@ -191,14 +232,44 @@ hound_err counter_next(hound_data_id id)
 
     XASSERT_EQ(id, HOUND_DATA_COUNTER);
 
-    written = write(ctx->pipe[WRITE_END], &ctx->count, sizeof(ctx->count));
-    XASSERT_EQ(written, sizeof(ctx->count));
+    memcpy(ctx->buf, &ctx->count, sizeof(ctx->count));
+    written = write(ctx->pipe[WRITE_END], ctx->buf, ctx->record_size);
+    XASSERT_EQ(written, (ssize_t) ctx->record_size);
 
     ++ctx->count;
 
 	return HOUND_OK;
 }
 
+static
+hound_err counter_next_batch(
+    const hound_data_id *ids,
+    size_t count,
+    size_t n)
+{
+    hound_err err;
+    size_t i;
+    size_t j;
+
+    XASSERT_NOT_NULL(ids);
+
+    /*
+     * The same ID can show up more than once when it's requested at several
+     * periods, and each instance gets its own records. Each value is its own
+     * datagram, as the socket reads one per message.
+     */
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < n; ++j) {
+            err = counter_next(ids[i]);
+            if (err != HOUND_OK) {
+                return err;
+            }
+        }
+    }
+
+    return HOUND_OK;
+}
+
 static struct driver_ops counter_driver = {
     .init = counter_init,
     .destroy = counter_destroy,
@@ -209,6 +280,7 @@ static struct driver_ops counter_driver = {
     .parse = counter_parse,
     .start = counter_start,
     .next = counter_next,
+    .next_batch = counter_next_batch,
     .stop = counter_stop
 };
 
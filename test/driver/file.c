@@ -127,7 +127,7 @@ hound_err file_parse(unsigned char *buf, size_t bytes)
     XASSERT_NOT_NULL(buf);
     XASSERT_GT(bytes, 0);
 
-    record.data = drv_alloc(bytes * sizeof(*buf));
+    record.data = drv_record_alloc(bytes * sizeof(*buf));
     if (record.data == NULL) {
         return HOUND_OOM;
     }
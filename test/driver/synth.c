@@ -0,0 +1,351 @@
+/**
+ * @file      synth.c
+ * @brief     Synthetic load driver. This driver makes records at a configured
+ *            rate, for soak-testing the I/O loop and the rest of the record
+ *            path. A timerfd wakes the I/O loop once per burst, and each
+ *            expiration yields a burst of records spread round-robin across the
+ *            requested data IDs, with sizes drawn uniformly from a range. Each
+ *            record starts with a per-ID sequence number, so readers can spot
+ *            drops. The init arguments, all uint64, are:
+ *
+ *            - the average rate, in records per second
+ *            - the smallest record size, in bytes, at least 8
+ *            - the largest record size, in bytes
+ *            - the number of records per burst
+ *            - the number of data IDs to enable, from 1 to SYNTH_MAX_IDS
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <hound/hound.h>
+#include <hound-private/driver.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FD_INVALID (-1)
+
+#define SYNTH_ARG_COUNT 5
+
+struct synth_ctx {
+    int fd;
+    uint64_t rate;
+    size_t min_size;
+    size_t max_size;
+    uint64_t burst;
+    size_t id_count;
+
+    /* The requested IDs, as set by setdata. */
+    hound_data_id active_ids[SYNTH_MAX_IDS];
+    size_t active_count;
+    size_t next_id;
+    uint64_t seqnos[SYNTH_MAX_IDS];
+
+    uint64_t rand_state;
+};
+
+static
+hound_err synth_init(
+    UNUSED const char *path,
+    size_t arg_count,
+    const struct hound_init_arg *args)
+{
+    struct synth_ctx *ctx;
+    size_t i;
+
+    if (args == NULL) {
+        return HOUND_NULL_VAL;
+    }
+    if (arg_count != SYNTH_ARG_COUNT) {
+        return HOUND_INVALID_VAL;
+    }
+    for (i = 0; i < arg_count; ++i) {
+        if (args[i].type != HOUND_TYPE_UINT64) {
+            return HOUND_INVALID_VAL;
+        }
+    }
+    if (args[0].data.as_uint64 == 0 ||
+        args[1].data.as_uint64 < sizeof(uint64_t) ||
+        args[2].data.as_uint64 < args[1].data.as_uint64 ||
+        args[3].data.as_uint64 == 0 ||
+        args[4].data.as_uint64 == 0 ||
+        args[4].data.as_uint64 > SYNTH_MAX_IDS) {
+        return HOUND_INVALID_VAL;
+    }
+
+    ctx = malloc(sizeof(*ctx));
+    if (ctx == NULL) {
+        return HOUND_OOM;
+    }
+    ctx->fd = FD_INVALID;
+    ctx->rate = args[0].data.as_uint64;
+    ctx->min_size = args[1].data.as_uint64;
+    ctx->max_size = args[2].data.as_uint64;
+    ctx->burst = args[3].data.as_uint64;
+    ctx->id_count = args[4].data.as_uint64;
+    ctx->active_count = 0;
+    ctx->next_id = 0;
+    memset(ctx->seqnos, 0, sizeof(ctx->seqnos));
+    ctx->rand_state = 0x9e3779b97f4a7c15;
+
+    drv_set_ctx(ctx);
+
+    return HOUND_OK;
+}
+
+static
+hound_err synth_destroy(void)
+{
+    free(drv_ctx());
+
+    return HOUND_OK;
+}
+
+static
+hound_err synth_device_name(char *device_name)
+{
+    XASSERT_NOT_NULL(device_name);
+
+    strcpy(device_name, "synth");
+
+    return HOUND_OK;
+}
+
+static
+hound_err synth_datadesc(size_t desc_count, struct drv_datadesc *descs)
+{
+    struct synth_ctx *ctx;
+    struct drv_datadesc *desc;
+    size_t i;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+    XASSERT_EQ(desc_count, SYNTH_MAX_IDS);
+
+    for (i = 0; i < desc_count; ++i) {
+        desc = &descs[i];
+        XASSERT_EQ(desc->schema_desc->data_id, HOUND_DATA_SYNTH(i));
+        desc->enabled = i < ctx->id_count;
+        if (!desc->enabled) {
+            continue;
+        }
+        desc->period_count = 1;
+        desc->avail_periods = drv_alloc(sizeof(*desc->avail_periods));
+        if (desc->avail_periods == NULL) {
+            for (--i; i < desc_count; --i) {
+                drv_free(descs[i].avail_periods);
+            }
+            return HOUND_OOM;
+        }
+        desc->avail_periods[0] = 0;
+    }
+
+    return HOUND_OK;
+}
+
+static
+hound_err synth_setdata(const struct hound_data_rq *rqs, size_t rqs_len)
+{
+    struct synth_ctx *ctx;
+    size_t i;
+    size_t j;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    /* The same ID can be requested more than once; make it only once. */
+    ctx->active_count = 0;
+    for (i = 0; i < rqs_len; ++i) {
+        for (j = 0; j < ctx->active_count; ++j) {
+            if (ctx->active_ids[j] == rqs[i].id) {
+                break;
+            }
+        }
+        if (j == ctx->active_count) {
+            XASSERT_LT(ctx->active_count, ARRAYLEN(ctx->active_ids));
+            ctx->active_ids[ctx->active_count] = rqs[i].id;
+            ++ctx->active_count;
+        }
+    }
+    ctx->next_id = 0;
+
+    return HOUND_OK;
+}
+
+/* xorshift64, which is plenty for picking record sizes. */
+static
+uint64_t next_rand(struct synth_ctx *ctx)
+{
+    uint64_t x;
+
+    x = ctx->rand_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    ctx->rand_state = x;
+
+    return x;
+}
+
+static
+hound_err make_record(
+    struct synth_ctx *ctx,
+    const struct timespec *timestamp,
+    struct hound_record *record)
+{
+    hound_data_id id;
+    size_t index;
+    size_t size;
+
+    size = ctx->min_size + next_rand(ctx) % (ctx->max_size - ctx->min_size + 1);
+    record->data = drv_record_alloc(size);
+    if (record->data == NULL) {
+        return HOUND_OOM;
+    }
+
+    id = ctx->active_ids[ctx->next_id];
+    ctx->next_id = (ctx->next_id + 1) % ctx->active_count;
+    index = id - HOUND_DATA_SYNTH(0);
+    XASSERT_LT(index, ARRAYLEN(ctx->seqnos));
+
+    memcpy(record->data, &ctx->seqnos[index], sizeof(ctx->seqnos[index]));
+    memset(
+        record->data + sizeof(ctx->seqnos[index]),
+        0,
+        size - sizeof(ctx->seqnos[index]));
+    ++ctx->seqnos[index];
+    record->data_id = id;
+    record->timestamp = *timestamp;
+    record->size = size;
+
+    return HOUND_OK;
+}
+
+static
+hound_err synth_parse(unsigned char *buf, size_t bytes)
+{
+    struct synth_ctx *ctx;
+    hound_err err;
+    uint64_t expirations;
+    size_t n;
+    struct hound_record records[DRV_PUSH_BATCH_SIZE];
+    uint64_t remaining;
+    struct timespec timestamp;
+
+    XASSERT_NOT_NULL(buf);
+    XASSERT_EQ(bytes, sizeof(expirations));
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    if (ctx->active_count == 0) {
+        return HOUND_OK;
+    }
+
+    /*
+     * If the I/O loop fell behind, the timer expired more than once, so make
+     * up for every burst we missed, as a real device's backlog would.
+     */
+    memcpy(&expirations, buf, sizeof(expirations));
+    err = clock_gettime(CLOCK_REALTIME, &timestamp);
+    XASSERT_EQ(err, 0);
+
+    err = HOUND_OK;
+    n = 0;
+    for (remaining = expirations * ctx->burst; remaining > 0; --remaining) {
+        err = make_record(ctx, &timestamp, &records[n]);
+        if (err != HOUND_OK) {
+            break;
+        }
+        ++n;
+        if (n == ARRAYLEN(records)) {
+            drv_push_records(records, n);
+            n = 0;
+        }
+    }
+
+    if (n > 0) {
+        drv_push_records(records, n);
+    }
+
+    return err;
+}
+
+static
+hound_err synth_start(int *out_fd)
+{
+    struct synth_ctx *ctx;
+    int fd;
+    uint64_t interval_ns;
+    struct itimerspec spec;
+    int ret;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+    XASSERT_NOT_NULL(out_fd);
+    XASSERT_EQ(ctx->fd, FD_INVALID);
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        return errno;
+    }
+
+    /* One expiration per burst, keeping the average at the requested rate. */
+    interval_ns = max(ctx->burst * NSEC_PER_SEC / ctx->rate, 1);
+    spec.it_interval.tv_sec = interval_ns / NSEC_PER_SEC;
+    spec.it_interval.tv_nsec = interval_ns % NSEC_PER_SEC;
+    spec.it_value = spec.it_interval;
+    ret = timerfd_settime(fd, 0, &spec, NULL);
+    if (ret == -1) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+
+    ctx->fd = fd;
+    *out_fd = fd;
+
+    return HOUND_OK;
+}
+
+static
+hound_err synth_stop(void)
+{
+    struct synth_ctx *ctx;
+    hound_err err;
+
+    ctx = drv_ctx();
+    XASSERT_NOT_NULL(ctx);
+
+    XASSERT_NEQ(ctx->fd, FD_INVALID);
+    err = close(ctx->fd);
+    XASSERT_NEQ(err, -1);
+    ctx->fd = FD_INVALID;
+
+    return HOUND_OK;
+}
+
+static struct driver_ops synth_driver = {
+    .init = synth_init,
+    .destroy = synth_destroy,
+    .device_name = synth_device_name,
+    .datadesc = synth_datadesc,
+    .setdata = synth_setdata,
+    .poll = drv_default_push,
+    .parse = synth_parse,
+    .start = synth_start,
+    .next = NULL,
+    .stop = synth_stop
+};
+
+HOUND_DRIVER_REGISTER_FUNC
+static void register_synth_driver(void)
+{
+    driver_register("synth", &synth_driver);
+}
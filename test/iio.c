@@ -155,10 +155,10 @@ int main(int argc, const char **argv)
     }
 
     rq.rq_list.len = iio_count;
-    rq.rq_list.data = malloc(iio_count * sizeof(*rq.rq_list.data));
+    rq.rq_list.data = calloc(iio_count, sizeof(*rq.rq_list.data));
     if (rq.rq_list.data == NULL) {
         status = EXIT_FAILURE;
-        perror("malloc");
+        perror("calloc");
         goto error;
     }
     for (i = 0; i < iio_count; ++i) {
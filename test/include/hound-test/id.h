@@ -19,4 +19,8 @@
 #define HOUND_DATA_NOP1 ((hound_data_id) 0xffffff02)
 #define HOUND_DATA_NOP2 ((hound_data_id) 0xffffff03)
 
+/* The synth driver has SYNTH_MAX_IDS consecutive data IDs. */
+#define SYNTH_MAX_IDS 8
+#define HOUND_DATA_SYNTH(n) ((hound_data_id) (0xffffff10 + (n)))
+
 #endif /* HOUND_TEST_ID_H_ */
@@ -155,6 +155,35 @@ void validate_msg_g(const struct hound_record *record)
     }
 }
 
+/* Topic h carries a batch of samples, each with its own timestamp. */
+#define BATCH_SAMPLES 3
+#define BATCH_BASE_NS (1600000000*NSEC_PER_SEC)
+
+static
+void make_msg_h(msgpack_packer *packer)
+{
+    size_t i;
+
+    msgpack_pack_array(packer, BATCH_SAMPLES);
+    for (i = 0; i < BATCH_SAMPLES; ++i) {
+        msgpack_pack_array(packer, 2);
+        msgpack_pack_fix_uint64(packer, BATCH_BASE_NS + i);
+        msgpack_pack_float(packer, i);
+    }
+}
+
+static
+void validate_msg_h(const struct hound_record *record)
+{
+    uint64_t i;
+
+    i = NSEC_PER_SEC*record->timestamp.tv_sec + record->timestamp.tv_nsec -
+        BATCH_BASE_NS;
+    XASSERT_LT(i, BATCH_SAMPLES);
+    XASSERT_EQ(record->size, sizeof(float));
+    XASSERT_FLTEQ(*((float *) record->data), (float) i);
+}
+
 typedef void (*make_msg_func)(msgpack_packer *packer);
 typedef void (*validate_msg_func)(const struct hound_record *record);
 
@@ -207,6 +236,12 @@ const struct topic_info s_topic_info[] = {
         .topic = "g",
         .msg_func = make_msg_g,
         .validate_func = validate_msg_g
+    },
+    {
+        .data_id = 0xfe000007,
+        .topic = "h",
+        .msg_func = make_msg_h,
+        .validate_func = validate_msg_h
     }
 };
 
@@ -451,6 +486,7 @@ int main(int argc, const char **argv)
     }
     mosq_conf = argv[3];
 
+    memset(data_rqs, 0, sizeof(data_rqs));
     for (i = 0; i < test_ctx.count; ++i) {
         data_rq = &data_rqs[i];
         data_rq->id = test_ctx.info[i].data_id;
@@ -484,7 +520,8 @@ int main(int argc, const char **argv)
 
     publish_messages(&test_ctx, MQTT_HOST, MQTT_PORT);
 
-    err = hound_read(ctx, test_ctx.count, NULL);
+    /* Every topic sends one record, except h, which sends a batch. */
+    err = hound_read(ctx, test_ctx.count - 1 + BATCH_SAMPLES, NULL);
     XASSERT_EQ(err, HOUND_OK);
 
     err = hound_stop(ctx);
@@ -15,6 +15,8 @@
 #include <linux/limits.h>
 #include <string.h>
 
+#include "nop-schema.h"
+
 void data_cb(
     const struct hound_record *rec,
     UNUSED hound_seqno seqno,
@@ -56,6 +58,16 @@ void test_driver_init(const char *config_path, const char *schema_base)
     err = hound_destroy_all_drivers();
     XASSERT_OK(err);
 
+    err = hound_init_config_parallel(config_path, schema_base, 0);
+    XASSERT_OK(err);
+
+    /* Registering the same config twice must fail and leave the first. */
+    err = hound_init_config_parallel(config_path, schema_base, 0);
+    XASSERT_ERRCODE(err, HOUND_DRIVER_ALREADY_PRESENT);
+
+    err = hound_destroy_all_drivers();
+    XASSERT_OK(err);
+
     err = hound_init_config(config_path, schema_base);
     XASSERT_OK(err);
 }
@@ -95,9 +107,82 @@ void test_datadescs(void)
     XASSERT_EQ(descs[1].fmts[0].unit, HOUND_UNIT_NONE);
     XASSERT_EQ(descs[1].fmts[0].type, HOUND_TYPE_BYTES);
 
+    /* The generated accessors must agree with the runtime layout. */
+    XASSERT_EQ(descs[0].data_id, NOP_NOP_ID);
+    XASSERT_EQ(descs[0].fmts[0].offset, NOP_NOP_A_OFFSET);
+    XASSERT_EQ(descs[0].fmts[1].offset, NOP_NOP_B_OFFSET);
+    XASSERT_EQ(descs[1].data_id, NOP_NOP2_ID);
+    XASSERT_EQ(descs[1].fmts[0].offset, NOP_NOP2_X_OFFSET);
+    XASSERT_EQ(descs[1].fmts[0].size, NOP_NOP2_SIZE);
+
     hound_free_datadescs(descs);
 }
 
+static
+void test_schema_header(void)
+{
+    unsigned char data[] = { 42, 'h', 'i' };
+    struct hound_record record;
+
+    record.data_id = NOP_NOP_ID;
+    record.size = sizeof(data);
+    record.data = data;
+    XASSERT_EQ(nop_nop_a(&record), 42);
+    XASSERT_EQ(nop_nop_b(&record), &data[1]);
+    XASSERT_EQ(nop_nop_b_size(&record), 2);
+
+    record.data_id = NOP_NOP2_ID;
+    XASSERT_EQ(nop_nop2_x(&record), data);
+}
+
+static
+void test_datadesc_snapshot(const char *config_path, const char *schema_base)
+{
+    hound_err err;
+    uint64_t generation;
+    const struct hound_datadesc_snapshot *snapshot;
+    const struct hound_datadesc_snapshot *snapshot2;
+
+    err = hound_acquire_datadescs(NULL);
+    XASSERT_ERRCODE(err, HOUND_NULL_VAL);
+
+    err = hound_acquire_datadescs(&snapshot);
+    XASSERT_OK(err);
+    XASSERT_EQ(snapshot->generation, hound_datadesc_generation());
+    XASSERT_EQ(snapshot->len, 2);
+    XASSERT_EQ(snapshot->descs[0].data_id, HOUND_DATA_NOP1);
+    XASSERT_STREQ(snapshot->descs[0].name, "nop");
+    XASSERT_EQ(snapshot->descs[0].fmt_count, 2);
+    XASSERT_STREQ(snapshot->descs[0].fmts[1].name, "b");
+    XASSERT_STREQ(snapshot->descs[1].name, "nop2");
+
+    /* Nothing changed, so we should get the same snapshot back. */
+    err = hound_acquire_datadescs(&snapshot2);
+    XASSERT_OK(err);
+    XASSERT_EQ(snapshot, snapshot2);
+    hound_release_datadescs(snapshot2);
+
+    /* The snapshot must outlive the driver it describes. */
+    generation = snapshot->generation;
+    err = hound_destroy_all_drivers();
+    XASSERT_OK(err);
+    XASSERT_NEQ(hound_datadesc_generation(), generation);
+    XASSERT_STREQ(snapshot->descs[0].name, "nop");
+    XASSERT_STREQ(snapshot->descs[1].fmts[0].name, "x");
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+
+    err = hound_acquire_datadescs(&snapshot2);
+    XASSERT_OK(err);
+    XASSERT_NEQ(snapshot, snapshot2);
+    XASSERT_EQ(snapshot2->generation, hound_datadesc_generation());
+    XASSERT_EQ(snapshot2->len, 2);
+    hound_release_datadescs(snapshot2);
+
+    hound_release_datadescs(snapshot);
+}
+
 static
 void ctx_test(
     struct hound_ctx **ctx,
@@ -111,6 +196,9 @@ void ctx_test(
     struct hound_rq rq;
 
     rq.queue_len = queue_len;
+    rq.queue_type = HOUND_QUEUE_LOCKED;
+    rq.overflow_policy = HOUND_OVERFLOW_OVERWRITE;
+    rq.queue_max_len = queue_len;
     rq.cb = cb;
     rq.cb_ctx = NULL;
     rq.rq_list.len = rq_len;
@@ -225,8 +313,10 @@ int main(int argc, const char **argv)
     config_path = argv[2];
 
     test_strerror();
+    test_schema_header();
     test_driver_init(config_path, schema_base);
     test_datadescs();
+    test_datadesc_snapshot(config_path, schema_base);
     test_alloc_ctx(&ctx);
     test_start_ctx(ctx);
     test_stop_ctx(ctx);
@@ -1,7 +1,9 @@
 /**
  * @file      sim.c
  * @brief     OBD II simulator. Reads from a SocketCAN socket and writes
- *            back realistic-seeming responses.
+ *            back realistic-seeming responses. It can also flood the bus with
+ *            unrequested responses for a weighted mix of PIDs, and with
+ *            background frames on unrelated IDs, to load-test the OBD driver.
  * @author    Martin Kelly <mkelly@xevo.com>
  * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
  */
@@ -14,22 +16,59 @@
 #include <linux/can/raw.h>
 #include <linux/if.h>
 #include <net/if.h>
+#include <pthread.h>
 #include <signal.h>
 #include <semaphore.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
 #include <yobd/yobd.h>
 #include <xlib/xassert.h>
 
+#define MODE_CURRENT 0x01
+#define RESPONSE_MODE 0x40
+#define ECU_ADDRESS (YOBD_OBD_II_RESPONSE_BASE - 8)
+#define ISOTP_FIRST 0x1
+#define ISOTP_CONSECUTIVE 0x2
+#define ISOTP_FLOW_CONTROL 0x3
+
+#define NSEC_PER_SEC 1000000000ULL
+#define MAX_MIX 32
+
+/*
+ * Background frames use standard IDs below the OBD II range, so the OBD driver
+ * has to filter them out.
+ */
+#define BACKGROUND_ID_BASE 0x100
+#define BACKGROUND_ID_COUNT 0x600
+
+struct mix_entry {
+    yobd_pid pid;
+    size_t can_bytes;
+    unsigned long weight;
+};
+
+struct load {
+    const char *iface;
+    struct yobd_ctx *ctx;
+    unsigned long flood_rate;
+    unsigned long background_rate;
+    unsigned long burst;
+    struct mix_entry mix[MAX_MIX];
+    size_t mix_len;
+    unsigned long total_weight;
+};
+
 struct yobd_ctx *s_ctx = NULL;
 int s_fd = -1;
 
 static
-int make_can_socket(const char *iface)
+int open_can_socket(const char *iface)
 {
     struct sockaddr_can addr;
-    struct can_filter filter;
     int fd;
     unsigned long index;
     int ret;
@@ -46,38 +85,146 @@ int make_can_socket(const char *iface)
     ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
     XASSERT_NEQ(ret, -1);
 
-    filter.can_id = YOBD_OBD_II_QUERY_ADDRESS;
-    filter.can_mask = CAN_SFF_MASK;
+    return fd;
+}
+
+static
+int make_can_socket(const char *iface)
+{
+    struct can_filter filters[2];
+    int fd;
+    int ret;
+
+    fd = open_can_socket(iface);
+
+    /* Listen for queries, and for flow control in multi-frame responses. */
+    filters[0].can_id = YOBD_OBD_II_QUERY_ADDRESS;
+    filters[0].can_mask = CAN_SFF_MASK;
+    filters[1].can_id = ECU_ADDRESS;
+    filters[1].can_mask = CAN_SFF_MASK;
     ret = setsockopt(
         fd,
         SOL_CAN_RAW,
         CAN_RAW_FILTER,
-        &filter,
-        sizeof(filter));
+        &filters,
+        sizeof(filters));
     XASSERT_EQ(ret, 0);
 
     return fd;
 }
 
+/* Takes a seed, since the responder and the load generator both use this. */
 static
-void fill_with_random(unsigned char *data, size_t bytes)
+void fill_with_random(unsigned int *seed, unsigned char *data, size_t bytes)
 {
     size_t i;
     int r;
 
-    for (i = 0; i < bytes; i += sizeof(r)) {
-        r = rand();
+    for (i = 0; i + sizeof(r) <= bytes; i += sizeof(r)) {
+        r = rand_r(seed);
         memcpy(data + i, &r, sizeof(r));
     }
 
     if (i < bytes) {
-        r = rand();
+        r = rand_r(seed);
         memcpy(data + i, &r, bytes - i);
     }
 }
 
 static
-int can_response(int fd, struct yobd_ctx *ctx, struct can_frame *frame)
+void write_frame(int fd, const struct can_frame *frame)
+{
+    int ret;
+    size_t written;
+
+    written = 0;
+    do {
+        ret = write(
+            fd,
+            (const unsigned char *) frame + written,
+            sizeof(*frame) - written);
+        XASSERT_NEQ(ret, -1);
+        written += ret;
+    } while (written < sizeof(*frame));
+}
+
+/*
+ * Answer a mode 01 request for several PIDs with a single response, split into
+ * ISO-TP frames if it doesn't fit in one.
+ */
+static
+void can_packed_response(
+    int fd,
+    struct yobd_ctx *ctx,
+    unsigned int *seed,
+    const struct can_frame *frame)
+{
+    size_t bytes;
+    size_t count;
+    const struct yobd_pid_desc *desc;
+    yobd_err err;
+    struct can_frame fc;
+    size_t i;
+    size_t len;
+    unsigned char payload[64];
+    yobd_pid pid;
+    struct can_frame response_frame;
+    int ret;
+    uint8_t seq;
+
+    count = frame->data[0] - 1;
+    payload[0] = RESPONSE_MODE | MODE_CURRENT;
+    len = 1;
+    for (i = 0; i < count; ++i) {
+        pid = frame->data[2 + i];
+        err = yobd_get_pid_descriptor(ctx, MODE_CURRENT, pid, &desc);
+        XASSERT_EQ(err, YOBD_OK);
+        XASSERT_LTE(len + 1 + desc->can_bytes, sizeof(payload) - sizeof(int));
+        payload[len] = pid;
+        fill_with_random(seed, &payload[len + 1], desc->can_bytes);
+        len += 1 + desc->can_bytes;
+    }
+
+    memset(&response_frame, 0, sizeof(response_frame));
+    response_frame.can_id = YOBD_OBD_II_RESPONSE_BASE;
+    response_frame.can_dlc = CAN_MAX_DLEN;
+    if (len < CAN_MAX_DLEN) {
+        response_frame.data[0] = len;
+        memcpy(&response_frame.data[1], payload, len);
+        write_frame(fd, &response_frame);
+        return;
+    }
+
+    response_frame.data[0] = (ISOTP_FIRST << 4) | (len >> 8);
+    response_frame.data[1] = len & 0xff;
+    memcpy(&response_frame.data[2], payload, CAN_MAX_DLEN - 2);
+    write_frame(fd, &response_frame);
+
+    /* Wait for the requester to tell us to go on. */
+    do {
+        ret = read(fd, &fc, sizeof(fc));
+        XASSERT(ret != -1 || errno == EINTR);
+    } while (ret != sizeof(fc) ||
+             fc.can_id != ECU_ADDRESS ||
+             (fc.data[0] >> 4) != ISOTP_FLOW_CONTROL);
+
+    seq = 1;
+    for (i = CAN_MAX_DLEN - 2; i < len; i += bytes) {
+        bytes = len - i < CAN_MAX_DLEN - 1 ? len - i : CAN_MAX_DLEN - 1;
+        memset(&response_frame.data, 0, sizeof(response_frame.data));
+        response_frame.data[0] = (ISOTP_CONSECUTIVE << 4) | seq;
+        memcpy(&response_frame.data[1], &payload[i], bytes);
+        write_frame(fd, &response_frame);
+        seq = (seq + 1) & 0x0f;
+    }
+}
+
+static
+int can_response(
+    int fd,
+    struct yobd_ctx *ctx,
+    unsigned int *seed,
+    struct can_frame *frame)
 {
     unsigned char data[8];
     const struct yobd_pid_desc *desc;
@@ -88,12 +235,21 @@ int can_response(int fd, struct yobd_ctx *ctx, struct can_frame *frame)
     int ret;
     size_t written;
 
+    if (frame->can_id != YOBD_OBD_II_QUERY_ADDRESS) {
+        /* Stray flow control. */
+        return -1;
+    }
+    if (frame->data[1] == MODE_CURRENT && frame->data[0] > 2) {
+        can_packed_response(fd, ctx, seed, frame);
+        return 0;
+    }
+
     err = yobd_parse_can_headers(ctx, frame, &mode, &pid);
     XASSERT_EQ(err, YOBD_OK);
 
     err = yobd_get_pid_descriptor(ctx, mode, pid, &desc);
     XASSERT_EQ(err, YOBD_OK);
-    fill_with_random(data, desc->can_bytes);
+    fill_with_random(seed, data, desc->can_bytes);
 
     /*
      * The kernel doesn't seem to care about the padding/reserved bytes in
@@ -128,8 +284,9 @@ void event_loop(int fd, struct yobd_ctx *ctx)
 {
     struct can_frame frame;
     int ret;
+    unsigned int seed;
 
-    srand(time(NULL));
+    seed = time(NULL);
     while (true) {
         ret = read(fd, &frame, sizeof(frame));
         if (ret == -1) {
@@ -142,13 +299,248 @@ void event_loop(int fd, struct yobd_ctx *ctx)
             }
         }
 
-        ret = can_response(fd, ctx, &frame);
+        ret = can_response(fd, ctx, &seed, &frame);
         if (ret == -1) {
             continue;
         }
     }
 }
 
+/* Returns a random number in [0, n). */
+static
+unsigned long random_below(unsigned int *seed, unsigned long n)
+{
+    return (double) rand_r(seed) / ((double) RAND_MAX + 1) * n;
+}
+
+static
+void make_flood_frame(
+    const struct load *load,
+    unsigned int *seed,
+    struct can_frame *frame)
+{
+    unsigned char data[CAN_MAX_DLEN];
+    const struct mix_entry *entry;
+    yobd_err err;
+    size_t i;
+    unsigned long r;
+
+    r = random_below(seed, load->total_weight);
+    for (i = 0; i < load->mix_len - 1; ++i) {
+        if (r < load->mix[i].weight) {
+            break;
+        }
+        r -= load->mix[i].weight;
+    }
+    entry = &load->mix[i];
+
+    fill_with_random(seed, data, entry->can_bytes);
+    err = yobd_make_can_response(
+        load->ctx,
+        MODE_CURRENT,
+        entry->pid,
+        data,
+        entry->can_bytes,
+        frame);
+    XASSERT_EQ(err, YOBD_OK);
+}
+
+static
+void make_background_frame(unsigned int *seed, struct can_frame *frame)
+{
+    frame->can_id = BACKGROUND_ID_BASE +
+        random_below(seed, BACKGROUND_ID_COUNT);
+    frame->can_dlc = CAN_MAX_DLEN;
+    fill_with_random(seed, frame->data, CAN_MAX_DLEN);
+}
+
+static
+void advance_timespec(struct timespec *ts, unsigned long long ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+/*
+ * Writes bursts of unrequested frames at the configured average rate, from its
+ * own socket so it never waits behind the responder.
+ */
+static
+void *run_load(void *data)
+{
+    struct timespec deadline;
+    int fd;
+    int flags;
+    struct can_frame frame;
+    unsigned long i;
+    unsigned long long interval_ns;
+    const struct load *load;
+    int ret;
+    unsigned int seed;
+    unsigned long total_rate;
+
+    load = data;
+    fd = open_can_socket(load->iface);
+
+    /* We only write, so don't let unread frames fill up the socket. */
+    ret = setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+    XASSERT_EQ(ret, 0);
+
+    /*
+     * A flood can ask for more than the bus takes, so drop those frames
+     * instead of blocking, which would throw off the schedule.
+     */
+    flags = fcntl(fd, F_GETFL);
+    XASSERT_NEQ(flags, -1);
+    ret = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    XASSERT_NEQ(ret, -1);
+
+    total_rate = load->flood_rate + load->background_rate;
+    interval_ns = load->burst * NSEC_PER_SEC / total_rate;
+    if (interval_ns == 0) {
+        interval_ns = 1;
+    }
+
+    seed = time(NULL) ^ 0x5eed;
+    ret = clock_gettime(CLOCK_MONOTONIC, &deadline);
+    XASSERT_EQ(ret, 0);
+    while (true) {
+        advance_timespec(&deadline, interval_ns);
+        do {
+            ret = clock_nanosleep(
+                CLOCK_MONOTONIC,
+                TIMER_ABSTIME,
+                &deadline,
+                NULL);
+        } while (ret == EINTR);
+        XASSERT_EQ(ret, 0);
+
+        for (i = 0; i < load->burst; ++i) {
+            memset(&frame, 0, sizeof(frame));
+            if (random_below(&seed, total_rate) < load->flood_rate) {
+                make_flood_frame(load, &seed, &frame);
+            }
+            else {
+                make_background_frame(&seed, &frame);
+            }
+
+            /* A full transmit queue just means this frame is dropped. */
+            ret = write(fd, &frame, sizeof(frame));
+            XASSERT(
+                ret == (int) sizeof(frame) ||
+                errno == ENOBUFS ||
+                errno == EAGAIN);
+        }
+    }
+
+    return NULL;
+}
+
+static
+bool parse_ulong(const char *s, int base, unsigned long *out)
+{
+    char *end;
+
+    errno = 0;
+    *out = strtoul(s, &end, base);
+
+    return errno == 0 && *s != '\0' && *end == '\0';
+}
+
+/* Parses a PID mix, written as PID[:WEIGHT],..., with PIDs in hex. */
+static
+bool parse_mix(char *arg, struct load *load)
+{
+    char *entry;
+    char *pid;
+    char *save;
+    unsigned long val;
+    char *weight;
+
+    load->mix_len = 0;
+    for (entry = strtok_r(arg, ",", &save);
+         entry != NULL;
+         entry = strtok_r(NULL, ",", &save)) {
+        if (load->mix_len == MAX_MIX) {
+            return false;
+        }
+
+        pid = entry;
+        weight = strchr(entry, ':');
+        if (weight != NULL) {
+            *weight = '\0';
+            ++weight;
+        }
+
+        if (!parse_ulong(pid, 16, &val) || val > 0xff) {
+            return false;
+        }
+        load->mix[load->mix_len].pid = val;
+
+        if (weight == NULL) {
+            val = 1;
+        }
+        else if (!parse_ulong(weight, 10, &val) || val == 0) {
+            return false;
+        }
+        load->mix[load->mix_len].weight = val;
+
+        ++load->mix_len;
+    }
+
+    return load->mix_len > 0;
+}
+
+/* Looks up how many data bytes each PID in the mix responds with. */
+static
+void resolve_mix(struct load *load)
+{
+    const struct yobd_pid_desc *desc;
+    yobd_err err;
+    size_t i;
+
+    load->total_weight = 0;
+    for (i = 0; i < load->mix_len; ++i) {
+        err = yobd_get_pid_descriptor(
+            load->ctx,
+            MODE_CURRENT,
+            load->mix[i].pid,
+            &desc);
+        if (err != YOBD_OK) {
+            fprintf(
+                stderr,
+                "PID 0x%02x is not in the schema\n",
+                (unsigned int) load->mix[i].pid);
+            exit(EXIT_FAILURE);
+        }
+        /* Flood frames are single frames: length, mode, PID, then data. */
+        if (desc->can_bytes > CAN_MAX_DLEN - 3) {
+            fprintf(
+                stderr,
+                "PID 0x%02x does not fit in a single frame\n",
+                (unsigned int) load->mix[i].pid);
+            exit(EXIT_FAILURE);
+        }
+        load->mix[i].can_bytes = desc->can_bytes;
+        load->total_weight += load->mix[i].weight;
+    }
+}
+
+static
+void usage(const char *name)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-r RATE -p PID[:WEIGHT],...] [-b RATE] [-B BURST] "
+        "IFACE YOBD-SCHEMA [SEMAPHORE-NAME]\n"
+        "  -r RATE   flood unrequested mode 01 responses, in frames/sec\n"
+        "  -p MIX    PIDs to flood, in hex, each with an optional weight\n"
+        "  -b RATE   background frames on non-OBD IDs, in frames/sec\n"
+        "  -B BURST  frames to write back-to-back each time (default 1)\n",
+        name);
+}
+
 static
 void cleanup(UNUSED int signal)
 {
@@ -168,30 +560,74 @@ void cleanup(UNUSED int signal)
     exit(EXIT_SUCCESS);
 }
 
-int main(int argc, const char **argv)
+int main(int argc, char **argv)
 {
     yobd_err err;
+    bool have_mix;
     const char *iface;
+    struct load load;
+    pthread_t load_thread;
+    int opt;
     struct sigaction sa;
     sem_t *sem;
     const char * sem_name;
     const char *yobd_schema;
 
-    if (argc != 3 && argc != 4) {
-        fprintf(stderr, "Usage: %s IFACE YOBD-SCHEMA [SEMAPHORE-NAME]\n", argv[0]);
+    have_mix = false;
+    load.flood_rate = 0;
+    load.background_rate = 0;
+    load.burst = 1;
+    while ((opt = getopt(argc, argv, "r:b:p:B:")) != -1) {
+        switch (opt) {
+            case 'r':
+                if (!parse_ulong(optarg, 10, &load.flood_rate)) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                if (!parse_ulong(optarg, 10, &load.background_rate)) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                if (!parse_mix(optarg, &load)) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                have_mix = true;
+                break;
+            case 'B':
+                if (!parse_ulong(optarg, 10, &load.burst) || load.burst == 0) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 2 && argc - optind != 3) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (load.flood_rate > 0 && !have_mix) {
+        fprintf(stderr, "-r needs a PID mix from -p\n");
         exit(EXIT_FAILURE);
     }
 
-    if (strnlen(argv[1], IFNAMSIZ) == IFNAMSIZ) {
+    if (strnlen(argv[optind], IFNAMSIZ) == IFNAMSIZ) {
         fprintf(stderr, "Device argument is longer than IFNAMSIZ\n");
         exit(EXIT_FAILURE);
     }
-    iface = argv[1];
+    iface = argv[optind];
 
-    yobd_schema = argv[2];
+    yobd_schema = argv[optind + 1];
 
-    if (argc > 3) {
-        sem_name = argv[3];
+    if (argc - optind > 2) {
+        sem_name = argv[optind + 2];
         sem = sem_open(sem_name, 0);
         if (sem == SEM_FAILED) {
             fprintf(
@@ -228,6 +664,16 @@ int main(int argc, const char **argv)
     s_fd = make_can_socket(iface);
     XASSERT_NEQ(s_fd, -1);
 
+    if (load.flood_rate > 0 || load.background_rate > 0) {
+        load.iface = iface;
+        load.ctx = s_ctx;
+        if (load.flood_rate > 0) {
+            resolve_mix(&load);
+        }
+        err = pthread_create(&load_thread, NULL, run_load, &load);
+        XASSERT_EQ(err, 0);
+    }
+
     /*
      * If we were given a semaphore, signal on it to indicate we are ready to
      * respond to requests.
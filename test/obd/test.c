@@ -139,6 +139,7 @@ void test_read(hound_data_period period_ns)
         .rq_list.data = data_rqs
     };
 
+    memset(data_rqs, 0, sizeof(data_rqs));
     for (i = 0; i < ARRAYLEN(data_rqs); ++i) {
         data_rq = &data_rqs[i];
         modepid = &s_ctx.obd_rqs[i];
@@ -0,0 +1,232 @@
+/**
+ * @file      replay.c
+ * @brief     Unit test for record logging and the replay driver. Records from
+ *            the counter driver are logged, and then replayed both as fast as
+ *            possible and at their original timing.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORD_COUNT 200
+
+struct log_state {
+    size_t count;
+    uint64_t values[RECORD_COUNT];
+    struct timespec timestamps[RECORD_COUNT];
+};
+
+static
+void log_cb(const struct hound_record *rec, hound_seqno seqno, void *cb_ctx)
+{
+    struct log_state *state;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    state = cb_ctx;
+
+    XASSERT_EQ(seqno, state->count);
+    XASSERT_EQ(rec->size, sizeof(uint64_t));
+    if (state->count < RECORD_COUNT) {
+        memcpy(&state->values[state->count], rec->data, sizeof(uint64_t));
+        state->timestamps[state->count] = rec->timestamp;
+    }
+    ++state->count;
+}
+
+static
+void replay_cb(const struct hound_record *rec, hound_seqno seqno, void *cb_ctx)
+{
+    struct log_state *state;
+    uint64_t value;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    state = cb_ctx;
+
+    XASSERT_LT(seqno, RECORD_COUNT);
+    XASSERT_EQ(rec->data_id, HOUND_DATA_COUNTER);
+    XASSERT_EQ(rec->size, sizeof(value));
+    memcpy(&value, rec->data, sizeof(value));
+    XASSERT_EQ(value, state->values[seqno]);
+    XASSERT_EQ(rec->timestamp.tv_sec, state->timestamps[seqno].tv_sec);
+    XASSERT_EQ(rec->timestamp.tv_nsec, state->timestamps[seqno].tv_nsec);
+}
+
+static
+hound_data_period get_mono_ns(void)
+{
+    struct timespec ts;
+    int ret;
+
+    ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    XASSERT_EQ(ret, 0);
+
+    return NSEC_PER_SEC*ts.tv_sec + ts.tv_nsec;
+}
+
+static
+void record(
+    const char *config_path,
+    const char *schema_base,
+    const char *log_path,
+    struct log_state *state)
+{
+    struct hound_ctx *ctx;
+    hound_err err;
+    size_t read;
+    struct hound_data_rq data_rq = {
+        .id = HOUND_DATA_COUNTER,
+        .period_ns = NSEC_PER_SEC/1000
+    };
+    struct hound_rq rq = {
+        .queue_len = RECORD_COUNT,
+        .cb = log_cb,
+        .rq_list.len = 1,
+        .rq_list.data = &data_rq
+    };
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+
+    state->count = 0;
+    rq.cb_ctx = state;
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+
+    err = hound_start_record_log(ctx, log_path);
+    XASSERT_OK(err);
+    err = hound_start_record_log(ctx, log_path);
+    XASSERT_ERRCODE(err, HOUND_RECORD_LOG_ACTIVE);
+
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+    err = hound_read(ctx, RECORD_COUNT, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, RECORD_COUNT);
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+
+    err = hound_stop_record_log(ctx);
+    XASSERT_OK(err);
+    /* Stopping twice is harmless. */
+    err = hound_stop_record_log(ctx);
+    XASSERT_OK(err);
+
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+}
+
+static
+void replay(
+    const char *schema_base,
+    const char *log_path,
+    bool realtime,
+    struct log_state *state)
+{
+    struct hound_init_arg arg;
+    struct hound_ctx *ctx;
+    hound_data_period elapsed_ns;
+    hound_err err;
+    hound_data_period log_span_ns;
+    size_t read;
+    hound_data_period start_ns;
+    struct hound_data_rq data_rq = { .id = HOUND_DATA_COUNTER, .period_ns = 0 };
+    struct hound_rq rq = {
+        .queue_len = RECORD_COUNT,
+        .overflow_policy = HOUND_OVERFLOW_DROP_NEWEST,
+        .cb = replay_cb,
+        .rq_list.len = 1,
+        .rq_list.data = &data_rq
+    };
+
+    arg.type = HOUND_TYPE_BOOL;
+    arg.data.as_bool = realtime;
+    err = hound_init_driver(
+        "replay",
+        log_path,
+        schema_base,
+        "counter.yaml",
+        1,
+        &arg);
+    XASSERT_OK(err);
+
+    rq.cb_ctx = state;
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+
+    start_ns = get_mono_ns();
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+    err = hound_read(ctx, RECORD_COUNT, &read);
+    XASSERT_OK(err);
+    XASSERT_EQ(read, RECORD_COUNT);
+    elapsed_ns = get_mono_ns() - start_ns;
+
+    if (realtime) {
+        /*
+         * The replay should take about as long as the recording did. Check
+         * only for a generous lower bound, as a loaded machine can always make
+         * it take longer.
+         */
+        log_span_ns =
+            NSEC_PER_SEC*(
+                state->timestamps[RECORD_COUNT-1].tv_sec -
+                state->timestamps[0].tv_sec) +
+            state->timestamps[RECORD_COUNT-1].tv_nsec -
+            state->timestamps[0].tv_nsec;
+        XASSERT_GTE(elapsed_ns, log_span_ns / 2);
+    }
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+    err = hound_destroy_driver(log_path);
+    XASSERT_OK(err);
+}
+
+int main(int argc, const char **argv)
+{
+    const char *config_path;
+    int fd;
+    char log_path[] = "/tmp/hound-replay-XXXXXX";
+    const char *schema_base;
+    struct log_state state;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s SCHEMA-BASE-PATH CONFIG-PATH\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    schema_base = argv[1];
+    config_path = argv[2];
+
+    fd = mkstemp(log_path);
+    XASSERT_NEQ(fd, -1);
+    close(fd);
+
+    record(config_path, schema_base, log_path, &state);
+    replay(schema_base, log_path, false, &state);
+    replay(schema_base, log_path, true, &state);
+
+    unlink(log_path);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/**
+ * @file      schema-cache.c
+ * @brief     Unit test for the binary schema cache. The counter schema is
+ *            copied into a scratch directory, and the driver is brought up
+ *            against it with a cold cache, a warm cache, an edited schema and
+ *            a damaged cache, checking each time that the descriptors come out
+ *            right and that the cache is only rewritten when it should be.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCHEMA "counter.yaml"
+
+static const char *edited_schema =
+    "---\n"
+    "id: 0xffffff00\n"
+    "name: edited-counter\n"
+    "fmt:\n"
+    "    - name: edited-value\n"
+    "      unit: none\n"
+    "      type: uint64\n";
+
+static
+void write_file(const char *path, const void *buf, size_t size)
+{
+    int fd;
+    ssize_t bytes;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    XASSERT_NEQ(fd, -1);
+    bytes = write(fd, buf, size);
+    XASSERT_EQ(bytes, (ssize_t) size);
+    close(fd);
+}
+
+static
+void copy_file(const char *src, const char *dst)
+{
+    char buf[4096];
+    size_t bytes;
+    FILE *f;
+
+    f = fopen(src, "r");
+    XASSERT_NOT_NULL(f);
+    bytes = fread(buf, 1, sizeof(buf), f);
+    XASSERT_EQ(ferror(f), 0);
+    XASSERT_NEQ(feof(f), 0);
+    fclose(f);
+
+    write_file(dst, buf, bytes);
+}
+
+/*
+ * Bring up the driver from the scratch directory, check its descriptors, and
+ * return the inode of the cache it left behind. Caches are renamed into place,
+ * so a new inode means the cache was rewritten.
+ */
+static
+ino_t load(
+    const char *config_path,
+    const char *dir,
+    const char *cache_path,
+    const char *name,
+    const char *fmt_name)
+{
+    struct hound_datadesc *descs;
+    hound_err err;
+    size_t size;
+    struct stat st;
+
+    err = hound_init_config(config_path, dir);
+    XASSERT_OK(err);
+
+    err = hound_get_datadescs(&descs, &size);
+    XASSERT_OK(err);
+    XASSERT_EQ(size, 1);
+    XASSERT_EQ(descs[0].data_id, HOUND_DATA_COUNTER);
+    XASSERT_STREQ(descs[0].name, name);
+    XASSERT_EQ(descs[0].fmt_count, 1);
+    XASSERT_STREQ(descs[0].fmts[0].name, fmt_name);
+    XASSERT_EQ(descs[0].fmts[0].unit, HOUND_UNIT_NONE);
+    XASSERT_EQ(descs[0].fmts[0].type, HOUND_TYPE_UINT64);
+    hound_free_datadescs(descs);
+
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    err = stat(cache_path, &st);
+    XASSERT_EQ(err, 0);
+    XASSERT_GT(st.st_size, 0);
+
+    return st.st_ino;
+}
+
+int main(int argc, const char **argv)
+{
+    char cache_path[PATH_MAX];
+    const char *config_path;
+    char dir[] = "/tmp/hound-schema-cache-XXXXXX";
+    int err;
+    int fd;
+    unsigned char byte;
+    ssize_t bytes;
+    ino_t ino;
+    ino_t new_ino;
+    char schema_path[PATH_MAX];
+    char src_path[PATH_MAX];
+    struct stat st;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s SCHEMA-BASE-PATH CONFIG-PATH\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    config_path = argv[2];
+
+    XASSERT_NOT_NULL(mkdtemp(dir));
+    snprintf(src_path, sizeof(src_path), "%s/%s", argv[1], SCHEMA);
+    snprintf(schema_path, sizeof(schema_path), "%s/%s", dir, SCHEMA);
+    snprintf(cache_path, sizeof(cache_path), "%s.cache", schema_path);
+    copy_file(src_path, schema_path);
+
+    /* A cold load parses the schema and writes the cache. */
+    err = stat(cache_path, &st);
+    XASSERT_EQ(err, -1);
+    XASSERT_EQ(errno, ENOENT);
+    ino = load(config_path, dir, cache_path, "counter", "counter");
+
+    /* A warm load maps the cache as it is. */
+    new_ino = load(config_path, dir, cache_path, "counter", "counter");
+    XASSERT_EQ(new_ino, ino);
+
+    /* A damaged cache is thrown away and rebuilt from the schema. */
+    err = stat(cache_path, &st);
+    XASSERT_EQ(err, 0);
+    fd = open(cache_path, O_RDWR | O_CLOEXEC);
+    XASSERT_NEQ(fd, -1);
+    bytes = pread(fd, &byte, sizeof(byte), st.st_size / 2);
+    XASSERT_EQ(bytes, (ssize_t) sizeof(byte));
+    byte ^= 0xff;
+    bytes = pwrite(fd, &byte, sizeof(byte), st.st_size / 2);
+    XASSERT_EQ(bytes, (ssize_t) sizeof(byte));
+    close(fd);
+    new_ino = load(config_path, dir, cache_path, "counter", "counter");
+    XASSERT_NEQ(new_ino, ino);
+    ino = new_ino;
+
+    /* So is a truncated one. */
+    err = stat(cache_path, &st);
+    XASSERT_EQ(err, 0);
+    err = truncate(cache_path, st.st_size / 2);
+    XASSERT_EQ(err, 0);
+    new_ino = load(config_path, dir, cache_path, "counter", "counter");
+    XASSERT_NEQ(new_ino, ino);
+    ino = new_ino;
+    new_ino = load(config_path, dir, cache_path, "counter", "counter");
+    XASSERT_EQ(new_ino, ino);
+
+    /* Editing the schema invalidates the cache. */
+    write_file(schema_path, edited_schema, strlen(edited_schema));
+    new_ino = load(
+        config_path,
+        dir,
+        cache_path,
+        "edited-counter",
+        "edited-value");
+    XASSERT_NEQ(new_ino, ino);
+
+    unlink(cache_path);
+    unlink(schema_path);
+    rmdir(dir);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file      shm.c
+ * @brief     Unit test for shared-memory distribution. A server publishes
+ *            counter records, which are read both by a client in this process
+ *            and by one in a child process.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_COUNT 500
+#define READ_TIMEOUT_NS (5*NSEC_PER_SEC)
+#define SLOT_COUNT 16
+
+struct read_state {
+    size_t count;
+    bool have_first;
+    hound_seqno first_seqno;
+    uint64_t first_value;
+};
+
+static
+void read_cb(const struct hound_record *rec, hound_seqno seqno, void *cb_ctx)
+{
+    struct read_state *state;
+    uint64_t value;
+
+    XASSERT_NOT_NULL(rec);
+    XASSERT_NOT_NULL(cb_ctx);
+    state = cb_ctx;
+
+    XASSERT_EQ(rec->data_id, HOUND_DATA_COUNTER);
+    XASSERT_EQ(rec->size, sizeof(value));
+    memcpy(&value, rec->data, sizeof(value));
+
+    /*
+     * The server publishes every counter record, so even across drops, the
+     * value and the sequence number move in step.
+     */
+    if (!state->have_first) {
+        state->have_first = true;
+        state->first_seqno = seqno;
+        state->first_value = value;
+    }
+    XASSERT_EQ(value - state->first_value, seqno - state->first_seqno);
+    ++state->count;
+}
+
+static
+void read_records(struct hound_shm_client *client, struct read_state *state)
+{
+    hound_err err;
+    size_t read;
+
+    while (state->count < READ_COUNT) {
+        err = hound_shm_read(
+            client,
+            READ_COUNT - state->count,
+            READ_TIMEOUT_NS,
+            read_cb,
+            state,
+            &read);
+        XASSERT_OK(err);
+        XASSERT_GT(read, 0);
+    }
+}
+
+static
+void run_client(const char *socket_path)
+{
+    struct hound_shm_client *client;
+    hound_err err;
+    size_t i;
+    struct read_state state;
+    struct timespec ts;
+
+    /* Wait for the parent to start the server. */
+    for (i = 0; i < 500; ++i) {
+        err = hound_shm_attach(socket_path, HOUND_DATA_COUNTER, &client);
+        if (err != ENOENT && err != ECONNREFUSED) {
+            break;
+        }
+        ts.tv_sec = 0;
+        ts.tv_nsec = 10*NSEC_PER_MSEC;
+        nanosleep(&ts, NULL);
+    }
+    XASSERT_OK(err);
+
+    memset(&state, 0, sizeof(state));
+    read_records(client, &state);
+    hound_shm_detach(client);
+
+    exit(EXIT_SUCCESS);
+}
+
+static
+void test_overflow(struct hound_shm_client *client)
+{
+    uint64_t dropped;
+    hound_err err;
+    struct read_state state;
+    struct timespec ts;
+
+    err = hound_shm_dropped(client, &dropped);
+    XASSERT_OK(err);
+    XASSERT_EQ(dropped, 0);
+
+    /* Fall far enough behind for the ring to wrap. */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 20 * SLOT_COUNT * NSEC_PER_MSEC;
+    nanosleep(&ts, NULL);
+
+    memset(&state, 0, sizeof(state));
+    read_records(client, &state);
+
+    err = hound_shm_dropped(client, &dropped);
+    XASSERT_OK(err);
+    XASSERT_GT(dropped, 0);
+}
+
+int main(int argc, const char **argv)
+{
+    struct hound_shm_client *client;
+    const char *config_path;
+    hound_err err;
+    struct hound_shm_server *other;
+    pid_t pid;
+    size_t read;
+    const char *schema_base;
+    struct hound_shm_server *server;
+    char socket_path[PATH_MAX];
+    struct read_state state;
+    int status;
+    struct hound_data_rq data_rq = {
+        .id = HOUND_DATA_COUNTER,
+        .period_ns = NSEC_PER_MSEC
+    };
+    struct hound_rq rq = {
+        .queue_len = 100,
+        .cb = read_cb,
+        .rq_list.len = 1,
+        .rq_list.data = &data_rq
+    };
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s SCHEMA-BASE-PATH CONFIG-PATH\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    schema_base = argv[1];
+    config_path = argv[2];
+
+    snprintf(
+        socket_path,
+        sizeof(socket_path),
+        "/tmp/hound-shm-test-%ld",
+        (long) getpid());
+    unlink(socket_path);
+
+    /* Fork before hound starts any threads. */
+    pid = fork();
+    XASSERT_NEQ(pid, -1);
+    if (pid == 0) {
+        run_client(socket_path);
+    }
+
+    err = hound_init_config(config_path, schema_base);
+    XASSERT_OK(err);
+
+    err = hound_shm_serve(socket_path, &rq, SLOT_COUNT, 0, &server);
+    XASSERT_OK(err);
+    /* The path is taken. */
+    err = hound_shm_serve(socket_path, &rq, SLOT_COUNT, 0, &other);
+    XASSERT_ERRCODE(err, EADDRINUSE);
+
+    err = hound_shm_attach(socket_path, HOUND_DATA_FILE, &client);
+    XASSERT_ERRCODE(err, HOUND_DATA_ID_DOES_NOT_EXIST);
+
+    err = hound_shm_attach(socket_path, HOUND_DATA_COUNTER, &client);
+    XASSERT_OK(err);
+
+    memset(&state, 0, sizeof(state));
+    read_records(client, &state);
+    test_overflow(client);
+
+    XASSERT_EQ(waitpid(pid, &status, 0), pid);
+    XASSERT(WIFEXITED(status));
+    XASSERT_EQ(WEXITSTATUS(status), EXIT_SUCCESS);
+
+    /* After the server stops, what's left is readable, and then nothing. */
+    err = hound_shm_stop(server);
+    XASSERT_OK(err);
+    do {
+        err = hound_shm_read(client, SIZE_MAX, 0, read_cb, &state, &read);
+        XASSERT_OK(err);
+    } while (read > 0);
+    hound_shm_detach(client);
+
+    err = hound_destroy_driver("/dev/counter");
+    XASSERT_OK(err);
+
+    return EXIT_SUCCESS;
+}
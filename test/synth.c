@@ -0,0 +1,238 @@
+/**
+ * @file      synth.c
+ * @brief     Unit test for the synth driver, which checks that the generated
+ *            load has the shape it was configured with.
+ * @author    Martin Kelly <mkelly@xevo.com>
+ * @copyright Copyright (C) 2019 Xevo Inc. All Rights Reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <hound/hound.h>
+#include <hound-private/util.h>
+#include <hound-test/assert.h>
+#include <hound-test/id.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <valgrind.h>
+
+#define RATE 20000
+#define MIN_SIZE 8
+#define MAX_SIZE 256
+#define BURST 16
+#define ID_COUNT 4
+
+struct cb_ctx {
+    size_t count;
+    bool seen[SYNTH_MAX_IDS];
+    uint64_t next_seqno[SYNTH_MAX_IDS];
+    size_t min_size;
+    size_t max_size;
+};
+
+void data_cb(
+    const struct hound_record *record,
+    UNUSED hound_seqno seqno,
+    void *data)
+{
+    struct cb_ctx *ctx;
+    size_t index;
+    uint64_t synth_seqno;
+
+    XASSERT_NOT_NULL(record);
+    XASSERT_NOT_NULL(record->data);
+    XASSERT_NOT_NULL(data);
+    ctx = data;
+
+    XASSERT(
+        record->data_id == HOUND_DATA_SYNTH(1) ||
+        record->data_id == HOUND_DATA_SYNTH(3));
+    XASSERT_GTE(record->size, MIN_SIZE);
+    XASSERT_LTE(record->size, MAX_SIZE);
+    ctx->min_size = min(ctx->min_size, record->size);
+    ctx->max_size = max(ctx->max_size, record->size);
+
+    /* Each ID counts up on its own, with nothing skipped. */
+    index = record->data_id - HOUND_DATA_SYNTH(0);
+    memcpy(&synth_seqno, record->data, sizeof(synth_seqno));
+    if (ctx->seen[index]) {
+        XASSERT_EQ(synth_seqno, ctx->next_seqno[index]);
+    }
+    ctx->seen[index] = true;
+    ctx->next_seqno[index] = synth_seqno + 1;
+
+    ++ctx->count;
+}
+
+static
+void init_driver(const char *schema_base)
+{
+    struct hound_init_arg args[5];
+    hound_err err;
+    size_t i;
+
+    for (i = 0; i < ARRAYLEN(args); ++i) {
+        args[i].type = HOUND_TYPE_UINT64;
+    }
+    args[0].data.as_uint64 = RATE;
+    args[1].data.as_uint64 = MIN_SIZE;
+    args[2].data.as_uint64 = MAX_SIZE;
+    args[3].data.as_uint64 = BURST;
+    args[4].data.as_uint64 = ID_COUNT;
+    err = hound_init_driver(
+        "synth",
+        "/dev/synth",
+        schema_base,
+        "synth.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_OK(err);
+}
+
+static
+void test_bad_args(const char *schema_base)
+{
+    struct hound_init_arg args[5];
+    hound_err err;
+    size_t i;
+
+    for (i = 0; i < ARRAYLEN(args); ++i) {
+        args[i].type = HOUND_TYPE_UINT64;
+        args[i].data.as_uint64 = 1;
+    }
+
+    /* Records must have room for the sequence number. */
+    args[1].data.as_uint64 = 4;
+    args[2].data.as_uint64 = 16;
+    err = hound_init_driver(
+        "synth",
+        "/dev/synth",
+        schema_base,
+        "synth.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+
+    /* The size range can't be backwards. */
+    args[1].data.as_uint64 = 32;
+    err = hound_init_driver(
+        "synth",
+        "/dev/synth",
+        schema_base,
+        "synth.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+
+    /* There are only so many IDs in the schema. */
+    args[1].data.as_uint64 = 8;
+    args[4].data.as_uint64 = SYNTH_MAX_IDS + 1;
+    err = hound_init_driver(
+        "synth",
+        "/dev/synth",
+        schema_base,
+        "synth.yaml",
+        ARRAYLEN(args),
+        args);
+    XASSERT_ERRCODE(err, HOUND_INVALID_VAL);
+}
+
+static
+void test_disabled_id(void)
+{
+    struct hound_ctx *ctx;
+    hound_err err;
+    struct hound_data_rq data_rq = {
+        .id = HOUND_DATA_SYNTH(ID_COUNT),
+        .period_ns = 0
+    };
+    struct hound_rq rq = {
+        .queue_len = 16,
+        .cb = data_cb,
+        .rq_list.len = 1,
+        .rq_list.data = &data_rq
+    };
+
+    /* Only the first ID_COUNT IDs are enabled. */
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_ERRCODE(err, HOUND_DATA_ID_DOES_NOT_EXIST);
+}
+
+static
+void test_load(size_t total_records)
+{
+    struct cb_ctx cb_ctx;
+    struct hound_ctx *ctx;
+    hound_err err;
+    size_t read;
+    struct hound_data_rq data_rqs[] = {
+        { .id = HOUND_DATA_SYNTH(1), .period_ns = 0 },
+        { .id = HOUND_DATA_SYNTH(3), .period_ns = 0 }
+    };
+    struct hound_rq rq = {
+        /* Big enough that the reader never falls a whole queue behind. */
+        .queue_len = 4096,
+        .cb = data_cb,
+        .cb_ctx = &cb_ctx,
+        .rq_list.len = ARRAYLEN(data_rqs),
+        .rq_list.data = data_rqs
+    };
+
+    memset(&cb_ctx, 0, sizeof(cb_ctx));
+    cb_ctx.min_size = SIZE_MAX;
+
+    err = hound_alloc_ctx(&rq, &ctx);
+    XASSERT_OK(err);
+    err = hound_start(ctx);
+    XASSERT_OK(err);
+
+    while (cb_ctx.count < total_records) {
+        err = hound_read(ctx, min(BURST, total_records - cb_ctx.count), &read);
+        XASSERT_OK(err);
+    }
+
+    err = hound_stop(ctx);
+    XASSERT_OK(err);
+    err = hound_free_ctx(ctx);
+    XASSERT_OK(err);
+
+    /* Both IDs get records, since the driver spreads them round-robin. */
+    XASSERT(cb_ctx.seen[1]);
+    XASSERT(cb_ctx.seen[3]);
+    XASSERT_LT(cb_ctx.min_size, cb_ctx.max_size);
+}
+
+int main(int argc, const char **argv)
+{
+    hound_err err;
+    const char *schema_base;
+    size_t total_records;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s SCHEMA-BASE-PATH\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strnlen(argv[1], PATH_MAX) == PATH_MAX) {
+        fprintf(stderr, "Schema base path is longer than PATH_MAX\n");
+        exit(EXIT_FAILURE);
+    }
+    schema_base = argv[1];
+
+    if (RUNNING_ON_VALGRIND) {
+        total_records = 100;
+    }
+    else {
+        total_records = 5000;
+    }
+
+    test_bad_args(schema_base);
+
+    init_driver(schema_base);
+    test_disabled_id();
+    test_load(total_records);
+    err = hound_destroy_driver("/dev/synth");
+    XASSERT_OK(err);
+
+    return EXIT_SUCCESS;
+}